@@ -0,0 +1,470 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "broadcastring.h"
+
+#include <QElapsedTimer>
+#include <QObject>
+
+#include <atomic>
+#include <new>
+#include <climits>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define RING_MAGIC					0x4D425247	/* MBRG */
+#define RING_VERSION				1
+#define RING_MIN_CAPACITY		4096
+// Space reserved for BroadcastRingHeader in front of the data
+#define RING_HEADER_SPACE		4096
+
+/*
+ * Package format (aligned to 8 bytes):
+ *
+ * Pos Type     Data
+ * -------------------------
+ * 0   quint32  Size of the data
+ * 4   quint32  Optional id
+ * 8   quint32  Type
+ * 12  quint32  Reserved
+ * 16  Data
+ */
+#define RECORD_HEADER_SIZE	16
+#define RECORD_SIZE(size)		((quint64(RECORD_HEADER_SIZE) + (size) + 7) & ~quint64(7))
+
+struct BroadcastRingHeader
+{
+	quint32										magic;
+	quint32										version;
+	quint64										capacity;
+
+	// Positions are the total number of bytes written, the data is at (pos & (capacity - 1))
+	// End of the newest package
+	std::atomic<quint64>			writePos;
+	// Begin of the oldest package (moved before its data is overwritten)
+	std::atomic<quint64>			tailPos;
+
+	// Futex word: changed by the writer when readers are sleeping
+	alignas(64) std::atomic<quint32>	sequence;
+	std::atomic<quint32>			sleepers;
+};
+
+struct BroadcastRingRecord
+{
+	quint32		size;
+	quint32		optionalId;
+	quint32		type;
+	quint32		reserved;
+};
+
+static_assert(sizeof(BroadcastRingHeader) <= RING_HEADER_SPACE, "Header does not fit");
+static_assert(sizeof(BroadcastRingRecord) == RECORD_HEADER_SIZE, "Unexpected record header size");
+static_assert(sizeof(std::atomic<quint32>) == sizeof(int), "Futex word must be an int");
+
+
+static int futexWait(std::atomic<quint32> * word, quint32 value, int timeout)
+{
+	struct timespec		ts;
+	ts.tv_sec		=	timeout / 1000;
+	ts.tv_nsec	=	(timeout % 1000) * 1000000;
+
+	// Not FUTEX_PRIVATE: The word is shared between processes
+	return syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAIT, int(value), (timeout < 0 ? 0 : &ts), 0, 0);
+}
+
+
+static int futexWakeAll(std::atomic<quint32> * word)
+{
+	return syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+
+BroadcastRing::BroadcastRing()
+	:	m_fd(-1), m_header(0), m_data(0), m_mask(0), m_readPos(0), m_overruns(0)
+{
+}
+
+
+BroadcastRing::~BroadcastRing()
+{
+	close();
+}
+
+
+bool BroadcastRing::create(qint64 capacity)
+{
+	if(isOpen()) {
+		m_lastError	=	QObject::tr("Ring already open");
+		return false;
+	}
+
+	quint64	size	=	RING_MIN_CAPACITY;
+	while(size < quint64(capacity))
+		size	<<=	1;
+
+	int	fd	=	memfd_create("messagebus-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(fd < 0) {
+		m_lastError	=	QObject::tr("Cannot create ring: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+		return false;
+	}
+
+	if(ftruncate(fd, RING_HEADER_SPACE + size) < 0) {
+		m_lastError	=	QObject::tr("Cannot resize ring: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+		::close(fd);
+		return false;
+	}
+
+	// Readers must not be able to shrink the ring under our feet (attach() refuses unsealed rings)
+	if(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		const int	error	=	errno;
+		m_lastError	=	QObject::tr("Cannot seal ring: %1").arg(QString::fromLocal8Bit(strerror(error)));
+		::close(fd);
+		return false;
+	}
+
+	if(!map(fd, true, size))
+		return false;
+
+	return true;
+}
+
+
+bool BroadcastRing::attach(const Variant& descriptor)
+{
+	if(isOpen()) {
+		m_lastError	=	QObject::tr("Ring already open");
+		return false;
+	}
+
+	bool	ok	=	false;
+	int		fd	=	descriptor.toSocketDescriptor(&ok);
+
+	if(!ok || fd < 0) {
+		m_lastError	=	QObject::tr("Invalid file descriptor");
+		return false;
+	}
+
+	struct stat		st;
+	if(fstat(fd, &st) < 0 || st.st_size <= RING_HEADER_SPACE) {
+		m_lastError	=	QObject::tr("File descriptor is not a ring");
+		::close(fd);
+		return false;
+	}
+
+	// Accessing the mapping of a ring shrunk by another process would crash us (SIGBUS)
+	const int	seals	=	fcntl(fd, F_GET_SEALS);
+	if(seals < 0 || !(seals & F_SEAL_SHRINK)) {
+		m_lastError	=	QObject::tr("Ring is not sealed");
+		::close(fd);
+		return false;
+	}
+
+	if(!map(fd, false, quint64(st.st_size) - RING_HEADER_SPACE))
+		return false;
+
+	if(m_header->magic != RING_MAGIC || m_header->version != RING_VERSION || m_header->capacity != m_mask + 1) {
+		m_lastError	=	QObject::tr("File descriptor is not a ring");
+		close();
+		return false;
+	}
+
+	// Start with the next package
+	m_readPos	=	m_header->writePos.load(std::memory_order_acquire);
+
+	return true;
+}
+
+
+void BroadcastRing::close()
+{
+	if(m_header)
+		munmap(m_header, RING_HEADER_SPACE + m_mask + 1);
+
+	if(m_fd >= 0)
+		::close(m_fd);
+
+	m_fd				=	-1;
+	m_header		=	0;
+	m_data			=	0;
+	m_mask			=	0;
+	m_readPos		=	0;
+	m_overruns	=	0;
+}
+
+
+bool BroadcastRing::isOpen() const
+{
+	return (m_header != 0);
+}
+
+
+Variant BroadcastRing::descriptor() const
+{
+	return Variant::fromSocketDescriptor(m_fd);
+}
+
+
+qint64 BroadcastRing::capacity() const
+{
+	return (m_header ? qint64(m_mask + 1) : 0);
+}
+
+
+bool BroadcastRing::write(const Variant& data)
+{
+	if(!m_header) {
+		m_lastError	=	QObject::tr("Ring not open");
+		return false;
+	}
+
+	if(data.type() == Variant::SocketDescriptor) {
+		m_lastError	=	QObject::tr("File descriptors cannot be written to a ring");
+		return false;
+	}
+
+	const QByteArray	bytes(data.toByteArray());
+	const quint64			recordSize	=	RECORD_SIZE(quint64(bytes.size()));
+
+	if(recordSize > m_mask + 1) {
+		m_lastError	=	QObject::tr("Package exceeds the capacity of the ring");
+		return false;
+	}
+
+	// We are the only writer
+	const quint64	writePos	=	m_header->writePos.load(std::memory_order_relaxed);
+	quint64				tailPos		=	m_header->tailPos.load(std::memory_order_relaxed);
+
+	// Make room by dropping the oldest packages
+	if(writePos + recordSize - tailPos > m_mask + 1)
+	{
+		while(writePos + recordSize - tailPos > m_mask + 1)
+		{
+			quint32	size;
+			copyOut(tailPos, &size, sizeof(size));
+			tailPos	+=	RECORD_SIZE(size);
+		}
+
+		// Readers check the tail after copying a package, so it must be visible before the data changes
+		m_header->tailPos.store(tailPos, std::memory_order_release);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	BroadcastRingRecord	record;
+	record.size				=	quint32(bytes.size());
+	record.optionalId	=	data.optionalId();
+	record.type				=	quint32(data.type());
+	record.reserved		=	0;
+
+	copyIn(writePos, &record, sizeof(record));
+	copyIn(writePos + RECORD_HEADER_SIZE, bytes.constData(), bytes.size());
+
+	m_header->writePos.store(writePos + recordSize, std::memory_order_seq_cst);
+
+	// Only enter the kernel if somebody is sleeping
+	if(m_header->sleepers.load(std::memory_order_seq_cst) > 0)
+	{
+		m_header->sequence.fetch_add(1, std::memory_order_seq_cst);
+		futexWakeAll(&m_header->sequence);
+	}
+
+	return true;
+}
+
+
+Variant BroadcastRing::read(bool* ok)
+{
+	if(ok)
+		*ok	=	false;
+
+	if(!m_header)
+		return Variant();
+
+	forever
+	{
+		const quint64	writePos	=	m_header->writePos.load(std::memory_order_acquire);
+
+		if(m_readPos == writePos)
+			return Variant();
+
+		// Fell behind: Continue with the oldest package available
+		const quint64	tailPos		=	m_header->tailPos.load(std::memory_order_acquire);
+		if(m_readPos < tailPos)
+		{
+			m_overruns++;
+			m_readPos	=	tailPos;
+			continue;
+		}
+
+		BroadcastRingRecord	record;
+		copyOut(m_readPos, &record, sizeof(record));
+
+		// The record might be garbage if it has been overwritten meanwhile
+		const bool	valid	=	(RECORD_SIZE(record.size) <= writePos - m_readPos);
+		QByteArray	data;
+
+		if(valid)
+		{
+			data.resize(int(record.size));
+			copyOut(m_readPos + RECORD_HEADER_SIZE, data.data(), record.size);
+		}
+
+		// Check if the writer overwrote the package while we copied it
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(m_header->tailPos.load(std::memory_order_relaxed) > m_readPos)
+		{
+			m_overruns++;
+			m_readPos	=	m_header->tailPos.load(std::memory_order_acquire);
+			continue;
+		}
+
+		if(!valid)
+		{
+			m_lastError	=	QObject::tr("Ring is corrupted");
+			m_overruns++;
+			m_readPos	=	writePos;
+			return Variant();
+		}
+
+		m_readPos	+=	RECORD_SIZE(record.size);
+
+		if(ok)
+			*ok	=	true;
+
+		return Variant(data, Variant::Type(record.type), record.optionalId);
+	}
+}
+
+
+bool BroadcastRing::hasPendingData() const
+{
+	return (m_header && m_header->writePos.load(std::memory_order_seq_cst) != m_readPos);
+}
+
+
+bool BroadcastRing::waitForReadyRead(int timeout)
+{
+	if(!m_header)
+		return false;
+
+	QElapsedTimer	timer;
+	timer.start();
+
+	while(!hasPendingData())
+	{
+		int	remaining	=	-1;
+		if(timeout >= 0)
+		{
+			remaining	=	timeout - int(timer.elapsed());
+			if(remaining <= 0)
+				return false;
+		}
+
+		// Announce that we sleep before checking for data the last time, so the writer cannot miss us
+		m_header->sleepers.fetch_add(1, std::memory_order_seq_cst);
+		const quint32	sequence	=	m_header->sequence.load(std::memory_order_seq_cst);
+
+		if(!hasPendingData())
+			futexWait(&m_header->sequence, sequence, remaining);
+
+		m_header->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+	}
+
+	return true;
+}
+
+
+quint64 BroadcastRing::overruns() const
+{
+	return m_overruns;
+}
+
+
+QString BroadcastRing::lastErrorString() const
+{
+	return m_lastError;
+}
+
+
+bool BroadcastRing::map(int fd, bool create, qint64 capacity)
+{
+	// The capacity must be a power of two
+	if(capacity < RING_MIN_CAPACITY || (capacity & (capacity - 1))) {
+		m_lastError	=	QObject::tr("Invalid ring capacity");
+		::close(fd);
+		return false;
+	}
+
+	void	*	memory	=	mmap(0, RING_HEADER_SPACE + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if(memory == MAP_FAILED) {
+		m_lastError	=	QObject::tr("Cannot map ring: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+		::close(fd);
+		return false;
+	}
+
+	m_fd			=	fd;
+	m_header	=	reinterpret_cast<BroadcastRingHeader*>(memory);
+	m_data		=	reinterpret_cast<char*>(memory) + RING_HEADER_SPACE;
+	m_mask		=	quint64(capacity) - 1;
+	m_readPos	=	0;
+
+	if(create)
+	{
+		// The memory of a new memfd is zeroed
+		new (&m_header->writePos) std::atomic<quint64>(0);
+		new (&m_header->tailPos) std::atomic<quint64>(0);
+		new (&m_header->sequence) std::atomic<quint32>(0);
+		new (&m_header->sleepers) std::atomic<quint32>(0);
+		m_header->capacity	=	quint64(capacity);
+		m_header->version		=	RING_VERSION;
+		m_header->magic			=	RING_MAGIC;
+	}
+
+	return true;
+}
+
+
+void BroadcastRing::copyIn(quint64 pos, const void* data, quint64 size)
+{
+	const quint64	offset	=	pos & m_mask;
+	const quint64	first		=	qMin(size, m_mask + 1 - offset);
+
+	memcpy(m_data + offset, data, first);
+
+	// Wrap around
+	if(first < size)
+		memcpy(m_data, reinterpret_cast<const char*>(data) + first, size - first);
+}
+
+
+void BroadcastRing::copyOut(quint64 pos, void* data, quint64 size) const
+{
+	const quint64	offset	=	pos & m_mask;
+	const quint64	first		=	qMin(size, m_mask + 1 - offset);
+
+	memcpy(data, m_data + offset, first);
+
+	if(first < size)
+		memcpy(reinterpret_cast<char*>(data) + first, m_data, size - first);
+}
@@ -0,0 +1,111 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BROADCASTRING_H
+#define BROADCASTRING_H
+
+#include <QString>
+
+#include "variant.h"
+
+struct BroadcastRingHeader;
+
+/**
+	@brief Shared memory ring buffer with one writer and many readers.
+
+	The publisher create()s the ring and passes descriptor() to its subscribers, e.g. as
+	parameter of MessageBus::call(). Each subscriber attach()es to the ring and reads the
+	packages with its own cursor, so a package is written once no matter how many processes
+	read it. The writer never waits for readers: a reader falling behind by more than the
+	capacity of the ring loses the overwritten packages and continues with the oldest
+	package still available (see overruns()).
+
+	Readers sleeping in waitForReadyRead() are woken by a futex, the writer only enters the
+	kernel if a reader is actually sleeping.
+
+	File descriptors are not supported as packages.
+*/
+class BroadcastRing
+{
+	public:
+		BroadcastRing();
+
+		~BroadcastRing();
+
+		/**
+			@brief Create a new ring holding \a capacity bytes (rounded up to a power of two).
+
+			Fails if the memory cannot be sealed against resizing (readers refuse such rings),
+			write the packages to the sockets of the subscribers instead.
+		*/
+		bool create(qint64 capacity);
+
+		/**
+			@brief Map the ring created by another process.
+
+			\a descriptor is the file descriptor received from the publisher, the ring takes
+			ownership of it. Reading starts with the next package written. Rings that could be
+			shrunk by another process are refused.
+		*/
+		bool attach(const Variant& descriptor);
+
+		void close();
+
+		bool isOpen() const;
+
+		// The file descriptor of the ring to be passed to subscribers
+		Variant descriptor() const;
+
+		qint64 capacity() const;
+
+		// Write \a data to the ring (only one process may write)
+		bool write(const Variant& data);
+
+		// Read the next package, \a ok is false if no package is available
+		Variant read(bool * ok = 0);
+
+		bool hasPendingData() const;
+
+		bool waitForReadyRead(int timeout = 30000);
+
+		// Number of times this reader fell behind and lost packages
+		quint64 overruns() const;
+
+		QString lastErrorString() const;
+
+	private:
+		Q_DISABLE_COPY(BroadcastRing)
+
+		bool map(int fd, bool create, qint64 capacity);
+
+		void copyIn(quint64 pos, const void * data, quint64 size);
+
+		void copyOut(quint64 pos, void * data, quint64 size) const;
+
+	private:
+		QString									m_lastError;
+		int											m_fd;
+		BroadcastRingHeader		*	m_header;
+		char									*	m_data;
+		quint64									m_mask;
+		// Cursor of this reader (total number of bytes read)
+		quint64									m_readPos;
+		quint64									m_overruns;
+};
+
+#endif // BROADCASTRING_H
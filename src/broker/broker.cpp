@@ -0,0 +1,334 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "broker.h"
+
+#include <QMetaObject>
+
+#include "localserver.h"
+#include "brokerprotocol.h"
+
+// Calls for a client with more data queued are dropped
+#define BROKER_HIGH_WATER_MARK		(16 * 1024 * 1024)
+
+BrokerWorker::BrokerWorker(Broker* broker)
+:	QObject(), m_broker(broker)
+{
+}
+
+
+BrokerWorker::~BrokerWorker()
+{
+	foreach(BrokerConnection * connection, m_connections)
+	{
+		m_broker->unregisterClient(connection);
+		delete connection->socket;
+		delete connection;
+	}
+}
+
+
+void BrokerWorker::addClient(quintptr socketDescriptor)
+{
+	LocalSocket	*	socket	=	new LocalSocket(this);
+	
+	if(!socket->setSocketDescriptor(socketDescriptor))
+	{
+		qWarning("Broker: Cannot accept client: %s", qPrintable(socket->lastErrorString()));
+		delete socket;
+		return;
+	}
+	
+	socket->setHighWaterMark(BROKER_HIGH_WATER_MARK);
+	socket->setLowWaterMark(BROKER_HIGH_WATER_MARK / 2);
+	
+	BrokerConnection	*	connection	=	new BrokerConnection;
+	connection->socket							=	socket;
+	connection->worker							=	this;
+	connection->remainingPackages		=	0;
+	
+	m_connections.insert(socket, connection);
+	
+	connect(socket, SIGNAL(disconnected()), SLOT(onDisconnected()), Qt::QueuedConnection);
+	connect(socket, SIGNAL(readyRead()), SLOT(onNewPackage()), Qt::QueuedConnection);
+	
+	// Data received before the signals were connected
+	readPackages(connection);
+}
+
+
+void BrokerWorker::onNewPackage()
+{
+	BrokerConnection	*	connection	=	m_connections.value(qobject_cast<LocalSocket*>(sender()));
+	
+	if(connection)
+		readPackages(connection);
+}
+
+
+void BrokerWorker::onDisconnected()
+{
+	LocalSocket				*	socket			=	qobject_cast<LocalSocket*>(sender());
+	BrokerConnection	*	connection	=	m_connections.take(socket);
+	
+	if(!connection)
+		return;
+	
+	// Nobody forwards to the connection after it has been unregistered
+	m_broker->unregisterClient(connection);
+	
+	socket->deleteLater();
+	delete connection;
+}
+
+
+void BrokerWorker::readPackages(BrokerConnection* connection)
+{
+	forever
+	{
+		bool			ok	=	false;
+		Variant		package(connection->socket->read(&ok));
+		
+		if(!ok)
+			break;
+		
+		handlePackage(connection, package);
+	}
+}
+
+
+void BrokerWorker::handlePackage(BrokerConnection* connection, const Variant& package)
+{
+	// Package of the call currently received: forward it as it is
+	if(connection->remainingPackages > 0)
+	{
+		// Keep the received descriptor open until it has been forwarded
+		if(package.type() == Variant::SocketDescriptor)
+			connection->packages.append(Variant::fromSocketDescriptor(package.toSocketDescriptor(), true));
+		else
+			connection->packages.append(package);
+		
+		if(--connection->remainingPackages == 0)
+			forward(connection);
+		
+		return;
+	}
+	
+	const quint32	optId	=	package.optionalId();
+	
+	switch(BROKER_COMMAND(optId))
+	{
+		case BROKER_REGISTER:
+		{
+			Variant	answer(m_broker->registerClient(connection, package.toString()));
+			answer.setOptionalId(BROKER_OPTID(BROKER_REGISTERED, 0));
+			
+			connection->socket->write(answer);
+		}break;
+		
+		case BROKER_SEND:
+		{
+			connection->receiver						=	package.toString();
+			connection->remainingPackages		=	BROKER_PACKAGES(optId);
+			connection->packages.clear();
+			
+			if(connection->remainingPackages == 0)
+				forward(connection);
+		}break;
+		
+		default:
+		{
+			qWarning("Broker: Unknown package 0x%08X", optId);
+		}break;
+	}
+}
+
+
+void BrokerWorker::forward(BrokerConnection* connection)
+{
+	// Unregistered clients are not allowed to send
+	if(connection->name.isEmpty())
+	{
+		qWarning("Broker: Call of an unregistered client dropped");
+		connection->packages.clear();
+		return;
+	}
+	
+	BrokerWorker	*	worker	=	0;
+	
+	// The socket of the receiver is written by its own worker only
+	if(registeredConnection(connection->receiver, &worker))
+		deliver(connection->receiver, connection->name, connection->packages);
+	else if(worker)
+		QMetaObject::invokeMethod(worker, "deliver", Qt::QueuedConnection, Q_ARG(QString, connection->receiver), Q_ARG(QString, connection->name), Q_ARG(QList<Variant>, connection->packages));
+	else
+		undeliverable(connection->name, connection->receiver);
+	
+	connection->packages.clear();
+}
+
+
+void BrokerWorker::deliver(const QString& receiver, const QString& sender, const QList<Variant>& packages)
+{
+	// The receiver may have disconnected since the call was queued
+	BrokerConnection	*	connection	=	registeredConnection(receiver);
+	
+	if(!connection || !connection->socket->isWritable())
+	{
+		if(connection)
+			qWarning("Broker: Call for %s dropped, the client does not read", qPrintable(receiver));
+		
+		BrokerWorker	*	worker	=	0;
+		
+		if(registeredConnection(sender, &worker))
+			undeliverable(sender, receiver);
+		else if(worker)
+			QMetaObject::invokeMethod(worker, "undeliverable", Qt::QueuedConnection, Q_ARG(QString, sender), Q_ARG(QString, receiver));
+		
+		return;
+	}
+	
+	Variant	header(sender);
+	header.setOptionalId(BROKER_OPTID(BROKER_DELIVER, packages.count()));
+	
+	connection->socket->write(header);
+	foreach(const Variant& package, packages)
+		connection->socket->write(package);
+}
+
+
+void BrokerWorker::undeliverable(const QString& sender, const QString& receiver)
+{
+	BrokerConnection	*	connection	=	registeredConnection(sender);
+	
+	if(!connection)
+		return;
+	
+	Variant	answer(receiver);
+	answer.setOptionalId(BROKER_OPTID(BROKER_UNDELIVERABLE, 0));
+	
+	connection->socket->write(answer);
+}
+
+
+BrokerConnection* BrokerWorker::registeredConnection(const QString& name, BrokerWorker** worker) const
+{
+	QReadLocker		clientLocker(&m_broker->m_clientLock);
+	
+	BrokerConnection	*	connection	=	m_broker->m_clients.value(name);
+	
+	if(worker)
+		*worker	=	connection ? connection->worker : 0;
+	
+	// Connections of other workers may be deleted at any time
+	return connection && connection->worker == this ? connection : 0;
+}
+
+
+Broker::Broker(QObject* parent)
+:	QObject(parent), m_server(0), m_nextWorker(0)
+{
+	// Calls queued to the worker of the receiver
+	qRegisterMetaType<QList<Variant> >("QList<Variant>");
+}
+
+
+Broker::~Broker()
+{
+	foreach(QThread * thread, m_threads)
+	{
+		thread->quit();
+		thread->wait();
+	}
+	
+	// The workers are not running anymore
+	qDeleteAll(m_workers);
+	qDeleteAll(m_threads);
+}
+
+
+bool Broker::listen(const QString& filename, int threads)
+{
+	if(m_server) {
+    m_lastError = tr("Already listening on a socket");
+		return false;
+  }
+	
+	m_server	=	new LocalServer(this);
+	connect(m_server, SIGNAL(newConnection(quintptr)), SLOT(onNewClient(quintptr)));
+	
+	if(!m_server->listen(filename)) {
+    m_lastError = m_server->errorString();
+		m_server->deleteLater();
+		m_server	=	0;
+		return false;
+  }
+	
+	for(int i = 0; i < qMax(threads, 1); i++)
+	{
+		QThread				*	thread	=	new QThread();
+		BrokerWorker	*	worker	=	new BrokerWorker(this);
+		
+		worker->moveToThread(thread);
+		thread->start();
+		
+		m_threads.append(thread);
+		m_workers.append(worker);
+	}
+	
+	return true;
+}
+
+
+QString Broker::lastErrorMessage() const
+{
+	return m_lastError;
+}
+
+
+void Broker::onNewClient(quintptr socketDescriptor)
+{
+	// Round robin: The socket is created in the thread of the worker
+	BrokerWorker	*	worker	=	m_workers.at(m_nextWorker);
+	m_nextWorker	=	(m_nextWorker + 1) % m_workers.count();
+	
+	QMetaObject::invokeMethod(worker, "addClient", Qt::QueuedConnection, Q_ARG(quintptr, socketDescriptor));
+}
+
+
+bool Broker::registerClient(BrokerConnection* connection, const QString& name)
+{
+	QWriteLocker	clientLocker(&m_clientLock);
+	
+	if(name.isEmpty() || !connection->name.isEmpty() || m_clients.contains(name))
+		return false;
+	
+	connection->name	=	name;
+	m_clients.insert(name, connection);
+	
+	return true;
+}
+
+
+void Broker::unregisterClient(BrokerConnection* connection)
+{
+	QWriteLocker	clientLocker(&m_clientLock);
+	
+	if(!connection->name.isEmpty() && m_clients.value(connection->name) == connection)
+		m_clients.remove(connection->name);
+}
@@ -0,0 +1,133 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <QObject>
+#include <QThread>
+#include <QHash>
+#include <QList>
+#include <QReadWriteLock>
+
+#include "variant.h"
+#include "localsocket.h"
+
+class LocalServer;
+class Broker;
+class BrokerWorker;
+
+// Client connected to the broker (only used in the thread of its worker)
+struct BrokerConnection
+{
+	LocalSocket					*	socket;
+	QString								name;
+	BrokerWorker				*	worker;
+	
+	// Call currently received: receiver and the packages still missing
+	QString								receiver;
+	int										remainingPackages;
+	QList<Variant>				packages;
+};
+
+
+/**
+	@brief Serves the connections assigned to one thread of the broker.
+*/
+class BrokerWorker : public QObject
+{
+	Q_OBJECT
+	
+	public:
+		BrokerWorker(Broker * broker);
+		
+		~BrokerWorker();
+		
+	public slots:
+		void addClient(quintptr socketDescriptor);
+		
+		void deliver(const QString& receiver, const QString& sender, const QList<Variant>& packages);
+		
+		void undeliverable(const QString& sender, const QString& receiver);
+		
+	private slots:
+		void onNewPackage();
+		
+		void onDisconnected();
+		
+	private:
+		void readPackages(BrokerConnection * connection);
+		
+		void handlePackage(BrokerConnection * connection, const Variant& package);
+		
+		void forward(BrokerConnection * connection);
+		
+		BrokerConnection * registeredConnection(const QString& name, BrokerWorker ** worker = 0) const;
+		
+	private:
+		Broker															*	m_broker;
+		QHash<LocalSocket*, BrokerConnection*>		m_connections;
+};
+
+
+/**
+	@brief Forwards calls between the clients registered by name.
+	
+	Connections are accepted in the main thread and distributed to a fixed number of worker
+	threads. Forwarded packages are written to the socket of the receiver as they have been
+	read, their data is not decoded. A socket is only written in the thread of its worker:
+	calls for a client of another worker are queued to that worker.
+	Calls for a client that does not drain its socket (more than BROKER_HIGH_WATER_MARK bytes
+	queued) are dropped and answered as undeliverable.
+*/
+class Broker : public QObject
+{
+	Q_OBJECT
+	
+	friend class BrokerWorker;
+	
+	public:
+		Broker(QObject * parent = 0);
+		
+		~Broker();
+		
+		bool listen(const QString& filename, int threads = QThread::idealThreadCount());
+		
+		QString lastErrorMessage() const;
+		
+	private slots:
+		void onNewClient(quintptr socketDescriptor);
+		
+	private:
+		bool registerClient(BrokerConnection * connection, const QString& name);
+		
+		void unregisterClient(BrokerConnection * connection);
+		
+	private:
+		QString									m_lastError;
+		LocalServer						*	m_server;
+		QList<QThread*>					m_threads;
+		QList<BrokerWorker*>		m_workers;
+		int											m_nextWorker;
+		
+		// Registered clients by name
+		QReadWriteLock					m_clientLock;
+		QHash<QString, BrokerConnection*>	m_clients;
+};
+
+#endif // BROKER_H
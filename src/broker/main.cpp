@@ -0,0 +1,48 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCoreApplication>
+#include <QStringList>
+
+#include "broker.h"
+
+int main(int argc, char ** argv)
+{
+	QCoreApplication	app(argc, argv);
+	QStringList				args(app.arguments());
+	
+	if(args.count() < 2 || args.count() > 3)
+	{
+		qWarning("Usage: %s <socket> [threads]", qPrintable(args.value(0)));
+		return 1;
+	}
+	
+	int	threads	=	QThread::idealThreadCount();
+	if(args.count() > 2)
+		threads	=	args.at(2).toInt();
+	
+	Broker	broker;
+	
+	if(!broker.listen(args.at(1), threads))
+	{
+		qWarning("Cannot listen on %s: %s", qPrintable(args.at(1)), qPrintable(broker.lastErrorMessage()));
+		return 1;
+	}
+	
+	return app.exec();
+}
@@ -0,0 +1,226 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "brokerclient.h"
+
+#include <QElapsedTimer>
+
+#include "localsocket.h"
+#include "brokerprotocol.h"
+#include "tools.h"
+
+BrokerClient::BrokerClient(QObject* callReceiver)
+:	QObject(callReceiver), m_callReceiver(callReceiver), m_socket(0), m_remainingPackages(0)
+{
+}
+
+
+BrokerClient::~BrokerClient()
+{
+}
+
+
+bool BrokerClient::connectToBroker(const QString& filename, const QString& name, int timeout)
+{
+	if(m_socket) {
+    m_lastError = tr("Already connected to a broker");
+		return false;
+  }
+	
+	LocalSocket	*	socket	=	new LocalSocket(this);
+	
+	if(!socket->connectToServer(filename)) {
+    m_lastError = socket->lastErrorString();
+		socket->deleteLater();
+		return false;
+  }
+	
+	Variant	package(name);
+	package.setOptionalId(BROKER_OPTID(BROKER_REGISTER, 0));
+	socket->write(package);
+	
+	// Wait for the broker to accept the name
+	QElapsedTimer	timer;
+	timer.start();
+	
+	bool	registered	=	false;
+	bool	answered		=	false;
+	
+	while(!answered && socket->isOpen() && timer.elapsed() < timeout)
+	{
+		if(!socket->availableData())
+			socket->waitForReadyRead(qMax(int(timeout - timer.elapsed()), 1));
+		
+		bool			ok	=	false;
+		Variant		answer(socket->read(&ok));
+		
+		if(ok && BROKER_COMMAND(answer.optionalId()) == BROKER_REGISTERED)
+		{
+			answered		=	true;
+			registered	=	answer.toBool();
+		}
+	}
+	
+	if(!registered) {
+    m_lastError = (answered ? tr("Name already registered at the broker") : tr("Broker did not answer"));
+		socket->deleteLater();
+		return false;
+  }
+	
+	m_socket	=	socket;
+	m_name		=	name;
+	
+	connect(socket, SIGNAL(disconnected()), SIGNAL(disconnected()), Qt::QueuedConnection);
+	connect(socket, SIGNAL(readyRead()), SLOT(onNewPackage()), Qt::QueuedConnection);
+	
+	// Calls received while registering
+	callSlotQueued(this, "onNewPackage");
+	
+	return true;
+}
+
+
+void BrokerClient::disconnectFromBroker()
+{
+	if(m_socket)
+		m_socket->disconnectFromServer();
+}
+
+
+bool BrokerClient::isOpen() const
+{
+	return (m_socket && m_socket->isOpen());
+}
+
+
+QString BrokerClient::name() const
+{
+	return m_name;
+}
+
+
+QString BrokerClient::lastErrorMessage() const
+{
+	return m_lastError;
+}
+
+
+bool BrokerClient::call(const QString& receiver, const QString& slot, const QList<Variant>& paramList)
+{
+	if(!m_socket) {
+    m_lastError = tr("Not connected to a broker");
+		return false;
+  }
+	
+	// Address, slot and one package per parameter
+	Variant	header(receiver);
+	header.setOptionalId(BROKER_OPTID(BROKER_SEND, 1 + paramList.count()));
+	
+	QMutexLocker	writeLocker(&m_writeLock);
+	
+	bool	result	=	m_socket->write(header) && m_socket->write(Variant(slot));
+	
+	for(int i = 0; result && i < paramList.count(); i++)
+	{
+		Variant	param(paramList.at(i));
+		param.setOptionalId(0);
+		
+		result	=	m_socket->write(param);
+	}
+	
+	if(!result)
+    m_lastError = tr("Socket closed while trying to write data");
+	
+	return result;
+}
+
+
+void BrokerClient::onNewPackage()
+{
+	if(!m_socket)
+		return;
+	
+	forever
+	{
+		bool			ok	=	false;
+		Variant		package(m_socket->read(&ok));
+		
+		if(!ok)
+			break;
+		
+		// Parameter of the call currently received
+		if(m_remainingPackages > 0)
+		{
+			m_receivingCall.append(package);
+			
+			if(--m_remainingPackages == 0)
+				dispatchCall();
+			
+			continue;
+		}
+		
+		const quint32	optId	=	package.optionalId();
+		
+		switch(BROKER_COMMAND(optId))
+		{
+			case BROKER_DELIVER:
+			{
+				m_sender						=	package.toString();
+				m_remainingPackages	=	BROKER_PACKAGES(optId);
+				m_receivingCall.clear();
+				
+				if(m_remainingPackages == 0)
+					dispatchCall();
+			}break;
+			
+			case BROKER_UNDELIVERABLE:
+			{
+				emit(undeliverable(package.toString()));
+			}break;
+			
+			default:
+				qWarning("BrokerClient: Unknown package 0x%08X", optId);
+				break;
+		}
+	}
+}
+
+
+void BrokerClient::dispatchCall()
+{
+	if(m_receivingCall.isEmpty())
+		return;
+	
+	const QByteArray	slot(m_receivingCall.takeFirst().toUtf8());
+	const QList<Variant>&	args	=	m_receivingCall;
+	
+	if(args.count() == 0)
+		callSlotQueued(m_callReceiver, slot.constData(), Q_ARG(QString, m_sender));
+	else if(args.count() == 1)
+		callSlotQueued(m_callReceiver, slot.constData(), Q_ARG(QString, m_sender), Q_ARG(Variant, args.at(0)));
+	else if(args.count() == 2)
+		callSlotQueued(m_callReceiver, slot.constData(), Q_ARG(QString, m_sender), Q_ARG(Variant, args.at(0)), Q_ARG(Variant, args.at(1)));
+	else if(args.count() == 3)
+		callSlotQueued(m_callReceiver, slot.constData(), Q_ARG(QString, m_sender), Q_ARG(Variant, args.at(0)), Q_ARG(Variant, args.at(1)), Q_ARG(Variant, args.at(2)));
+	else if(args.count() == 4)
+		callSlotQueued(m_callReceiver, slot.constData(), Q_ARG(QString, m_sender), Q_ARG(Variant, args.at(0)), Q_ARG(Variant, args.at(1)), Q_ARG(Variant, args.at(2)), Q_ARG(Variant, args.at(3)));
+	else
+		qWarning("BrokerClient: Too many arguments!");
+	
+	m_receivingCall.clear();
+}
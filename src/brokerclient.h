@@ -0,0 +1,92 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BROKERCLIENT_H
+#define BROKERCLIENT_H
+
+#include <QObject>
+#include <QList>
+#include <QMutex>
+
+#include "variant.h"
+
+class LocalSocket;
+
+/**
+	@brief Client of the broker (messagebus-broker).
+	
+	Instead of connecting every pair of processes each process connects once to the broker
+	and registers a name. Calls are addressed to the name of another client and forwarded by
+	the broker without being decoded.
+*/
+class BrokerClient : public QObject
+{
+	Q_OBJECT
+	
+	public:
+		BrokerClient(QObject * callReceiver);
+		
+		~BrokerClient();
+		
+		// Connect to the broker listening on \a filename and register as \a name
+		bool connectToBroker(const QString& filename, const QString& name, int timeout = 30000);
+		
+		void disconnectFromBroker();
+		
+		bool isOpen() const;
+		
+		QString name() const;
+		
+		QString lastErrorMessage() const;
+		
+	public slots:
+		/**
+			@brief Calls \a slot of the call receiver of the client registered as \a receiver.
+			
+			The slot is invoked as slot(const QString& sender, const Variant& param1, ...).
+			Parameters may be file descriptors, they are passed through the broker. Calls are
+			not acknowledged, undeliverable() is emitted if \a receiver is not registered.
+		*/
+		bool call(const QString& receiver, const QString& slot, const QList<Variant>& paramList);
+		
+	signals:
+		void undeliverable(const QString& receiver);
+		
+		void disconnected();
+		
+	private slots:
+		void onNewPackage();
+		
+	private:
+		void dispatchCall();
+		
+	private:
+		QString								m_lastError;
+		QObject							*	m_callReceiver;
+		LocalSocket					*	m_socket;
+		QString								m_name;
+		// Packages of a call must not interleave with another thread's call
+		QMutex								m_writeLock;
+		
+		// Call currently received
+		QString								m_sender;
+		int										m_remainingPackages;
+		QList<Variant>				m_receivingCall;
+};
+
+#endif // BROKERCLIENT_H
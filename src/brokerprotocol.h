@@ -0,0 +1,50 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BROKERPROTOCOL_H
+#define BROKERPROTOCOL_H
+
+/*
+ * Broker protocol
+ * 
+ * Packages exchanged with the broker carry the command in the lower 8 bits of the
+ * optional id. SEND and DELIVER are followed by the number of packages given in the
+ * upper 24 bits; these are forwarded unchanged (including file descriptors).
+ * 
+ * Command      Direction          Data
+ * ---------------------------------------------------------
+ * REGISTER     client -> broker   String: name of the client
+ * REGISTERED   broker -> client   Bool: name accepted
+ * SEND         client -> broker   String: name of the receiver
+ * DELIVER      broker -> client   String: name of the sender
+ * UNDELIVERABLE broker -> client  String: name of the unknown receiver
+ * 
+ * Calls for a receiver that does not read its socket are dropped and answered with
+ * UNDELIVERABLE as well.
+ */
+#define BROKER_REGISTER				0x01
+#define BROKER_REGISTERED			0x02
+#define BROKER_SEND						0x03
+#define BROKER_DELIVER				0x04
+#define BROKER_UNDELIVERABLE	0x05
+
+#define BROKER_COMMAND(optId)		((optId) & 0xFF)
+#define BROKER_PACKAGES(optId)	((optId) >> 8)
+#define BROKER_OPTID(command, packages)	(quint32(command) | (quint32(packages) << 8))
+
+#endif // BROKERPROTOCOL_H
@@ -0,0 +1,150 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "flushscheduler.h"
+
+#include <QCoreApplication>
+#include <QMetaObject>
+
+static QMutex							s_instanceLock;
+static FlushScheduler		*	s_instance	=	0;
+
+FlushScheduler::FlushScheduler()
+	:	QThread(), m_quit(false)
+{
+	m_clock.start();
+}
+
+
+FlushScheduler::~FlushScheduler()
+{
+}
+
+
+FlushScheduler * FlushScheduler::instance()
+{
+	QMutexLocker	locker(&s_instanceLock);
+
+	if(!s_instance)
+	{
+		s_instance	=	new FlushScheduler();
+		s_instance->start();
+
+		// Stop the thread before the application is gone
+		qAddPostRoutine(&FlushScheduler::shutdown);
+	}
+
+	return s_instance;
+}
+
+
+void FlushScheduler::schedule(QObject* target, const char* member, int usecs)
+{
+	Entry	entry;
+	entry.target	=	target;
+	entry.member	=	member;
+
+	QMutexLocker	locker(&m_lock);
+
+	m_deadlines.insert(m_clock.nsecsElapsed() + qint64(qMax(usecs, 0)) * 1000, entry);
+	m_changed.wakeAll();
+}
+
+
+void FlushScheduler::cancel(QObject* target)
+{
+	QMutexLocker	locker(&m_lock);
+
+	QMultiMap<qint64, Entry>::iterator	it	=	m_deadlines.begin();
+	while(it != m_deadlines.end())
+	{
+		if(it.value().target == target)
+			it	=	m_deadlines.erase(it);
+		else
+			++it;
+	}
+}
+
+
+void FlushScheduler::cancelIfRunning(QObject* target)
+{
+	QMutexLocker	locker(&s_instanceLock);
+
+	if(s_instance)
+		s_instance->cancel(target);
+}
+
+
+void FlushScheduler::run()
+{
+	QMutexLocker	locker(&m_lock);
+
+	while(!m_quit)
+	{
+		if(m_deadlines.isEmpty())
+		{
+			m_changed.wait(&m_lock);
+			continue;
+		}
+
+		const qint64	remaining	=	m_deadlines.firstKey() - m_clock.nsecsElapsed();
+
+		// Far away: sleep interruptible so earlier deadlines can be inserted
+		if(remaining >= 1000000)
+		{
+			m_changed.wait(&m_lock, remaining / 1000000);
+			continue;
+		}
+
+		// Below the resolution of QWaitCondition: sleep the exact amount of time
+		if(remaining > 0)
+		{
+			locker.unlock();
+			QThread::usleep((remaining + 999) / 1000);
+			locker.relock();
+			continue;
+		}
+
+		// Deadline expired: flush in the thread of the target
+		// (we are still locked, so cancel() cannot return before the call has been posted)
+		QMultiMap<qint64, Entry>::iterator	it	=	m_deadlines.begin();
+		Entry	entry	=	it.value();
+		m_deadlines.erase(it);
+
+		QMetaObject::invokeMethod(entry.target, entry.member, Qt::QueuedConnection);
+	}
+}
+
+
+void FlushScheduler::shutdown()
+{
+	QMutexLocker	locker(&s_instanceLock);
+
+	if(!s_instance)
+		return;
+
+	{
+		QMutexLocker	schedulerLocker(&s_instance->m_lock);
+		s_instance->m_quit	=	true;
+		s_instance->m_changed.wakeAll();
+	}
+
+	s_instance->wait();
+	delete s_instance;
+	s_instance	=	0;
+}
@@ -0,0 +1,77 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FLUSHSCHEDULER_H
+#define FLUSHSCHEDULER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QMultiMap>
+
+#include "global.h"
+
+/**
+	@brief Process wide deadline timer for corked sockets.
+
+	Instead of one QTimer per socket all pending deadlines are kept in one
+	ordered map and served by a single thread. When a deadline expires the
+	given slot of the target is invoked queued, so the actual flush happens
+	in the thread the target lives in.
+*/
+class MSGBUS_LOCAL FlushScheduler : public QThread
+{
+	public:
+		static FlushScheduler * instance();
+
+		// Invoke the slot \a member of \a target in \a usecs microseconds
+		void schedule(QObject * target, const char * member, int usecs);
+
+		// Remove all pending deadlines of \a target
+		void cancel(QObject * target);
+
+		// Like cancel() but does not create (or recreate after shutdown) the scheduler
+		static void cancelIfRunning(QObject * target);
+
+	protected:
+		virtual void run();
+
+	private:
+		FlushScheduler();
+
+		virtual ~FlushScheduler();
+
+		static void shutdown();
+
+	private:
+		struct Entry
+		{
+			QObject			*	target;
+			const char	*	member;
+		};
+
+		QMutex												m_lock;
+		QWaitCondition								m_changed;
+		// Pending deadlines (nanoseconds since m_clock was started)
+		QMultiMap<qint64, Entry>			m_deadlines;
+		QElapsedTimer									m_clock;
+		bool													m_quit;
+};
+
+#endif // FLUSHSCHEDULER_H
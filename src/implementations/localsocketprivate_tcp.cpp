@@ -0,0 +1,260 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "localsocketprivate_tcp.h"
+
+#include <QUrl>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+
+LocalSocketPrivate_Tcp::LocalSocketPrivate_Tcp(LocalSocket* q)
+	:	LocalSocketPrivate_Unix(q)
+{
+}
+
+
+LocalSocketPrivate_Tcp::~LocalSocketPrivate_Tcp()
+{
+}
+
+
+bool LocalSocketPrivate_Tcp::parseAddress(const QString& address, QString* host, quint16* port)
+{
+	if(!address.startsWith(QLatin1String(LOCALSOCKET_TCP_SCHEME)))
+		return false;
+	
+	// QUrl handles bracketed IPv6 addresses
+	QUrl	url(address);
+	
+	if(!url.isValid() || url.host().isEmpty() || url.port() <= 0)
+		return false;
+	
+	if(host)
+		*host	=	url.host();
+	if(port)
+		*port	=	quint16(url.port());
+	
+	return true;
+}
+
+
+bool LocalSocketPrivate_Tcp::isTcpSocket(quintptr socketDescriptor)
+{
+	struct	sockaddr_storage	addr;
+	socklen_t									addrLen	=	sizeof(addr);
+	
+	if(getsockname(int(socketDescriptor), (sockaddr*)&addr, &addrLen) != 0)
+		return false;
+	
+	return (addr.ss_family == AF_INET || addr.ss_family == AF_INET6);
+}
+
+
+void LocalSocketPrivate_Tcp::setSocketOptions(quintptr socketDescriptor)
+{
+	int	set	=	1;
+	setsockopt(int(socketDescriptor), IPPROTO_TCP, TCP_NODELAY, &set, sizeof(set));
+	setsockopt(int(socketDescriptor), SOL_SOCKET, SO_KEEPALIVE, &set, sizeof(set));
+	
+#ifdef TCP_KEEPIDLE
+	int	idle			=	TCP_KEEPALIVE_IDLE;
+	int	interval	=	TCP_KEEPALIVE_INTERVAL;
+	int	count			=	TCP_KEEPALIVE_COUNT;
+	setsockopt(int(socketDescriptor), IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+	setsockopt(int(socketDescriptor), IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+	setsockopt(int(socketDescriptor), IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#endif
+}
+
+
+bool LocalSocketPrivate_Tcp::connectSocket(int socketDescriptor, const sockaddr* address, socklen_t addressLength, int timeout)
+{
+	// Connect without blocking to bound the time an unreachable host takes
+	const int	flags	=	fcntl(socketDescriptor, F_GETFL, 0);
+	if(flags < 0 || fcntl(socketDescriptor, F_SETFL, flags | O_NONBLOCK) != 0)
+		return false;
+	
+	if(::connect(socketDescriptor, address, addressLength) != 0)
+	{
+		if(errno != EINPROGRESS)
+			return false;
+		
+		struct	pollfd	pfd;
+		pfd.fd			=	socketDescriptor;
+		pfd.events	=	POLLOUT;
+		pfd.revents	=	0;
+		
+		int	result;
+		do
+		{
+			result	=	poll(&pfd, 1, timeout);
+		}
+		while(result < 0 && errno == EINTR);
+		
+		if(result == 0)
+			errno	=	ETIMEDOUT;
+		if(result <= 0)
+			return false;
+		
+		int				error				=	0;
+		socklen_t	errorLength	=	sizeof(error);
+		if(getsockopt(socketDescriptor, SOL_SOCKET, SO_ERROR, &error, &errorLength) != 0)
+			return false;
+		
+		if(error != 0)
+		{
+			errno	=	error;
+			return false;
+		}
+	}
+	
+	// The socket is used blocking
+	return (fcntl(socketDescriptor, F_SETFL, flags) == 0);
+}
+
+
+bool LocalSocketPrivate_Tcp::connectToServer(const QString& address)
+{
+	QString		host;
+	quint16		port	=	0;
+	
+	if(!parseAddress(address, &host, &port))
+	{
+    setError(QStringLiteral("Invalid TCP address: %1").arg(address));
+		return false;
+	}
+	
+	struct	addrinfo		hints;
+	struct	addrinfo	*	result	=	0;
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family		=	AF_UNSPEC;
+	hints.ai_socktype	=	SOCK_STREAM;
+	
+	int	error	=	getaddrinfo(host.toLocal8Bit().constData(), QByteArray::number(port).constData(), &hints, &result);
+	if(error != 0)
+	{
+    setError(QStringLiteral("Cannot resolve host: %1").arg(QString::fromLocal8Bit(gai_strerror(error))));
+		return false;
+	}
+	
+	int	socketDescriptor	=	-1;
+	int	connectError			=	0;
+	
+	// Try all addresses of the host
+	for(struct addrinfo * info = result; info; info = info->ai_next)
+	{
+		socketDescriptor	=	::socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if(socketDescriptor < 0)
+		{
+			connectError	=	errno;
+			continue;
+		}
+		
+		if(connectSocket(socketDescriptor, info->ai_addr, info->ai_addrlen, TCP_CONNECT_TIMEOUT))
+			break;
+		
+		// Before close() may change it
+		connectError	=	errno;
+		
+		::close(socketDescriptor);
+		socketDescriptor	=	-1;
+	}
+	
+	freeaddrinfo(result);
+	
+	if(socketDescriptor < 0)
+	{
+		setError(QStringLiteral("Cannot connect to server: %1").arg(QString::fromLocal8Bit(strerror(connectError))));
+		return false;
+	}
+	
+	return setSocketDescriptor(quintptr(socketDescriptor));
+}
+
+
+bool LocalSocketPrivate_Tcp::setSocketDescriptor(quintptr socketDescriptor)
+{
+	setSocketOptions(socketDescriptor);
+	
+	return LocalSocketPrivate_Unix::setSocketDescriptor(socketDescriptor);
+}
+
+
+bool LocalSocketPrivate_Tcp::canPassFileDescriptors() const
+{
+	return false;
+}
+
+
+int LocalSocketPrivate_Tcp::write(const char* data, int size, quintptr* fileDescriptor)
+{
+	if(!m_socketDescriptor)
+		return 0;
+	
+	// Refused by LocalSocket::write() already
+	if(fileDescriptor)
+	{
+		setError(QStringLiteral("File descriptors cannot be passed over TCP"));
+		return 0;
+	}
+	
+	int	result	=	::send(m_socketDescriptor, data, size, MSG_NOSIGNAL);
+	
+	if(result < 1)
+	{
+		setError(QStringLiteral("Could not write data: %1").arg(QString::fromLocal8Bit(strerror(errno))));
+		return 0;
+	}
+	
+	return result;
+}
+
+
+int LocalSocketPrivate_Tcp::read(char* data, int size)
+{
+	if(!m_socketDescriptor)
+		return -1;
+	
+	ssize_t	readBytes	=	::recv(m_socketDescriptor, data, size, MSG_DONTWAIT);
+	
+	if(readBytes < 0)
+	{
+		if(errno != EAGAIN && errno != EWOULDBLOCK)
+			setError(QStringLiteral("Could not read data: %1").arg(QString::fromLocal8Bit(strerror(errno))));
+		
+		return 0;
+	}
+	
+	// Unlike local sockets, a TCP socket reports the closed connection by end of file
+	if(readBytes == 0)
+	{
+		setError(QStringLiteral("Connection closed by peer"));
+		return 0;
+	}
+	
+	return readBytes;
+}
@@ -0,0 +1,76 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOCALSOCKETPRIVATE_TCP_H
+#define LOCALSOCKETPRIVATE_TCP_H
+
+#include "localsocketprivate_unix.h"
+
+// Keepalive: idle seconds before probing, seconds between probes, probes before giving up
+#define TCP_KEEPALIVE_IDLE			60
+#define TCP_KEEPALIVE_INTERVAL	10
+#define TCP_KEEPALIVE_COUNT			6
+// Milliseconds to wait for each address of the host to accept the connection
+#define TCP_CONNECT_TIMEOUT			10000
+
+/**
+	@brief TCP transport (addresses like "tcp://host:port").
+	
+	Shares waiting and closing with the Unix implementation. Nagle's algorithm is disabled,
+	as the write path already batches all queued packages into one send() call. File
+	descriptors cannot be passed.
+*/
+class LocalSocketPrivate_Tcp : public LocalSocketPrivate_Unix
+{
+	public:
+		LocalSocketPrivate_Tcp(LocalSocket * q);
+		
+		virtual ~LocalSocketPrivate_Tcp();
+		
+		// Split "tcp://host:port" into \a host and \a port
+		static bool parseAddress(const QString& address, QString * host, quint16 * port);
+		
+		// Whether \a socketDescriptor is a TCP socket
+		static bool isTcpSocket(quintptr socketDescriptor);
+		
+		// Disable Nagle's algorithm and enable keepalive
+		static void setSocketOptions(quintptr socketDescriptor);
+		
+		// Connect the blocking socket \a socketDescriptor, false with errno set on failure or timeout
+		static bool connectSocket(int socketDescriptor, const struct sockaddr * address, socklen_t addressLength, int timeout);
+		
+		/*
+		 * Implementation
+		 */
+		// Connect to "tcp://host:port"
+		virtual bool connectToServer(const QString& address);
+		
+		virtual bool setSocketDescriptor(quintptr socketDescriptor);
+		
+		virtual bool canPassFileDescriptors() const;
+		
+	protected:
+		/*
+		 * Implementation
+		 */
+		virtual int write(const char * data, int size, quintptr * fileDescriptor);
+		
+		virtual int read(char * data, int size);
+};
+
+#endif // LOCALSOCKETPRIVATE_TCP_H
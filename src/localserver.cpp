@@ -22,8 +22,19 @@
 #include <QDir>
 #include <QFile>
 
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
 #include "localsocket.h"
 
+// Suffix of the name the socket is bound to before it is renamed to its file name
+#define BIND_SUFFIX		".bind"
+
 LocalServer::LocalServer(QObject * parent)
 	:	QLocalServer(parent)
 {
@@ -47,26 +58,116 @@ bool LocalServer::listen(const QString& filename)
 // 	QString	filename(tmpDir.absoluteFilePath("LocalSocket_" + QString::fromLatin1(QCryptographicHash::hash(filename.toUtf8(), QCryptographicHash::Sha1).toHex()) + ".sock"));
 
 	QLocalServer::removeServer(filename);
-	bool	ret	=	QLocalServer::listen(filename);
+	m_errorString.clear();
+	
+	/*
+	 * The socket is bound to a temporary name and renamed to filename: QLocalServer removes the
+	 * name the socket is bound to when closing, so takeSocketDescriptor() keeps the socket file.
+	 */
+	const QByteArray	path(QFile::encodeName(filename));
+	const QByteArray	bindPath(path + BIND_SUFFIX);
+	
+	struct sockaddr_un	address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family	=	AF_UNIX;
+	
+	if(bindPath.size() >= int(sizeof(address.sun_path)))
+	{
+		m_errorString	=	tr("Socket path too long: %1").arg(filename);
+		qWarning("Could not create local server socket!");
+		return false;
+	}
+	
+	memcpy(address.sun_path, bindPath.constData(), bindPath.size());
+	
+	int	fd	=	::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	
+	::unlink(bindPath.constData());
+	
+	if(fd < 0 || ::bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+		 ::chmod(bindPath.constData(), S_IRWXU | S_IRWXG) != 0 ||
+		 ::listen(fd, SOMAXCONN) != 0 || ::rename(bindPath.constData(), path.constData()) != 0)
+	{
+		const int	error	=	errno;
+		
+		if(fd >= 0)
+			::close(fd);
+		::unlink(bindPath.constData());
+		
+		m_errorString	=	QString::fromLocal8Bit(strerror(error));
+		qWarning("Could not create local server socket!");
+		return false;
+	}
+	
+	if(!QLocalServer::listen(qintptr(fd)))
+	{
+		::close(fd);
+		QFile::remove(filename);
+		
+		qWarning("Could not create local server socket!");
+		return false;
+	}
 	
 // 	dbg("LocalServer::listen");
 	
+	m_id				=	filename;
+	m_filename	=	filename;
+	
+	return true;
+}
+
+
+bool LocalServer::listen(quintptr socketDescriptor)
+{
+	bool	ret	=	QLocalServer::listen(qintptr(socketDescriptor));
+	
+	m_errorString.clear();
+	
 	if(ret)
 	{
-		QFile::setPermissions(filename, QFile::ExeOwner | QFile::ExeGroup | /*QFile::ExeOther |*/
-																	QFile::ReadOwner | QFile::ReadGroup | /*QFile::ReadOther |*/
-																	QFile::WriteOwner | QFile::WriteGroup/* | QFile::WriteOther*/);
+		// Remove the socket file when we stop listening (not the name it has been bound to)
+		QString	filename(fullServerName());
+		if(filename.endsWith(QLatin1String(BIND_SUFFIX)))
+			filename.chop(int(strlen(BIND_SUFFIX)));
 		
 		m_id				=	filename;
 		m_filename	=	filename;
 	}
 	else
-		qWarning("Could not create local server socket!");
+		qWarning("Could not listen on local server socket!");
 	
 	return ret;
 }
 
 
+quintptr LocalServer::takeSocketDescriptor()
+{
+	if(!isListening())
+		return 0;
+	
+	int	fd	=	::dup(int(socketDescriptor()));
+	if(fd < 0)
+		return 0;
+	
+	// Only removes the name the socket has been bound to (see listen()), the socket file stays
+	QLocalServer::close();
+	
+	m_id.clear();
+	m_filename.clear();
+	
+	return quintptr(fd);
+}
+
+
+QString LocalServer::errorString() const
+{
+	if(!m_errorString.isEmpty())
+		return m_errorString;
+	
+	return QLocalServer::errorString();
+}
+
+
 void LocalServer::incomingConnection(quintptr socketDescriptor)
 {
 	emit(newConnection(socketDescriptor));
@@ -37,6 +37,20 @@ class LocalServer : public QLocalServer
 
 		bool listen(const QString& filename);
 		
+		// Listen on the socket passed by takeSocketDescriptor() of another process
+		bool listen(quintptr socketDescriptor);
+		
+		/**
+			@brief Stops listening and returns a duplicate of the listening socket.
+			
+			Unlike close() the socket file is kept, so clients can connect to the process the
+			descriptor is passed to without interruption. Returns 0 on failure.
+		*/
+		quintptr takeSocketDescriptor();
+		
+		// Also reports errors of listen() not coming from QLocalServer
+		QString errorString() const;
+		
 	signals:
 		void newConnection(quintptr socketDescriptor);
 		
@@ -46,6 +60,7 @@ class LocalServer : public QLocalServer
 	private:
 		QString			m_id;
 		QString			m_filename;
+		QString			m_errorString;
 };
 
 #endif // LOCALSERVER_H
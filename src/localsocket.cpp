@@ -20,10 +20,12 @@
 
 #include <QThread>
 #include <QTimer>
+#include <utility>
 #include "eventloop.h"
 
 #if defined(Q_OS_UNIX) || defined(Q_OS_LINX)
 	#include "implementations/localsocketprivate_unix.h"
+	#include "implementations/localsocketprivate_tcp.h"
 #else
 	#error No implementation of LocalSocket for this operating system!
 #endif
@@ -39,6 +41,8 @@ LocalSocket::LocalSocket(QObject* parent)
   connect(d_ptr, SIGNAL(readyRead()), SIGNAL(readyRead()));
   connect(d_ptr, SIGNAL(error(QString)), SIGNAL(error(QString)));
   connect(d_ptr, SIGNAL(disconnected()), SIGNAL(disconnected()));
+  connect(d_ptr, SIGNAL(writable()), SIGNAL(writable()));
+  connect(d_ptr, SIGNAL(bytesWritten()), SIGNAL(dataWritten()));
 }
 
 LocalSocket::~LocalSocket()
@@ -49,11 +53,39 @@ LocalSocket::~LocalSocket()
 }
 
 
+void LocalSocket::selectTransport(bool tcp)
+{
+	if((dynamic_cast<LocalSocketPrivate_Tcp*>(d_ptr) != 0) == tcp)
+		return;
+	
+	LocalSocketPrivate	*	transport;
+	if(tcp)
+		transport	=	new LocalSocketPrivate_Tcp(this);
+	else
+		transport	=	new LocalSocketPrivate_Unix(this);
+	
+	// Keep the settings made before connecting
+	transport->copySettings(d_ptr);
+	
+	disconnect(d_ptr, 0, this, 0);
+	delete d_ptr;
+	d_ptr	=	transport;
+	
+  connect(d_ptr, SIGNAL(readyRead()), SIGNAL(readyRead()));
+  connect(d_ptr, SIGNAL(error(QString)), SIGNAL(error(QString)));
+  connect(d_ptr, SIGNAL(disconnected()), SIGNAL(disconnected()));
+  connect(d_ptr, SIGNAL(writable()), SIGNAL(writable()));
+  connect(d_ptr, SIGNAL(bytesWritten()), SIGNAL(dataWritten()));
+}
+
+
 bool LocalSocket::connectToServer(const QString& filename)
 {
 	if(isOpen() || filename.isEmpty())
 		return false;
 	
+	selectTransport(filename.startsWith(QLatin1String(LOCALSOCKET_TCP_SCHEME)));
+	
 	return d_ptr->connectToServer(filename);
 }
 
@@ -63,10 +95,36 @@ bool LocalSocket::setSocketDescriptor(quintptr socketDescriptor)
 	if(isOpen() || socketDescriptor == 0)
 		return false;
 	
+	selectTransport(LocalSocketPrivate_Tcp::isTcpSocket(socketDescriptor));
+	
 	return d_ptr->setSocketDescriptor(socketDescriptor);
 }
 
 
+Variant LocalSocket::detach(Variant* state, int timeout)
+{
+	if(!isOpen())
+		return Variant();
+	
+	return d_ptr->detach(state, timeout);
+}
+
+
+bool LocalSocket::attach(const Variant& socketDescriptor, const Variant& state)
+{
+	if(isOpen())
+		return false;
+	
+	bool	ok	=	false;
+	int		fd	=	socketDescriptor.toSocketDescriptor(&ok);
+	
+	if(ok && fd > 0)
+		selectTransport(LocalSocketPrivate_Tcp::isTcpSocket(quintptr(fd)));
+	
+	return d_ptr->attach(socketDescriptor, state);
+}
+
+
 quintptr LocalSocket::socketDescriptor() const
 {
 	QReadLocker		controlLock(&d_ptr->m_controlLock);
@@ -83,11 +141,30 @@ bool LocalSocket::isOpen() const
 }
 
 
-Variant LocalSocket::read(bool* ok)
+bool LocalSocket::canPassFileDescriptors() const
+{
+	return d_ptr->canPassFileDescriptors();
+}
+
+
+void LocalSocket::setFragmentsEnabled(bool enabled)
+{
+	QWriteLocker		writeLock(&d_ptr->m_writeBufferLock);
+	
+	d_ptr->m_fragmentsEnabled	=	enabled;
+}
+
+
+Variant LocalSocket::read(bool* ok, Priority * priority)
 {
 	QWriteLocker		readLock(&d_ptr->m_readBufferLock);
 	
-	if(d_ptr->m_readBuffer.isEmpty())
+	// Take from the lane with the highest priority
+	int	lane	=	0;
+	while(lane < PRIORITY_LANES && d_ptr->m_readBuffer[lane].isEmpty())
+		lane++;
+	
+	if(lane >= PRIORITY_LANES)
 	{
 		if(ok)
 			*ok	=	false;
@@ -99,7 +176,20 @@ Variant LocalSocket::read(bool* ok)
 		if(ok)
 			*ok	=	true;
 		
-		return d_ptr->m_readBuffer.takeFirst();
+		if(priority)
+			*priority	=	Priority(lane);
+		
+		Variant	ret(std::move(d_ptr->m_readBuffer[lane].first()));
+		d_ptr->m_readBuffer[lane].removeFirst();
+		
+		// Continue reading from the socket (in the thread of the socket)
+		if(d_ptr->m_readPaused && d_ptr->readBufferCount() < d_ptr->m_readBufferLimit)
+		{
+			d_ptr->m_readPaused	=	false;
+			QMetaObject::invokeMethod(d_ptr, "resumeReading", Qt::QueuedConnection);
+		}
+		
+		return ret;
 	}
 }
 
@@ -108,15 +198,112 @@ int LocalSocket::availableData() const
 {
 	QReadLocker		readLock(&d_ptr->m_readBufferLock);
 	
-	return d_ptr->m_readBuffer.count();
+	return d_ptr->readBufferCount();
+}
+
+
+void LocalSocket::setReadBufferLimit(int packages)
+{
+	QWriteLocker		readLock(&d_ptr->m_readBufferLock);
+	
+	d_ptr->m_readBufferLimit	=	packages;
+	
+	if(d_ptr->m_readPaused && (packages <= 0 || d_ptr->readBufferCount() < packages))
+	{
+		d_ptr->m_readPaused	=	false;
+		QMetaObject::invokeMethod(d_ptr, "resumeReading", Qt::QueuedConnection);
+	}
+}
+
+
+qint64 LocalSocket::dataToWrite() const
+{
+	QReadLocker		writeLock(&d_ptr->m_writeBufferLock);
+	
+	return d_ptr->queuedBytes();
+}
+
+
+void LocalSocket::setCorked(bool corked)
+{
+	{
+		QWriteLocker		writeLock(&d_ptr->m_writeBufferLock);
+		
+		if(d_ptr->m_corked == corked)
+			return;
+		
+		d_ptr->m_corked	=	corked;
+	}
+	
+	// Write held back data
+	if(!corked && isOpen())
+		d_ptr->notifyWrite();
+}
+
+
+bool LocalSocket::isCorked() const
+{
+	QReadLocker		writeLock(&d_ptr->m_writeBufferLock);
+	
+	return d_ptr->m_corked;
+}
+
+
+void LocalSocket::setCorkThreshold(int bytes)
+{
+	QWriteLocker		writeLock(&d_ptr->m_writeBufferLock);
+	
+	d_ptr->m_corkThreshold	=	bytes;
+}
+
+
+int LocalSocket::corkThreshold() const
+{
+	QReadLocker		writeLock(&d_ptr->m_writeBufferLock);
+	
+	return d_ptr->m_corkThreshold;
+}
+
+
+void LocalSocket::setCorkDeadline(int usecs)
+{
+	QWriteLocker		writeLock(&d_ptr->m_writeBufferLock);
+	
+	d_ptr->m_corkDeadline	=	usecs;
+}
+
+
+int LocalSocket::corkDeadline() const
+{
+	QReadLocker		writeLock(&d_ptr->m_writeBufferLock);
+	
+	return d_ptr->m_corkDeadline;
 }
 
 
-int LocalSocket::dataToWrite() const
+void LocalSocket::setHighWaterMark(qint64 bytes, int messages)
 {
 	QWriteLocker		writeLock(&d_ptr->m_writeBufferLock);
 	
-	return d_ptr->m_writeBuffer.count() + (d_ptr->m_currentWriteData.isEmpty() ? 0 : 1);
+	d_ptr->m_highWaterBytes			=	bytes;
+	d_ptr->m_highWaterMessages	=	messages;
+}
+
+
+void LocalSocket::setLowWaterMark(qint64 bytes, int messages)
+{
+	QWriteLocker		writeLock(&d_ptr->m_writeBufferLock);
+	
+	d_ptr->m_lowWaterBytes			=	bytes;
+	d_ptr->m_lowWaterMessages		=	messages;
+}
+
+
+bool LocalSocket::isWritable() const
+{
+	QReadLocker		writeLock(&d_ptr->m_writeBufferLock);
+	
+	return !d_ptr->m_writeBlocked;
 }
 
 
@@ -127,7 +314,7 @@ bool LocalSocket::waitForReadyRead(int timeout)
 	
 	{
 		QReadLocker		readLock(&d_ptr->m_readBufferLock);
-		if(!d_ptr->m_readBuffer.isEmpty())
+		if(d_ptr->readBufferCount() > 0)
 			return true;
 	}
 	
@@ -161,7 +348,7 @@ bool LocalSocket::waitForDataWritten(int timeout)
 	
 	{
 		QWriteLocker		writeLock(&d_ptr->m_writeBufferLock);
-		if(d_ptr->m_writeBuffer.isEmpty() && d_ptr->m_currentWriteData.isEmpty())
+		if(!d_ptr->hasQueuedPackages() && d_ptr->m_currentWriteData.isEmpty())
 			return true;
 	}
 	
@@ -205,17 +392,70 @@ void LocalSocket::disconnectFromServer()
 }
 
 
-bool LocalSocket::write(const Variant& data)
+bool LocalSocket::write(const Variant& data, LocalSocket::Priority priority)
+{
+	// Shares the data, the copy is moved into the write buffer
+	Variant	package(data);
+	return writePackage(package, false, 0, priority);
+}
+
+
+bool LocalSocket::write(Variant&& data, LocalSocket::Priority priority)
+{
+	return writePackage(data, false, 0, priority);
+}
+
+
+bool LocalSocket::tryWrite(const Variant& data, bool * wouldBlock, LocalSocket::Priority priority)
+{
+	// Shares the data, the copy is moved into the write buffer
+	Variant	package(data);
+	return writePackage(package, true, wouldBlock, priority);
+}
+
+
+bool LocalSocket::writePackage(Variant& data, bool tryOnly, bool * wouldBlock, LocalSocket::Priority priority)
 {
+	if(wouldBlock)
+		*wouldBlock	=	false;
+	
 	if(!isOpen())
 		return false;
 	
+	// Would break the stream: refuse before anything is queued
+	if(data.type() == Variant::SocketDescriptor && !d_ptr->canPassFileDescriptors())
+		return false;
+	
+	bool	holdBack	=	false;
+	
 	{
 		QWriteLocker		writeLock(&d_ptr->m_writeBufferLock);
-		d_ptr->m_writeBuffer.append(data);
+		
+		// Write buffer is full: Wait until it drained below the low water mark
+		if(tryOnly && d_ptr->m_writeBlocked && priority != HighPriority)
+		{
+			if(wouldBlock)
+				*wouldBlock	=	true;
+			
+			return false;
+		}
+		
+		d_ptr->m_writeBufferSize	+=	LocalSocketPrivate::packageSize(data);
+		// QList has no append() taking an rvalue
+		d_ptr->m_writeBuffer[priority].append(Variant());
+		d_ptr->m_writeBuffer[priority].last()	=	std::move(data);
+		
+		if(d_ptr->isAboveHighWaterMark())
+			d_ptr->m_writeBlocked	=	true;
+		
+		// Corked: Wait for more data until the threshold is reached
+		holdBack	=	(priority != HighPriority && d_ptr->m_corked && d_ptr->m_writeBufferSize < d_ptr->m_corkThreshold);
 	}
 	
-	d_ptr->notifyWrite();
+	if(holdBack)
+		d_ptr->scheduleCorkFlush();
+	else
+		d_ptr->notifyWrite();
 	
 	return true;
 }
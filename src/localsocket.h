@@ -23,6 +23,9 @@
 
 #include "variant.h"
 
+// Address prefix selecting the TCP transport, e.g. "tcp://127.0.0.1:4000"
+#define LOCALSOCKET_TCP_SCHEME		"tcp://"
+
 class LocalSocketPrivate;
 class LocalSocket : public QObject
 {
@@ -30,24 +33,132 @@ class LocalSocket : public QObject
 	
 	friend class LocalSocketPrivate;
 	
+	public:
+		/**
+			@brief Write lanes of a socket.
+			
+			High priority packages are written before queued normal packages (weighted, so
+			normal packages are not starved) and are returned first by read(). They are neither
+			held back by cork mode nor refused by the high water mark.
+		*/
+		enum Priority
+		{
+			HighPriority		=	0,
+			NormalPriority	=	1
+		};
+		
 	public:
 		LocalSocket(QObject * parent = 0);
 		
 		~LocalSocket();
 		
+		/**
+			@brief Connects to the server listening on \a filename.
+			
+			Addresses starting with LOCALSOCKET_TCP_SCHEME ("tcp://host:port") connect by TCP
+			instead of a local socket. File descriptors cannot be written to TCP connections.
+		*/
 		bool connectToServer(const QString& filename);
 		
+		// Local and TCP sockets are both accepted
 		bool setSocketDescriptor(quintptr socketDescriptor);
 		
 		quintptr socketDescriptor() const;
 		
+		/**
+			@brief Detaches the connection to hand it over to another process.
+			
+			Writes the pending data (waiting up to \a timeout ms) and stops reading. Returns a
+			duplicate of the socket descriptor and stores the data already read from the kernel
+			but not yet returned by read() (including partially received packages) in \a state.
+			The socket is closed afterwards, the connection stays open through the returned
+			descriptor. Returns an invalid Variant if the connection cannot be handed over, e.g.
+			because received file descriptors have not been read yet.
+			
+			Pass both to attach() in the other process.
+		*/
+		Variant detach(Variant * state, int timeout = 30000);
+		
+		// Continues a connection detached by another process (takes ownership of the descriptor)
+		bool attach(const Variant& socketDescriptor, const Variant& state);
+		
 		bool isOpen() const;
 		
-		Variant read(bool * ok = NULL);
+		// Whether SocketDescriptor Variants can be written (false for TCP connections)
+		bool canPassFileDescriptors() const;
+		
+		/**
+			@brief Writes packages larger than 16k in fragments.
+			
+			Packages of the high priority lane can overtake a large package written in fragments,
+			but peers of older versions cannot read them, so this is disabled by default and has to
+			be negotiated (MessageBus enables it if the peer announced it). Fragments are always
+			accepted when reading. Disconnecting disables it again.
+			
+			Only one package per lane is written in fragments at a time: the packages of the same
+			lane queued behind it wait until it has been written, they keep their order. Packages
+			larger than 256M are written in one piece as if fragments were disabled.
+		*/
+		void setFragmentsEnabled(bool enabled);
+		
+		// Returns high priority packages first, the lane of the package is stored in \a priority
+		Variant read(bool * ok = NULL, Priority * priority = NULL);
+		
+		// Like write(const Variant&), but \a data is moved into the write buffer
+		bool write(Variant&& data, LocalSocket::Priority priority = NormalPriority);
 		
 		int availableData() const;
 		
-		int dataToWrite() const;
+		/**
+			@brief Stops reading from the socket while \a packages packages are waiting to be read.
+			
+			Reading continues as soon as read() took enough packages. This passes a slow
+			reader's backpressure on to the kernel buffers and thus to the peer.
+			A value of 0 (default) disables the limit.
+		*/
+		void setReadBufferLimit(int packages);
+		
+		// Number of bytes waiting to be written
+		qint64 dataToWrite() const;
+		
+		/**
+			@brief Enables or disables cork mode.
+			
+			In cork mode written data is held back in the write buffer until either
+			corkThreshold() bytes are queued, flush() is called or corkDeadline()
+			microseconds have passed since the first held back write. Disabling cork
+			mode writes held back data immediately.
+		*/
+		void setCorked(bool corked);
+		
+		bool isCorked() const;
+		
+		void setCorkThreshold(int bytes);
+		
+		int corkThreshold() const;
+		
+		void setCorkDeadline(int usecs);
+		
+		int corkDeadline() const;
+		
+		/**
+			@brief Limits the write buffer.
+			
+			Once \a bytes bytes or \a messages packages are queued tryWrite() refuses new
+			data until the queue has drained below the low water mark. write() still queues
+			the data (use isWritable() to throttle).
+			A value of 0 disables the respective limit.
+		*/
+		void setHighWaterMark(qint64 bytes, int messages = 0);
+		
+		/**
+			@brief Sets the fill level at which a blocked write buffer accepts data again.
+			
+			writable() is emitted when the queue drains to \a bytes bytes and \a messages packages.
+		*/
+		void setLowWaterMark(qint64 bytes, int messages = 0);
+		
+		bool isWritable() const;
 		
 		bool waitForReadyRead(int timeout = 30000);
 		
@@ -58,7 +169,10 @@ class LocalSocket : public QObject
 	public slots:
 		void disconnectFromServer();
 		
-		bool write(const Variant& data);
+		bool write(const Variant& data, LocalSocket::Priority priority = NormalPriority);
+		
+		// Like write() but refuses data above the high water mark (reported in \a wouldBlock)
+		bool tryWrite(const Variant& data, bool * wouldBlock = 0, LocalSocket::Priority priority = NormalPriority);
 		
 		bool flush();
 		
@@ -71,10 +185,21 @@ class LocalSocket : public QObject
 		
 		void dataWritten();
 		
+		// The write buffer drained below the low water mark
+		void writable();
+		
 		void error(const QString& errorString);
 		
 	private:
-		LocalSocketPrivate		*	const d_ptr;
+		// Replace the implementation if \a tcp does not match it (only while closed)
+		void selectTransport(bool tcp);
+		
+		// Queue \a data (moved from if it is accepted), \a tryOnly refuses it above the high water mark
+		bool writePackage(Variant& data, bool tryOnly, bool * wouldBlock, LocalSocket::Priority priority);
+		
+	private:
+		// Not const: replaced by selectTransport()
+		LocalSocketPrivate		*	d_ptr;
 };
 
 #endif // LOCALSOCKET_H
@@ -19,27 +19,72 @@
 #include "localsocketprivate.h"
 
 #include <QThread>
+#include <climits>
+#include <utility>
+#include <unistd.h>
+
+#include "flushscheduler.h"
 
 #define HEADER_SIZE (sizeof(quint8) + sizeof(quint32) + sizeof(quint32))
 
+// Default cork settings
+#define CORK_THRESHOLD	16384		// 16k
+#define CORK_DEADLINE		50			// 50 µs
+
+// Set in the type byte of the header for high priority packages
+#define PRIORITY_FLAG		0x80
+// High priority packages written in a row before a waiting normal package is written
+#define PRIORITY_WEIGHT	4
+
+// Packages larger than this are written in fragments
+#define FRAGMENT_SIZE		16384		// 16k
+// Header type of a fragment (optional id: package id, size: fragment size)
+#define FRAGMENT_TYPE		0x7F
+// Additional header of the first fragment: [quint8 type][quint32 optional id][quint64 package size]
+#define FRAGMENT_HEADER_SIZE (sizeof(quint8) + sizeof(quint32) + sizeof(quint64))
+// Largest package written and accepted in fragments (larger ones are written in one piece)
+#define MAX_FRAGMENTED_SIZE	(256 * 1024 * 1024)		// 256M
+// A peer writes at most one package per lane in fragments at a time
+#define MAX_INCOMING_FRAGMENTS	PRIORITY_LANES
+
 LocalSocketPrivate::LocalSocketPrivate(LocalSocket * q)
 	:	QObject(), m_q(q), m_readNotifier(0), m_writeNotifier(0), m_exceptionNotifier(0),
-	m_currentlyWritingFileDescriptor(0), m_currentWriteDataPos(0), m_socketDescriptor(0),
-	m_currentRequiredReadDataSize(0), m_isOpen(false)
+	m_currentlyWritingFileDescriptor(0), m_currentlyWritingDescriptorVar(0), m_highPriorityRun(0), m_nextFragmentId(0), m_currentWriteDataPos(0), m_socketDescriptor(0),
+	m_currentRequiredReadDataSize(0), m_isOpen(false), m_writeBufferSize(0),
+	m_corked(false), m_corkThreshold(CORK_THRESHOLD), m_corkDeadline(CORK_DEADLINE), m_corkFlushScheduled(false),
+	m_highWaterBytes(0), m_highWaterMessages(0), m_lowWaterBytes(0), m_lowWaterMessages(0), m_writeBlocked(false),
+	m_fragmentsEnabled(false), m_readBufferLimit(0), m_readPaused(false)
 {
+	for(int i = 0; i < PRIORITY_LANES; i++)
+	{
+		m_outgoingFragments[i].active	=	false;
+		m_outgoingFragments[i].id			=	0;
+		m_outgoingFragments[i].pos		=	0;
+	}
 }
 
 
 LocalSocketPrivate::~LocalSocketPrivate()
 {
+	// Don't get called by the flush scheduler anymore (never started for sockets that did not cork)
+	bool	flushScheduled;
+	{
+		QReadLocker	writeLocker(&m_writeBufferLock);
+		flushScheduled	=	m_corkFlushScheduled;
+	}
+	if(flushScheduled)
+		FlushScheduler::cancelIfRunning(this);
+	
 	removeReadNotifier();
 	removeWriteNotifier();
 	
 	if(m_currentlyWritingFileDescriptor)
 		delete m_currentlyWritingFileDescriptor;
+	delete m_currentlyWritingDescriptorVar;
 	
 	QWriteLocker		readBufferLock(&m_readBufferLock);
-	m_readBuffer.clear();
+	for(int i = 0; i < PRIORITY_LANES; i++)
+		m_readBuffer[i].clear();
 }
 
 
@@ -60,7 +105,7 @@ bool LocalSocketPrivate::waitForReadyRead(QElapsedTimer& timer, int timeout)
 		controlLock.unlock();
     QReadLocker   readLocker(&m_readBufferLock);
     // We need to read
-    readyRead		=	m_readBuffer.isEmpty();
+    readyRead		=	(readBufferCount() == 0);
 		readLocker.unlock();
     
     if(!readyRead)
@@ -68,7 +113,7 @@ bool LocalSocketPrivate::waitForReadyRead(QElapsedTimer& timer, int timeout)
     
     QReadLocker   writeLocker(&m_writeBufferLock);
     // Do we need to write?
-    readyWrite  = (!m_currentWriteData.isEmpty() || !m_writeBuffer.isEmpty());
+    readyWrite  = (!m_currentWriteData.isEmpty() || hasQueuedPackages());
     writeLocker.unlock();
 		
 		bool	ret	=	waitForReadOrWrite(readyRead, readyWrite, (timeout > 0 ? timeout - timer.elapsed() : 0));
@@ -187,7 +232,7 @@ void LocalSocketPrivate::flush()
 	QReadLocker		readLocker(&m_writeBufferLock);
 	QReadLocker		controlLock(&m_controlLock);
 	
-	while(m_isOpen && !m_writeBuffer.isEmpty() && !m_currentReadData.isEmpty())
+	while(m_isOpen && (hasQueuedPackages() || !m_currentWriteData.isEmpty()))
 	{
 		controlLock.unlock();
 		readLocker.unlock();
@@ -201,6 +246,242 @@ void LocalSocketPrivate::flush()
 }
 
 
+void LocalSocketPrivate::scheduleCorkFlush()
+{
+	QWriteLocker	writeLocker(&m_writeBufferLock);
+	
+	if(m_corkFlushScheduled)
+		return;
+	
+	m_corkFlushScheduled	=	true;
+	const int	deadline	=	m_corkDeadline;
+	writeLocker.unlock();
+	
+	FlushScheduler::instance()->schedule(this, "corkTimeout", deadline);
+}
+
+
+qint64 LocalSocketPrivate::packageSize(const Variant& data)
+{
+	// File descriptors are transferred without data
+	if(data.type() == Variant::SocketDescriptor)
+		return HEADER_SIZE;
+	
+	return HEADER_SIZE + data.size();
+}
+
+
+qint64 LocalSocketPrivate::queuedBytes() const
+{
+	return m_writeBufferSize + (m_currentWriteData.size() - m_currentWriteDataPos);
+}
+
+
+bool LocalSocketPrivate::isAboveHighWaterMark() const
+{
+	return ((m_highWaterBytes > 0 && queuedBytes() >= m_highWaterBytes) ||
+					(m_highWaterMessages > 0 && queuedPackages() >= m_highWaterMessages));
+}
+
+
+bool LocalSocketPrivate::isBelowLowWaterMark() const
+{
+	return ((m_highWaterBytes <= 0 || queuedBytes() <= m_lowWaterBytes) &&
+					(m_highWaterMessages <= 0 || queuedPackages() <= m_lowWaterMessages));
+}
+
+
+int LocalSocketPrivate::queuedPackages() const
+{
+	int	count	=	0;
+	for(int i = 0; i < PRIORITY_LANES; i++)
+	{
+		count	+=	m_writeBuffer[i].count();
+		
+		if(m_outgoingFragments[i].active)
+			count++;
+	}
+	
+	return count;
+}
+
+
+bool LocalSocketPrivate::hasQueuedPackages() const
+{
+	for(int i = 0; i < PRIORITY_LANES; i++)
+	{
+		if(!m_writeBuffer[i].isEmpty() || m_outgoingFragments[i].active)
+			return true;
+	}
+	
+	return false;
+}
+
+
+int LocalSocketPrivate::readBufferCount() const
+{
+	int	count	=	0;
+	for(int i = 0; i < PRIORITY_LANES; i++)
+		count	+=	m_readBuffer[i].count();
+	
+	return count;
+}
+
+
+/*
+ * Handover state (List):
+ * 
+ * Pos Type       Data
+ * -------------------------
+ * 0   ByteArray  Partially read package (m_currentReadData)
+ * 1   List       Large packages being reassembled: List of [id, type, optional id, size, data]
+ * 2   List       Read packages: List of [lane, type, optional id, data]
+ */
+Variant LocalSocketPrivate::detach(Variant* state, int timeout)
+{
+	QElapsedTimer	timer;
+	timer.start();
+	
+	// Write pending data, the other process cannot continue a partially written package
+	forever
+	{
+		{
+			QReadLocker		writeLocker(&m_writeBufferLock);
+			if(!hasQueuedPackages() && m_currentWriteData.isEmpty())
+				break;
+		}
+		
+		if(timer.elapsed() >= timeout || !m_q->isOpen())
+		{
+			setError(tr("Pending data could not be written before detaching"));
+			return Variant();
+		}
+		
+		waitForDataWritten(timer, timeout);
+	}
+	
+	// Stop reading, the rest stays in the kernel for the other process
+	removeReadNotifier();
+	
+	QWriteLocker		readLocker(&m_readBufferLock);
+	
+	// Received file descriptors cannot be part of the state
+	bool	hasDescriptors	=	(!m_tempReadBuffer.isEmpty() || !m_tempReadFileDescBuffer.isEmpty());
+	for(int i = 0; i < PRIORITY_LANES; i++)
+	{
+		foreach(const Variant& package, m_readBuffer[i])
+			hasDescriptors	|=	(package.type() == Variant::SocketDescriptor);
+	}
+	
+	if(hasDescriptors)
+	{
+		readLocker.unlock();
+		enableReadNotifier();
+		
+		setError(tr("Received file descriptors have to be read before detaching"));
+		return Variant();
+	}
+	
+	QList<Variant>	fragments;
+	for(QHash<quint32, IncomingFragments>::const_iterator it = m_incomingFragments.constBegin(); it != m_incomingFragments.constEnd(); ++it)
+	{
+		fragments.append(Variant(QList<Variant>() << Variant(it.key()) << Variant(it->type) << Variant(it->optionalId)
+																							<< Variant(it->size) << Variant(it->data)));
+	}
+	
+	QList<Variant>	packages;
+	for(int i = 0; i < PRIORITY_LANES; i++)
+	{
+		foreach(const Variant& package, m_readBuffer[i])
+		{
+			packages.append(Variant(QList<Variant>() << Variant(quint8(i)) << Variant(quint8(package.type())) << Variant(package.optionalId())
+																								<< Variant(package.toByteArray())));
+		}
+		
+		m_readBuffer[i].clear();
+	}
+	
+	if(state)
+		*state	=	Variant(QList<Variant>() << Variant(m_currentReadData) << Variant(fragments) << Variant(packages));
+	
+	m_incomingFragments.clear();
+	m_currentReadData.clear();
+	m_currentRequiredReadDataSize	=	0;
+	readLocker.unlock();
+	
+	// Closing our descriptor keeps the connection open through the duplicate
+	Variant	socketDescriptor(Variant::fromSocketDescriptor(::dup(int(m_socketDescriptor)), true));
+	close();
+	
+	return socketDescriptor;
+}
+
+
+bool LocalSocketPrivate::attach(const Variant& socketDescriptor, const Variant& state)
+{
+	bool	ok	=	false;
+	int		fd	=	socketDescriptor.toSocketDescriptor(&ok);
+	
+	if(!ok || fd <= 0)
+		return false;
+	
+	QList<Variant>	values(state.toList());
+	bool						buffered	=	false;
+	
+	{
+		QWriteLocker		readLocker(&m_readBufferLock);
+		
+		m_currentReadData								=	values.value(0).toByteArray();
+		m_currentRequiredReadDataSize		=	0;
+		
+		foreach(const Variant& fragment, values.value(1).toList())
+		{
+			QList<Variant>			fields(fragment.toList());
+			IncomingFragments		fragments;
+			fragments.type				=	fields.value(1).toUInt8();
+			fragments.optionalId	=	fields.value(2).toUInt32();
+			fragments.size				=	fields.value(3).toInt64();
+			fragments.data				=	fields.value(4).toByteArray();
+			
+			m_incomingFragments.insert(fields.value(0).toUInt32(), fragments);
+		}
+		
+		foreach(const Variant& package, values.value(2).toList())
+		{
+			QList<Variant>	fields(package.toList());
+			const int				lane	=	qBound(0, int(fields.value(0).toUInt8()), PRIORITY_LANES - 1);
+			
+			m_readBuffer[lane].append(Variant(fields.value(3).toByteArray(), Variant::Type(fields.value(1).toUInt8()), fields.value(2).toUInt32()));
+		}
+		
+		buffered	=	(readBufferCount() > 0);
+	}
+	
+	// Continues reading after the restored data
+	if(!setSocketDescriptor(quintptr(fd)))
+		return false;
+	
+	if(buffered)
+		QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
+	
+	return true;
+}
+
+
+void LocalSocketPrivate::copySettings(const LocalSocketPrivate* other)
+{
+	m_corked							=	other->m_corked;
+	m_corkThreshold				=	other->m_corkThreshold;
+	m_corkDeadline				=	other->m_corkDeadline;
+	m_highWaterBytes			=	other->m_highWaterBytes;
+	m_highWaterMessages		=	other->m_highWaterMessages;
+	m_lowWaterBytes				=	other->m_lowWaterBytes;
+	m_lowWaterMessages		=	other->m_lowWaterMessages;
+	m_fragmentsEnabled		=	other->m_fragmentsEnabled;
+	m_readBufferLimit			=	other->m_readBufferLimit;
+}
+
+
 void LocalSocketPrivate::enableReadNotifier()
 {
 	QReadLocker		controlLock(&m_controlLock);
@@ -368,13 +649,26 @@ void LocalSocketPrivate::setClosed()
 	if(m_currentlyWritingFileDescriptor)
 		delete m_currentlyWritingFileDescriptor;
 	m_currentlyWritingFileDescriptor	=	0;
+	delete m_currentlyWritingDescriptorVar;
+	m_currentlyWritingDescriptorVar		=	0;
 	m_currentWriteData.clear();
 	m_currentWriteDataPos	=	0;
-	m_writeBuffer.clear();
+	for(int i = 0; i < PRIORITY_LANES; i++)
+	{
+		m_writeBuffer[i].clear();
+		m_outgoingFragments[i].active	=	false;
+		m_outgoingFragments[i].data		=	Variant();
+	}
+	m_writeBufferSize	=	0;
+	m_highPriorityRun	=	0;
+	m_writeBlocked	=	false;
+	// Negotiated again with the next peer
+	m_fragmentsEnabled	=	false;
   writeLocker.unlock();
 	
 	// Clear temporary read data
 	m_currentReadData.clear();
+	m_incomingFragments.clear();
 	m_tempReadBuffer.clear();
 	m_tempReadFileDescBuffer.clear();
 	
@@ -410,7 +704,7 @@ void LocalSocketPrivate::addReadFileDescriptor(quintptr fileDescriptor)
  * 
  * Pos Type     Data
  * -------------------------
- * 0   quint8   Type
+ * 0   quint8   Type (| PRIORITY_FLAG for high priority packages)
  * 1   quint32  Optional id
  * 5   quint32  Data size
  * -------------------------
@@ -420,6 +714,20 @@ void LocalSocketPrivate::readData()
 {
 // 	qDebug("[%p] LocalSocketPrivate::readData()", this);
 	
+	// Don't read more data while the read buffer is full
+	{
+		QWriteLocker	readLocker(&m_readBufferLock);
+		
+		if(m_readBufferLimit > 0 && readBufferCount() >= m_readBufferLimit)
+		{
+			m_readPaused	=	true;
+			readLocker.unlock();
+			
+			disableReadNotifier();
+			return;
+		}
+	}
+	
 	// Try to read data
 	disableReadNotifier();
   // Reset data size
@@ -481,6 +789,9 @@ void LocalSocketPrivate::readData()
 			// Type
 			memcpy((char*)&readVarType, m_currentReadData.constData() + dataPos, sizeof(readVarType));
 			dataPos	+=	sizeof(readVarType);
+			// Lane
+			LocalSocket::Priority	priority	=	((readVarType & PRIORITY_FLAG) ? LocalSocket::HighPriority : LocalSocket::NormalPriority);
+			readVarType	&=	~PRIORITY_FLAG;
 			// Optional id
 			memcpy((char*)&readVarOptId, m_currentReadData.constData() + dataPos, sizeof(readVarOptId));
 			dataPos	+=	sizeof(readVarOptId);
@@ -488,13 +799,30 @@ void LocalSocketPrivate::readData()
 			memcpy((char*)&readVarDataSize, m_currentReadData.constData() + dataPos, sizeof(readVarDataSize));
 			dataPos	+=	sizeof(readVarDataSize);
 			
+			// Fragment of a large package
+			if(readVarType == FRAGMENT_TYPE)
+			{
+				QByteArray	fragment(m_currentReadData.mid(dataPos, readVarDataSize));
+				
+				m_currentReadData.remove(0, dataPos + readVarDataSize);
+				m_currentRequiredReadDataSize	=	0;
+				
+				if(!readFragment(readVarOptId, fragment, priority))
+				{
+					setError(tr("Received an invalid fragment"));
+					return;
+				}
+				
+				continue;
+			}
+			
 			Variant		readVar((Variant::Type)readVarType);
 			readVar.setOptionalId(readVarOptId);
 			
 			// Set data
 			if(readVarDataSize)
 			{
-				readVar.setValue(m_currentReadData.mid(dataPos, readVarDataSize));
+				readVar.setRawData(m_currentReadData.constData() + dataPos, readVarDataSize);
 				dataPos	+=	readVarDataSize;
 			}
 			
@@ -504,16 +832,9 @@ void LocalSocketPrivate::readData()
 			
 			// Append to temporary read buffer if necessary
 			if(readVar.type() == Variant::SocketDescriptor || !m_tempReadBuffer.isEmpty())
-				m_tempReadBuffer.append(readVar);
+				m_tempReadBuffer.append(qMakePair(readVar, priority));
 			else
-			{
-				{
-					QWriteLocker	writeLock(&m_readBufferLock);
-					m_readBuffer.append(readVar);
-				}
-				// We have read a package
-				emit(readyRead());
-			}
+				appendReadPackage(std::move(readVar), priority);
 		}
 	}
 	
@@ -527,17 +848,6 @@ void LocalSocketPrivate::readData()
 }
 
 
-/*
- * Header format:
- * 
- * Pos Type     Data
- * -------------------------
- * 0   quint8   Type
- * 1   quint32  Optional id
- * 5   quint32  Data size
- * -------------------------
- * Total size: 9 bytes
- */
 void LocalSocketPrivate::writeData()
 {
 // 	qDebug("[%p] LocalSocketPrivate::writeData()", this);
@@ -545,55 +855,67 @@ void LocalSocketPrivate::writeData()
 	// Move new data into the buffer
 	if(m_currentWriteData.isEmpty())
 	{
-		if(m_writeBuffer.isEmpty())
+		QWriteLocker	writeLocker(&m_writeBufferLock);
+		
+		if(!hasQueuedPackages())
 		{
+			writeLocker.unlock();
 			// Nothing to write so we don't need the notifier
 			disableWriteNotifier();
 // 			qDebug("[%p] LocalSocketPrivate::~writeData()", this);
 			return;
 		}
 		
-		QReadLocker   readLocker(&m_writeBufferLock);
-		Variant			writeVar(m_writeBuffer.takeFirst());
-    readLocker.unlock();
-    
-		QByteArray	writeVarData(writeVar.toByteArray());
-		quint8			writeVarType			=	quint8(writeVar.type());
-		quint32			writeVarOptId			=	writeVar.optionalId();
-		quint32			writeVarDataSize	=	writeVarData.size();
-		
-// 		static	int	_w_count	=	0;
-// 		_w_count++;
-// 		qDebug("[%p] LocalSocketPrivate::writeData() - count: %d", this, _w_count);
-		
-		// File descriptors don't need the writeVars data as it is transferred via m_currentlyWritingFileDescriptor
-		if(writeVar.type() == Variant::SocketDescriptor)
-			writeVarDataSize	=	0;
-		
-		// Data to be written (including metadata)
-		QByteArray	data;
-		int					dataPos	=	0;
-		
-		data.resize(HEADER_SIZE);
-		// Set metadata
-		// type
-		memcpy(data.data() + dataPos, (const char*)&writeVarType, sizeof(writeVarType));
-		dataPos	+=	sizeof(writeVarType);
-		// optional id
-		memcpy(data.data() + dataPos, (const char*)&writeVarOptId, sizeof(writeVarOptId));
-		dataPos	+=	sizeof(writeVarOptId);
-		// data size
-		memcpy(data.data() + dataPos, (const char*)&writeVarDataSize, sizeof(writeVarDataSize));
-		dataPos	+=	sizeof(writeVarDataSize);
-		
-		// File descriptors don't need the writeVars data as it is transferred via m_currentlyWritingFileDescriptor
-		if(writeVar.type() == Variant::SocketDescriptor)
+		// Coalesce as many packages as fit into one write() call
+		const int	batchSize	=	availableWriteBufferSpace();
+		
+		while(hasQueuedPackages() && (m_currentWriteData.isEmpty() || m_currentWriteData.size() < batchSize))
 		{
-			m_currentWriteData	=	data;
-			m_currentlyWritingFileDescriptor	=	new quintptr(writeVar.toSocketDescriptor());
+			const LocalSocket::Priority	lane	=	nextWriteLane();
+			
+			// Continue a large package (nothing else of this lane may be written in between)
+			if(m_outgoingFragments[lane].active)
+			{
+				appendFragment(m_currentWriteData, lane);
+				continue;
+			}
+			
+			// A file descriptor is sent along with the first byte of a write() call, so it has to start a new batch
+			if(m_writeBuffer[lane].first().type() == Variant::SocketDescriptor && !m_currentWriteData.isEmpty())
+				break;
+			
+			Variant			writeVar(std::move(m_writeBuffer[lane].first()));
+			m_writeBuffer[lane].removeFirst();
+			
+			// Large packages are written in fragments (if the peer can read them), so packages of other lanes can overtake them
+			if(m_fragmentsEnabled && writeVar.type() != Variant::SocketDescriptor && writeVar.size() > FRAGMENT_SIZE && writeVar.size() <= MAX_FRAGMENTED_SIZE)
+			{
+				OutgoingFragments&	fragments	=	m_outgoingFragments[lane];
+				fragments.active	=	true;
+				fragments.data		=	writeVar;
+				fragments.id			=	m_nextFragmentId++;
+				fragments.pos			=	0;
+				
+				m_writeBufferSize	-=	HEADER_SIZE;
+				appendFragment(m_currentWriteData, lane);
+				continue;
+			}
+			
+			m_writeBufferSize	-=	packageSize(writeVar);
+			
+// 			static	int	_w_count	=	0;
+// 			_w_count++;
+// 			qDebug("[%p] LocalSocketPrivate::writeData() - count: %d", this, _w_count);
+			
+			appendPackage(m_currentWriteData, writeVar, lane);
+			
+			// File descriptors don't need the writeVars data as it is transferred via m_currentlyWritingFileDescriptor
+			if(writeVar.type() == Variant::SocketDescriptor)
+			{
+				m_currentlyWritingDescriptorVar		=	new Variant(writeVar);
+				m_currentlyWritingFileDescriptor	=	new quintptr(m_currentlyWritingDescriptorVar->toSocketDescriptor());
+			}
 		}
-		else
-			m_currentWriteData	=	data + writeVarData;
 	}
 	
 	// Get size of data to write
@@ -617,25 +939,45 @@ void LocalSocketPrivate::writeData()
 		
 		m_currentWriteDataPos	+=	written;
 		
-		// Clear finished data
-		if(m_currentWriteDataPos >= m_currentWriteData.size())
+		// The file descriptor has been sent with the written data
+		if(m_currentlyWritingFileDescriptor)
 		{
-			m_currentWriteData.clear();
-			m_currentWriteDataPos	=	0;
-			if(m_currentlyWritingFileDescriptor)
+			delete m_currentlyWritingFileDescriptor;
+			m_currentlyWritingFileDescriptor	=	0;
+			delete m_currentlyWritingDescriptorVar;
+			m_currentlyWritingDescriptorVar		=	0;
+		}
+		
+		bool	becameWritable	=	false;
+		
+		{
+			QWriteLocker	writeLocker(&m_writeBufferLock);
+			
+			// Clear finished data
+			if(m_currentWriteDataPos >= m_currentWriteData.size())
 			{
-				delete m_currentlyWritingFileDescriptor;
-				m_currentlyWritingFileDescriptor	=	0;
+				m_currentWriteData.clear();
+				m_currentWriteDataPos	=	0;
+			}
+			
+			// Accept new data again if enough has been written
+			if(m_writeBlocked && isBelowLowWaterMark())
+			{
+				m_writeBlocked	=	false;
+				becameWritable	=	true;
 			}
 		}
 		
 		// Tell LocalSocket that we have finished writing
 		emit(bytesWritten());
+		
+		if(becameWritable)
+			emit(writable());
 	}
 
 	// Only enable notifier if we have data to write
 	QReadLocker   readLocker(&m_writeBufferLock);
-	if(!m_currentWriteData.isEmpty() || !m_writeBuffer.isEmpty())
+	if(!m_currentWriteData.isEmpty() || hasQueuedPackages())
 		enableWriteNotifier();
   readLocker.unlock();
 	
@@ -643,6 +985,199 @@ void LocalSocketPrivate::writeData()
 }
 
 
+LocalSocket::Priority LocalSocketPrivate::nextWriteLane()
+{
+	const bool	highWaiting		=	!m_writeBuffer[LocalSocket::HighPriority].isEmpty();
+	const bool	normalWaiting	=	!m_writeBuffer[LocalSocket::NormalPriority].isEmpty();
+	
+	// Weighted: A steady stream of high priority packages doesn't starve the normal lane
+	if(highWaiting && (!normalWaiting || m_highPriorityRun < PRIORITY_WEIGHT))
+	{
+		if(normalWaiting)
+			m_highPriorityRun++;
+		
+		return LocalSocket::HighPriority;
+	}
+	
+	m_highPriorityRun	=	0;
+	return LocalSocket::NormalPriority;
+}
+
+
+/*
+ * Header format:
+ * 
+ * Pos Type     Data
+ * -------------------------
+ * 0   quint8   Type (| PRIORITY_FLAG for high priority packages)
+ * 1   quint32  Optional id
+ * 5   quint32  Data size
+ * -------------------------
+ * Total size: 9 bytes
+ */
+void LocalSocketPrivate::appendPackage(QByteArray& target, const Variant& data, LocalSocket::Priority priority)
+{
+	quint8			writeVarType			=	quint8(data.type());
+	quint32			writeVarOptId			=	data.optionalId();
+	quint32			writeVarDataSize	=	data.size();
+	
+	// File descriptors don't need the writeVars data as it is transferred via m_currentlyWritingFileDescriptor
+	if(data.type() == Variant::SocketDescriptor)
+		writeVarDataSize	=	0;
+	
+	if(priority == LocalSocket::HighPriority)
+		writeVarType	|=	PRIORITY_FLAG;
+	
+	appendHeader(target, writeVarType, writeVarOptId, writeVarDataSize);
+	
+	if(writeVarDataSize)
+		target.append(data.constData(), writeVarDataSize);
+}
+
+
+void LocalSocketPrivate::appendHeader(QByteArray& target, quint8 type, quint32 optionalId, quint32 size)
+{
+	int	dataPos	=	target.size();
+	target.resize(dataPos + HEADER_SIZE);
+	
+	// Set metadata
+	// type
+	memcpy(target.data() + dataPos, (const char*)&type, sizeof(type));
+	dataPos	+=	sizeof(type);
+	// optional id
+	memcpy(target.data() + dataPos, (const char*)&optionalId, sizeof(optionalId));
+	dataPos	+=	sizeof(optionalId);
+	// data size
+	memcpy(target.data() + dataPos, (const char*)&size, sizeof(size));
+	dataPos	+=	sizeof(size);
+}
+
+
+/*
+ * Fragment format:
+ * 
+ * Header: Type FRAGMENT_TYPE, optional id: package id, data size: size of the fragment
+ * 
+ * First fragment:
+ * Pos Type     Data
+ * -------------------------
+ * 0   quint8   Type of the package
+ * 1   quint32  Optional id of the package
+ * 5   quint64  Data size of the package
+ * 13  ...      Data
+ * 
+ * Following fragments only contain data
+ */
+void LocalSocketPrivate::appendFragment(QByteArray& target, LocalSocket::Priority lane)
+{
+	OutgoingFragments&	fragments	=	m_outgoingFragments[lane];
+	const QByteArray		data(fragments.data.toByteArray());
+	const int						length	=	qMin(FRAGMENT_SIZE, data.size() - fragments.pos);
+	
+	quint8		type	=	FRAGMENT_TYPE;
+	if(lane == LocalSocket::HighPriority)
+		type	|=	PRIORITY_FLAG;
+	
+	if(fragments.pos == 0)
+	{
+		quint8		packageType				=	quint8(fragments.data.type());
+		quint32		packageOptId			=	fragments.data.optionalId();
+		quint64		packageDataSize		=	data.size();
+		
+		appendHeader(target, type, fragments.id, FRAGMENT_HEADER_SIZE + length);
+		target.append((const char*)&packageType, sizeof(packageType));
+		target.append((const char*)&packageOptId, sizeof(packageOptId));
+		target.append((const char*)&packageDataSize, sizeof(packageDataSize));
+	}
+	else
+		appendHeader(target, type, fragments.id, length);
+	
+	target.append(data.constData() + fragments.pos, length);
+	fragments.pos			+=	length;
+	m_writeBufferSize	-=	length;
+	
+	// Last fragment written
+	if(fragments.pos >= data.size())
+	{
+		fragments.active	=	false;
+		fragments.data		=	Variant();
+	}
+}
+
+
+bool LocalSocketPrivate::readFragment(quint32 id, const QByteArray& data, LocalSocket::Priority priority)
+{
+	QHash<quint32, IncomingFragments>::iterator	it	=	m_incomingFragments.find(id);
+	
+	// First fragment
+	if(it == m_incomingFragments.end())
+	{
+		if(data.size() < int(FRAGMENT_HEADER_SIZE))
+			return false;
+		
+		IncomingFragments	fragments;
+		quint64						size;
+		int								dataPos	=	0;
+		
+		memcpy((char*)&fragments.type, data.constData() + dataPos, sizeof(fragments.type));
+		dataPos	+=	sizeof(fragments.type);
+		memcpy((char*)&fragments.optionalId, data.constData() + dataPos, sizeof(fragments.optionalId));
+		dataPos	+=	sizeof(fragments.optionalId);
+		memcpy((char*)&size, data.constData() + dataPos, sizeof(size));
+		dataPos	+=	sizeof(size);
+		
+		// Don't let the peer make us allocate unlimited memory (the data grows with the fragments received)
+		if(size > quint64(MAX_FRAGMENTED_SIZE) || m_incomingFragments.count() >= MAX_INCOMING_FRAGMENTS)
+			return false;
+		
+		if(qint64(data.size() - dataPos) > qint64(size))
+			return false;
+		
+		fragments.size	=	qint64(size);
+		fragments.data.append(data.constData() + dataPos, data.size() - dataPos);
+		
+		it	=	m_incomingFragments.insert(id, fragments);
+	}
+	else
+	{
+		if(it->data.size() + qint64(data.size()) > it->size)
+			return false;
+		
+		it->data.append(data);
+	}
+	
+	if(it->data.size() < it->size)
+		return true;
+	
+	// Package complete
+	Variant		readVar((Variant::Type)it->type);
+	readVar.setOptionalId(it->optionalId);
+	readVar.setValue(std::move(it->data));
+	
+	m_incomingFragments.erase(it);
+	
+	if(!m_tempReadBuffer.isEmpty())
+		m_tempReadBuffer.append(qMakePair(readVar, priority));
+	else
+		appendReadPackage(std::move(readVar), priority);
+	
+	return true;
+}
+
+
+void LocalSocketPrivate::appendReadPackage(Variant&& data, LocalSocket::Priority priority)
+{
+	{
+		QWriteLocker	writeLock(&m_readBufferLock);
+		m_readBuffer[priority].append(Variant());
+		m_readBuffer[priority].last()	=	std::move(data);
+	}
+	
+	// We have read a package
+	emit(readyRead());
+}
+
+
 void LocalSocketPrivate::exception()
 {
 // 	qDebug("[%p] LocalSocketPrivate::exception()", this);
@@ -652,6 +1187,24 @@ void LocalSocketPrivate::exception()
 }
 
 
+void LocalSocketPrivate::corkTimeout()
+{
+	{
+		QWriteLocker	writeLocker(&m_writeBufferLock);
+		m_corkFlushScheduled	=	false;
+	}
+	
+	writeData();
+}
+
+
+void LocalSocketPrivate::resumeReading()
+{
+	enableReadNotifier();
+	readData();
+}
+
+
 void LocalSocketPrivate::checkTempReadData(bool required)
 {
 // 	qDebug("[%p] LocalSocketPrivate::checkTempReadData()", this);
@@ -660,25 +1213,19 @@ void LocalSocketPrivate::checkTempReadData(bool required)
 	{
 // 		qDebug("[%p] LocalSocketPrivate::checkTempReadData() - checking", this);
 		
-		if(m_tempReadBuffer.first().type() == Variant::SocketDescriptor)
+		if(m_tempReadBuffer.first().first.type() == Variant::SocketDescriptor)
 		{
 			if(m_tempReadFileDescBuffer.isEmpty() && !required)
 				break;
 		}
 		
-		Variant	src(m_tempReadBuffer.takeFirst());
+		QPair<Variant, LocalSocket::Priority>	src(m_tempReadBuffer.takeFirst());
 		
 		// Pop up normal data
-		if(src.type() != Variant::SocketDescriptor)
-		{
-			QWriteLocker	writeLock(&m_readBufferLock);
-			
-			m_readBuffer.append(src);
-		}
+		if(src.first.type() != Variant::SocketDescriptor)
+			appendReadPackage(std::move(src.first), src.second);
 		else
 		{
-			QWriteLocker	writeLock(&m_readBufferLock);
-			
 			quintptr	fileDescriptor	=	0;
 			
 			if(!m_tempReadFileDescBuffer.isEmpty())
@@ -688,10 +1235,8 @@ void LocalSocketPrivate::checkTempReadData(bool required)
 			
 			Variant	package(Variant::fromSocketDescriptor(fileDescriptor));
 			
-			package.setOptionalId(src.optionalId());
-			m_readBuffer.append(package);
+			package.setOptionalId(src.first.optionalId());
+			appendReadPackage(std::move(package), src.second);
 		}
-		
-		emit(readyRead());
 	}
 }
@@ -26,6 +26,11 @@
 #include <QElapsedTimer>
 #include <QSocketNotifier>
 #include <QReadWriteLock>
+#include <QPair>
+#include <QHash>
+
+// Number of write and read lanes (see LocalSocket::Priority)
+#define PRIORITY_LANES	2
 
 class LocalSocketPrivate : public QObject
 {
@@ -46,6 +51,36 @@ class LocalSocketPrivate : public QObject
 		
 		void flush();
 		
+		// Arm the cork deadline if not already done
+		void scheduleCorkFlush();
+		
+		// Number of bytes a package occupies on the wire (including header)
+		static qint64 packageSize(const Variant& data);
+		
+		// Bytes waiting to be written (m_writeBufferLock must be locked)
+		qint64 queuedBytes() const;
+		
+		// Check the water marks (m_writeBufferLock must be locked)
+		bool isAboveHighWaterMark() const;
+		
+		bool isBelowLowWaterMark() const;
+		
+		// Packages in all lanes of the write buffer (m_writeBufferLock must be locked)
+		int queuedPackages() const;
+		
+		bool hasQueuedPackages() const;
+		
+		// Packages in all lanes of the read buffer (m_readBufferLock must be locked)
+		int readBufferCount() const;
+		
+		// Hand the connection over (see LocalSocket::detach() and LocalSocket::attach())
+		Variant detach(Variant * state, int timeout);
+		
+		bool attach(const Variant& socketDescriptor, const Variant& state);
+		
+		// Take over cork mode, water marks and read buffer limit of \a other (before opening)
+		void copySettings(const LocalSocketPrivate * other);
+		
 		/*
 		 * Implementation
 		 */
@@ -55,6 +90,12 @@ class LocalSocketPrivate : public QObject
 		// Set socket descriptor to use for communication
 		virtual bool setSocketDescriptor(quintptr socketDescriptor) = 0;
 		
+		// Whether SocketDescriptor Variants can be written
+		virtual bool canPassFileDescriptors() const
+		{
+			return true;
+		}
+		
 		/*
 		 * Control variables
 		 */
@@ -69,12 +110,30 @@ class LocalSocketPrivate : public QObject
 		/*
 		 * Data variables
 		 */
-		// Output buffer
+		// Output buffer (one per lane)
 		QReadWriteLock		m_writeBufferLock;
-		QList<Variant>		m_writeBuffer;
-		// Input buffer
+		QList<Variant>		m_writeBuffer[PRIORITY_LANES];
+		// Size of m_writeBuffer in bytes
+		qint64						m_writeBufferSize;
+		// Cork mode
+		bool							m_corked;
+		int								m_corkThreshold;
+		int								m_corkDeadline;
+		bool							m_corkFlushScheduled;
+		// Water marks of the write buffer
+		qint64						m_highWaterBytes;
+		int								m_highWaterMessages;
+		qint64						m_lowWaterBytes;
+		int								m_lowWaterMessages;
+		bool							m_writeBlocked;
+		// Peer can read fragments (negotiated by the user of the socket)
+		bool							m_fragmentsEnabled;
+		// Input buffer (one per lane)
 		QReadWriteLock		m_readBufferLock;
-		QList<Variant>		m_readBuffer;
+		QList<Variant>		m_readBuffer[PRIORITY_LANES];
+		// Maximum number of packages in m_readBuffer before reading pauses
+		int								m_readBufferLimit;
+		bool							m_readPaused;
 		// Currently writing data (including Variant type and id)
 		QByteArray				m_currentWriteData;
     
@@ -86,6 +145,8 @@ class LocalSocketPrivate : public QObject
     void disconnected();
     
     void bytesWritten();
+    
+    void writable();
 		
 	protected:
 		void enableReadNotifier();
@@ -151,10 +212,32 @@ class LocalSocketPrivate : public QObject
 		
 		void exception();
 		
+		void corkTimeout();
+		
+		void resumeReading();
+		
 	private:
 		// Check temporary read data and associate received file descritpors to Variants
 		void checkTempReadData(bool required = false);
 		
+		// Lane to take the next package to write from (m_writeBufferLock must be locked)
+		LocalSocket::Priority nextWriteLane();
+		
+		// Append a package header to \a target
+		void appendHeader(QByteArray& target, quint8 type, quint32 optionalId, quint32 size);
+		
+		// Append the header and data of a package to \a target
+		void appendPackage(QByteArray& target, const Variant& data, LocalSocket::Priority priority);
+		
+		// Append the next fragment of the large package written in \a lane to \a target
+		void appendFragment(QByteArray& target, LocalSocket::Priority lane);
+		
+		// Reassemble a large package; returns false on protocol errors
+		bool readFragment(quint32 id, const QByteArray& data, LocalSocket::Priority priority);
+		
+		// Move a completely read package into the read buffer
+		void appendReadPackage(Variant&& data, LocalSocket::Priority priority);
+		
 	private:
 		LocalSocket				*	m_q;
 		
@@ -170,9 +253,33 @@ class LocalSocketPrivate : public QObject
 		int								m_currentWriteDataPos;
 		// File descriptor associated with the data
 		quintptr				*	m_currentlyWritingFileDescriptor;
+		// Keeps a descriptor owned by its Variant open until it has been sent
+		Variant						*	m_currentlyWritingDescriptorVar;
+		// High priority packages written in a row while normal packages are waiting
+		int								m_highPriorityRun;
+		// Large package currently written in fragments (one per lane)
+		struct OutgoingFragments
+		{
+			bool						active;
+			Variant					data;
+			quint32					id;
+			int							pos;
+		};
+		OutgoingFragments	m_outgoingFragments[PRIORITY_LANES];
+		quint32						m_nextFragmentId;
+		
+		// Large packages currently reassembled from fragments (by id)
+		struct IncomingFragments
+		{
+			quint8					type;
+			quint32					optionalId;
+			qint64					size;
+			QByteArray			data;
+		};
+		QHash<quint32, IncomingFragments>	m_incomingFragments;
 		
 		// Temporary input buffer (until file descriptors are set correctly in read data)
-		QList<Variant>		m_tempReadBuffer;
+		QList< QPair<Variant, LocalSocket::Priority> >	m_tempReadBuffer;
 		// Input buffer for file descriptors which are not yet associated to Variants
 		QList<quintptr>		m_tempReadFileDescBuffer;
 		// Currently reading data (whole package)
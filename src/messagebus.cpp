@@ -20,27 +20,108 @@
 
 #include "messagebus_p.h"
 #include "tools.h"
+#include "variantstruct.h"
 
 #include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMetaMethod>
+#include <QThread>
 #include <unistd.h>
+#include <utility>
 
 #define PKG_TYPE_CALL  0x01
 #define PKG_TYPE_PARAM 0x02
 #define PKG_TYPE_END   0x03
 #define PKG_TYPE_END_ACKNOWLEDGED	0x04
 #define PKG_TYPE_ACK   0x05
+#define PKG_TYPE_CREDIT 0x06
+#define PKG_TYPE_CHANNEL_OPEN	0x07
+#define PKG_TYPE_CHANNEL_CLOSE	0x08
+#define PKG_TYPE_OBJECT 0x09
+#define PKG_TYPE_SUBSCRIBE	0x0A
+#define PKG_TYPE_UNSUBSCRIBE	0x0B
+#define PKG_TYPE_PUBLISH	0x0C
+#define PKG_TYPE_SHAPE		0x0D
+
+// The optional id holds the package type (lower 16 bits) and the channel id (upper 16 bits)
+#define PKG_TYPE(optId)		((optId) & 0xFFFF)
+#define PKG_CHANNEL(optId)	((optId) >> 16)
+// Set in the type of Map and List packages using the compact encoding
+#define PKG_COMPACT_FLAG	0x8000
+// Set in the type of Map packages sent as shape id and values (see MapShapes)
+#define PKG_SHAPED_FLAG		0x4000
+
+// Packages the socket buffers before it stops reading (if a receive window is set)
+#define RECEIVE_BUFFER_PACKAGES	256
+
+// Features announced with the first CREDIT package
+#define FEATURE_PRIORITY_LANES	0x01
+#define FEATURE_CHANNELS				0x02
+#define FEATURE_OBJECTS					0x04
+#define FEATURE_TOPICS					0x08
+#define FEATURE_COMPACT_VARIANTS	0x10
+#define FEATURE_METHOD_IDS			0x20
+#define FEATURE_MAP_SHAPES			0x40
+#define FEATURE_FRAGMENTS				0x80
+#define SUPPORTED_FEATURES			(FEATURE_PRIORITY_LANES | FEATURE_CHANNELS | FEATURE_OBJECTS | FEATURE_TOPICS | FEATURE_COMPACT_VARIANTS | FEATURE_METHOD_IDS | FEATURE_MAP_SHAPES | FEATURE_FRAGMENTS)
+
+// Time to wait for the features of the peer when opening a channel
+#define FEATURES_TIMEOUT	5000
+// Time connectToServer() waits for the features, the accepting side announces them right away
+#define FEATURES_CONNECT_TIMEOUT	250
+// Time a thread waits for the shared socket before it checks for its ACK again
+#define ROUTE_TIMEOUT			10
+// Packages of a bus with a full receive window buffered while the channels are read on
+#define MAX_HELD_PACKAGES	1024
 
 
 MessageBus::MessageBus(QObject* callReceiver)
-:	QObject(callReceiver), m_callReceiver(callReceiver), m_server(0), m_peerSocket(0)
+:	QObject(callReceiver), m_callReceiver(callReceiver), m_server(0), m_tcpServer(0), m_peerSocket(0), m_handoverBus(0),
+	m_highWaterBytes(0), m_highWaterMessages(0), m_lowWaterBytes(0), m_lowWaterMessages(0), m_peerFeatures(0),
+	m_root(0), m_channelId(0), m_ownedByRoot(false), m_nextChannelId(1),
+	m_objects(new ObjectTable()), m_topics(new TopicTable()), m_shapes(new MapShapes()),
+	m_publishQueueSize(0), m_publishFlushQueued(false), m_slowSubscriberPolicy(DropOldest), m_maxQueuedBytes(0),
+	m_peerSupportsCredits(false), m_peerFeaturesMissing(false), m_sendFlowControlled(false), m_sendByteLimited(false), m_sendCallCredits(0), m_sendByteCredits(0),
+	m_receiveWindowCalls(0), m_receiveWindowBytes(0), m_grantedCalls(0), m_grantedBytes(0),
+	m_pendingCalls(0), m_pendingBytes(0), m_ungrantedCalls(0), m_ungrantedBytes(0)
 {
-
+	for(int i = LocalSocket::HighPriority; i <= LocalSocket::NormalPriority; i++)
+	{
+		m_receivingCall[i].size			=	0;
+		m_receivingCall[i].objectId	=	0;
+		m_receivingCall[i].methodId	=	0;
+	}
 }
 
 
 MessageBus::~MessageBus()
 {
 // 	qDebug("MessageBus::~MessageBus()");
+	
+	// Don't get messages published anymore
+	m_topics->unsubscribeAll(this);
+	
+	// Don't get packages routed anymore
+	if(m_root)
+		m_root->removeChannel(this);
+	
+	// Channels must not use our socket anymore
+	QWriteLocker		channelLocker(&m_channelLock);
+	QHash<quint16, MessageBus*>	channels(m_channels);
+	m_channels.clear();
+	channelLocker.unlock();
+	
+	foreach(MessageBus * channel, channels)
+	{
+		{
+			QWriteLocker	socketLocker(&channel->m_socketLock);
+			channel->m_root				=	0;
+			channel->m_peerSocket	=	0;
+		}
+		
+		if(channel->m_ownedByRoot)
+			channel->QObject::deleteLater();
+	}
 }
 
 
@@ -60,6 +141,7 @@ bool MessageBus::connectToServer(const QString& filename)
   
   connect(socket, SIGNAL(disconnected()), SLOT(onDisconnected()), Qt::QueuedConnection);
   connect(socket, SIGNAL(readyRead()), SLOT(onNewPackage()), Qt::QueuedConnection);
+	setupSocket(socket);
 	
 	bool	result	=	socket->connectToServer(filename);
 	
@@ -70,13 +152,176 @@ bool MessageBus::connectToServer(const QString& filename)
 		socket->deleteLater();
     m_lastError = socket->lastErrorString();
   }
+	socketLocker.unlock();
+	
+	// Announce flow control and grant the initial window
+	if(result)
+	{
+		sendCredits(m_receiveWindowCalls, m_receiveWindowBytes);
+		
+		// Briefly only: calls don't wait for the features, old peers are recognized by their first ACK
+		QReadLocker		featuresLocker(&m_socketLock);
+		
+		if(m_peerSocket)
+			waitForPeerFeatures(FEATURES_CONNECT_TIMEOUT);
+		featuresLocker.unlock();
+		
+		// Packages read while waiting for the features of the peer
+		callSlotQueued(this, "onNewPackage");
+	}
 	
 	return result;
 }
 
 
+bool MessageBus::setSocketDescriptor(quintptr socketDescriptor)
+{
+	QWriteLocker		socketLocker(&m_socketLock);
+	
+	if(m_peerSocket || m_server || m_tcpServer) {
+    m_lastError = tr("Already connected or listening");
+		return false;
+  }
+	
+	LocalSocket	*	socket	=	new LocalSocket(this);
+// 	socket->setWritePkgBufferSize(10485760 /* 10M */);
+	
+	connect(socket, SIGNAL(disconnected()), SLOT(onDisconnected()), Qt::QueuedConnection);
+	connect(socket, SIGNAL(readyRead()), SLOT(onNewPackage()), Qt::QueuedConnection);
+	setupSocket(socket);
+	
+	if(!socket->setSocketDescriptor(socketDescriptor)) {
+    disconnect(socket, 0, this, 0);
+    m_lastError = socket->lastErrorString();
+		socket->deleteLater();
+		return false;
+  }
+	
+	m_peerSocket	=	socket;
+	// Connecting side uses odd, accepting side even channel ids
+	m_nextChannelId	=	2;
+	socketLocker.unlock();
+	
+	// Announce flow control and grant the initial window
+	sendCredits(m_receiveWindowCalls, m_receiveWindowBytes);
+	
+	return true;
+}
+
+
+bool MessageBus::handOver(const QString& filename, int timeout)
+{
+	if(m_tcpServer) {
+    m_lastError = tr("TCP listeners cannot be handed over");
+		return false;
+  }
+	
+	if(!m_server) {
+    m_lastError = tr("Not listening on a socket");
+		return false;
+  }
+	
+	MessageBus	*	target	=	new MessageBus(0);
+	
+	if(!target->connectToServer(filename)) {
+    m_lastError = target->lastErrorMessage();
+		delete target;
+		return false;
+  }
+	
+	// Hand over the listening socket first, so no new client is lost
+	quintptr	serverDescriptor	=	0;
+	{
+		QWriteLocker		socketLocker(&m_socketLock);
+		serverDescriptor	=	m_server->takeSocketDescriptor();
+	}
+	
+	if(!serverDescriptor || !target->call("adoptServer", Variant::fromSocketDescriptor(int(serverDescriptor), true)))
+	{
+    m_lastError = (serverDescriptor ? target->lastErrorMessage() : tr("Cannot take the listening socket"));
+		
+		// Continue listening ourselves
+		if(serverDescriptor)
+			m_server->listen(quintptr(::dup(int(serverDescriptor))));
+		
+		target->deleteLater();
+		return false;
+	}
+	
+	{
+		QWriteLocker		socketLocker(&m_socketLock);
+		disconnect(m_server, 0, this, 0);
+		m_server->deleteLater();
+		m_server	=	0;
+	}
+	
+	QList< QPointer<MessageBus> >	remaining;
+	
+	foreach(const QPointer<MessageBus>& client, m_clients)
+	{
+		if(!client)
+			continue;
+		
+		Variant		state;
+		Variant		socketDescriptor(client->detachConnection(&state, timeout));
+		
+		if(!socketDescriptor.isValid())
+		{
+			qWarning("MessageBus: Client not handed over: %s", qPrintable(client->lastErrorMessage()));
+			remaining.append(client);
+			continue;
+		}
+		
+		if(!target->call("adoptClient", socketDescriptor, state))
+			qWarning("MessageBus: Handing over client failed: %s", qPrintable(target->lastErrorMessage()));
+	}
+	
+	m_clients	=	remaining;
+	
+	target->disconnectFromServer();
+	target->deleteLater();
+	
+	return true;
+}
+
+
+bool MessageBus::acceptHandover(const QString& filename)
+{
+	if(m_handoverBus) {
+    m_lastError = tr("Already accepting a handover");
+		return false;
+  }
+	
+	// Calls of the other process are delivered to this bus
+	m_handoverBus	=	new MessageBus(this);
+	
+	if(!m_handoverBus->listen(filename)) {
+    m_lastError = m_handoverBus->lastErrorMessage();
+		delete m_handoverBus;
+		m_handoverBus	=	0;
+		return false;
+  }
+	
+	return true;
+}
+
+
 void MessageBus::disconnectFromServer()
 {
+	// Close the channel only
+	if(m_channelId)
+	{
+		Variant	package;
+		package.setOptionalId(PKG_TYPE_CHANNEL_CLOSE);
+		writeHelper(package);
+		
+		if(m_root)
+			m_root->removeChannel(this);
+		
+		onDisconnected();
+		return;
+	}
+	
 	QWriteLocker		socketLocker(&m_socketLock);
 	
 	if(!m_peerSocket)
@@ -90,11 +335,29 @@ bool MessageBus::listen(const QString& filename)
 {
 	QWriteLocker		socketLocker(&m_socketLock);
 	
-	if(m_peerSocket || m_server) {
+	if(m_peerSocket || m_server || m_tcpServer) {
     m_lastError = tr("Already listening on a socket");
 		return false;
   }
 	
+	if(filename.startsWith(QLatin1String(LOCALSOCKET_TCP_SCHEME)))
+	{
+		m_tcpServer	=	new TcpServer(this);
+		connect(m_tcpServer, SIGNAL(newConnection(quintptr)), SLOT(onNewClient(quintptr)));
+		
+		if(!m_tcpServer->listen(filename))
+		{
+			disconnect(m_tcpServer, 0, this, 0);
+			
+      m_lastError = m_tcpServer->errorString();
+			m_tcpServer->deleteLater();
+			m_tcpServer	=	0;
+			return false;
+		}
+		
+		return true;
+	}
+	
 	m_server	=	new LocalServer(this);
   
   connect(m_server, SIGNAL(newConnection(quintptr)), SLOT(onNewClient(quintptr)));
@@ -132,249 +395,1295 @@ QString MessageBus::lastErrorMessage() const
 }
 
 
-void MessageBus::deleteLater()
+void MessageBus::setHighWaterMark(qint64 bytes, int messages)
 {
 	QReadLocker		socketLocker(&m_socketLock);
 	
-	if(m_peerSocket) {
-    disconnect(m_peerSocket, 0, this, 0);
-		m_peerSocket->disconnectFromServer();
-  }
+	m_highWaterBytes		=	bytes;
+	m_highWaterMessages	=	messages;
 	
-	m_tmpReadBuffer.clear();
-	m_receivingCallArgs.clear();
+	if(m_peerSocket)
+		m_peerSocket->setHighWaterMark(bytes, messages);
+}
+
+
+void MessageBus::setLowWaterMark(qint64 bytes, int messages)
+{
+	QReadLocker		socketLocker(&m_socketLock);
 	
-	disconnect(this, 0, 0, 0);
+	m_lowWaterBytes			=	bytes;
+	m_lowWaterMessages	=	messages;
 	
-	QObject::deleteLater();
+	if(m_peerSocket)
+		m_peerSocket->setLowWaterMark(bytes, messages);
+}
+
+
+bool MessageBus::isWritable() const
+{
+	QReadLocker		socketLocker(&m_socketLock);
+	
+	return (m_peerSocket && m_peerSocket->isWritable());
+}
+
+
+qint64 MessageBus::dataToWrite() const
+{
+	QReadLocker		socketLocker(&m_socketLock);
+	
+	return (m_peerSocket ? m_peerSocket->dataToWrite() : 0);
+}
+
+
+void MessageBus::setReceiveWindow(int calls, qint64 bytes)
+{
+	m_receiveWindowCalls	=	qMax(calls, 0);
+	m_receiveWindowBytes	=	(m_receiveWindowCalls > 0 ? qMax(bytes, qint64(0)) : 0);
 }
 
 
-bool MessageBus::call(const QString& slot, const QList< Variant >& paramList)
+MessageBus * MessageBus::openChannel(QObject* callReceiver)
 {
 	QReadLocker		socketLocker(&m_socketLock);
 	
+	if(m_channelId) {
+    m_lastError = tr("Channels can only be opened on a bus owning its socket");
+		return 0;
+  }
+	
 	if(!m_peerSocket) {
     m_lastError = tr("Not connected to a peer");
-		return false;
+		return 0;
   }
 	
-	/*
-	 * Send CALL package
-	 */
-	Variant	package(slot);
-	// Set id
-	package.setOptionalId(PKG_TYPE_CALL);
+	if(!waitForPeerFeatures() || !(m_peerFeatures & FEATURE_CHANNELS)) {
+    m_lastError = tr("Peer does not support channels");
+		return 0;
+  }
 	
-	if(!writeHelper(package))
-		return false;
-    
-// 	static	int	_cw_count	=	0;
-// 	_cw_count++;
-// 	qDebug("CALL package sent: %d - %s", _cw_count, qPrintable(paramList.first().toString()));
+	MessageBus	*	channel	=	new MessageBus(callReceiver);
 	
-	/*
-	 * Send parameters
-	 */
-	foreach(Variant parameter, paramList)
 	{
-		// Set id
-		parameter.setOptionalId(PKG_TYPE_PARAM);
+		QWriteLocker		channelLocker(&m_channelLock);
 		
-		if(!writeHelper(parameter))
-			return false;
-// 		qDebug("PARAM package sent");
+		// Connecting side uses odd, accepting side even ids
+		while(m_nextChannelId == 0 || m_channels.contains(m_nextChannelId))
+			m_nextChannelId	+=	2;
+		
+		attachChannel(channel, m_nextChannelId);
+		m_nextChannelId	+=	2;
 	}
+	socketLocker.unlock();
 	
-	/*
-	 * Send END package
-	 */
-	package	=	Variant();
-	// Set id
-	package.setOptionalId(PKG_TYPE_END);
-  
-//   disconnect(m_peerSocket, SIGNAL(readyRead()), this, 0);
-	
-	if(!writeHelper(package)) {
-//     connect(m_peerSocket, SIGNAL(readyRead()), SLOT(onNewPackage()), Qt::QueuedConnection);
-		return false;
-  }
-// 	m_peerSocket->flush();
-// 	qDebug("END package sent");
+	// Announce the channel and its flow control window
+	Variant	package;
+	package.setOptionalId(PKG_TYPE_CHANNEL_OPEN);
 	
-	/*
-	 * Wait for ACK package
-	 */
+	if(!channel->writeHelper(package) || !channel->sendCredits(m_receiveWindowCalls, m_receiveWindowBytes))
 	{
-		while(m_peerSocket && m_peerSocket->isOpen() && !checkAckPackage())
-			m_peerSocket->waitForReadyRead(1000);
-		
-// 		connect(m_peerSocket, SIGNAL(readyRead()), SLOT(onNewPackage()), Qt::QueuedConnection);
-		callSlotQueued(this, "onNewPackage");
+		m_lastError	=	channel->lastErrorMessage();
+		delete channel;
+		return 0;
 	}
-	//qDebug("Waited for ACK package");
 	
-	// Ack received
-	return m_peerSocket->isOpen();
+	// Packages read while waiting for the features of the peer
+	callSlotQueued(this, "onNewPackage");
+	
+	return channel;
 }
 
 
-bool MessageBus::call(const QString& slot, const Variant& param1, const Variant& param2, const Variant& param3, const Variant& param4, const Variant& param5)
+quint16 MessageBus::channelId() const
 {
-	QList<Variant>	params;
-	
-	if(param1.isValid())
-	{
-		params.append(param1);
-		
-		if(param2.isValid())
-		{
-			params.append(param2);
-			
-			if(param3.isValid())
-			{
-				params.append(param3);
-				
-				if(param4.isValid())
-				{
-					params.append(param4);
-					
-					if(param5.isValid())
-						params.append(param5);
-				}
-			}
-		}
-	}
-	
-	return call(slot, params);
+	return m_channelId;
 }
 
 
-void MessageBus::onNewClient(quintptr socketDescriptor)
+void MessageBus::setCallReceiver(QObject* callReceiver)
 {
-	LocalSocket	*	socket	=	new LocalSocket(this);
-	MessageBus	*	bus	=	new MessageBus(m_callReceiver);
-	bus->m_peerSocket = socket;
-// 	socket->setWritePkgBufferSize(10485760 /* 10M */);
-	
-	connect(socket, SIGNAL(disconnected()), bus, SLOT(onDisconnected()), Qt::QueuedConnection);
-	connect(socket, SIGNAL(readyRead()), bus, SLOT(onNewPackage()), Qt::QueuedConnection);
-  
-  if(!socket->setSocketDescriptor(socketDescriptor))
-  {
-    disconnect(socket, 0, bus, 0);
-    bus->m_peerSocket = nullptr;
-    bus->deleteLater();
-    socket->deleteLater();
-    return;
-  }
-	
-	emit(clientConnected(bus));
+	m_callReceiver	=	callReceiver;
 }
 
 
-void MessageBus::onDisconnected()
+bool MessageBus::registerObject(const QString& path, QObject* receiver)
 {
-	QWriteLocker		socketLocker(&m_socketLock);
-	
-	if(!m_peerSocket)
-		return;
-	
-// 	qDebug("MessageBus::onDisconnected()");
-	
-	LocalSocket	*	socket	=	0;
-	socket	=	m_peerSocket;
-	m_peerSocket = 0;
-	socketLocker.unlock();
-	
- 	emit(disconnected());
+	if(!m_objects->insert(objectId(path), path, receiver)) {
+    m_lastError = tr("Object path collides with an already registered path");
+		return false;
+  }
 	
-	socket->deleteLater();
+	return true;
 }
 
 
-void MessageBus::onNewPackage()
+void MessageBus::unregisterObject(const QString& path)
 {
-	QReadLocker		socketLocker(&m_socketLock);
-	
-// 	qDebug("onNewPackage()");
-	if(!m_peerSocket)
-		return;
-	
-	// Read new packages
-	while(m_peerSocket->availableData() > 0)
-	{
-		// Read package
-		Variant		package(m_peerSocket->read());
-	
-		m_tmpReadBuffer.enqueue(package);
-	}
-	socketLocker.unlock();
-	
-	while(!m_tmpReadBuffer.isEmpty())
-		handlePackage(m_tmpReadBuffer.dequeue());
+	m_objects->remove(objectId(path), path);
 }
 
 
-bool MessageBus::writeHelper(const Variant &package)
+quint32 MessageBus::objectId(const QString& path)
 {
-	QReadLocker		socketLocker(&m_socketLock);
+	return objectPathId(path);
+}
+
+
+void MessageBus::registerMethodHelper(quint32 methodId, QObject* receiver, MessageBusMethodDispatcher dispatcher)
+{
+	m_objects->insertMethod(methodId, receiver, dispatcher);
+}
+
+
+void MessageBus::setSlowSubscriberPolicy(MessageBus::SlowSubscriberPolicy policy, qint64 maxQueuedBytes)
+{
+	QMutexLocker	publishLocker(&m_publishLock);
+	
+	m_slowSubscriberPolicy	=	policy;
+	m_maxQueuedBytes				=	maxQueuedBytes;
+}
+
+
+bool MessageBus::subscribe(const QString& topic)
+{
+	QReadLocker		socketLocker(&m_socketLock);
+	
+	if(!m_peerSocket) {
+    m_lastError = tr("Not connected to a peer");
+		return false;
+  }
+	
+	if(!waitForPeerFeatures() || !(m_peerFeatures & FEATURE_TOPICS)) {
+    m_lastError = tr("Peer does not support topics");
+		return false;
+  }
+	
+	const quint32	topicId	=	objectPathId(topic);
+	
+	{
+		QMutexLocker	subscriptionLocker(&m_subscriptionLock);
+		m_subscriptions.insert(topicId);
+	}
+	
+	Variant	package(topicId);
+	package.setOptionalId(PKG_TYPE_SUBSCRIBE);
+	
+	return writeHelper(package, controlPriority());
+}
+
+
+bool MessageBus::unsubscribe(const QString& topic)
+{
+	QReadLocker		socketLocker(&m_socketLock);
+	
+	const quint32	topicId	=	objectPathId(topic);
+	
+	{
+		QMutexLocker	subscriptionLocker(&m_subscriptionLock);
+		
+		if(!m_subscriptions.remove(topicId))
+			return true;
+	}
+	
+	if(!m_peerSocket) {
+    m_lastError = tr("Not connected to a peer");
+		return false;
+  }
+	
+	Variant	package(topicId);
+	package.setOptionalId(PKG_TYPE_UNSUBSCRIBE);
+	
+	return writeHelper(package, controlPriority());
+}
+
+
+int MessageBus::publish(const QString& topic, const QString& slot, const QList<Variant>& paramList)
+{
+	const quint32		topicId	=	objectPathId(topic);
+	
+	// Serialize once, all subscribers share the data
+	Variant	package(QList<Variant>() << Variant(topicId) << Variant(slot) << paramList);
+	package.setOptionalId(PKG_TYPE_PUBLISH);
+	
+	QReadLocker		topicLocker(m_topics->lock());
+	
+	int	count	=	0;
+	foreach(MessageBus * subscriber, m_topics->subscribers(topicId))
+	{
+		if(subscriber->publishPackage(package))
+			count++;
+	}
+	
+	return count;
+}
+
+
+void MessageBus::deleteLater()
+{
+	// The socket belongs to the root bus
+	if(m_channelId)
+	{
+		disconnectFromServer();
+		
+		disconnect(this, 0, 0, 0);
+		QObject::deleteLater();
+		return;
+	}
+	
+	QReadLocker		socketLocker(&m_socketLock);
+	
+	if(m_peerSocket) {
+    disconnect(m_peerSocket, 0, this, 0);
+		m_peerSocket->disconnectFromServer();
+  }
+	
+	m_tmpReadBuffer.clear();
+	for(int i = LocalSocket::HighPriority; i <= LocalSocket::NormalPriority; i++)
+		m_receivingCall[i].args.clear();
+	
+	disconnect(this, 0, 0, 0);
+	
+	QObject::deleteLater();
+}
+
+
+bool MessageBus::call(const QString& slot, const QList< Variant >& paramList, LocalSocket::Priority priority)
+{
+	return callHelper(0, slot, paramList, priority);
+}
+
+
+bool MessageBus::call(const QString& slot, QList< Variant >&& paramList, LocalSocket::Priority priority)
+{
+	return callHelper(0, slot, std::move(paramList), priority);
+}
+
+
+bool MessageBus::callObject(quint32 objectId, const QString& slot, const QList< Variant >& paramList, LocalSocket::Priority priority)
+{
+	return callHelper(objectId, slot, paramList, priority);
+}
+
+
+bool MessageBus::callObject(const QString& path, const QString& slot, const QList< Variant >& paramList, LocalSocket::Priority priority)
+{
+	return callHelper(objectId(path), slot, paramList, priority);
+}
+
+
+template<typename List>
+bool MessageBus::sendCall(quint32 objectId, const Variant& target, List& paramList, LocalSocket::Priority priority)
+{
+	QReadLocker		socketLocker(&m_socketLock);
+	
+	if(!m_peerSocket) {
+    m_lastError = tr("Not connected to a peer");
+		return false;
+  }
+	
+	// Old peers would deliver the call to their call receiver
+	if(objectId && (!waitForPeerFeatures() || !(m_peerFeatures & FEATURE_OBJECTS))) {
+    m_lastError = tr("Peer does not support object paths");
+		return false;
+  }
+	
+	// Old peers would take the method id for a slot name
+	if(target.type() == Variant::UInt32 && (!waitForPeerFeatures() || !(m_peerFeatures & FEATURE_METHOD_IDS))) {
+    m_lastError = tr("Peer does not support method ids");
+		return false;
+  }
+	
+	// Old peers only know one lane
+	if(!(m_peerFeatures & FEATURE_PRIORITY_LANES))
+		priority	=	LocalSocket::NormalPriority;
+	
+	// TCP connections cannot pass file descriptors
+	if(!m_peerSocket->canPassFileDescriptors())
+	{
+		foreach(const Variant& parameter, paramList)
+		{
+			if(parameter.type() == Variant::SocketDescriptor) {
+        m_lastError = tr("File descriptors cannot be passed over this connection");
+				return false;
+      }
+		}
+	}
+	
+	/*
+	 * Take credits for the CALL package and its parameters
+	 */
+	Variant	package(target);
+	// Set id
+	package.setOptionalId(PKG_TYPE_CALL);
+	
+	qint64	callSize	=	package.size();
+	foreach(const Variant& parameter, paramList)
+		callSize	+=	parameter.size();
+	
+	if(!waitForCredits(callSize))
+		return false;
+	
+	/*
+	 * Send OBJECT package
+	 */
+	if(objectId)
+	{
+		Variant	objectPackage(objectId);
+		objectPackage.setOptionalId(PKG_TYPE_OBJECT);
+		
+		if(!writeHelper(objectPackage, priority))
+			return false;
+	}
+	
+	/*
+	 * Send CALL package
+	 */
+	if(!writeHelper(package, priority))
+		return false;
+    
+// 	static	int	_cw_count	=	0;
+// 	_cw_count++;
+// 	qDebug("CALL package sent: %d - %s", _cw_count, qPrintable(paramList.first().toString()));
+	
+	/*
+	 * Send parameters
+	 */
+	const quint32		peerFeatures	=	(m_root ? m_root->m_peerFeatures : m_peerFeatures);
+	const bool			shapeMaps			=	((peerFeatures & FEATURE_COMPACT_VARIANTS) && (peerFeatures & FEATURE_MAP_SHAPES));
+	
+	for(int i = 0; i < paramList.count(); i++)
+	{
+		// Moved out of a list handed over by the caller, a const list is not detached (the parameter is copied)
+		Variant		parameter(std::move(paramList[i]));
+		
+		// Set id
+		parameter.setOptionalId(PKG_TYPE_PARAM);
+		
+		// Maps with known keys are sent as shape id and values
+		if(shapeMaps && parameter.type() == Variant::Map)
+		{
+			Variant		definition;
+			Variant		shaped(m_shapes->compress(parameter, priority, &definition));
+			
+			if(definition.isValid())
+			{
+				definition.setOptionalId(PKG_TYPE_SHAPE);
+				
+				if(!writeHelper(definition, priority))
+					return false;
+			}
+			
+			if(shaped.isValid())
+			{
+				parameter	=	std::move(shaped);
+				parameter.setOptionalId(PKG_TYPE_PARAM | PKG_SHAPED_FLAG);
+			}
+		}
+		
+		if(!writeHelper(parameter, priority))
+			return false;
+// 		qDebug("PARAM package sent");
+	}
+	
+	/*
+	 * Send END package
+	 */
+	package	=	Variant();
+	// Set id
+	package.setOptionalId(PKG_TYPE_END);
+  
+//   disconnect(m_peerSocket, SIGNAL(readyRead()), this, 0);
+	
+	if(!writeHelper(package, priority)) {
+//     connect(m_peerSocket, SIGNAL(readyRead()), SLOT(onNewPackage()), Qt::QueuedConnection);
+		return false;
+  }
+// 	m_peerSocket->flush();
+// 	qDebug("END package sent");
+	
+	/*
+	 * Wait for ACK package
+	 */
+	bool	acknowledged	=	waitForAck();
+	
+// 	connect(m_peerSocket, SIGNAL(readyRead()), SLOT(onNewPackage()), Qt::QueuedConnection);
+	callSlotQueued(this, "onNewPackage");
+	//qDebug("Waited for ACK package");
+	
+	// Ack received
+	return acknowledged;
+}
+
+
+bool MessageBus::callHelper(quint32 objectId, const Variant& target, const QList< Variant >& paramList, LocalSocket::Priority priority)
+{
+	return sendCall(objectId, target, paramList, priority);
+}
+
+
+bool MessageBus::callHelper(quint32 objectId, const Variant& target, QList< Variant >&& paramList, LocalSocket::Priority priority)
+{
+	return sendCall(objectId, target, paramList, priority);
+}
+
+
+bool MessageBus::call(const QString& slot, const Variant& param1, const Variant& param2, const Variant& param3, const Variant& param4, const Variant& param5)
+{
+	QList<Variant>	params;
+	
+	if(param1.isValid())
+	{
+		params.append(param1);
+		
+		if(param2.isValid())
+		{
+			params.append(param2);
+			
+			if(param3.isValid())
+			{
+				params.append(param3);
+				
+				if(param4.isValid())
+				{
+					params.append(param4);
+					
+					if(param5.isValid())
+						params.append(param5);
+				}
+			}
+		}
+	}
+	
+	return call(slot, std::move(params));
+}
+
+
+void MessageBus::onNewClient(quintptr socketDescriptor)
+{
+	MessageBus	*	bus	=	new MessageBus(m_callReceiver);
+	inheritSettings(bus);
+  
+  if(!bus->setSocketDescriptor(socketDescriptor))
+  {
+    bus->deleteLater();
+    return;
+  }
+	
+	m_clients.append(bus);
+	
+	emit(clientConnected(bus));
+}
+
+
+void MessageBus::adoptServer(MessageBus* bus, const Variant& socketDescriptor)
+{
+	Q_UNUSED(bus);
+	
+	bool	ok	=	false;
+	int		fd	=	socketDescriptor.toSocketDescriptor(&ok);
+	
+	if(!ok || fd < 0)
+		return;
+	
+	QWriteLocker		socketLocker(&m_socketLock);
+	
+	if(m_server || m_tcpServer || m_peerSocket)
+	{
+		qWarning("MessageBus: Cannot take over listening socket, already listening or connected");
+		::close(fd);
+		return;
+	}
+	
+	m_server	=	new LocalServer(this);
+	connect(m_server, SIGNAL(newConnection(quintptr)), SLOT(onNewClient(quintptr)));
+	
+	if(!m_server->listen(quintptr(fd)))
+	{
+		disconnect(m_server, 0, this, 0);
+		m_server->deleteLater();
+		m_server	=	0;
+		::close(fd);
+	}
+}
+
+
+void MessageBus::adoptClient(MessageBus* bus, const Variant& socketDescriptor, const Variant& state)
+{
+	Q_UNUSED(bus);
+	
+	MessageBus	*	client	=	new MessageBus(m_callReceiver);
+	inheritSettings(client);
+	
+	if(!client->attachConnection(socketDescriptor, state))
+	{
+		qWarning("MessageBus: Cannot take over client: %s", qPrintable(client->lastErrorMessage()));
+		client->deleteLater();
+		return;
+	}
+	
+	m_clients.append(client);
+	
+	emit(clientConnected(client));
+}
+
+
+void MessageBus::onDisconnected()
+{
+	QWriteLocker		socketLocker(&m_socketLock);
+	
+	if(!m_peerSocket)
+		return;
+	
+// 	qDebug("MessageBus::onDisconnected()");
+	
+	LocalSocket	*	socket	=	0;
+	socket	=	m_peerSocket;
+	m_peerSocket = 0;
+	socketLocker.unlock();
+	
+	// Nothing to publish to anymore
+	m_topics->unsubscribeAll(this);
+	{
+		QMutexLocker	publishLocker(&m_publishLock);
+		m_publishQueue.clear();
+		m_publishQueueSize	=	0;
+	}
+	
+	// A new peer knows none of the shapes
+	m_shapes->clear();
+	
+	// Channels lost their connection too
+	{
+		QReadLocker		channelLocker(&m_channelLock);
+		
+		foreach(MessageBus * channel, m_channels)
+			callSlotQueued(channel, "onDisconnected");
+	}
+	
+ 	emit(disconnected());
+	
+	// The socket of a channel belongs to the root bus
+	if(!m_channelId)
+		socket->deleteLater();
+}
+
+
+void MessageBus::onNewPackage()
+{
+	// Handle packages buffered while waiting for an ACK first (the rest waits for room in the receive window)
+	while(!m_tmpReadBuffer.isEmpty() && !isReceiveWindowFull())
+	{
+		QPair<Variant, LocalSocket::Priority>	buffered(m_tmpReadBuffer.dequeue());
+		handlePackage(buffered.first, buffered.second);
+	}
+	
+	QReadLocker		socketLocker(&m_socketLock);
+	
+// 	qDebug("onNewPackage()");
+	// Packages of channels are routed by the root bus
+	if(!m_peerSocket || m_channelId)
+		return;
+	
+	// Read new packages as long as the receive window allows it
+	// (with channels the window holds back the packages of this bus only, channels have their own windows)
+	while(m_peerSocket->availableData() > 0)
+	{
+		if(isReceiveWindowFull())
+		{
+			QReadLocker		channelLocker(&m_channelLock);
+			if(m_channels.isEmpty() || m_tmpReadBuffer.count() >= MAX_HELD_PACKAGES)
+				break;
+		}
+		
+		// Read and route package (high priority packages first)
+		QMutexLocker	routeLocker(&m_routeLock);
+		
+		LocalSocket::Priority	priority	=	LocalSocket::NormalPriority;
+		bool			ok	=	false;
+		Variant		package(m_peerSocket->read(&ok, &priority));
+		
+		if(!ok)
+			break;
+		
+		socketLocker.unlock();
+		QList<quint16>	acks;
+		const bool			handle	=	routePackage(package, priority, true, &acks);
+		routeLocker.unlock();
+		
+		writeAcks(acks);
+		if(handle)
+			handlePackage(package, priority);
+		socketLocker.relock();
+		
+		if(!m_peerSocket)
+			return;
+	}
+}
+
+
+void MessageBus::onChannelOpened(MessageBus* channel)
+{
+	emit(channelOpened(channel));
+}
+
+
+void MessageBus::onDataWritten()
+{
+	{
+		QMutexLocker	publishLocker(&m_publishLock);
+		
+		m_publishFlushQueued	=	false;
+		if(!m_publishQueue.isEmpty())
+			writePublishQueue();
+	}
+	
+	// Channels share our socket
+	QReadLocker		channelLocker(&m_channelLock);
+	
+	foreach(MessageBus * channel, m_channels)
+	{
+		QMutexLocker	publishLocker(&channel->m_publishLock);
+		
+		channel->m_publishFlushQueued	=	false;
+		if(!channel->m_publishQueue.isEmpty())
+			channel->writePublishQueue();
+	}
+}
+
+
+void MessageBus::onSlowSubscriber()
+{
+	m_lastError	=	tr("Subscriber did not keep up with the published messages");
+	qWarning("MessageBus: Disconnecting slow subscriber!");
+	disconnectFromServer();
+}
+
+
+void MessageBus::onCallDispatched(qint64 size)
+{
+	m_pendingCalls--;
+	m_pendingBytes	-=	size;
+	m_ungrantedCalls++;
+	m_ungrantedBytes	+=	size;
+	
+	// Grant credits in batches of a quarter of the window
+	if(m_ungrantedCalls >= qMax(m_receiveWindowCalls / 4, 1) || m_pendingCalls == 0)
+	{
+		const int			calls	=	m_ungrantedCalls;
+		const qint64	bytes	=	(m_receiveWindowBytes > 0 ? m_ungrantedBytes : 0);
+		
+		m_ungrantedCalls	=	0;
+		m_ungrantedBytes	=	0;
+		
+		sendCredits(calls, bytes);
+	}
+	
+	// Continue reading if we stopped because of a full window
+	onNewPackage();
+}
+
+
+void MessageBus::inheritSettings(MessageBus* bus) const
+{
+	// Clients inherit the settings of the listening bus
+	bus->m_highWaterBytes			=	m_highWaterBytes;
+	bus->m_highWaterMessages	=	m_highWaterMessages;
+	bus->m_lowWaterBytes			=	m_lowWaterBytes;
+	bus->m_lowWaterMessages		=	m_lowWaterMessages;
+	bus->m_receiveWindowCalls	=	m_receiveWindowCalls;
+	bus->m_receiveWindowBytes	=	m_receiveWindowBytes;
+	// Clients are served by the objects registered on the listening bus
+	bus->m_objects						=	m_objects;
+	// Publishing on the listening bus reaches all subscribed clients
+	bus->m_topics							=	m_topics;
+	bus->m_slowSubscriberPolicy	=	m_slowSubscriberPolicy;
+	bus->m_maxQueuedBytes			=	m_maxQueuedBytes;
+}
+
+
+/*
+ * Handover state (List):
+ * 
+ * Pos Type       Data
+ * -------------------------
+ * 0   List       State of the socket (see LocalSocket::detach())
+ * 1   UInt32     Features of the peer
+ * 2   Bool       Peer supports credits
+ * 3   Bool       Sending is flow controlled
+ * 4   Bool       Sending is limited by bytes
+ * 5   Int32      Call credits granted by the peer
+ * 6   Int64      Byte credits granted by the peer
+ * 7   Int32      Call credits granted to the peer
+ * 8   Int64      Byte credits granted to the peer
+ * 9   Int32      Calls received but not yet granted again
+ * 10  Int64      Bytes received but not yet granted again
+ * 11  List       Calls currently received (per lane): [slot, object id, size, arguments, method id]
+ * 12  List       Buffered packages: [lane, type, optional id, data]
+ * 13  List       Topics the peer subscribed to
+ * 14  List       Map shapes sent and received (per lane, see MapShapes::state())
+ */
+Variant MessageBus::detachConnection(Variant* state, int timeout)
+{
+	QWriteLocker		socketLocker(&m_socketLock);
+	
+	if(!m_peerSocket || m_channelId) {
+    m_lastError = tr("Not connected to a peer");
+		return Variant();
+  }
+	
+	{
+		QReadLocker		channelLocker(&m_channelLock);
+		
+		if(!m_channels.isEmpty()) {
+      m_lastError = tr("Connections with channels cannot be handed over");
+			return Variant();
+    }
+	}
+	
+	// Closing the socket must not look like a disconnect
+	disconnect(m_peerSocket, 0, this, 0);
+	
+	Variant		socketState;
+	Variant		socketDescriptor(m_peerSocket->detach(&socketState, timeout));
+	
+	if(!socketDescriptor.isValid())
+	{
+    m_lastError = m_peerSocket->lastErrorString();
+		
+		connect(m_peerSocket, SIGNAL(disconnected()), SLOT(onDisconnected()), Qt::QueuedConnection);
+		connect(m_peerSocket, SIGNAL(readyRead()), SLOT(onNewPackage()), Qt::QueuedConnection);
+		setupSocket(m_peerSocket);
+		return Variant();
+	}
+	
+	QList<Variant>	calls;
+	for(int i = LocalSocket::HighPriority; i <= LocalSocket::NormalPriority; i++)
+	{
+		const ReceivingCall&	receivingCall	=	m_receivingCall[i];
+		
+		calls.append(Variant(QList<Variant>() << Variant(QString::fromLatin1(receivingCall.slot)) << Variant(receivingCall.objectId)
+																					<< Variant(receivingCall.size) << Variant(receivingCall.args) << Variant(receivingCall.methodId)));
+	}
+	
+	QList<Variant>	buffered;
+	while(!m_tmpReadBuffer.isEmpty())
+	{
+		QPair<Variant, LocalSocket::Priority>	package(m_tmpReadBuffer.dequeue());
+		
+		buffered.append(Variant(QList<Variant>() << Variant(quint8(package.second)) << Variant(quint8(package.first.type()))
+																						<< Variant(package.first.optionalId()) << Variant(package.first.toByteArray())));
+	}
+	
+	QList<Variant>	topics;
+	foreach(quint32 topicId, m_topics->topics(this))
+		topics.append(Variant(topicId));
+	
+	if(state)
+	{
+		*state	=	Variant(QList<Variant>() << socketState << Variant(m_peerFeatures) << Variant(m_peerSupportsCredits)
+												<< Variant(m_sendFlowControlled) << Variant(m_sendByteLimited)
+												<< Variant(qint32(m_sendCallCredits)) << Variant(m_sendByteCredits)
+												<< Variant(qint32(m_grantedCalls)) << Variant(m_grantedBytes)
+												<< Variant(qint32(m_pendingCalls + m_ungrantedCalls)) << Variant(m_pendingBytes + m_ungrantedBytes)
+												<< Variant(calls) << Variant(buffered) << Variant(topics) << m_shapes->state());
+	}
+	
+	m_topics->unsubscribeAll(this);
+	
+	m_peerSocket->deleteLater();
+	m_peerSocket	=	0;
+	socketLocker.unlock();
+	
+	// The connection is continued by another process
+	emit(disconnected());
+	
+	return socketDescriptor;
+}
+
+
+bool MessageBus::attachConnection(const Variant& socketDescriptor, const Variant& state)
+{
+	QList<Variant>	values(state.toList());
+	
+	QWriteLocker		socketLocker(&m_socketLock);
+	
+	if(m_peerSocket || m_server || m_tcpServer) {
+    m_lastError = tr("Already connected or listening");
+		return false;
+  }
+	
+	LocalSocket	*	socket	=	new LocalSocket(this);
+	
+	connect(socket, SIGNAL(disconnected()), SLOT(onDisconnected()), Qt::QueuedConnection);
+	connect(socket, SIGNAL(readyRead()), SLOT(onNewPackage()), Qt::QueuedConnection);
+	setupSocket(socket);
+	
+	if(!socket->attach(socketDescriptor, values.value(0))) {
+    disconnect(socket, 0, this, 0);
+    m_lastError = socket->lastErrorString();
+		socket->deleteLater();
+		return false;
+  }
+	
+	m_peerSocket						=	socket;
+	m_nextChannelId					=	2;
+	m_peerFeatures					=	values.value(1).toUInt32();
+	m_peerSupportsCredits		=	values.value(2).toBool();
+	m_sendFlowControlled		=	values.value(3).toBool();
+	m_sendByteLimited				=	values.value(4).toBool();
+	m_sendCallCredits				=	values.value(5).toInt32();
+	m_sendByteCredits				=	values.value(6).toInt64();
+	m_grantedCalls					=	values.value(7).toInt32();
+	m_grantedBytes					=	values.value(8).toInt64();
+	m_peerSocket->setFragmentsEnabled((m_peerFeatures & FEATURE_FRAGMENTS) != 0);
+	
+	const int			returnCalls	=	values.value(9).toInt32();
+	const qint64	returnBytes	=	values.value(10).toInt64();
+	
+	QList<Variant>	calls(values.value(11).toList());
+	for(int i = LocalSocket::HighPriority; i <= LocalSocket::NormalPriority; i++)
+	{
+		QList<Variant>	fields(calls.value(i).toList());
+		ReceivingCall&	receivingCall	=	m_receivingCall[i];
+		
+		receivingCall.slot			=	fields.value(0).toUtf8();
+		receivingCall.objectId	=	fields.value(1).toUInt32();
+		receivingCall.size			=	fields.value(2).toInt64();
+		receivingCall.args			=	fields.value(3).toList();
+		receivingCall.methodId	=	fields.value(4).toUInt32();
+	}
+	
+	foreach(const Variant& package, values.value(12).toList())
+	{
+		QList<Variant>	fields(package.toList());
+		
+		m_tmpReadBuffer.enqueue(qMakePair(Variant(fields.value(3).toByteArray(), Variant::Type(fields.value(1).toUInt8()), fields.value(2).toUInt32()),
+																			LocalSocket::Priority(qBound(0, int(fields.value(0).toUInt8()), int(LocalSocket::NormalPriority)))));
+	}
+	
+	foreach(const Variant& topicId, values.value(13).toList())
+		m_topics->subscribe(topicId.toUInt32(), this);
+	
+	m_shapes->restoreState(values.value(14));
+	
+	socketLocker.unlock();
+	
+	// Credits of the calls the other process received but did not grant again
+	if(m_receiveWindowCalls > 0 && (returnCalls > 0 || returnBytes > 0))
+		sendCredits(returnCalls, (m_receiveWindowBytes > 0 ? returnBytes : 0));
+	
+	// Packages received by the other process
+	callSlotQueued(this, "onNewPackage");
+	
+	return true;
+}
+
+
+void MessageBus::setupSocket(LocalSocket* socket)
+{
+	socket->setHighWaterMark(m_highWaterBytes, m_highWaterMessages);
+	socket->setLowWaterMark(m_lowWaterBytes, m_lowWaterMessages);
+	
+	// Flow control: Stop reading from the kernel if the peer ignores our credits
+	if(m_receiveWindowCalls > 0)
+		socket->setReadBufferLimit(RECEIVE_BUFFER_PACKAGES);
+	
+	connect(socket, SIGNAL(writable()), SIGNAL(writable()));
+	connect(socket, SIGNAL(dataWritten()), SLOT(onDataWritten()), Qt::QueuedConnection);
+}
+
+
+bool MessageBus::writeHelper(const Variant &package, LocalSocket::Priority priority)
+{
+	QReadLocker		socketLocker(&m_socketLock);
 	//qDebug("Writing package of size %d", package.size());
 	
-	while(m_peerSocket && !m_peerSocket->write(package))
+	Variant		channelPackage(addressPackage(package));
+	
+	// Throttle while the write buffer is above the high water mark (control packages are never held back)
+	while(m_peerSocket && priority != LocalSocket::HighPriority && !m_peerSocket->isWritable() && m_peerSocket->isOpen())
+		m_peerSocket->waitForDataWritten(1000);
+	
+	if(!m_peerSocket)
+	{
+		m_lastError = tr("Socket already closed while trying to write data");
+		return false;
+	}
+	
+	if(!m_peerSocket->write(std::move(channelPackage), priority))
+	{
+		if(channelPackage.type() == Variant::SocketDescriptor && m_peerSocket->isOpen())
+			m_lastError = tr("File descriptors cannot be passed over this connection");
+		else
+			m_lastError = tr("Socket already closed while trying to write data");
+		
+		return false;
+	}
+	
+	return true;
+}
+
+
+Variant MessageBus::addressPackage(const Variant& package) const
+{
+	Variant		ret(package);
+	quint32		optId	=	package.optionalId();
+	
+	// Address the channel
+	if(m_channelId)
+		optId	|=	(quint32(m_channelId) << 16);
+	
+	const Variant::Type		type	=	package.type();
+	
+	if(type == Variant::Map || type == Variant::List || type == Variant::Int32Array || type == Variant::Int64Array)
+	{
+		// Peers of older versions (and packages sent before the features are known) get the old encoding
+		const quint32		peerFeatures	=	(m_root ? m_root->m_peerFeatures : m_peerFeatures);
+		
+		if(!(peerFeatures & FEATURE_COMPACT_VARIANTS))
+			ret	=	package.toLegacyEncoding();
+		else if(type == Variant::Map || type == Variant::List)
+			optId	|=	PKG_COMPACT_FLAG;
+	}
+	
+	ret.setOptionalId(optId);
+	return ret;
+}
+
+
+LocalSocket::Priority MessageBus::controlPriority() const
+{
+	return ((m_peerFeatures & FEATURE_PRIORITY_LANES) ? LocalSocket::HighPriority : LocalSocket::NormalPriority);
+}
+
+
+bool MessageBus::waitForCredits(qint64 callSize)
+{
+	// socket lock should already be locked by call()
+	
+	forever
 	{
-		if(!m_peerSocket->isOpen()) {
-      m_lastError = tr("Socket already closed while trying to write data");
+		{
+			QMutexLocker	creditLocker(&m_creditLock);
+			
+			// Old peer or no window
+			if(m_peerFeaturesMissing || (m_peerSupportsCredits && !m_sendFlowControlled))
+				return true;
+			
+			// Before the first grant a single call is sent, it is deducted from the grant
+			if(m_peerSupportsCredits ? (m_sendCallCredits > 0 && (!m_sendByteLimited || m_sendByteCredits > 0)) : m_sendCallCredits == 0)
+			{
+				m_sendCallCredits--;
+				m_sendByteCredits	-=	callSize;
+				return true;
+			}
+		}
+		
+		if(!m_peerSocket || !m_peerSocket->isOpen())
+		{
+			m_lastError = tr("Socket closed while waiting for credits");
 			return false;
-    }
+		}
 		
-		m_peerSocket->waitForDataWritten(1000);
+		// Credits are handled while routing, everything else is buffered
+		(m_root ? m_root : this)->routeAvailablePackages(m_peerSocket, 1000);
 	}
+}
+
+
+bool MessageBus::sendCredits(int calls, qint64 bytes)
+{
+	Variant	package(QList<Variant>() << Variant(quint32(calls)) << Variant(bytes) << Variant(quint32(SUPPORTED_FEATURES)));
+	package.setOptionalId(PKG_TYPE_CREDIT);
 	
-	if(!m_peerSocket)
-    m_lastError = tr("Socket already closed while trying to write data");
+	m_grantedCalls	+=	calls;
+	m_grantedBytes	+=	bytes;
+	
+	return writeHelper(package, controlPriority());
+}
+
+
+bool MessageBus::isReceiveWindowFull() const
+{
+	return ((m_receiveWindowCalls > 0 && m_pendingCalls >= m_receiveWindowCalls) ||
+					(m_receiveWindowBytes > 0 && m_pendingBytes >= m_receiveWindowBytes));
+}
+
+
+void MessageBus::handleCreditPackage(const Variant& package)
+{
+	QList<Variant>	credits(package.toList());
+	const int				calls	=	int(credits.value(0).toUInt32());
+	const qint64		bytes	=	credits.value(1).toInt64();
+	
+	QMutexLocker	creditLocker(&m_creditLock);
+	
+	// The first credit package announces the window of the peer
+	if(!m_peerSupportsCredits)
+	{
+		m_peerSupportsCredits	=	true;
+		m_sendFlowControlled	=	(calls > 0);
+		m_sendByteLimited			=	(bytes > 0);
+		m_peerFeatures				=	credits.value(2).toUInt32();
+		
+		// Large packages may be fragmented now (the first CREDIT of a channel comes from the same peer)
+		if((m_peerFeatures & FEATURE_FRAGMENTS) && m_peerSocket)
+			m_peerSocket->setFragmentsEnabled(true);
+	}
 	
-	return (m_peerSocket != 0);
+	m_sendCallCredits	+=	calls;
+	m_sendByteCredits	+=	bytes;
 }
 
 
-bool MessageBus::checkAckPackage()
+bool MessageBus::waitForAck()
 {
 	// socket lock should already be locked by call()
+	MessageBus	*	root	=	(m_root ? m_root.data() : this);
 	
-	if(!m_peerSocket->availableData())
-		return false;
+	while(m_peerSocket && m_peerSocket->isOpen())
+	{
+		// Routed by this or another thread
+		if(m_ackCount.loadAcquire() > 0)
+		{
+			m_ackCount.deref();
+			return true;
+		}
+		
+		root->routeAvailablePackages(m_peerSocket, 1000);
+	}
+	
+	return false;
+}
+
+
+void MessageBus::routeAvailablePackages(LocalSocket* socket, int timeout)
+{
+	// socket lock should already be locked by the caller
 	
-	Variant	package(m_peerSocket->read());
+	// Another thread is reading the shared socket and routes our packages
+	if(!m_routeLock.tryLock(ROUTE_TIMEOUT))
+		return;
 	
-	// Get type
-	const quint32 type = package.optionalId();
+	{
+		QReadLocker		channelLocker(&m_channelLock);
+		
+		// Don't keep the socket from other channels for too long
+		if(!m_channels.isEmpty())
+			timeout	=	qMin(timeout, ROUTE_TIMEOUT);
+	}
 	
-	if(type == PKG_TYPE_ACK)
-		return true;
-	else if(type == PKG_TYPE_END)
+	if(!socket->availableData())
+		socket->waitForReadyRead(timeout);
+	
+	QList<quint16>	acks;
+	
+	while(socket->availableData())
 	{
-		// Send ACK package
-		Variant	ackPackage;
-		ackPackage.setOptionalId(PKG_TYPE_ACK);
+		LocalSocket::Priority	priority	=	LocalSocket::NormalPriority;
+		bool			ok	=	false;
+		Variant		package(socket->read(&ok, &priority));
+		
+		if(!ok)
+			break;
+		
+		routePackage(package, priority, false, &acks);
+	}
+	
+	m_routeLock.unlock();
+	
+	// Not written while other threads wait for the shared socket
+	writeAcks(acks);
+}
+
+
+bool MessageBus::routePackage(Variant& package, LocalSocket::Priority priority, bool handleInline, QList<quint16> * acks)
+{
+	// route lock should already be locked by the caller
+	
+	// Maps and Lists are decoded in the compact encoding only
+	if(package.type() == Variant::Map || package.type() == Variant::List)
+	{
+		if(!(package.optionalId() & PKG_COMPACT_FLAG))
+			package	=	Variant::fromLegacyEncoding(package);
+		
+		package.setOptionalId(package.optionalId() & ~quint32(PKG_COMPACT_FLAG));
+	}
+	
+	const quint32		optId			=	package.optionalId();
+	const quint16		channelId	=	PKG_CHANNEL(optId);
+	const quint32		type			=	PKG_TYPE(optId);
+	MessageBus		*	target		=	this;
+	
+	if(channelId)
+	{
+		QWriteLocker		channelLocker(&m_channelLock);
+		
+		target	=	m_channels.value(channelId);
+		
+		if(type == PKG_TYPE_CHANNEL_OPEN)
+		{
+			if(target)
+				return false;
+			
+			// Channel opened by the peer
+			MessageBus	*	channel	=	new MessageBus(0);
+			channel->m_callReceiver	=	m_callReceiver;
+			channel->m_ownedByRoot	=	true;
+			attachChannel(channel, channelId);
+			channelLocker.unlock();
+			
+			if(channel->thread() != thread())
+				channel->moveToThread(thread());
+			
+			// Announce flow control and grant the initial window
+			channel->sendCredits(m_receiveWindowCalls, m_receiveWindowBytes);
+			
+			// Queued: Calls on the channel are dispatched after the signal has been delivered
+			callSlotQueued(this, "onChannelOpened", Q_ARG(MessageBus*, channel));
+			return false;
+		}
+		else if(type == PKG_TYPE_CHANNEL_CLOSE)
+		{
+			if(!target)
+				return false;
+			
+			m_channels.remove(channelId);
+			channelLocker.unlock();
+			
+			callSlotQueued(target, "onDisconnected");
+			return false;
+		}
 		
-		if(!writeHelper(ackPackage))
+		// Channel already closed
+		if(!target)
 			return false;
-//  				m_peerSocket->flush();
-// 		qDebug("ACK package sent");
+		
+		package.setOptionalId(type);
+	}
+	
+	if(type == PKG_TYPE_ACK)
+	{
+		// New peers announce their features before they acknowledge the first call
+		target->m_creditLock.lock();
+		if(!target->m_peerSupportsCredits)
+			target->m_peerFeaturesMissing	=	true;
+		target->m_creditLock.unlock();
+		
+		target->m_ackCount.ref();
+		return false;
+	}
+	else if(type == PKG_TYPE_CREDIT)
+	{
+		// Credits are needed right now if the bus is waiting for them
+		target->handleCreditPackage(package);
+		return false;
+	}
+	
+	// Held back behind buffered packages or by a full receive window
+	if(handleInline && target == this && m_tmpReadBuffer.isEmpty() && !isReceiveWindowFull())
+		return true;
+	
+	if(type == PKG_TYPE_END)
+	{
+		// Acknowledge right away, the bus might be waiting for an ACK itself
+		acks->append(channelId);
 		package.setOptionalId(PKG_TYPE_END_ACKNOWLEDGED);
 	}
 	
-	m_tmpReadBuffer.enqueue(package);
+	// Handled in the thread of the bus
+	target->m_tmpReadBuffer.enqueue(qMakePair(package, priority));
+	callSlotQueued(target, "onNewPackage");
 	
 	return false;
 }
 
 
-void MessageBus::handlePackage(Variant package)
+void MessageBus::writeAcks(const QList<quint16>& channelIds)
+{
+	// Addressed to the channels like the packages of the channels themselves
+	foreach(quint16 channelId, channelIds)
+	{
+		Variant	ackPackage;
+		ackPackage.setOptionalId(PKG_TYPE_ACK | (quint32(channelId) << 16));
+		
+		if(!writeHelper(ackPackage, controlPriority()))
+			return;
+	}
+}
+
+
+bool MessageBus::waitForPeerFeatures()
+{
+	// socket lock should already be locked by the caller
+	
+	if(!waitForPeerFeatures(FEATURES_TIMEOUT) && m_peerSocket->isOpen())
+	{
+		QMutexLocker	creditLocker(&m_creditLock);
+		
+		if(!m_peerSupportsCredits)
+			m_peerFeaturesMissing	=	true;
+	}
+	
+	return m_peerSupportsCredits;
+}
+
+
+bool MessageBus::waitForPeerFeatures(int timeout)
+{
+	// socket lock should already be locked by the caller
+	
+	QElapsedTimer	timer;
+	timer.start();
+	
+	while(!m_peerSupportsCredits && !m_peerFeaturesMissing && m_peerSocket->isOpen() && timer.elapsed() < timeout)
+		(m_root ? m_root.data() : this)->routeAvailablePackages(m_peerSocket, ROUTE_TIMEOUT);
+	
+	return m_peerSupportsCredits;
+}
+
+
+void MessageBus::attachChannel(MessageBus* channel, quint16 id)
+{
+	channel->m_root								=	this;
+	channel->m_channelId					=	id;
+	channel->m_peerSocket					=	m_peerSocket;
+	channel->m_receiveWindowCalls	=	m_receiveWindowCalls;
+	channel->m_receiveWindowBytes	=	m_receiveWindowBytes;
+	channel->m_objects						=	m_objects;
+	channel->m_topics							=	m_topics;
+	channel->m_slowSubscriberPolicy	=	m_slowSubscriberPolicy;
+	channel->m_maxQueuedBytes			=	m_maxQueuedBytes;
+	
+	m_channels.insert(id, channel);
+}
+
+
+void MessageBus::removeChannel(MessageBus* channel)
+{
+	QWriteLocker		channelLocker(&m_channelLock);
+	
+	if(m_channels.value(channel->m_channelId) == channel)
+		m_channels.remove(channel->m_channelId);
+}
+
+
+void MessageBus::handlePackage(Variant package, LocalSocket::Priority priority)
 {
 	// Get type
-	const quint32 type = package.optionalId();
+	quint32 type = package.optionalId();
+	// Calls of different lanes may interleave
+	ReceivingCall&	receivingCall	=	m_receivingCall[priority];
+	
+	// Map sent as shape id and values
+	if(type & PKG_SHAPED_FLAG)
+	{
+		bool	ok	=	false;
+		package	=	m_shapes->expand(package, priority, &ok);
+		type		&=	~quint32(PKG_SHAPED_FLAG);
+		
+		if(!ok)
+			qWarning("MessageBus: Map of an unknown shape received");
+	}
 	
 // 	qDebug("Package size: %d", package.size());
 // 	qDebug("Package type: 0x%02X", type);
@@ -391,13 +1700,32 @@ void MessageBus::handlePackage(Variant package)
 //  			qDebug("CALL package received: %d", _rc_count);
 			
 			// Clean previous values
-			m_receivingCallSlot.clear();
+			receivingCall.slot.clear();
 // 			qDebug("CALL package received: clearing");
-			m_receivingCallArgs.clear();
+			receivingCall.args.clear();
+			receivingCall.methodId	=	0;
 
-			m_receivingCallSlot	=	package.toString().toLatin1();
-// 			if(m_receivingCallSlot.isEmpty())
+			// Typed methods are called by id
+			if(package.type() == Variant::UInt32)
+				receivingCall.methodId	=	package.toUInt32();
+			else
+				receivingCall.slot	=	package.toUtf8();
+// 			if(receivingCall.slot.isEmpty())
 // 				qDebug("CALL package received: received empty call slot!");
+			
+			// Flow control: The peer must not exceed its credits
+			if(m_receiveWindowCalls > 0 && m_peerSupportsCredits)
+			{
+				if(--m_grantedCalls < 0 || (m_receiveWindowBytes > 0 && m_grantedBytes <= 0))
+				{
+					m_lastError	=	tr("Peer exceeded its flow control credits");
+					qWarning("MessageBus: Peer exceeded its flow control credits!");
+					disconnectFromServer();
+					return;
+				}
+			}
+			
+			receivingCall.size	=	package.size();
 		}break;
 		
 		/*
@@ -409,7 +1737,7 @@ void MessageBus::handlePackage(Variant package)
 			Variant	ackPackage;
 			ackPackage.setOptionalId(PKG_TYPE_ACK);
 			
-			if(!writeHelper(ackPackage))
+			if(!writeHelper(ackPackage, controlPriority()))
 				return;
 //  				m_peerSocket->flush();
 // 			qDebug("ACK package sent");
@@ -418,36 +1746,80 @@ void MessageBus::handlePackage(Variant package)
 		{
 // 			static	int	_re_count	=	0;
 // 			_re_count++;
-// 			if(m_receivingCallArgs.count())
-// 				qDebug("END package received: %d - %s", _re_count, qPrintable(m_receivingCallArgs.first().toString()));
+// 			if(receivingCall.args.count())
+// 				qDebug("END package received: %d - %s", _re_count, qPrintable(receivingCall.args.first().toString()));
 // 			else
 // 				qDebug("END package received: %d", _re_count);
-			//qDebug("Slot: %s", m_receivingCallSlot.constData());
+			//qDebug("Slot: %s", receivingCall.slot.constData());
+			
+			dispatchCall(priority);
 			
-			if(m_receivingCallSlot.isEmpty())
+			// Flow control: Grant the credits again once the call has been dispatched
+			if(m_receiveWindowCalls > 0)
 			{
-// 				qDebug("END package received: empty call slot!");
-				m_receivingCallArgs.clear();
-				return;
+				if(m_peerSupportsCredits)
+					m_grantedBytes	-=	receivingCall.size;
+				
+				m_pendingCalls++;
+				m_pendingBytes	+=	receivingCall.size;
+				callSlotQueued(this, "onCallDispatched", Q_ARG(qint64, receivingCall.size));
 			}
 			
-			// Call
-			if(m_receivingCallArgs.count() == 0)
-				callSlotQueued(m_callReceiver, m_receivingCallSlot.constData(), Q_ARG(MessageBus*, this));
-			else if(m_receivingCallArgs.count() == 1)
-				callSlotQueued(m_callReceiver, m_receivingCallSlot.constData(), Q_ARG(MessageBus*, this), Q_ARG(Variant, m_receivingCallArgs.at(0)));
-			else if(m_receivingCallArgs.count() == 2)
-				callSlotQueued(m_callReceiver, m_receivingCallSlot.constData(), Q_ARG(MessageBus*, this), Q_ARG(Variant, m_receivingCallArgs.at(0)), Q_ARG(Variant, m_receivingCallArgs.at(1)));
-			else if(m_receivingCallArgs.count() == 3)
-				callSlotQueued(m_callReceiver, m_receivingCallSlot.constData(), Q_ARG(MessageBus*, this), Q_ARG(Variant, m_receivingCallArgs.at(0)), Q_ARG(Variant, m_receivingCallArgs.at(1)), Q_ARG(Variant, m_receivingCallArgs.at(2)));
-			else if(m_receivingCallArgs.count() == 4)
-				callSlotQueued(m_callReceiver, m_receivingCallSlot.constData(), Q_ARG(MessageBus*, this), Q_ARG(Variant, m_receivingCallArgs.at(0)), Q_ARG(Variant, m_receivingCallArgs.at(1)), Q_ARG(Variant, m_receivingCallArgs.at(2)), Q_ARG(Variant, m_receivingCallArgs.at(3)));
-			else
-				qWarning("MessageBus: Too many arguments!");
+			receivingCall.size	=	0;
+		}break;
+		
+		/*
+		 * OBJECT package (precedes the CALL package)
+		 */
+		case PKG_TYPE_OBJECT:
+		{
+			receivingCall.objectId	=	package.toUInt32();
+		}break;
+		
+		/*
+		 * SUBSCRIBE and UNSUBSCRIBE packages
+		 */
+		case PKG_TYPE_SUBSCRIBE:
+		{
+			m_topics->subscribe(package.toUInt32(), this);
+		}break;
+		
+		case PKG_TYPE_UNSUBSCRIBE:
+		{
+			m_topics->unsubscribe(package.toUInt32(), this);
+		}break;
+		
+		/*
+		 * PUBLISH package (topic id, slot and parameters; not acknowledged)
+		 */
+		case PKG_TYPE_PUBLISH:
+		{
+			QList<Variant>	message(package.toList());
+			const quint32		topicId	=	message.value(0).toUInt32();
+			
+			{
+				QMutexLocker	subscriptionLocker(&m_subscriptionLock);
+				
+				// Unsubscribed while the message was on its way
+				if(!m_subscriptions.contains(topicId))
+					break;
+			}
+			
+			if(message.count() < 2)
+				break;
+			
+			const QByteArray	slot(message.at(1).toUtf8());
 			
-			m_receivingCallSlot.clear();
-// 			qDebug("END package received: clearing");
-			m_receivingCallArgs.clear();
+			invokeSlot(m_callReceiver, slot, message.mid(2));
+		}break;
+		
+		/*
+		 * SHAPE package (precedes the first map of the shape)
+		 */
+		case PKG_TYPE_SHAPE:
+		{
+			if(!m_shapes->define(package, priority))
+				qWarning("MessageBus: Invalid map shape received");
 		}break;
 		
 		/*
@@ -458,12 +1830,234 @@ void MessageBus::handlePackage(Variant package)
 //  			qDebug("PARAM package received");
 			package.setOptionalId(0);
 			
-			m_receivingCallArgs.append(package);
+			receivingCall.size	+=	package.size();
+			receivingCall.args.append(package);
 		}break;
 	}
 }
 
 
+void MessageBus::dispatchCall(LocalSocket::Priority priority)
+{
+	ReceivingCall&	receivingCall	=	m_receivingCall[priority];
+	
+	const quint32	objectId	=	receivingCall.objectId;
+	receivingCall.objectId	=	0;
+	
+	// Typed method: the dispatcher decodes the arguments and queues the call
+	if(receivingCall.methodId)
+	{
+		const quint32	methodId	=	receivingCall.methodId;
+		receivingCall.methodId	=	0;
+		
+		MessageBusMethodDispatcher	dispatcher	=	0;
+		QObject	*	receiver	=	m_objects->method(methodId, &dispatcher);
+		
+		if(!receiver)
+			qWarning("MessageBus: Call to unregistered method 0x%08X", methodId);
+		else if(!dispatcher(receiver, this, receivingCall.args))
+			qWarning("MessageBus: Call to method 0x%08X with wrong arguments", methodId);
+		
+		receivingCall.args.clear();
+		return;
+	}
+	
+	if(receivingCall.slot.isEmpty())
+	{
+// 		qDebug("END package received: empty call slot!");
+		receivingCall.args.clear();
+		return;
+	}
+	
+	// Look up the addressed object
+	QObject	*	receiver	=	m_callReceiver;
+	if(objectId)
+	{
+		receiver	=	m_objects->receiver(objectId);
+		
+		if(!receiver)
+		{
+			qWarning("MessageBus: Call to unregistered object 0x%08X", objectId);
+			receivingCall.slot.clear();
+			receivingCall.args.clear();
+			return;
+		}
+	}
+	
+	// Call
+	invokeSlot(receiver, receivingCall.slot, receivingCall.args);
+	
+	receivingCall.slot.clear();
+// 	qDebug("END package received: clearing");
+	receivingCall.args.clear();
+}
+
+
+void MessageBus::invokeSlot(QObject* receiver, const QByteArray& slot, const QList<Variant>& args)
+{
+	if(invokeStructSlot(receiver, slot, args))
+		return;
+	
+	if(args.count() == 0)
+		callSlotQueued(receiver, slot.constData(), Q_ARG(MessageBus*, this));
+	else if(args.count() == 1)
+		callSlotQueued(receiver, slot.constData(), Q_ARG(MessageBus*, this), Q_ARG(Variant, args.at(0)));
+	else if(args.count() == 2)
+		callSlotQueued(receiver, slot.constData(), Q_ARG(MessageBus*, this), Q_ARG(Variant, args.at(0)), Q_ARG(Variant, args.at(1)));
+	else if(args.count() == 3)
+		callSlotQueued(receiver, slot.constData(), Q_ARG(MessageBus*, this), Q_ARG(Variant, args.at(0)), Q_ARG(Variant, args.at(1)), Q_ARG(Variant, args.at(2)));
+	else if(args.count() == 4)
+		callSlotQueued(receiver, slot.constData(), Q_ARG(MessageBus*, this), Q_ARG(Variant, args.at(0)), Q_ARG(Variant, args.at(1)), Q_ARG(Variant, args.at(2)), Q_ARG(Variant, args.at(3)));
+	else
+		qWarning("MessageBus: Too many arguments!");
+}
+
+
+bool MessageBus::invokeStructSlot(QObject* receiver, const QByteArray& slot, const QList<Variant>& args)
+{
+	// Structs are sent as List, other calls don't need to look at the slots
+	bool	hasList	=	false;
+	for(int i = 0; i < args.count(); i++)
+		hasList	|=	(args.at(i).type() == Variant::List);
+	
+	if(!hasList || args.count() > 4)
+		return false;
+	
+	// Name of the slot (like callSlot())
+	int		begin	=	0;
+	while(begin < slot.size() && slot.at(begin) >= '0' && slot.at(begin) <= '9')
+		begin++;
+	
+	int		end		=	slot.indexOf('(', begin);
+	const QByteArray	name(slot.mid(begin, (end < 0 ? -1 : end - begin)).trimmed());
+	
+	// Methods taking structs are looked up once per class and slot
+	const QMetaObject	*	meta			=	receiver->metaObject();
+	const QVector<int>		methods		=	VariantStruct::structSlots(meta, name);
+	const int						variantId	=	qMetaTypeId<Variant>();
+	
+	for(int i = 0; i < methods.count(); i++)
+	{
+		QMetaMethod		method(meta->method(methods.at(i)));
+		
+		if(method.parameterCount() != args.count() + 1)
+			continue;
+		
+		// Decode into values of the parameter types (copied by the queued call)
+		void							*	values[4]		=	{0, 0, 0, 0};
+		QGenericArgument		arguments[4];
+		bool									decoded			=	true;
+		
+		for(int p = 0; p < args.count(); p++)
+		{
+			const int		type	=	method.parameterType(p + 1);
+			
+			if(type == variantId)
+			{
+				arguments[p]	=	Q_ARG(Variant, args.at(p));
+				continue;
+			}
+			
+			values[p]			=	QMetaType::create(type);
+			arguments[p]	=	QGenericArgument(QMetaType::typeName(type), values[p]);
+			decoded				&=	VariantStruct::decoder(type)(args.at(p), values[p]);
+		}
+		
+		if(decoded)
+			method.invoke(receiver, Qt::QueuedConnection, Q_ARG(MessageBus*, this), arguments[0], arguments[1], arguments[2], arguments[3]);
+		else
+			qWarning("MessageBus: Parameters of %s don't match the struct", name.constData());
+		
+		for(int p = 0; p < args.count(); p++)
+		{
+			if(values[p])
+				QMetaType::destroy(method.parameterType(p + 1), values[p]);
+		}
+		
+		return true;
+	}
+	
+	return false;
+}
+
+
+bool MessageBus::publishPackage(const Variant& package)
+{
+	QMutexLocker	publishLocker(&m_publishLock);
+	
+	m_publishQueue.append(package);
+	m_publishQueueSize	+=	package.size();
+	
+	// The socket is only written in its own thread, the root bus writes the queues of its channels too
+	MessageBus	*	root	=	(m_root ? m_root.data() : this);
+	
+	if(QThread::currentThread() == root->thread())
+		writePublishQueue();
+	else if(!m_publishFlushQueued)
+	{
+		m_publishFlushQueued	=	true;
+		callSlotQueued(root, "onDataWritten");
+	}
+	
+	// Slow subscriber: The socket is full and the queue exceeds its limit too
+	if(m_maxQueuedBytes > 0 && m_publishQueueSize > m_maxQueuedBytes)
+	{
+		switch(m_slowSubscriberPolicy)
+		{
+			case DropOldest:
+				while(m_publishQueue.count() > 1 && m_publishQueueSize > m_maxQueuedBytes)
+					m_publishQueueSize	-=	m_publishQueue.takeFirst().size();
+				break;
+				
+			case DropNewest:
+				m_publishQueueSize	-=	m_publishQueue.takeLast().size();
+				break;
+				
+			case DisconnectSubscriber:
+				m_publishQueue.clear();
+				m_publishQueueSize	=	0;
+				
+				// Disconnect in the thread of the bus
+				callSlotQueued(this, "onSlowSubscriber");
+				return false;
+		}
+	}
+	
+	return true;
+}
+
+
+void MessageBus::writePublishQueue()
+{
+	QReadLocker		socketLocker(&m_socketLock);
+	
+	while(m_peerSocket && !m_publishQueue.isEmpty())
+	{
+		// Leave the rest queued, so the slow subscriber policy can be applied
+		if(m_maxQueuedBytes > 0 && m_peerSocket->dataToWrite() >= m_maxQueuedBytes)
+			break;
+		
+		// The data stays shared with the other subscribers (unless it is converted for an older peer)
+		Variant		package(addressPackage(m_publishQueue.first()));
+		
+		bool	wouldBlock	=	false;
+		if(!m_peerSocket->tryWrite(package, &wouldBlock))
+		{
+			// Retried when the socket has written data
+			if(wouldBlock)
+				break;
+			
+			m_publishQueue.clear();
+			m_publishQueueSize	=	0;
+			break;
+		}
+		
+		m_publishQueueSize	-=	m_publishQueue.first().size();
+		m_publishQueue.removeFirst();
+	}
+}
+
+
 int __init_MessageBus()
 {
 	qRegisterMetaType<MessageBus*>("MessageBus*");
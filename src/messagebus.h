@@ -23,43 +23,232 @@
 #include <QList>
 #include <QReadWriteLock>
 #include <QWaitCondition>
+#include <QPair>
+#include <QHash>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QSet>
 
 #include "variant.h"
 #include "localsocket.h"
 #include "localserver.h"
+#include "tcpserver.h"
 #include "tsqueue.h"
+#include "messagebusmethod.h"
+
+class ObjectTable;
+class TopicTable;
+class MapShapes;
 
 class MessageBus : public QObject
 {
 	Q_OBJECT
 	
 	public:
+		// What to do with messages published to a subscriber that does not keep up
+		enum SlowSubscriberPolicy
+		{
+			DropOldest,
+			DropNewest,
+			DisconnectSubscriber
+		};
+		
 		MessageBus(QObject * callReceiver);
 		
 		~MessageBus();
 		
 		bool connectToServer(const QString& filename);
 		
+		/**
+			@brief Serves the connection \a socketDescriptor accepted by another process.
+			
+			The bus takes ownership of the descriptor and acts as the accepting side, like the
+			buses of clientConnected().
+		*/
+		bool setSocketDescriptor(quintptr socketDescriptor);
+		
+		/**
+			@brief Hands the listening socket and all clients over to another process.
+			
+			Used to restart a service without disconnecting its clients: the new process calls
+			acceptHandover() with \a filename, then the old process calls handOver(). Every client
+			is passed on with its socket descriptor and the state of its connection (partially
+			received data and calls, flow control credits and subscriptions). Clients with
+			channels cannot be handed over and stay connected to this process. Buses listening
+			for TCP connections cannot be handed over, handOver() fails for them.
+			
+			Returns false if the listening socket could not be handed over.
+		*/
+		bool handOver(const QString& filename, int timeout = 30000);
+		
+		// Take over the listening socket and the clients of a process calling handOver()
+		bool acceptHandover(const QString& filename);
+		
 		void disconnectFromServer();
 		
+		// Addresses like "tcp://0.0.0.0:4000" listen for TCP connections
 		bool listen(const QString& filename);
 		
 		bool isOpen() const;
     
     QString lastErrorMessage() const;
 		
+		/**
+			@brief Limits the write buffer of the connection.
+			
+			While the write buffer is above the high water mark call() blocks until the
+			peer has read enough data. Use isWritable() and writable() to shed load
+			instead. The marks are passed on to clients of a listening bus.
+			
+			@see LocalSocket::setHighWaterMark()
+		*/
+		void setHighWaterMark(qint64 bytes, int messages = 0);
+		
+		void setLowWaterMark(qint64 bytes, int messages = 0);
+		
+		bool isWritable() const;
+		
+		// Number of bytes waiting to be written to the peer
+		qint64 dataToWrite() const;
+		
+		/**
+			@brief Enables credit based flow control for calls received by this bus.
+			
+			The peer may only send as many calls (and bytes) as have been granted.
+			Credits are replenished once the bus dispatched a call to its receiver:
+			for a receiver living in the thread of the bus that is after its slot
+			returned, a receiver in another thread gets the calls queued and its
+			event queue is not bounded by the window. Peers which exceed their
+			credits are disconnected. A value of 0 disables the window.
+			
+			Must be set before connecting or listening. Clients of a listening bus inherit the window.
+			
+			@note A receiver that calls back into the sender from within a slot needs a window large
+			enough for the calls in flight in both directions.
+		*/
+		void setReceiveWindow(int calls, qint64 bytes = 0);
+		
+		/**
+			@brief Opens a logical channel to the peer over the connection of this bus.
+			
+			A channel is a MessageBus of its own sharing the socket of this bus: calls keep
+			their order within the channel, are delivered to \a callReceiver and have their own
+			flow control window (inherited from this bus). The peer is notified by channelOpened().
+			Close the channel with disconnectFromServer().
+			
+			Returns 0 if this bus is not connected or the peer does not support channels.
+		*/
+		MessageBus * openChannel(QObject * callReceiver);
+		
+		// Id of the channel (0 for a bus owning its socket)
+		quint16 channelId() const;
+		
+		void setCallReceiver(QObject * callReceiver);
+		
+		/**
+			@brief Registers \a receiver for calls addressed to the object \a path.
+			
+			Calls are routed by objectId(path), so no strings are compared per call. A listening
+			bus shares its objects with all its clients. Fails if another path with the same id is
+			registered (until it is unregistered by unregisterObject()).
+		*/
+		bool registerObject(const QString& path, QObject * receiver);
+		
+		void unregisterObject(const QString& path);
+		
+		// Id of an object path (stable across processes)
+		static quint32 objectId(const QString& path);
+		
+		/**
+			@brief Registers \a receiver for the typed method \a Method (see MSGBUS_METHOD).
+			
+			Calls of the method are routed by its id and decoded without looking up the slot in
+			the meta object. A listening bus shares its methods with all its clients.
+		*/
+		template<typename Method>
+		void registerMethod(typename Method::Receiver * receiver)
+		{
+			registerMethodHelper(Method::id, receiver, &Method::dispatch);
+		}
+		
+		/**
+			@brief Calls the typed method \a Method of the receiver registered by the peer.
+			
+			The arguments are checked against the parameters of the method at compile time.
+			Fails if the peer does not support method ids.
+		*/
+		template<typename Method, typename... Args>
+		bool invoke(const Args&... args)
+		{
+			return callHelper(0, Variant(Method::id), Method::encode(args...), LocalSocket::NormalPriority);
+		}
+		
+		// Like call(), but the parameters are moved to the socket instead of being shared
+		bool call(const QString& slot, QList<Variant>&& paramList, LocalSocket::Priority priority = LocalSocket::NormalPriority);
+		
+		/**
+			@brief Limits the messages queued for a subscriber which does not read fast enough.
+			
+			Once the socket of a subscriber holds \a maxQueuedBytes bytes, published messages are
+			queued by the bus. If that queue exceeds \a maxQueuedBytes too, \a policy is applied.
+			A value of 0 disables the limit. Clients of a listening bus inherit the policy.
+		*/
+		void setSlowSubscriberPolicy(SlowSubscriberPolicy policy, qint64 maxQueuedBytes);
+		
+		// Subscribe to the messages the peer publishes to \a topic
+		bool subscribe(const QString& topic);
+		
+		bool unsubscribe(const QString& topic);
+		
+		/**
+			@brief Calls \a slot of the call receivers of all peers subscribed to \a topic.
+			
+			The message is serialized once and the same data is written to every subscriber.
+			May be called from any thread: subscribers served by other threads are written to in
+			their own thread.
+			Published messages are neither acknowledged nor flow controlled, use
+			setSlowSubscriberPolicy() to bound the memory. A listening bus publishes to all its
+			clients. Returns the number of subscribers the message was queued for.
+		*/
+		int publish(const QString& topic, const QString& slot, const QList<Variant>& paramList);
+		
 	public slots:
 		void deleteLater();
 		
-		bool call(const QString& slot, const QList<Variant>& paramList);
+		/**
+			@brief Calls \a slot of the peer's call receiver.
+			
+			Calls with LocalSocket::HighPriority overtake queued normal calls on both the
+			sending and the receiving side, e.g. for heartbeats or cancel requests during bulk
+			transfers. Peers not supporting priorities receive all calls with normal priority.
+		*/
+		bool call(const QString& slot, const QList<Variant>& paramList, LocalSocket::Priority priority = LocalSocket::NormalPriority);
 		
 		bool call(const QString& slot, const Variant& param1 = Variant(), const Variant& param2 = Variant(), const Variant& param3 = Variant(), const Variant& param4 = Variant(), const Variant& param5 = Variant());
 		
+		// Calls \a slot of the object registered by the peer with the id \a objectId
+		bool callObject(quint32 objectId, const QString& slot, const QList<Variant>& paramList, LocalSocket::Priority priority = LocalSocket::NormalPriority);
+		
+		bool callObject(const QString& path, const QString& slot, const QList<Variant>& paramList, LocalSocket::Priority priority = LocalSocket::NormalPriority);
+		
 	signals:
 		void clientConnected(MessageBus * bus);
 		
 		void disconnected();
 		
+		// The write buffer drained below the low water mark
+		void writable();
+		
+		/**
+			@brief The peer opened a channel.
+			
+			The channel is owned by this bus. Calls on the channel are delivered to the call
+			receiver of this bus unless setCallReceiver() is called from a directly connected slot.
+		*/
+		void channelOpened(MessageBus * channel);
+		
 	private slots:
 		void onNewClient(quintptr socketDescriptor);
 		
@@ -67,12 +256,105 @@ class MessageBus : public QObject
 		
 		void onNewPackage();
 		
+		void onCallDispatched(qint64 size);
+		
+		void onChannelOpened(MessageBus * channel);
+		
+		void onDataWritten();
+		
+		void onSlowSubscriber();
+		
+		// Called by the process handing over its connections
+		void adoptServer(MessageBus * bus, const Variant& socketDescriptor);
+		
+		void adoptClient(MessageBus * bus, const Variant& socketDescriptor, const Variant& state);
+		
 	private:
-		bool writeHelper(const Variant& package);
+		void setupSocket(LocalSocket * socket);
 		
-		bool checkAckPackage();
+		// Pass the settings of a listening bus on to a client
+		void inheritSettings(MessageBus * bus) const;
 		
-		void handlePackage(Variant package);
+		// Detach the connection for handOver() (see LocalSocket::detach())
+		Variant detachConnection(Variant * state, int timeout);
+		
+		bool attachConnection(const Variant& socketDescriptor, const Variant& state);
+		
+		// \a target is the name of the slot or the id of a typed method
+		bool callHelper(quint32 objectId, const Variant& target, const QList<Variant>& paramList, LocalSocket::Priority priority);
+		
+		// Like above, the parameters are moved out of \a paramList instead of being shared
+		bool callHelper(quint32 objectId, const Variant& target, QList<Variant>&& paramList, LocalSocket::Priority priority);
+		
+		// Parameters of a const \a List are copied (sharing their data), the others are moved
+		template<typename List>
+		bool sendCall(quint32 objectId, const Variant& target, List& paramList, LocalSocket::Priority priority);
+		
+		void registerMethodHelper(quint32 methodId, QObject * receiver, MessageBusMethodDispatcher dispatcher);
+		
+		bool writeHelper(const Variant& package, LocalSocket::Priority priority = LocalSocket::NormalPriority);
+		
+		// Add the channel id and encode Maps and Lists for the peer
+		Variant addressPackage(const Variant& package) const;
+		
+		// Lane for ACK and CREDIT packages
+		LocalSocket::Priority controlPriority() const;
+		
+		// Wait for the ACK of the current call
+		bool waitForAck();
+		
+		// Read available packages from the (shared) socket and pass them on to the bus of their channel
+		void routeAvailablePackages(LocalSocket * socket, int timeout);
+		
+		/**
+			@brief Passes \a package on to the bus of its channel.
+			
+			Returns true if \a handleInline is set and the package is to be handled by this bus
+			right away (after the route lock has been released). The channels of packages to be
+			acknowledged are appended to \a acks, write them with writeAcks() once the route lock
+			has been released.
+		*/
+		bool routePackage(Variant& package, LocalSocket::Priority priority, bool handleInline, QList<quint16> * acks);
+		
+		// Acknowledge calls of the channels \a channelIds
+		void writeAcks(const QList<quint16>& channelIds);
+		
+		// Wait for the first CREDIT package announcing the features of the peer, gives up on old peers after FEATURES_TIMEOUT
+		bool waitForPeerFeatures();
+		
+		// Wait up to \a timeout ms without giving up on the features
+		bool waitForPeerFeatures(int timeout);
+		
+		// Share the socket of this bus with \a channel (m_channelLock must be locked)
+		void attachChannel(MessageBus * channel, quint16 id);
+		
+		void removeChannel(MessageBus * channel);
+		
+		// Wait until the peer granted credits for another call of \a callSize bytes and take them
+		bool waitForCredits(qint64 callSize);
+		
+		// Grant the peer credits for more calls
+		bool sendCredits(int calls, qint64 bytes);
+		
+		bool isReceiveWindowFull() const;
+		
+		void handleCreditPackage(const Variant& package);
+		
+		void handlePackage(Variant package, LocalSocket::Priority priority);
+		
+		// Invoke the slot of the completely received call
+		void dispatchCall(LocalSocket::Priority priority);
+		
+		void invokeSlot(QObject * receiver, const QByteArray& slot, const QList<Variant>& args);
+		
+		// Call a slot taking structs registered with VariantStruct, false if there is none
+		bool invokeStructSlot(QObject * receiver, const QByteArray& slot, const QList<Variant>& args);
+		
+		// Queue a published message for the peer, returns false if the peer has been dropped
+		bool publishPackage(const Variant& package);
+		
+		// Write queued published messages while the socket has room (m_publishLock must be locked)
+		void writePublishQueue();
 
 	private:
     QString               m_lastError;
@@ -80,11 +362,85 @@ class MessageBus : public QObject
 		
 		mutable QReadWriteLock				m_socketLock;
 		LocalServer					*	m_server;
+		TcpServer						*	m_tcpServer;
 		LocalSocket					*	m_peerSocket;
+		// Clients of a listening bus
+		QList< QPointer<MessageBus> >	m_clients;
+		// Receives connections handed over by another process
+		MessageBus					*	m_handoverBus;
+		
+		// Water marks of the write buffer
+		qint64								m_highWaterBytes;
+		int										m_highWaterMessages;
+		qint64								m_lowWaterBytes;
+		int										m_lowWaterMessages;
+		
+		// Features announced by the peer
+		quint32								m_peerFeatures;
+		
+		// Channels: bus owning the socket and id of this channel (0 if this bus owns the socket)
+		QPointer<MessageBus>	m_root;
+		quint16								m_channelId;
+		bool									m_ownedByRoot;
+		// Channels sharing the socket of this bus
+		mutable QReadWriteLock				m_channelLock;
+		QHash<quint16, MessageBus*>		m_channels;
+		quint16								m_nextChannelId;
+		// Reading and routing packages of the shared socket
+		QMutex								m_routeLock;
+		// ACKs received for calls of this bus
+		QAtomicInt						m_ackCount;
+		
+		// Registered receivers by object id
+		QSharedPointer<ObjectTable>		m_objects;
+		
+		// Topics: subscribers of the messages published by this bus and topics subscribed at the peer
+		QSharedPointer<TopicTable>		m_topics;
+		// Key sets of the maps exchanged with the peer
+		QSharedPointer<MapShapes>			m_shapes;
+		mutable QMutex								m_subscriptionLock;
+		QSet<quint32>									m_subscriptions;
+		// Published messages not yet written to the socket
+		QMutex									m_publishLock;
+		QList<Variant>					m_publishQueue;
+		qint64									m_publishQueueSize;
+		// The root bus has been asked to write the queue in the thread of the socket
+		bool									m_publishFlushQueued;
+		SlowSubscriberPolicy		m_slowSubscriberPolicy;
+		qint64									m_maxQueuedBytes;
+		
+		// Flow control: credits granted by the peer (taken by concurrent callers)
+		QMutex									m_creditLock;
+		bool									m_peerSupportsCredits;
+		// Old peers don't send credits, known once they acknowledged a call or after FEATURES_TIMEOUT
+		bool									m_peerFeaturesMissing;
+		bool									m_sendFlowControlled;
+		bool									m_sendByteLimited;
+		int										m_sendCallCredits;
+		qint64								m_sendByteCredits;
+		// Flow control: window of this bus and credits granted to the peer
+		int										m_receiveWindowCalls;
+		qint64								m_receiveWindowBytes;
+		int										m_grantedCalls;
+		qint64								m_grantedBytes;
+		// Received calls not yet dispatched and credits not yet granted again
+		int										m_pendingCalls;
+		qint64								m_pendingBytes;
+		int										m_ungrantedCalls;
+		qint64								m_ungrantedBytes;
 		
-		// Received values
-		QByteArray								m_receivingCallSlot;
-		QList<Variant>						m_receivingCallArgs;
+		// Call currently received (one per lane, as calls of different lanes interleave)
+		struct ReceivingCall
+		{
+			QByteArray							slot;
+			QList<Variant>					args;
+			qint64									size;
+			// Registered object the call is addressed to (0 for the call receiver)
+			quint32									objectId;
+			// Typed method called instead of a slot (0 for slots)
+			quint32									methodId;
+		};
+		ReceivingCall							m_receivingCall[LocalSocket::NormalPriority + 1];
 		// Received file descriptors
 // 		QList<quintptr /* uid */>						m_awaitingCallFileDescriptors;
 		QList<quintptr /* file descriptor */>	m_receivingCallFileDescriptors;
@@ -92,7 +448,7 @@ class MessageBus : public QObject
 // 		QReadWriteLock											m_fileDescriptorsLock;
 // 		QWaitCondition											m_receivingCallFileDescriptorsChanged;
 		
-		TsQueue<Variant>				m_tmpReadBuffer;
+		TsQueue< QPair<Variant, LocalSocket::Priority> >	m_tmpReadBuffer;
 };
 
 #endif // MESSAGEBUS_H
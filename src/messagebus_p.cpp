@@ -24,12 +24,405 @@
 
 #include "variant.h"
 
+// Shapes per lane, maps of further shapes are sent with their keys
+#define MAX_MAP_SHAPES	1024
+
 QString socketName(const QString& service, const QString& object)
 {
 	return QString("%1.%2").arg(service).arg(object).replace(QRegExp("[^a-zA-Z0-9_]"), "_");
 }
 
 
+quint32 objectPathId(const QString& path)
+{
+	const QByteArray	data(path.toUtf8());
+	quint32						hash	=	2166136261u;
+	
+	for(int i = 0; i < data.size(); i++)
+	{
+		hash	^=	quint8(data.at(i));
+		hash	*=	16777619u;
+	}
+	
+	// Id 0 stands for the call receiver of the bus
+	return (hash ? hash : 1);
+}
+
+
+bool ObjectTable::insert(quint32 id, const QString& path, QObject* receiver)
+{
+	QWriteLocker	locker(&m_lock);
+	
+	QHash<quint32, Entry>::iterator	it	=	m_entries.find(id);
+	
+	// Collision: ids are sent instead of paths, so they must be unique
+	// (even if the receiver is gone, calls for the other path would reach the new one)
+	if(it != m_entries.end() && it->path != path)
+		return false;
+	
+	Entry	entry;
+	entry.path			=	path;
+	entry.receiver	=	receiver;
+	m_entries.insert(id, entry);
+	
+	return true;
+}
+
+
+void ObjectTable::remove(quint32 id, const QString& path)
+{
+	QWriteLocker	locker(&m_lock);
+	
+	QHash<quint32, Entry>::iterator	it	=	m_entries.find(id);
+	
+	if(it != m_entries.end() && it->path == path)
+		m_entries.erase(it);
+}
+
+
+QObject * ObjectTable::receiver(quint32 id) const
+{
+	QReadLocker		locker(&m_lock);
+	
+	return m_entries.value(id).receiver.data();
+}
+
+
+void ObjectTable::insertMethod(quint32 id, QObject* receiver, MessageBusMethodDispatcher dispatcher)
+{
+	QWriteLocker	locker(&m_lock);
+	
+	Method	method;
+	method.receiver		=	receiver;
+	method.dispatcher	=	dispatcher;
+	m_methods.insert(id, method);
+}
+
+
+QObject * ObjectTable::method(quint32 id, MessageBusMethodDispatcher* dispatcher) const
+{
+	QReadLocker		locker(&m_lock);
+	
+	QHash<quint32, Method>::const_iterator	it	=	m_methods.constFind(id);
+	if(it == m_methods.constEnd() || it->receiver.isNull())
+		return 0;
+	
+	*dispatcher	=	it->dispatcher;
+	return it->receiver.data();
+}
+
+
+Variant MapShapes::compress(const Variant& map, LocalSocket::Priority lane, Variant* definition)
+{
+	QByteArray	keys;
+	QByteArray	values;
+	
+	// A received Map passed on is encoded with its keys again
+	if(!split(map.compactData(), &keys, &values))
+		return Variant();
+	
+	QMutexLocker	locker(&m_lock);
+	
+	QHash<QByteArray, quint32>&									sent	=	m_lanes[lane].sent;
+	QHash<QByteArray, quint32>::const_iterator	it		=	sent.constFind(keys);
+	quint32		id;
+	
+	if(it != sent.constEnd())
+		id	=	it.value();
+	else
+	{
+		if(sent.count() >= MAX_MAP_SHAPES)
+			return Variant();
+		
+		id	=	quint32(sent.count());
+		sent.insert(keys, id);
+		
+		*definition	=	Variant(QList<Variant>() << Variant(id) << Variant(keys));
+	}
+	
+	QByteArray	data;
+	data.reserve(values.size() + 9);
+	Variant::writeIntelligentNumber(data, id);
+	data.append(values);
+	
+	return Variant(data, Variant::Map);
+}
+
+
+bool MapShapes::define(const Variant& definition, LocalSocket::Priority lane)
+{
+	QList<Variant>	values(definition.toList());
+	Keys						keys;
+	
+	if(values.count() < 2 || !(keys = parseKeys(values.at(1).toByteArray())))
+		return false;
+	
+	const quint32	id	=	values.at(0).toUInt32();
+	
+	QMutexLocker	locker(&m_lock);
+	
+	QHash<quint32, Keys>&		received	=	m_lanes[lane].received;
+	
+	if(received.count() >= MAX_MAP_SHAPES && !received.contains(id))
+		return false;
+	
+	received.insert(id, keys);
+	return true;
+}
+
+
+Variant MapShapes::expand(const Variant& shaped, LocalSocket::Priority lane, bool* ok) const
+{
+	const char	*	source	=	shaped.m_data.constData();
+	const int			size		=	shaped.m_data.size();
+	int						idx			=	0;
+	bool					valid		=	true;
+	
+	const quint64	id	=	Variant::readIntelligentNumber(source, size, idx, &valid);
+	Keys					keys;
+	
+	{
+		QMutexLocker	locker(&m_lock);
+		keys	=	m_lanes[lane].received.value(quint32(id));
+	}
+	
+	if(!valid || !keys)
+	{
+		if(ok)
+			(*ok)	=	false;
+		return Variant();
+	}
+	
+	// One value per key, the keys themselves are not copied into the Map
+	const int		valuesBegin	=	idx;
+	
+	for(int i = 0; valid && i < keys->strings.count(); i++)
+	{
+		quint8			type;
+		int					begin, end;
+		
+		valid	=	Variant::locateCompactItem(source, size, idx, type, begin, end);
+	}
+	
+	valid	=	(valid && idx == size);
+	
+	if(ok)
+		(*ok)	=	valid;
+	
+	return (valid ? Variant::fromShape(keys, shaped.m_data.mid(valuesBegin)) : Variant());
+}
+
+
+void MapShapes::clear()
+{
+	QMutexLocker	locker(&m_lock);
+	
+	for(int i = LocalSocket::HighPriority; i <= LocalSocket::NormalPriority; i++)
+	{
+		m_lanes[i].sent.clear();
+		m_lanes[i].received.clear();
+	}
+}
+
+
+Variant MapShapes::state() const
+{
+	QMutexLocker	locker(&m_lock);
+	
+	QList<Variant>	lanes;
+	for(int i = LocalSocket::HighPriority; i <= LocalSocket::NormalPriority; i++)
+	{
+		QList<Variant>	sent;
+		for(QHash<QByteArray, quint32>::const_iterator it = m_lanes[i].sent.constBegin(); it != m_lanes[i].sent.constEnd(); ++it)
+			sent << Variant(it.key()) << Variant(it.value());
+		
+		QList<Variant>	received;
+		for(QHash<quint32, Keys>::const_iterator it = m_lanes[i].received.constBegin(); it != m_lanes[i].received.constEnd(); ++it)
+			received << Variant(it.key()) << Variant(it.value()->encoded);
+		
+		lanes.append(Variant(QList<Variant>() << Variant(sent) << Variant(received)));
+	}
+	
+	return Variant(lanes);
+}
+
+
+void MapShapes::restoreState(const Variant& state)
+{
+	QList<Variant>	lanes(state.toList());
+	
+	QMutexLocker	locker(&m_lock);
+	
+	for(int i = LocalSocket::HighPriority; i <= LocalSocket::NormalPriority; i++)
+	{
+		QList<Variant>	fields(lanes.value(i).toList());
+		Lane&						lane	=	m_lanes[i];
+		
+		lane.sent.clear();
+		lane.received.clear();
+		
+		QList<Variant>	sent(fields.value(0).toList());
+		for(int j = 0; j + 1 < sent.count(); j += 2)
+			lane.sent.insert(sent.at(j).toByteArray(), sent.at(j + 1).toUInt32());
+		
+		QList<Variant>	received(fields.value(1).toList());
+		for(int j = 0; j + 1 < received.count(); j += 2)
+		{
+			Keys	keys(parseKeys(received.at(j + 1).toByteArray()));
+			if(keys)
+				lane.received.insert(received.at(j).toUInt32(), keys);
+		}
+	}
+}
+
+
+bool MapShapes::split(const QByteArray& data, QByteArray* keys, QByteArray* values)
+{
+	const char	*	source	=	data.constData();
+	const int			size		=	data.size();
+	int						idx			=	0;
+	bool					ok			=	true;
+	
+	const quint64	count	=	Variant::readIntelligentNumber(source, size, idx, &ok);
+	
+	// Nothing to save for empty maps
+	if(!ok || count == 0 || count > quint64(size))
+		return false;
+	
+	keys->append(source, idx);
+	values->reserve(size - idx);
+	
+	for(quint64 i = 0; i < count; i++)
+	{
+		const int			keyBegin	=	idx;
+		const quint64	keySize		=	Variant::readIntelligentNumber(source, size, idx, &ok);
+		
+		if(!ok || keySize > quint64(size - idx))
+			return false;
+		
+		idx	+=	int(keySize);
+		keys->append(source + keyBegin, idx - keyBegin);
+		
+		const int		itemBegin	=	idx;
+		quint8			type;
+		int					begin, end;
+		
+		if(!Variant::locateCompactItem(source, size, idx, type, begin, end))
+			return false;
+		
+		values->append(source + itemBegin, idx - itemBegin);
+	}
+	
+	return (idx == size);
+}
+
+
+MapShapes::Keys MapShapes::parseKeys(const QByteArray& encoded)
+{
+	const char	*	source	=	encoded.constData();
+	const int			size		=	encoded.size();
+	int						idx			=	0;
+	bool					ok			=	true;
+	
+	const quint64	count	=	Variant::readIntelligentNumber(source, size, idx, &ok);
+	
+	if(!ok || count == 0 || count > quint64(size))
+		return Keys();
+	
+	QSharedPointer<Variant::MapKeys>	keys(new Variant::MapKeys());
+	keys->encoded	=	encoded;
+	keys->ends.reserve(int(count) + 1);
+	keys->ends.append(idx);
+	keys->strings.reserve(int(count));
+	
+	for(quint64 i = 0; i < count; i++)
+	{
+		const quint64	keySize		=	Variant::readIntelligentNumber(source, size, idx, &ok);
+		
+		if(!ok || keySize > quint64(size - idx))
+			return Keys();
+		
+		keys->strings.append(QString::fromUtf8(source + idx, int(keySize)));
+		idx	+=	int(keySize);
+		keys->ends.append(idx);
+	}
+	
+	if(idx != size)
+		return Keys();
+	
+	return keys;
+}
+
+
+void TopicTable::subscribe(quint32 topicId, MessageBus* bus)
+{
+	QWriteLocker	locker(&m_lock);
+	
+	QList<MessageBus*>&	subscribers	=	m_subscribers[topicId];
+	
+	if(!subscribers.contains(bus))
+		subscribers.append(bus);
+}
+
+
+void TopicTable::unsubscribe(quint32 topicId, MessageBus* bus)
+{
+	QWriteLocker	locker(&m_lock);
+	
+	QHash<quint32, QList<MessageBus*> >::iterator	it	=	m_subscribers.find(topicId);
+	if(it == m_subscribers.end())
+		return;
+	
+	it->removeAll(bus);
+	if(it->isEmpty())
+		m_subscribers.erase(it);
+}
+
+
+void TopicTable::unsubscribeAll(MessageBus* bus)
+{
+	QWriteLocker	locker(&m_lock);
+	
+	QHash<quint32, QList<MessageBus*> >::iterator	it	=	m_subscribers.begin();
+	while(it != m_subscribers.end())
+	{
+		it->removeAll(bus);
+		
+		if(it->isEmpty())
+			it	=	m_subscribers.erase(it);
+		else
+			++it;
+	}
+}
+
+
+QList<quint32> TopicTable::topics(MessageBus* bus)
+{
+	QReadLocker		locker(&m_lock);
+	
+	QList<quint32>	ret;
+	for(QHash<quint32, QList<MessageBus*> >::const_iterator it = m_subscribers.constBegin(); it != m_subscribers.constEnd(); ++it)
+	{
+		if(it->contains(bus))
+			ret.append(it.key());
+	}
+	
+	return ret;
+}
+
+
+QReadWriteLock * TopicTable::lock()
+{
+	return &m_lock;
+}
+
+
+QList<MessageBus*> TopicTable::subscribers(quint32 topicId) const
+{
+	return m_subscribers.value(topicId);
+}
+
+
 QByteArray writeVariant(const Variant& var)
 {
 	QByteArray	pkg;
@@ -21,8 +21,15 @@
 
 #include <QRegExp>
 #include <QString>
+#include <QHash>
+#include <QList>
+#include <QPointer>
+#include <QReadWriteLock>
+#include <QMutex>
+#include <QVector>
 
 #include "localsocket.h"
+#include "messagebusmethod.h"
 #include "global.h"
 
 
@@ -41,6 +48,136 @@ class QLocalSocket;
 
 QString MSGBUS_LOCAL	socketName(const QString& service, const QString& object);
 
+// Stable 32 bit hash (FNV-1a) of the UTF-8 encoded object path (never 0, which addresses the call receiver)
+quint32 MSGBUS_LOCAL	objectPathId(const QString& path);
+
+
+class MessageBus;
+
+/**
+	@brief Receivers registered on a bus, looked up by the id of their object path.
+	
+	Shared by a listening bus, the buses of its clients and their channels.
+*/
+class MSGBUS_LOCAL ObjectTable
+{
+	public:
+		// Returns false if a different path with the same id is registered (until it is removed)
+		bool insert(quint32 id, const QString& path, QObject * receiver);
+		
+		// Only removes the entry if it was registered for \a path
+		void remove(quint32 id, const QString& path);
+		
+		QObject * receiver(quint32 id) const;
+		
+		void insertMethod(quint32 id, QObject * receiver, MessageBusMethodDispatcher dispatcher);
+		
+		// Returns 0 if no receiver of the method \a id is registered
+		QObject * method(quint32 id, MessageBusMethodDispatcher * dispatcher) const;
+		
+	private:
+		struct Entry
+		{
+			QString							path;
+			QPointer<QObject>		receiver;
+		};
+		
+		struct Method
+		{
+			QPointer<QObject>						receiver;
+			MessageBusMethodDispatcher	dispatcher;
+		};
+		
+		mutable QReadWriteLock		m_lock;
+		QHash<quint32, Entry>			m_entries;
+		QHash<quint32, Method>		m_methods;
+};
+
+
+/**
+	@brief Subscribers of topics, by the id of the topic.
+	
+	Shared by a listening bus and the buses of its clients, so publishing on the
+	listening bus reaches all subscribed clients.
+*/
+class MSGBUS_LOCAL TopicTable
+{
+	public:
+		void subscribe(quint32 topicId, MessageBus * bus);
+		
+		void unsubscribe(quint32 topicId, MessageBus * bus);
+		
+		void unsubscribeAll(MessageBus * bus);
+		
+		// Topics \a bus is subscribed to
+		QList<quint32> topics(MessageBus * bus);
+		
+		// Lock for reading while using the subscribers, so they are not deleted meanwhile
+		QReadWriteLock * lock();
+		
+		// lock() must be locked
+		QList<MessageBus*> subscribers(quint32 topicId) const;
+		
+	private:
+		QReadWriteLock													m_lock;
+		QHash<quint32, QList<MessageBus*> >			m_subscribers;
+};
+
+
+/**
+	@brief Key sets of the maps sent to and received from the peer of one bus.
+	
+	The first map with a new set of keys is preceded by a SHAPE package holding its encoded
+	keys, later maps with the same keys are sent as shape id and values only. The receiver
+	converts the keys once per shape and hands out Maps holding the values and sharing the
+	keys (see Variant::fromShape()), toQMap() and VariantMapView don't convert them again.
+	Their size() includes the keys, so credits are the same as without shapes. Lanes don't
+	keep their order relative to each other, so each lane has shapes of its own.
+*/
+class MSGBUS_LOCAL MapShapes
+{
+	public:
+		/**
+			@brief Returns the compact \a map as shape id and values.
+			
+			\a definition is set to the payload of the SHAPE package if the shape is new. Returns
+			an invalid Variant if the map has to be sent as is (e.g. too many shapes).
+		*/
+		Variant compress(const Variant& map, LocalSocket::Priority lane, Variant * definition);
+		
+		// Register the shape of a received SHAPE package
+		bool define(const Variant& definition, LocalSocket::Priority lane);
+		
+		// Restore a map received as shape id and values
+		Variant expand(const Variant& shaped, LocalSocket::Priority lane, bool * ok) const;
+		
+		void clear();
+		
+		// For handing over the connection
+		Variant state() const;
+		
+		void restoreState(const Variant& state);
+		
+	private:
+		typedef QSharedPointer<const Variant::MapKeys>	Keys;
+		
+		struct Lane
+		{
+			// Ids of the shapes sent, by their encoded keys
+			QHash<QByteArray, quint32>		sent;
+			QHash<quint32, Keys>					received;
+		};
+		
+		// Split the compact map \a data into its encoded keys and its encoded values
+		static bool split(const QByteArray& data, QByteArray * keys, QByteArray * values);
+		
+		// Parse and convert the encoded keys of a SHAPE package
+		static Keys parseKeys(const QByteArray& encoded);
+		
+		mutable QMutex		m_lock;
+		Lane							m_lanes[LocalSocket::NormalPriority + 1];
+};
+
 QByteArray MSGBUS_LOCAL	writeVariant(const Variant& var);
 
 Variant MSGBUS_LOCAL	readVariant(const QByteArray& data, int& pos);
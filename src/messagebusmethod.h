@@ -0,0 +1,144 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MESSAGEBUSMETHOD_H
+#define MESSAGEBUSMETHOD_H
+
+#include <QObject>
+#include <QList>
+#include <QMetaObject>
+
+#include <tuple>
+#include <type_traits>
+
+#include "variant.h"
+#include "variantstruct.h"
+
+class MessageBus;
+
+/**
+	@brief Method of a receiver called by MessageBus::invoke().
+	
+	Declares \a method of the class \a Receiver with the method id derived from its name at
+	compile time. The method takes the calling bus as first parameter, like the slots called
+	by MessageBus::call():
+	
+@code
+class Receiver : public QObject
+{
+	public:
+		void onUpdate(MessageBus * bus, qint32 id, const QString& state);
+};
+
+// Receiving process
+bus->registerMethod<MSGBUS_METHOD(Receiver, onUpdate)>(receiver);
+
+// Calling process (a wrong number or type of arguments doesn't compile)
+bus->invoke<MSGBUS_METHOD(Receiver, onUpdate)>(42, QString("running"));
+@endcode
+*/
+#define MSGBUS_METHOD(Receiver, method) \
+	MessageBusMethod<decltype(&Receiver::method), &Receiver::method, messageBusMethodId(#Receiver "::" #method)>
+
+// FNV-1a hash of \a name
+constexpr quint32 messageBusMethodId(const char * name, quint32 hash = 2166136261u)
+{
+	return (*name ? messageBusMethodId(name + 1, (hash ^ quint8(*name)) * 16777619u) : hash);
+}
+
+typedef bool (*MessageBusMethodDispatcher)(QObject * receiver, MessageBus * bus, const QList<Variant>& args);
+
+template<int... I>
+struct MessageBusIndices
+{
+};
+
+// MessageBusIndices<0, ..., N - 1>
+template<int N, int... I>
+struct MessageBusIndexBuilder : MessageBusIndexBuilder<N - 1, N - 1, I...>
+{
+};
+
+template<int... I>
+struct MessageBusIndexBuilder<0, I...>
+{
+	typedef MessageBusIndices<I...>		Type;
+};
+
+template<typename Signature, Signature Method, quint32 Id>
+struct MessageBusMethod;
+
+template<typename R, typename... Params, void (R::*Method)(MessageBus *, Params...), quint32 Id>
+struct MessageBusMethod<void (R::*)(MessageBus *, Params...), Method, Id>
+{
+	static_assert(std::is_base_of<QObject, R>::value, "The receiver has to be a QObject");
+	
+	typedef R		Receiver;
+	
+	static const quint32	id	=	Id;
+	
+	// Each argument is converted to the type of its parameter (checked by the compiler)
+	template<typename... Args>
+	static QList<Variant> encode(const Args&... args)
+	{
+		static_assert(sizeof...(Args) == sizeof...(Params), "Wrong number of arguments");
+		
+		QList<Variant>	ret;
+		ret.reserve(sizeof...(Params));
+		
+		int	expand[]	=	{0, (ret.append(encodeArgument<typename std::decay<Params>::type>(args)), 0)...};
+		Q_UNUSED(expand);
+		
+		return ret;
+	}
+	
+	// Decode \a args and queue the call of the method
+	static bool dispatch(QObject * receiver, MessageBus * bus, const QList<Variant>& args)
+	{
+		return dispatch(static_cast<R*>(receiver), bus, args, typename MessageBusIndexBuilder<sizeof...(Params)>::Type());
+	}
+	
+	private:
+		template<typename P>
+		static Variant encodeArgument(const P& value)
+		{
+			return VariantStruct::toVariant(value);
+		}
+		
+		template<int... I>
+		static bool dispatch(R * receiver, MessageBus * bus, const QList<Variant>& args, MessageBusIndices<I...>)
+		{
+			std::tuple<typename std::decay<Params>::type...>	params;
+			
+			bool	ok				=	(args.count() == int(sizeof...(Params)));
+			int		expand[]	=	{0, (ok = ok && VariantStruct::fromVariant(args.at(I), std::get<I>(params)), 0)...};
+			Q_UNUSED(expand);
+			
+			if(!ok)
+				return false;
+			
+			// Queued like the slots called by MessageBus::call() (functors need Qt 5.10)
+			QMetaObject::invokeMethod(receiver, [receiver, bus, params]() mutable {
+				(receiver->*Method)(bus, std::get<I>(params)...);
+			}, Qt::QueuedConnection);
+			
+			return true;
+		}
+};
+
+#endif // MESSAGEBUSMETHOD_H
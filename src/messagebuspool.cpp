@@ -0,0 +1,447 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "messagebuspool.h"
+#include "messagebuspool_p.h"
+
+#include <QCoreApplication>
+#include <QRunnable>
+#include <QSemaphore>
+#include <string.h>
+
+#include "tools.h"
+
+// Writes one stripe in a thread of the pool
+class StripeWriter : public QRunnable
+{
+	public:
+		StripeWriter(MessageBus * bus, const Variant& header, const QByteArray& data, qint64 offset, qint64 size, QSemaphore * done, QAtomicInt * failed)
+		:	m_bus(bus), m_header(header), m_data(data), m_offset(offset), m_size(size), m_done(done), m_failed(failed)
+		{
+		}
+		
+		virtual void run()
+		{
+			// Copy the stripe in this thread
+			Variant	stripe(m_data.mid(int(m_offset), int(m_size)));
+			
+			if(!m_bus->callObject(QString::fromLatin1(MSGBUS_STRIPE_PATH), "stripe", QList<Variant>() << m_header << stripe))
+				m_failed->ref();
+			
+			m_done->release();
+		}
+		
+	private:
+		MessageBus			*	m_bus;
+		Variant						m_header;
+		QByteArray				m_data;
+		qint64						m_offset;
+		qint64						m_size;
+		QSemaphore			*	m_done;
+		QAtomicInt			*	m_failed;
+};
+
+
+static QAtomicInt		s_nextTransferId;
+
+
+MessageBusPool::MessageBusPool(QObject* callReceiver)
+:	QObject(callReceiver), m_callReceiver(callReceiver)
+{
+}
+
+
+MessageBusPool::~MessageBusPool()
+{
+	disconnectFromServer();
+}
+
+
+bool MessageBusPool::connectToServer(const QString& filename, int connections)
+{
+	QWriteLocker		poolLocker(&m_poolLock);
+	
+	if(!m_connections.isEmpty()) {
+    m_lastError = tr("Already connected");
+		return false;
+  }
+	
+	for(int i = 0; i < qMax(connections, 1); i++)
+	{
+		MessageBus	*	bus	=	new MessageBus(m_callReceiver);
+		
+		if(!bus->connectToServer(filename))
+		{
+      m_lastError = bus->lastErrorMessage();
+			delete bus;
+			
+			foreach(Connection * connection, m_connections)
+			{
+				delete connection->bus;
+				delete connection;
+			}
+			m_connections.clear();
+			return false;
+		}
+		
+		connect(bus, SIGNAL(disconnected()), SLOT(onDisconnected()), Qt::QueuedConnection);
+		
+		Connection	*	connection	=	new Connection;
+		connection->bus	=	bus;
+		m_connections.append(connection);
+	}
+	
+	m_threadPool.setMaxThreadCount(m_connections.count());
+	
+	return true;
+}
+
+
+void MessageBusPool::disconnectFromServer()
+{
+	QWriteLocker		poolLocker(&m_poolLock);
+	
+	foreach(Connection * connection, m_connections)
+	{
+		disconnect(connection->bus, 0, this, 0);
+		connection->bus->disconnectFromServer();
+		connection->bus->deleteLater();
+		delete connection;
+	}
+	
+	m_connections.clear();
+}
+
+
+int MessageBusPool::connectionCount() const
+{
+	QReadLocker		poolLocker(&m_poolLock);
+	
+	return m_connections.count();
+}
+
+
+QString MessageBusPool::lastErrorMessage() const
+{
+	return m_lastError;
+}
+
+
+bool MessageBusPool::acceptStripes(MessageBus* server, QObject* receiver)
+{
+	return server->registerObject(QString::fromLatin1(MSGBUS_STRIPE_PATH), new StripeAssembler(receiver, server));
+}
+
+
+bool MessageBusPool::call(const QString& slot, const QList<Variant>& paramList, LocalSocket::Priority priority)
+{
+	QReadLocker		poolLocker(&m_poolLock);
+	
+	Connection	*	connection	=	leastLoaded();
+	
+	if(!connection) {
+    m_lastError = tr("Not connected");
+		return false;
+  }
+	
+	connection->inFlight.ref();
+	bool	result	=	connection->bus->call(slot, paramList, priority);
+	connection->inFlight.deref();
+	
+	if(!result)
+		m_lastError	=	connection->bus->lastErrorMessage();
+	
+	return result;
+}
+
+
+bool MessageBusPool::call(const QString& slot, const Variant& param1, const Variant& param2, const Variant& param3, const Variant& param4, const Variant& param5)
+{
+	QList<Variant>	params;
+	
+	if(param1.isValid())
+	{
+		params.append(param1);
+		
+		if(param2.isValid())
+		{
+			params.append(param2);
+			
+			if(param3.isValid())
+			{
+				params.append(param3);
+				
+				if(param4.isValid())
+				{
+					params.append(param4);
+					
+					if(param5.isValid())
+						params.append(param5);
+				}
+			}
+		}
+	}
+	
+	return call(slot, params);
+}
+
+
+bool MessageBusPool::callStriped(const QString& slot, const QByteArray& data, const QList<Variant>& paramList)
+{
+	if(paramList.count() > 3) {
+    m_lastError = tr("Too many parameters");
+		return false;
+  }
+	
+	// Refused by the receiver
+	if(data.size() > MSGBUS_STRIPE_MAX_SIZE) {
+    m_lastError = tr("Data too large to be striped");
+		return false;
+  }
+	
+	QReadLocker		poolLocker(&m_poolLock);
+	
+	if(m_connections.isEmpty()) {
+    m_lastError = tr("Not connected");
+		return false;
+  }
+	
+	const qint64	size				=	data.size();
+	const int			stripes			=	int(qBound(qint64(1), size / MSGBUS_STRIPE_MIN_SIZE, qint64(m_connections.count())));
+	const qint64	stripeSize	=	(size + stripes - 1) / stripes;
+	const quint64	transferId	=	(quint64(QCoreApplication::applicationPid()) << 32) | quint32(s_nextTransferId.fetchAndAddRelaxed(1));
+	
+	QSemaphore		done;
+	QAtomicInt		failed;
+	
+	for(int i = 0; i < stripes; i++)
+	{
+		const qint64	offset	=	i * stripeSize;
+		
+		Variant	header(QList<Variant>() << Variant(transferId) << Variant(offset) << Variant(size) << Variant(qint32(stripes))
+														<< Variant(slot) << Variant(paramList));
+		
+		// The pool threads only copy the stripe, the connections are used in parallel
+		m_threadPool.start(new StripeWriter(m_connections.at(i)->bus, header, data, offset, qMin(stripeSize, size - offset), &done, &failed));
+	}
+	
+	done.acquire(stripes);
+	
+	if(failed.load() > 0) {
+    m_lastError = tr("Sending a stripe failed");
+		return false;
+  }
+	
+	return true;
+}
+
+
+void MessageBusPool::onDisconnected()
+{
+	MessageBus	*	bus	=	qobject_cast<MessageBus*>(sender());
+	
+	if(!bus)
+		return;
+	
+	bool	empty	=	false;
+	
+	{
+		QWriteLocker		poolLocker(&m_poolLock);
+		
+		for(int i = 0; i < m_connections.count(); i++)
+		{
+			if(m_connections.at(i)->bus != bus)
+				continue;
+			
+			delete m_connections.takeAt(i);
+			bus->deleteLater();
+			empty	=	m_connections.isEmpty();
+			break;
+		}
+	}
+	
+	if(empty)
+		emit(disconnected());
+}
+
+
+MessageBusPool::Connection * MessageBusPool::leastLoaded() const
+{
+	Connection	*	best						=	0;
+	int						bestInFlight		=	0;
+	qint64				bestDataToWrite	=	0;
+	
+	foreach(Connection * connection, m_connections)
+	{
+		const int			inFlight		=	connection->inFlight.load();
+		
+		if(best && inFlight > bestInFlight)
+			continue;
+		
+		const qint64	dataToWrite	=	connection->bus->dataToWrite();
+		
+		if(!best || inFlight < bestInFlight || dataToWrite < bestDataToWrite)
+		{
+			best							=	connection;
+			bestInFlight			=	inFlight;
+			bestDataToWrite		=	dataToWrite;
+		}
+	}
+	
+	return best;
+}
+
+
+
+StripeAssembler::StripeAssembler(QObject* receiver, QObject* parent)
+:	QObject(parent), m_receiver(receiver)
+{
+	m_expiryTimer.setInterval(MSGBUS_STRIPE_TIMEOUT / 2);
+	connect(&m_expiryTimer, SIGNAL(timeout()), SLOT(dropExpired()));
+	m_expiryTimer.start();
+}
+
+
+void StripeAssembler::stripe(MessageBus* bus, const Variant& header, const Variant& data)
+{
+	QList<Variant>	fields(header.toList());
+	
+	const quint64		transferId	=	fields.value(0).toUInt64();
+	const qint64		offset			=	fields.value(1).toInt64();
+	const qint64		size				=	fields.value(2).toInt64();
+	const int				stripes			=	fields.value(3).toInt32();
+	const QByteArray	stripe(data.toByteArray());
+	
+	// Layout of callStriped(): stripes of equal size (but the last), one per connection
+	const qint64		stripeSize	=	(stripes > 0 ? (size + stripes - 1) / stripes : 0);
+	const int				index				=	(stripeSize > 0 ? int(offset / stripeSize) : 0);
+	
+	if(size < 0 || size > MSGBUS_STRIPE_MAX_SIZE || stripes <= 0 || stripes > qMax(size, qint64(1)) ||
+		 (size > 0 && (size + stripeSize - 1) / stripeSize != stripes) ||
+		 offset < 0 || index >= stripes || offset != index * stripeSize || stripe.size() != qMin(stripeSize, size - offset))
+	{
+		qWarning("MessageBusPool: Invalid stripe, transfer dropped");
+		
+		QMutexLocker	locker(&m_lock);
+		m_transfers.remove(transferId);
+		return;
+	}
+	
+	QMutexLocker	locker(&m_lock);
+	
+	QHash<quint64, Transfer>::iterator	it	=	m_transfers.find(transferId);
+	if(it == m_transfers.end())
+	{
+		if(m_transfers.count() >= MSGBUS_STRIPE_MAX_TRANSFERS)
+		{
+			qWarning("MessageBusPool: Too many incomplete transfers, stripe dropped");
+			return;
+		}
+		
+		Transfer	transfer;
+		transfer.data				=	QByteArray(int(size), Qt::Uninitialized);
+		transfer.stripes		=	stripes;
+		transfer.stripeSize	=	stripeSize;
+		transfer.received		=	QBitArray(stripes);
+		transfer.remaining	=	stripes;
+		transfer.slot				=	fields.value(4).toString().toLatin1();
+		transfer.params			=	fields.value(5).toList();
+		transfer.started.start();
+		
+		it	=	m_transfers.insert(transferId, transfer);
+	}
+	
+	Transfer&	transfer	=	it.value();
+	
+	// Every stripe of a transfer describes the same layout and arrives once
+	if(transfer.data.size() != size || transfer.stripes != stripes || transfer.received.testBit(index))
+	{
+		qWarning("MessageBusPool: Inconsistent stripe, transfer dropped");
+		m_transfers.erase(it);
+		return;
+	}
+	
+	transfer.received.setBit(index);
+	
+	// Drop the transfer if one of its connections is closed
+	if(!transfer.buses.contains(bus))
+	{
+		transfer.buses.insert(bus);
+		connect(bus, SIGNAL(disconnected()), SLOT(onDisconnected()), Qt::UniqueConnection);
+	}
+	
+	memcpy(transfer.data.data() + offset, stripe.constData(), stripe.size());
+	
+	if(--transfer.remaining > 0)
+		return;
+	
+	Variant					result(transfer.data);
+	QByteArray			slot(transfer.slot);
+	QList<Variant>	args(transfer.params);
+	m_transfers.erase(it);
+	locker.unlock();
+	
+	if(!m_receiver)
+		return;
+	
+	if(args.count() == 0)
+		callSlotQueued(m_receiver, slot.constData(), Q_ARG(MessageBus*, bus), Q_ARG(Variant, result));
+	else if(args.count() == 1)
+		callSlotQueued(m_receiver, slot.constData(), Q_ARG(MessageBus*, bus), Q_ARG(Variant, result), Q_ARG(Variant, args.at(0)));
+	else if(args.count() == 2)
+		callSlotQueued(m_receiver, slot.constData(), Q_ARG(MessageBus*, bus), Q_ARG(Variant, result), Q_ARG(Variant, args.at(0)), Q_ARG(Variant, args.at(1)));
+	else if(args.count() == 3)
+		callSlotQueued(m_receiver, slot.constData(), Q_ARG(MessageBus*, bus), Q_ARG(Variant, result), Q_ARG(Variant, args.at(0)), Q_ARG(Variant, args.at(1)), Q_ARG(Variant, args.at(2)));
+	else
+		qWarning("MessageBusPool: Too many arguments!");
+}
+
+
+void StripeAssembler::onDisconnected()
+{
+	QObject	*	bus	=	sender();
+	
+	QMutexLocker	locker(&m_lock);
+	
+	QHash<quint64, Transfer>::iterator	it	=	m_transfers.begin();
+	while(it != m_transfers.end())
+	{
+		if(it.value().buses.contains(bus))
+			it	=	m_transfers.erase(it);
+		else
+			++it;
+	}
+}
+
+
+void StripeAssembler::dropExpired()
+{
+	QMutexLocker	locker(&m_lock);
+	
+	QHash<quint64, Transfer>::iterator	it	=	m_transfers.begin();
+	while(it != m_transfers.end())
+	{
+		if(it.value().started.hasExpired(MSGBUS_STRIPE_TIMEOUT))
+		{
+			qWarning("MessageBusPool: Transfer not completed in time, dropped");
+			it	=	m_transfers.erase(it);
+		}
+		else
+			++it;
+	}
+}
@@ -0,0 +1,124 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MESSAGEBUSPOOL_H
+#define MESSAGEBUSPOOL_H
+
+#include <QObject>
+#include <QList>
+#include <QReadWriteLock>
+#include <QThreadPool>
+
+#include "messagebus.h"
+
+// Default number of connections of a pool
+#define MSGBUS_POOL_SIZE					4
+// Data smaller than this is not striped
+#define MSGBUS_STRIPE_MIN_SIZE		(256 * 1024)
+// Object path of the receiver reassembling striped data
+#define MSGBUS_STRIPE_PATH				"/messagebus/stripe"
+// Limits of the receiver: size of a transfer, transfers reassembled at once and time to complete one (msecs)
+#define MSGBUS_STRIPE_MAX_SIZE				(256 * 1024 * 1024)
+#define MSGBUS_STRIPE_MAX_TRANSFERS		16
+#define MSGBUS_STRIPE_TIMEOUT					30000
+
+/**
+	@brief Several connections to the same server.
+	
+	Independent calls are spread over the connections, each call uses the connection with
+	the fewest calls in flight and bytes queued. Calls made one after another from the same
+	thread may therefore overtake each other, use MessageBus for calls that need ordering.
+	
+	callStriped() splits a large ByteArray into one stripe per connection and sends the
+	stripes in parallel. The server reassembles the stripes if acceptStripes() was called
+	on its listening bus.
+*/
+class MessageBusPool : public QObject
+{
+	Q_OBJECT
+	
+	public:
+		MessageBusPool(QObject * callReceiver);
+		
+		~MessageBusPool();
+		
+		// Open \a connections connections to the server listening on \a filename
+		bool connectToServer(const QString& filename, int connections = MSGBUS_POOL_SIZE);
+		
+		void disconnectFromServer();
+		
+		// Number of open connections
+		int connectionCount() const;
+		
+		QString lastErrorMessage() const;
+		
+		/**
+			@brief Reassembles data striped by pools connected to \a server.
+			
+			The slot given to callStriped() is invoked on \a receiver as
+			slot(MessageBus * bus, const Variant& data, const Variant& param1, ...) once all
+			stripes have arrived. \a server is usually a listening bus.
+			Transfers larger than MSGBUS_STRIPE_MAX_SIZE, beyond MSGBUS_STRIPE_MAX_TRANSFERS
+			incomplete ones and transfers not completed within MSGBUS_STRIPE_TIMEOUT are dropped.
+		*/
+		static bool acceptStripes(MessageBus * server, QObject * receiver);
+		
+	public slots:
+		bool call(const QString& slot, const QList<Variant>& paramList, LocalSocket::Priority priority = LocalSocket::NormalPriority);
+		
+		bool call(const QString& slot, const Variant& param1 = Variant(), const Variant& param2 = Variant(), const Variant& param3 = Variant(), const Variant& param4 = Variant(), const Variant& param5 = Variant());
+		
+		/**
+			@brief Sends \a data striped across all connections.
+			
+			Returns after every stripe has been acknowledged. At most three parameters may be
+			passed in \a paramList.
+		*/
+		bool callStriped(const QString& slot, const QByteArray& data, const QList<Variant>& paramList = QList<Variant>());
+		
+	signals:
+		// All connections are closed
+		void disconnected();
+		
+	private slots:
+		void onDisconnected();
+		
+	private:
+		struct Connection
+		{
+			MessageBus					*	bus;
+			// Calls currently in flight
+			QAtomicInt						inFlight;
+		};
+		
+		// The least loaded connection (m_poolLock must be locked)
+		Connection * leastLoaded() const;
+		
+	private:
+		QString												m_lastError;
+		QObject											*	m_callReceiver;
+		
+		// Calls hold the lock for reading, so no connection is deleted while in use
+		mutable QReadWriteLock				m_poolLock;
+		QList<Connection*>						m_connections;
+		
+		// Threads writing the stripes
+		QThreadPool										m_threadPool;
+};
+
+#endif // MESSAGEBUSPOOL_H
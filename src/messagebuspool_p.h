@@ -0,0 +1,93 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MESSAGEBUSPOOL_P_H
+#define MESSAGEBUSPOOL_P_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QPointer>
+#include <QBitArray>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include "global.h"
+#include "variant.h"
+
+class MessageBus;
+
+/**
+	@brief Reassembles data striped by MessageBusPool::callStriped().
+	
+	Registered on the server bus as MSGBUS_STRIPE_PATH. Each stripe is copied to its offset
+	of the preallocated result, the slot of the receiver is invoked with the last stripe.
+	Stripes must match the layout of callStriped(), a transfer with a stripe that does not is
+	dropped.
+*/
+class MSGBUS_LOCAL StripeAssembler : public QObject
+{
+	Q_OBJECT
+	
+	public:
+		StripeAssembler(QObject * receiver, QObject * parent);
+		
+	public slots:
+		/*
+		 * header (List):
+		 * 
+		 * Pos Type       Data
+		 * -------------------------
+		 * 0   UInt64     Id of the transfer
+		 * 1   Int64      Offset of the stripe
+		 * 2   Int64      Total size
+		 * 3   Int32      Number of stripes
+		 * 4   String     Slot of the receiver
+		 * 5   List       Parameters of the slot
+		 */
+		void stripe(MessageBus * bus, const Variant& header, const Variant& data);
+		
+	private slots:
+		void onDisconnected();
+		
+		// Drop the transfers not completed in time
+		void dropExpired();
+		
+	private:
+		struct Transfer
+		{
+			QByteArray						data;
+			int										stripes;
+			qint64								stripeSize;
+			QBitArray							received;
+			int										remaining;
+			QByteArray						slot;
+			QList<Variant>				params;
+			// Connections the stripes arrived on
+			QSet<QObject*>				buses;
+			QElapsedTimer					started;
+		};
+		
+		QPointer<QObject>							m_receiver;
+		QMutex												m_lock;
+		QHash<quint64, Transfer>			m_transfers;
+		QTimer												m_expiryTimer;
+};
+
+#endif // MESSAGEBUSPOOL_P_H
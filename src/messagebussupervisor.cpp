@@ -0,0 +1,191 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "messagebussupervisor.h"
+#include "messagebussupervisor_p.h"
+
+#include "localserver.h"
+#include "messagebus.h"
+
+// Clients waiting to be handed over to one worker
+#define MAX_PENDING_HANDOFFS	64
+
+WorkerHandoff::WorkerHandoff(MessageBus* worker)
+:	QObject(), m_worker(worker), m_pending(0)
+{
+	moveToThread(&m_thread);
+	m_thread.start();
+}
+
+
+WorkerHandoff::~WorkerHandoff()
+{
+	// Clients still queued are closed with the pending events
+	m_thread.quit();
+	m_thread.wait();
+}
+
+
+bool WorkerHandoff::enqueue(const Variant& socketDescriptor)
+{
+	if(m_pending.fetchAndAddOrdered(1) >= MAX_PENDING_HANDOFFS)
+	{
+		m_pending.deref();
+		return false;
+	}
+	
+	return QMetaObject::invokeMethod(this, "handoff", Qt::QueuedConnection, Q_ARG(Variant, socketDescriptor));
+}
+
+
+void WorkerHandoff::handoff(const Variant& socketDescriptor)
+{
+	if(!m_worker->call("handoff", socketDescriptor))
+		qWarning("MessageBusSupervisor: Handing over client failed: %s", qPrintable(m_worker->lastErrorMessage()));
+	
+	m_pending.deref();
+}
+
+
+MessageBusSupervisor::MessageBusSupervisor(QObject* parent)
+:	QObject(parent), m_server(0), m_control(0)
+{
+}
+
+
+MessageBusSupervisor::~MessageBusSupervisor()
+{
+	qDeleteAll(m_handoffs);
+}
+
+
+bool MessageBusSupervisor::listen(const QString& filename, const QString& controlFilename)
+{
+	if(m_server) {
+    m_lastError = tr("Already listening on a socket");
+		return false;
+  }
+	
+	m_control	=	new MessageBus(this);
+	connect(m_control, SIGNAL(clientConnected(MessageBus*)), SLOT(onWorkerConnected(MessageBus*)));
+	
+	if(!m_control->listen(controlFilename)) {
+    m_lastError = m_control->lastErrorMessage();
+		delete m_control;
+		m_control	=	0;
+		return false;
+  }
+	
+	m_server	=	new LocalServer(this);
+	connect(m_server, SIGNAL(newConnection(quintptr)), SLOT(onNewClient(quintptr)));
+	
+	if(!m_server->listen(filename)) {
+    m_lastError = m_server->errorString();
+		delete m_server;
+		m_server	=	0;
+		delete m_control;
+		m_control	=	0;
+		return false;
+  }
+	
+	return true;
+}
+
+
+int MessageBusSupervisor::workerCount() const
+{
+	return m_load.count();
+}
+
+
+QString MessageBusSupervisor::lastErrorMessage() const
+{
+	return m_lastError;
+}
+
+
+void MessageBusSupervisor::onNewClient(quintptr socketDescriptor)
+{
+	// Closed when the call has been written (or the client has been rejected)
+	Variant		descriptor(Variant::fromSocketDescriptor(int(socketDescriptor), true));
+	
+	MessageBus	*	worker	=	leastLoadedWorker();
+	
+	if(!worker)
+	{
+		qWarning("MessageBusSupervisor: No worker available, client rejected");
+		return;
+	}
+	
+	if(!m_handoffs.value(worker)->enqueue(descriptor))
+	{
+		qWarning("MessageBusSupervisor: Too many clients waiting for the worker, client rejected");
+		return;
+	}
+	
+	// Until the worker reports its new load
+	m_load[worker]++;
+}
+
+
+void MessageBusSupervisor::onWorkerConnected(MessageBus* bus)
+{
+	m_load.insert(bus, 0);
+	m_handoffs.insert(bus, new WorkerHandoff(bus));
+	
+	connect(bus, SIGNAL(disconnected()), SLOT(onWorkerDisconnected()));
+}
+
+
+void MessageBusSupervisor::onWorkerDisconnected()
+{
+	MessageBus	*	bus	=	qobject_cast<MessageBus*>(sender());
+	
+	if(!bus)
+		return;
+	
+	m_load.remove(bus);
+	// Not used by a hand-off anymore
+	delete m_handoffs.take(bus);
+	bus->deleteLater();
+}
+
+
+void MessageBusSupervisor::reportLoad(MessageBus* bus, const Variant& load)
+{
+	if(m_load.contains(bus))
+		m_load[bus]	=	load.toInt32();
+}
+
+
+MessageBus * MessageBusSupervisor::leastLoadedWorker() const
+{
+	MessageBus	*	worker	=	0;
+	int						load		=	0;
+	
+	for(QHash<MessageBus*, int>::const_iterator it = m_load.constBegin(); it != m_load.constEnd(); ++it)
+	{
+		if(!worker || it.value() < load)
+		{
+			worker	=	it.key();
+			load		=	it.value();
+		}
+	}
+	
+	return worker;
+}
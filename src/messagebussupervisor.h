@@ -0,0 +1,79 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MESSAGEBUSSUPERVISOR_H
+#define MESSAGEBUSSUPERVISOR_H
+
+#include <QObject>
+#include <QHash>
+
+#include "variant.h"
+
+class LocalServer;
+class MessageBus;
+class WorkerHandoff;
+
+/**
+	@brief Accepts clients and hands them over to worker processes.
+	
+	Workers (MessageBusWorker) connect to the control socket and report their load. Each
+	accepted client is passed as file descriptor to the least loaded worker, which serves it
+	with a MessageBus of its own. Clients connect to the supervisor's socket as usual and do
+	not notice the workers.
+	Clients are handed over in a thread per worker, a worker busy with other clients does not
+	delay accepting. A client is rejected if too many clients are waiting for its worker.
+*/
+class MessageBusSupervisor : public QObject
+{
+	Q_OBJECT
+	
+	public:
+		MessageBusSupervisor(QObject * parent = 0);
+		
+		~MessageBusSupervisor();
+		
+		// Accept clients on \a filename and workers on \a controlFilename
+		bool listen(const QString& filename, const QString& controlFilename);
+		
+		int workerCount() const;
+		
+		QString lastErrorMessage() const;
+		
+	private slots:
+		void onNewClient(quintptr socketDescriptor);
+		
+		void onWorkerConnected(MessageBus * bus);
+		
+		void onWorkerDisconnected();
+		
+		// Called by the workers
+		void reportLoad(MessageBus * bus, const Variant& load);
+		
+	private:
+		MessageBus * leastLoadedWorker() const;
+		
+	private:
+		QString									m_lastError;
+		LocalServer						*	m_server;
+		MessageBus						*	m_control;
+		// Last reported load of the workers plus the clients handed over since
+		QHash<MessageBus*, int>	m_load;
+		QHash<MessageBus*, WorkerHandoff*>	m_handoffs;
+};
+
+#endif // MESSAGEBUSSUPERVISOR_H
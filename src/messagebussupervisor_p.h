@@ -0,0 +1,60 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MESSAGEBUSSUPERVISOR_P_H
+#define MESSAGEBUSSUPERVISOR_P_H
+
+#include <QObject>
+#include <QThread>
+#include <QAtomicInt>
+
+#include "global.h"
+#include "variant.h"
+
+class MessageBus;
+
+/**
+	@brief Hands the clients over to one worker of a MessageBusSupervisor.
+	
+	The call to the worker waits for its acknowledgement, so it is made in a thread of its
+	own and the supervisor keeps accepting clients. Clients queued for a worker that does not
+	keep up are rejected.
+*/
+class MSGBUS_LOCAL WorkerHandoff : public QObject
+{
+	Q_OBJECT
+	
+	public:
+		WorkerHandoff(MessageBus * worker);
+		
+		// Waits for the client currently handed over
+		~WorkerHandoff();
+		
+		// Queue the client \a socketDescriptor, false if too many clients wait for the worker
+		bool enqueue(const Variant& socketDescriptor);
+		
+	private slots:
+		void handoff(const Variant& socketDescriptor);
+		
+	private:
+		MessageBus					*	m_worker;
+		QThread								m_thread;
+		QAtomicInt						m_pending;
+};
+
+#endif // MESSAGEBUSSUPERVISOR_P_H
@@ -0,0 +1,134 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "messagebusworker.h"
+
+#include "messagebus.h"
+
+MessageBusWorker::MessageBusWorker(QObject* callReceiver)
+:	QObject(callReceiver), m_callReceiver(callReceiver), m_control(0)
+{
+}
+
+
+MessageBusWorker::~MessageBusWorker()
+{
+}
+
+
+bool MessageBusWorker::connectToSupervisor(const QString& controlFilename)
+{
+	if(m_control) {
+    m_lastError = tr("Already connected to a supervisor");
+		return false;
+  }
+	
+	m_control	=	new MessageBus(this);
+	connect(m_control, SIGNAL(disconnected()), SIGNAL(disconnected()));
+	
+	if(!m_control->connectToServer(controlFilename)) {
+    m_lastError = m_control->lastErrorMessage();
+		delete m_control;
+		m_control	=	0;
+		return false;
+  }
+	
+	return true;
+}
+
+
+void MessageBusWorker::disconnectFromSupervisor()
+{
+	if(m_control)
+		m_control->disconnectFromServer();
+}
+
+
+bool MessageBusWorker::isOpen() const
+{
+	return (m_control && m_control->isOpen());
+}
+
+
+int MessageBusWorker::clientCount() const
+{
+	return m_clients.count();
+}
+
+
+bool MessageBusWorker::reportLoad(int load)
+{
+	if(!m_control) {
+    m_lastError = tr("Not connected to a supervisor");
+		return false;
+  }
+	
+	if(!m_control->call("reportLoad", Variant(qint32(load)))) {
+    m_lastError = m_control->lastErrorMessage();
+		return false;
+  }
+	
+	return true;
+}
+
+
+QString MessageBusWorker::lastErrorMessage() const
+{
+	return m_lastError;
+}
+
+
+void MessageBusWorker::handoff(MessageBus* control, const Variant& socketDescriptor)
+{
+	Q_UNUSED(control);
+	
+	bool	ok	=	false;
+	int		fd	=	socketDescriptor.toSocketDescriptor(&ok);
+	
+	if(!ok || fd < 0)
+		return;
+	
+	MessageBus	*	bus	=	new MessageBus(m_callReceiver);
+	
+	if(!bus->setSocketDescriptor(quintptr(fd)))
+	{
+		qWarning("MessageBusWorker: Cannot serve client: %s", qPrintable(bus->lastErrorMessage()));
+		delete bus;
+		return;
+	}
+	
+	m_clients.append(bus);
+	connect(bus, SIGNAL(disconnected()), SLOT(onClientDisconnected()));
+	
+	reportLoad(m_clients.count());
+	
+	emit(clientConnected(bus));
+}
+
+
+void MessageBusWorker::onClientDisconnected()
+{
+	MessageBus	*	bus	=	qobject_cast<MessageBus*>(sender());
+	
+	if(!bus || !m_clients.removeOne(bus))
+		return;
+	
+	bus->deleteLater();
+	
+	reportLoad(m_clients.count());
+}
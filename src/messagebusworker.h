@@ -0,0 +1,77 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MESSAGEBUSWORKER_H
+#define MESSAGEBUSWORKER_H
+
+#include <QObject>
+#include <QList>
+
+#include "variant.h"
+
+class MessageBus;
+
+/**
+	@brief Worker process of a MessageBusSupervisor.
+	
+	Receives clients accepted by the supervisor and serves each with a MessageBus delivering
+	calls to \a callReceiver. The number of connected clients is reported to the supervisor
+	as load whenever it changes, use reportLoad() to report a different measure.
+*/
+class MessageBusWorker : public QObject
+{
+	Q_OBJECT
+	
+	public:
+		MessageBusWorker(QObject * callReceiver);
+		
+		~MessageBusWorker();
+		
+		bool connectToSupervisor(const QString& controlFilename);
+		
+		void disconnectFromSupervisor();
+		
+		bool isOpen() const;
+		
+		int clientCount() const;
+		
+		bool reportLoad(int load);
+		
+		QString lastErrorMessage() const;
+		
+	signals:
+		// A client has been handed over
+		void clientConnected(MessageBus * bus);
+		
+		// The connection to the supervisor has been lost
+		void disconnected();
+		
+	private slots:
+		// Called by the supervisor
+		void handoff(MessageBus * control, const Variant& socketDescriptor);
+		
+		void onClientDisconnected();
+		
+	private:
+		QString								m_lastError;
+		QObject							*	m_callReceiver;
+		MessageBus					*	m_control;
+		QList<MessageBus*>		m_clients;
+};
+
+#endif // MESSAGEBUSWORKER_H
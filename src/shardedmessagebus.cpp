@@ -0,0 +1,270 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "shardedmessagebus.h"
+
+// Closes a bus no call is using anymore
+static void deleteBus(MessageBus * bus)
+{
+	bus->disconnectFromServer();
+	bus->deleteLater();
+}
+
+ShardedMessageBus::ShardedMessageBus(QObject* callReceiver)
+:	QObject(callReceiver), m_callReceiver(callReceiver)
+{
+}
+
+
+ShardedMessageBus::~ShardedMessageBus()
+{
+}
+
+
+bool ShardedMessageBus::addEndpoint(const QString& filename)
+{
+	{
+		QReadLocker		ringLocker(&m_ringLock);
+		
+		if(m_endpoints.contains(filename)) {
+      setLastError(tr("Endpoint already added"));
+			return false;
+    }
+	}
+	
+	MessageBus	*	bus	=	new MessageBus(m_callReceiver);
+	
+	if(!bus->connectToServer(filename)) {
+    setLastError(bus->lastErrorMessage());
+		delete bus;
+		return false;
+  }
+	
+	bus->setObjectName(filename);
+	connect(bus, SIGNAL(disconnected()), SLOT(onDisconnected()), Qt::QueuedConnection);
+	
+	QWriteLocker		ringLocker(&m_ringLock);
+	
+	if(m_endpoints.contains(filename)) {
+		ringLocker.unlock();
+    setLastError(tr("Endpoint already added"));
+		delete bus;
+		return false;
+  }
+	
+	m_endpoints.insert(filename, QSharedPointer<MessageBus>(bus, deleteBus));
+	insertNodes(filename);
+	
+	return true;
+}
+
+
+void ShardedMessageBus::removeEndpoint(const QString& filename)
+{
+	QWriteLocker		ringLocker(&m_ringLock);
+	
+	removeEndpointHelper(filename);
+}
+
+
+QStringList ShardedMessageBus::endpoints() const
+{
+	QReadLocker		ringLocker(&m_ringLock);
+	
+	return m_endpoints.keys();
+}
+
+
+QString ShardedMessageBus::endpointOf(const Variant& key) const
+{
+	QReadLocker		ringLocker(&m_ringLock);
+	
+	return endpointOfHelper(key);
+}
+
+
+QString ShardedMessageBus::lastErrorMessage() const
+{
+	QMutexLocker	errorLocker(&m_errorLock);
+	
+	return m_lastError;
+}
+
+
+bool ShardedMessageBus::callWithKey(const Variant& key, const QString& slot, const QList<Variant>& paramList, LocalSocket::Priority priority)
+{
+	QSharedPointer<MessageBus>	bus;
+	
+	// The call may wait for credits: Don't keep endpoints from being added or removed meanwhile
+	{
+		QReadLocker		ringLocker(&m_ringLock);
+		
+		bus	=	m_endpoints.value(endpointOfHelper(key));
+	}
+	
+	if(!bus) {
+    setLastError(tr("No endpoint available"));
+		return false;
+  }
+	
+	if(!bus->call(slot, paramList, priority)) {
+    setLastError(bus->lastErrorMessage());
+		return false;
+  }
+	
+	return true;
+}
+
+
+bool ShardedMessageBus::call(const QString& slot, const QList<Variant>& paramList, LocalSocket::Priority priority)
+{
+	return callWithKey(paramList.value(0), slot, paramList, priority);
+}
+
+
+bool ShardedMessageBus::call(const QString& slot, const Variant& param1, const Variant& param2, const Variant& param3, const Variant& param4, const Variant& param5)
+{
+	QList<Variant>	params;
+	
+	if(param1.isValid())
+	{
+		params.append(param1);
+		
+		if(param2.isValid())
+		{
+			params.append(param2);
+			
+			if(param3.isValid())
+			{
+				params.append(param3);
+				
+				if(param4.isValid())
+				{
+					params.append(param4);
+					
+					if(param5.isValid())
+						params.append(param5);
+				}
+			}
+		}
+	}
+	
+	return call(slot, params);
+}
+
+
+void ShardedMessageBus::onDisconnected()
+{
+	MessageBus	*	bus	=	qobject_cast<MessageBus*>(sender());
+	
+	if(!bus)
+		return;
+	
+	const QString		filename(bus->objectName());
+	
+	{
+		QWriteLocker		ringLocker(&m_ringLock);
+		
+		// Already removed or replaced
+		if(m_endpoints.value(filename) != bus)
+			return;
+		
+		removeEndpointHelper(filename);
+	}
+	
+	emit(endpointRemoved(filename));
+}
+
+
+QString ShardedMessageBus::endpointOfHelper(const Variant& key) const
+{
+	if(m_ring.isEmpty())
+		return QString();
+	
+	const quint32		position	=	keyHash(QByteArray(1, char(key.type())) + key.toByteArray());
+	
+	// The first endpoint at or after the position of the key, wrapping around
+	QMap<quint32, QString>::const_iterator	it	=	m_ring.lowerBound(position);
+	if(it == m_ring.constEnd())
+		it	=	m_ring.constBegin();
+	
+	return it.value();
+}
+
+
+void ShardedMessageBus::removeEndpointHelper(const QString& filename)
+{
+	QSharedPointer<MessageBus>	bus(m_endpoints.take(filename));
+	
+	if(!bus)
+		return;
+	
+	// Rebuild the ring, so positions lost in a collision go back to the remaining endpoints
+	m_ring.clear();
+	foreach(const QString& endpoint, m_endpoints.keys())
+		insertNodes(endpoint);
+	
+	// Disconnected when the last call using the bus returns
+	disconnect(bus.data(), 0, this, 0);
+}
+
+
+void ShardedMessageBus::setLastError(const QString& error)
+{
+	QMutexLocker	errorLocker(&m_errorLock);
+	
+	m_lastError	=	error;
+}
+
+
+void ShardedMessageBus::insertNodes(const QString& filename)
+{
+	const QByteArray	name(filename.toUtf8());
+	
+	for(int i = 0; i < SHARD_VIRTUAL_NODES; i++)
+	{
+		const quint32	position	=	keyHash(name + '#' + QByteArray::number(i));
+		
+		// On a collision the smaller filename wins, independent of the order endpoints are added
+		if(!m_ring.contains(position) || filename < m_ring.value(position))
+			m_ring.insert(position, filename);
+	}
+}
+
+
+quint32 ShardedMessageBus::keyHash(const QByteArray& data)
+{
+	// FNV-1a, stable across processes
+	quint32		hash	=	2166136261u;
+	
+	for(int i = 0; i < data.size(); i++)
+	{
+		hash	^=	quint8(data.at(i));
+		hash	*=	16777619u;
+	}
+	
+	// Finalizer of MurmurHash3: spread similar keys over the whole ring
+	hash	^=	hash >> 16;
+	hash	*=	0x85ebca6bu;
+	hash	^=	hash >> 13;
+	hash	*=	0xc2b2ae35u;
+	hash	^=	hash >> 16;
+	
+	return hash;
+}
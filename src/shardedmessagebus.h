@@ -0,0 +1,113 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SHARDEDMESSAGEBUS_H
+#define SHARDEDMESSAGEBUS_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QStringList>
+#include <QReadWriteLock>
+#include <QMutex>
+#include <QSharedPointer>
+
+#include "messagebus.h"
+
+// Points of every endpoint on the hash ring
+#define SHARD_VIRTUAL_NODES		160
+
+/**
+	@brief Distributes calls to several servers by consistent hashing of a key.
+	
+	Each endpoint is placed on a hash ring SHARD_VIRTUAL_NODES times, a call is sent to the
+	endpoint following the hash of its key. Calls with the same key always reach the same
+	server in the order they were made. When an endpoint is added or removed only the keys
+	of the ring segments it takes over or gives up move to another server.
+	
+	The ring position of an endpoint depends only on its filename and the hash of a key
+	only on its type and value, so all clients using the same endpoint filenames agree on
+	the server of a key. Note that Variant(5) and Variant(qint64(5)) are different keys.
+	
+	Endpoints that disconnect are removed from the ring and endpointRemoved() is emitted.
+*/
+class ShardedMessageBus : public QObject
+{
+	Q_OBJECT
+	
+	public:
+		ShardedMessageBus(QObject * callReceiver);
+		
+		~ShardedMessageBus();
+		
+		// Connect to the server listening on \a filename and add it to the ring
+		bool addEndpoint(const QString& filename);
+		
+		// Disconnect from \a filename, its keys move to the remaining endpoints
+		void removeEndpoint(const QString& filename);
+		
+		QStringList endpoints() const;
+		
+		// The endpoint calls with \a key are sent to (empty if there are no endpoints)
+		QString endpointOf(const Variant& key) const;
+		
+		QString lastErrorMessage() const;
+		
+	public slots:
+		// Calls \a slot on the endpoint of \a key
+		bool callWithKey(const Variant& key, const QString& slot, const QList<Variant>& paramList, LocalSocket::Priority priority = LocalSocket::NormalPriority);
+		
+		// Like MessageBus::call(), the first parameter is the key
+		bool call(const QString& slot, const QList<Variant>& paramList, LocalSocket::Priority priority = LocalSocket::NormalPriority);
+		
+		bool call(const QString& slot, const Variant& param1 = Variant(), const Variant& param2 = Variant(), const Variant& param3 = Variant(), const Variant& param4 = Variant(), const Variant& param5 = Variant());
+		
+	signals:
+		void endpointRemoved(const QString& filename);
+		
+	private slots:
+		void onDisconnected();
+		
+	private:
+		// Ring lock should already be locked
+		QString endpointOfHelper(const Variant& key) const;
+		
+		void removeEndpointHelper(const QString& filename);
+		
+		void setLastError(const QString& error);
+		
+		// Place the virtual nodes of \a filename on the ring
+		void insertNodes(const QString& filename);
+		
+		static quint32 keyHash(const QByteArray& data);
+		
+	private:
+		// Written by calls from any thread
+		mutable QMutex								m_errorLock;
+		QString												m_lastError;
+		QObject											*	m_callReceiver;
+		
+		// Calls hold a reference to their bus while waiting for it, not the lock
+		mutable QReadWriteLock				m_ringLock;
+		QHash<QString, QSharedPointer<MessageBus> >		m_endpoints;
+		// Hash ring: position -> filename of the endpoint
+		QMap<quint32, QString>				m_ring;
+};
+
+#endif // SHARDEDMESSAGEBUS_H
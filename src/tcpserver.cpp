@@ -0,0 +1,66 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tcpserver.h"
+
+#include <QHostAddress>
+
+#include "implementations/localsocketprivate_tcp.h"
+
+TcpServer::TcpServer(QObject* parent)
+	:	QTcpServer(parent)
+{
+}
+
+
+TcpServer::~TcpServer()
+{
+	QTcpServer::close();
+}
+
+
+bool TcpServer::listen(const QString& address)
+{
+	QString		host;
+	quint16		port	=	0;
+	
+	if(!LocalSocketPrivate_Tcp::parseAddress(address, &host, &port))
+	{
+		qWarning("Invalid TCP address: %s", qPrintable(address));
+		return false;
+	}
+	
+	QHostAddress	hostAddress(host);
+	if(hostAddress.isNull() && host == QLatin1String("localhost"))
+		hostAddress	=	QHostAddress(QHostAddress::LocalHost);
+	
+	bool	ret	=	(!hostAddress.isNull() && QTcpServer::listen(hostAddress, port));
+	
+	if(!ret)
+		qWarning("Could not create TCP server socket!");
+	
+	return ret;
+}
+
+
+void TcpServer::incomingConnection(qintptr socketDescriptor)
+{
+	LocalSocketPrivate_Tcp::setSocketOptions(quintptr(socketDescriptor));
+	
+	emit(newConnection(quintptr(socketDescriptor)));
+}
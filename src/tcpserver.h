@@ -0,0 +1,51 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TCPSERVER_H
+#define TCPSERVER_H
+
+#include <QTcpServer>
+
+#include "global.h"
+
+/**
+	@brief TCP counterpart of LocalServer.
+	
+	Listens on an address like "tcp://127.0.0.1:4000" ("tcp://0.0.0.0:4000" for all
+	interfaces) and passes accepted connections on as socket descriptors, ready for
+	LocalSocket::setSocketDescriptor().
+*/
+class TcpServer : public QTcpServer
+{
+	Q_OBJECT
+	
+	public:
+		TcpServer(QObject * parent = 0);
+		
+		virtual ~TcpServer();
+		
+		bool listen(const QString& address);
+		
+	signals:
+		void newConnection(quintptr socketDescriptor);
+		
+	protected:
+		virtual void incomingConnection(qintptr socketDescriptor);
+};
+
+#endif // TCPSERVER_H
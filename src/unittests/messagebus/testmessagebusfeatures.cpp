@@ -0,0 +1,814 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2012  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "testmessagebusfeatures.h"
+
+#include "testmessagebusfeatures_peer.h"
+
+#include <QTcpServer>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../../variantview.h"
+#include "../../messagebuspool.h"
+#include "../../messagebussupervisor.h"
+#include "../../messagebusworker.h"
+#include "../../shardedmessagebus.h"
+
+QString	TestMessageBusFeatures::s_path	=	QDir::tempPath() + "/test_messagebus_features.sock";
+
+
+// Calls a bus from another thread
+class TestMessageBusFeatures_CallThread : public QThread
+{
+	public:
+		TestMessageBusFeatures_CallThread(MessageBus * bus, int calls)
+			:	QThread(), m_bus(bus), m_calls(calls), m_failed(0)
+		{
+		}
+		
+		int failed() const
+		{
+			return m_failed;
+		}
+		
+	protected:
+		virtual void run()
+		{
+			for(int i = 0; i < m_calls; i++)
+			{
+				if(!m_bus->call("record", Variant(qint32(i))))
+					m_failed++;
+			}
+		}
+		
+	private:
+		MessageBus	*	m_bus;
+		int						m_calls;
+		int						m_failed;
+};
+
+
+void TestMessageBusFeatures::firstCallCredits()
+{
+	// A slow receiver granting one call at a time
+	TestMessageBusFeatures_PeerThread	peer(s_path, [](MessageBus * server, TestMessageBusFeatures_Receiver * receiver) {
+		server->setReceiveWindow(1);
+		receiver->setDelay(100);
+	});
+	QVERIFY(peer.waitForStarted());
+	
+	MessageBus	bus(0);
+	QVERIFY(bus.connectToServer(s_path));
+	
+	// Called before the window of the peer is known: must not be sent on credits not granted yet
+	for(int i = 0; i < 5; i++)
+		QVERIFY2(bus.call("record", Variant(qint32(i))), qPrintable(bus.lastErrorMessage()));
+	
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 5, 10000);
+	QCOMPARE(peer.receiver()->lastArgs().first().toInt32(), qint32(4));
+	QVERIFY(bus.isOpen());
+}
+
+
+void TestMessageBusFeatures::channelFirstCallCredits()
+{
+	TestMessageBusFeatures_PeerThread	peer(s_path, [](MessageBus * server, TestMessageBusFeatures_Receiver * receiver) {
+		server->setReceiveWindow(1);
+		receiver->setDelay(100);
+	});
+	QVERIFY(peer.waitForStarted());
+	
+	MessageBus	bus(0);
+	QVERIFY(bus.connectToServer(s_path));
+	
+	MessageBus	*	channel	=	bus.openChannel(0);
+	QVERIFY2(channel, qPrintable(bus.lastErrorMessage()));
+	
+	// The window of the channel is announced by the peer after it saw the channel
+	for(int i = 0; i < 5; i++)
+		QVERIFY2(channel->call("record", Variant(qint32(i))), qPrintable(channel->lastErrorMessage()));
+	
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 5, 10000);
+	QVERIFY(channel->isOpen());
+	QVERIFY(bus.isOpen());
+	
+	channel->disconnectFromServer();
+	delete channel;
+}
+
+
+// A peer of a version without flow control: acknowledges calls, never announces its features
+class TestMessageBusFeatures_OldPeerThread : public QThread
+{
+	public:
+		TestMessageBusFeatures_OldPeerThread(const QString& path)
+			:	QThread(), m_server(-1)
+		{
+			struct sockaddr_un	address;
+			memset(&address, 0, sizeof(address));
+			address.sun_family	=	AF_UNIX;
+			strncpy(address.sun_path, QFile::encodeName(path).constData(), sizeof(address.sun_path) - 1);
+			
+			::unlink(address.sun_path);
+			m_server	=	::socket(AF_UNIX, SOCK_STREAM, 0);
+			
+			if(m_server >= 0 && (::bind(m_server, (struct sockaddr*)&address, sizeof(address)) != 0 || ::listen(m_server, 1) != 0))
+			{
+				::close(m_server);
+				m_server	=	-1;
+			}
+		}
+		
+		~TestMessageBusFeatures_OldPeerThread()
+		{
+			m_stop.storeRelease(1);
+			wait();
+			
+			if(m_server >= 0)
+				::close(m_server);
+		}
+		
+		bool isListening() const
+		{
+			return (m_server >= 0);
+		}
+		
+		int calls() const
+		{
+			return m_calls.loadAcquire();
+		}
+		
+	protected:
+		virtual void run()
+		{
+			const int	fd	=	::accept(m_server, 0, 0);
+			LocalSocket	socket;
+			
+			if(fd < 0 || !socket.setSocketDescriptor(quintptr(fd)))
+				return;
+			
+			while(!m_stop.loadAcquire() && socket.isOpen())
+			{
+				while(socket.availableData() > 0)
+				{
+					// END (0x03) is acknowledged by ACK (0x05), CREDIT packages are ignored
+					if((socket.read().optionalId() & 0xFFFF) == 0x03)
+					{
+						Variant	ack;
+						ack.setOptionalId(0x05);
+						socket.write(ack);
+						m_calls.ref();
+					}
+				}
+				
+				socket.waitForReadyRead(100);
+			}
+		}
+		
+	private:
+		int						m_server;
+		QAtomicInt		m_stop;
+		QAtomicInt		m_calls;
+};
+
+
+void TestMessageBusFeatures::oldPeerCalls()
+{
+	TestMessageBusFeatures_OldPeerThread	peer(s_path);
+	QVERIFY(peer.isListening());
+	peer.start();
+	
+	QElapsedTimer	timer;
+	timer.start();
+	
+	MessageBus	bus(0);
+	QVERIFY(bus.connectToServer(s_path));
+	
+	// Not held back until FEATURES_TIMEOUT: the first ACK without credits tells an old peer
+	for(int i = 0; i < 5; i++)
+		QVERIFY2(bus.call("record", Variant(qint32(i))), qPrintable(bus.lastErrorMessage()));
+	
+	QVERIFY2(timer.elapsed() < 2000, qPrintable(QString::number(timer.elapsed())));
+	QCOMPARE(peer.calls(), 5);
+	
+	// Concurrent callers of a bus that does not know the features of the peer yet
+	MessageBus	concurrentBus(0);
+	TestMessageBusFeatures_PeerThread	newPeer(s_path + ".new", [](MessageBus * server, TestMessageBusFeatures_Receiver * receiver) {
+		server->setReceiveWindow(1);
+		receiver->setDelay(10);
+	});
+	QVERIFY(newPeer.waitForStarted());
+	QVERIFY(concurrentBus.connectToServer(s_path + ".new"));
+	
+	TestMessageBusFeatures_CallThread	first(&concurrentBus, 20);
+	TestMessageBusFeatures_CallThread	second(&concurrentBus, 20);
+	first.start();
+	second.start();
+	
+	// Credits are taken by one caller at a time: a peer with a window of 1 never sees two calls
+	QVERIFY(first.wait(30000));
+	QVERIFY(second.wait(30000));
+	QCOMPARE(first.failed(), 0);
+	QCOMPARE(second.failed(), 0);
+	QTRY_COMPARE_WITH_TIMEOUT(newPeer.receiver()->calls(), 40, 10000);
+	QVERIFY(concurrentBus.isOpen());
+}
+
+
+void TestMessageBusFeatures::channelsAndRootWindow()
+{
+	// Small windows: the root is full most of the time while the channel is read on
+	TestMessageBusFeatures_PeerThread	peer(s_path, [](MessageBus * server, TestMessageBusFeatures_Receiver * receiver) {
+		server->setReceiveWindow(2);
+		receiver->setDelay(5);
+	});
+	QVERIFY(peer.waitForStarted());
+	
+	MessageBus	bus(0);
+	QVERIFY(bus.connectToServer(s_path));
+	
+	MessageBus	*	channel	=	bus.openChannel(0);
+	QVERIFY2(channel, qPrintable(bus.lastErrorMessage()));
+	
+	TestMessageBusFeatures_CallThread	channelCalls(channel, 50);
+	channelCalls.start();
+	
+	for(int i = 0; i < 50; i++)
+		QVERIFY2(bus.call("record", Variant(qint32(i))), qPrintable(bus.lastErrorMessage()));
+	
+	QVERIFY(channelCalls.wait(30000));
+	QCOMPARE(channelCalls.failed(), 0);
+	
+	// Neither side exceeded its credits
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 100, 30000);
+	QVERIFY(bus.isOpen());
+	QVERIFY(channel->isOpen());
+	
+	channel->disconnectFromServer();
+	delete channel;
+}
+
+
+void TestMessageBusFeatures::shapedMaps()
+{
+	TestMessageBusFeatures_PeerThread	peer(s_path);
+	QVERIFY(peer.waitForStarted());
+	
+	MessageBus	bus(0);
+	QVERIFY(bus.connectToServer(s_path));
+	
+	QVariantMap	status;
+	status["state"]		=	QString("running");
+	status["uptime"]	=	42;
+	
+	// The first map defines the shape, both are sent as shape id and values
+	QVERIFY2(bus.call("record", Variant(status)), qPrintable(bus.lastErrorMessage()));
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 1, 5000);
+	const Variant	first(peer.receiver()->lastArgs().first());
+	
+	status["uptime"]	=	43;
+	QVERIFY2(bus.call("record", Variant(status)), qPrintable(bus.lastErrorMessage()));
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 2, 5000);
+	const Variant	second(peer.receiver()->lastArgs().first());
+	
+	// Same bytes and size as the map that was sent
+	QCOMPARE(second.toQMap(), status);
+	QCOMPARE(second.size(), Variant(status).size());
+	QVERIFY(second == Variant(status));
+	
+	VariantMapView	view(second.mapView());
+	QCOMPARE(view.size(), 2);
+	QCOMPARE(view.keyAt(1), QString("uptime"));
+	QCOMPARE(view.value("state").toString(), QString("running"));
+	QVERIFY(view.valueAt(1) == Variant(status).mapView().valueAt(1));
+	view.buildIndex();
+	QCOMPARE(view.value("state").toString(), QString("running"));
+	
+	// The keys are converted once per shape, not per map
+	QVERIFY(view.keyAt(0).constData() == first.mapView().keyAt(0).constData());
+	QVERIFY(second.toQMap().firstKey().constData() == first.toQMap().firstKey().constData());
+}
+
+
+void TestMessageBusFeatures::objectIdCollisions()
+{
+	QObject			first;
+	QObject			second;
+	MessageBus	bus(0);
+	
+	// Different paths with the same FNV-1a hash
+	QCOMPARE(MessageBus::objectId("costarring"), MessageBus::objectId("liquid"));
+	
+	QVERIFY(bus.registerObject("costarring", &first));
+	QVERIFY(!bus.registerObject("liquid", &second));
+	// Registering the same path again replaces the receiver
+	QVERIFY(bus.registerObject("costarring", &second));
+	
+	// Unregistering the other path does not remove the registered one
+	bus.unregisterObject("liquid");
+	QVERIFY(!bus.registerObject("liquid", &first));
+	
+	bus.unregisterObject("costarring");
+	QVERIFY(bus.registerObject("liquid", &first));
+}
+
+
+void TestMessageBusFeatures::objectIdZero()
+{
+	// FNV-1a of this path is 0, which addresses the call receiver
+	const QString		path("/obj/bgsBW7");
+	QVERIFY(MessageBus::objectId(path) != 0);
+	
+	TestMessageBusFeatures_Receiver	*	object	=	0;
+	TestMessageBusFeatures_PeerThread	peer(s_path, [&object, &path](MessageBus * server, TestMessageBusFeatures_Receiver * receiver) {
+		object	=	new TestMessageBusFeatures_Receiver();
+		object->setParent(receiver);
+		server->registerObject(path, object);
+	});
+	QVERIFY(peer.waitForStarted());
+	
+	MessageBus	bus(0);
+	QVERIFY(bus.connectToServer(s_path));
+	QVERIFY2(bus.callObject(path, "record", QList<Variant>() << Variant(qint32(1))), qPrintable(bus.lastErrorMessage()));
+	
+	QTRY_COMPARE_WITH_TIMEOUT(object->calls(), 1, 5000);
+	QCOMPARE(peer.receiver()->calls(), 0);
+}
+
+
+void TestMessageBusFeatures::structSlot()
+{
+	VariantStruct::registerType<TestMessageBusFeatures_Sample>("TestMessageBusFeatures_Sample");
+	
+	TestMessageBusFeatures_PeerThread	peer(s_path);
+	QVERIFY(peer.waitForStarted());
+	
+	MessageBus	bus(0);
+	QVERIFY(bus.connectToServer(s_path));
+	
+	// The second call uses the cached lookup of the slot
+	TestMessageBusFeatures_Sample	sample;
+	sample.time		=	1;
+	sample.sensor	=	"temperature";
+	QVERIFY2(bus.call("recordSample", VariantStruct::encode(sample)), qPrintable(bus.lastErrorMessage()));
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 1, 5000);
+	
+	sample.time		=	2;
+	QVERIFY2(bus.call("recordSample", VariantStruct::encode(sample)), qPrintable(bus.lastErrorMessage()));
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 2, 5000);
+	QCOMPARE(peer.receiver()->lastArgs().at(0).toInt64(), qint64(2));
+	QCOMPARE(peer.receiver()->lastArgs().at(1).toString(), QString("temperature"));
+	
+	// Slots without struct parameters get the List as Variant
+	QVERIFY2(bus.call("record", Variant(QList<Variant>() << Variant(qint32(3)))), qPrintable(bus.lastErrorMessage()));
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 3, 5000);
+	QCOMPARE(peer.receiver()->lastArgs().at(0).type(), Variant::List);
+	
+	const QMetaObject	*	meta	=	&TestMessageBusFeatures_Receiver::staticMetaObject;
+	QCOMPARE(VariantStruct::structSlots(meta, "recordSample").count(), 1);
+	QVERIFY(VariantStruct::structSlots(meta, "record").isEmpty());
+}
+
+
+void TestMessageBusFeatures::unknownMethodId()
+{
+	TestMessageBusFeatures_PeerThread	peer(s_path, [](MessageBus * server, TestMessageBusFeatures_Receiver * receiver) {
+		server->registerMethod<MSGBUS_METHOD(TestMessageBusFeatures_Receiver, recordSample)>(receiver);
+	});
+	QVERIFY(peer.waitForStarted());
+	
+	MessageBus	bus(0);
+	QVERIFY(bus.connectToServer(s_path));
+	
+	// The peer drops the call of a method it didn't register
+	QVERIFY2(bus.invoke<MSGBUS_METHOD(TestMessageBusFeatures_Receiver, record)>(Variant(qint32(1)), Variant(), Variant()), qPrintable(bus.lastErrorMessage()));
+	
+	// Calls are processed in order: once this one arrived, the dropped one didn't reach the receiver
+	TestMessageBusFeatures_Sample	sample;
+	sample.time		=	7;
+	sample.sensor	=	"pressure";
+	QVERIFY2(bus.invoke<MSGBUS_METHOD(TestMessageBusFeatures_Receiver, recordSample)>(sample), qPrintable(bus.lastErrorMessage()));
+	
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 1, 5000);
+	QCOMPARE(peer.receiver()->lastArgs().at(0).toInt64(), qint64(7));
+	QCOMPARE(peer.receiver()->lastArgs().at(1).toString(), QString("pressure"));
+	QVERIFY(bus.isOpen());
+}
+
+
+void TestMessageBusFeatures::publishFanOut()
+{
+	TestMessageBusFeatures_PeerThread	peer(s_path);
+	QVERIFY(peer.waitForStarted());
+	
+	// Subscribers served by the thread of the peer, published to from this thread
+	QList<TestMessageBusFeatures_Receiver*>	receivers;
+	QList<MessageBus*>											subscribers;
+	for(int i = 0; i < 3; i++)
+	{
+		receivers.append(new TestMessageBusFeatures_Receiver());
+		subscribers.append(new MessageBus(receivers.last()));
+		QVERIFY(subscribers.last()->connectToServer(s_path));
+		QVERIFY(subscribers.last()->subscribe("status"));
+	}
+	
+	// Subscriptions are processed by the peer asynchronously
+	qint32	message	=	0;
+	QTRY_COMPARE_WITH_TIMEOUT(peer.server()->publish("status", "record", QList<Variant>() << Variant(++message)), 3, 5000);
+	
+	for(int i = 0; i < receivers.count(); i++)
+	{
+		QTRY_VERIFY_WITH_TIMEOUT(receivers[i]->calls() > 0 && receivers[i]->lastArgs().first().toInt32() == message, 5000);
+		QVERIFY(subscribers[i]->isOpen());
+	}
+	
+	// Deletes the subscribers
+	qDeleteAll(receivers);
+}
+
+
+// Worker of a supervisor which is busy for \a delay msecs after connecting
+class TestMessageBusFeatures_WorkerThread : public QThread
+{
+	public:
+		TestMessageBusFeatures_WorkerThread(const QString& controlPath, int delay)
+			:	QThread(), m_controlPath(controlPath), m_delay(delay), m_receiver(0)
+		{
+		}
+		
+		~TestMessageBusFeatures_WorkerThread()
+		{
+			quit();
+			wait();
+		}
+		
+		int clients() const
+		{
+			return m_clients.loadAcquire();
+		}
+		
+		TestMessageBusFeatures_Receiver * receiver() const
+		{
+			return m_receiver;
+		}
+		
+	protected:
+		virtual void run()
+		{
+			TestMessageBusFeatures_Receiver		receiver;
+			MessageBusWorker								*	worker	=	new MessageBusWorker(&receiver);
+			
+			m_receiver	=	&receiver;
+			QObject::connect(worker, &MessageBusWorker::clientConnected, [this](MessageBus*) { m_clients.ref(); });
+			
+			if(!worker->connectToSupervisor(m_controlPath))
+				return;
+			
+			QThread::msleep(m_delay);
+			exec();
+		}
+		
+	private:
+		QString														m_controlPath;
+		int																m_delay;
+		QAtomicInt												m_clients;
+		TestMessageBusFeatures_Receiver		*	m_receiver;
+};
+
+
+void TestMessageBusFeatures::supervisorHandoff()
+{
+	const QString		controlPath(s_path + ".control");
+	
+	MessageBusSupervisor	supervisor;
+	QVERIFY2(supervisor.listen(s_path, controlPath), qPrintable(supervisor.lastErrorMessage()));
+	
+	TestMessageBusFeatures_WorkerThread	worker(controlPath, 2000);
+	worker.start();
+	QTRY_COMPARE_WITH_TIMEOUT(supervisor.workerCount(), 1, 5000);
+	
+	// The worker is busy: the supervisor must not wait for it while accepting
+	QList<MessageBus*>	clients;
+	for(int i = 0; i < 3; i++)
+	{
+		clients.append(new MessageBus(0));
+		QVERIFY(clients.last()->connectToServer(s_path));
+	}
+	
+	QElapsedTimer	timer;
+	timer.start();
+	QTest::qWait(300);
+	QVERIFY(timer.elapsed() < 1000);
+	QCOMPARE(worker.clients(), 0);
+	
+	// Served as soon as the worker is back
+	QTRY_COMPARE_WITH_TIMEOUT(worker.clients(), 3, 10000);
+	
+	foreach(MessageBus * client, clients)
+		QVERIFY2(client->call("record", Variant(qint32(1))), qPrintable(client->lastErrorMessage()));
+	
+	QTRY_COMPARE_WITH_TIMEOUT(worker.receiver()->calls(), 3, 5000);
+	
+	qDeleteAll(clients);
+}
+
+
+// Connects to a socket file until stopped, counting the refused attempts
+class TestMessageBusFeatures_ConnectThread : public QThread
+{
+	public:
+		TestMessageBusFeatures_ConnectThread(const QString& path)
+			:	QThread(), m_path(QFile::encodeName(path))
+		{
+		}
+		
+		void stop()
+		{
+			m_stop.storeRelease(1);
+			wait();
+		}
+		
+		int attempts() const
+		{
+			return m_attempts.loadAcquire();
+		}
+		
+		int refused() const
+		{
+			return m_refused.loadAcquire();
+		}
+		
+	protected:
+		virtual void run()
+		{
+			struct sockaddr_un	address;
+			memset(&address, 0, sizeof(address));
+			address.sun_family	=	AF_UNIX;
+			strncpy(address.sun_path, m_path.constData(), sizeof(address.sun_path) - 1);
+			
+			while(!m_stop.loadAcquire())
+			{
+				int	fd	=	::socket(AF_UNIX, SOCK_STREAM, 0);
+				
+				if(::connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+					m_refused.ref();
+				
+				m_attempts.ref();
+				::close(fd);
+				QThread::msleep(5);
+			}
+		}
+		
+	private:
+		QByteArray		m_path;
+		QAtomicInt		m_stop;
+		QAtomicInt		m_attempts;
+		QAtomicInt		m_refused;
+};
+
+
+void TestMessageBusFeatures::handOver()
+{
+	const QString		handoverPath(s_path + ".handover");
+	
+	TestMessageBusFeatures_PeerThread	oldPeer(s_path);
+	QVERIFY(oldPeer.waitForStarted());
+	
+	MessageBus	client(0);
+	QVERIFY(client.connectToServer(s_path));
+	QVERIFY2(client.call("record", Variant(qint32(1))), qPrintable(client.lastErrorMessage()));
+	QTRY_COMPARE_WITH_TIMEOUT(oldPeer.receiver()->calls(), 1, 5000);
+	
+	TestMessageBusFeatures_PeerThread	newPeer(handoverPath, TestMessageBusFeatures_PeerThread::Setup(), true);
+	QVERIFY(newPeer.waitForStarted());
+	
+	// The socket file must exist throughout the handover
+	TestMessageBusFeatures_ConnectThread	connecting(s_path);
+	connecting.start();
+	
+	QAtomicInt				result(-1);
+	MessageBus			*	oldServer	=	oldPeer.server();
+	QTimer::singleShot(0, oldServer, [&result, oldServer, handoverPath]() {
+		result.storeRelease(oldServer->handOver(handoverPath) ? 1 : 0);
+	});
+	QTRY_VERIFY_WITH_TIMEOUT(result.loadAcquire() >= 0, 30000);
+	
+	connecting.stop();
+	QCOMPARE(result.loadAcquire(), 1);
+	QVERIFY(connecting.attempts() > 0);
+	QCOMPARE(connecting.refused(), 0);
+	QVERIFY(QFile::exists(s_path));
+	
+	// The client continues with the new process, which accepts new clients too
+	QVERIFY2(client.call("record", Variant(qint32(2))), qPrintable(client.lastErrorMessage()));
+	QTRY_COMPARE_WITH_TIMEOUT(newPeer.receiver()->calls(), 1, 5000);
+	QCOMPARE(newPeer.receiver()->lastArgs().first().toInt32(), qint32(2));
+	
+	MessageBus	newClient(0);
+	QVERIFY(newClient.connectToServer(s_path));
+	QVERIFY2(newClient.call("record", Variant(qint32(3))), qPrintable(newClient.lastErrorMessage()));
+	QTRY_COMPARE_WITH_TIMEOUT(newPeer.receiver()->calls(), 2, 5000);
+	QCOMPARE(oldPeer.receiver()->calls(), 1);
+}
+
+
+void TestMessageBusFeatures::handOverTcp()
+{
+	// A free port on the loopback interface
+	QTcpServer	probe;
+	QVERIFY(probe.listen(QHostAddress::LocalHost));
+	const quint16	port	=	probe.serverPort();
+	probe.close();
+	
+	MessageBus	bus(0);
+	QVERIFY2(bus.listen(QString("tcp://127.0.0.1:%1").arg(port)), qPrintable(bus.lastErrorMessage()));
+	
+	// Refused instead of silently keeping the listener
+	QVERIFY(!bus.handOver(s_path + ".handover"));
+	QCOMPARE(bus.lastErrorMessage(), QString("TCP listeners cannot be handed over"));
+}
+
+
+// Calls a sharded bus from another thread
+class TestMessageBusFeatures_ShardedCallThread : public QThread
+{
+	public:
+		TestMessageBusFeatures_ShardedCallThread(ShardedMessageBus * bus, int calls)
+			:	QThread(), m_bus(bus), m_calls(calls), m_failed(0)
+		{
+		}
+		
+		int failed() const
+		{
+			return m_failed;
+		}
+		
+	protected:
+		virtual void run()
+		{
+			for(int i = 0; i < m_calls; i++)
+			{
+				if(!m_bus->callWithKey(Variant(qint32(1)), "record", QList<Variant>() << Variant(qint32(i))))
+					m_failed++;
+			}
+		}
+		
+	private:
+		ShardedMessageBus		*	m_bus;
+		int										m_calls;
+		int										m_failed;
+};
+
+
+void TestMessageBusFeatures::shardedCallOutsideRingLock()
+{
+	const QString		otherPath(s_path + ".other");
+	
+	// The second call waits for credits until the first one has been handled
+	TestMessageBusFeatures_PeerThread	peer(s_path, [](MessageBus * server, TestMessageBusFeatures_Receiver * receiver) {
+		server->setReceiveWindow(1);
+		receiver->setDelay(1000);
+	});
+	QVERIFY(peer.waitForStarted());
+	
+	TestMessageBusFeatures_PeerThread	other(otherPath);
+	QVERIFY(other.waitForStarted());
+	
+	ShardedMessageBus		sharded(0);
+	QVERIFY2(sharded.addEndpoint(s_path), qPrintable(sharded.lastErrorMessage()));
+	
+	TestMessageBusFeatures_ShardedCallThread	calls(&sharded, 2);
+	calls.start();
+	QTest::qWait(200);
+	
+	// Endpoints are added and removed while the call waits
+	QElapsedTimer	timer;
+	timer.start();
+	QVERIFY2(sharded.addEndpoint(otherPath), qPrintable(sharded.lastErrorMessage()));
+	sharded.removeEndpoint(otherPath);
+	QVERIFY(timer.elapsed() < 500);
+	
+	QVERIFY(calls.wait(10000));
+	QCOMPARE(calls.failed(), 0);
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 2, 5000);
+	
+	// The endpoint of a waiting call is removed at once, its bus is closed when the call returns
+	TestMessageBusFeatures_ShardedCallThread	moreCalls(&sharded, 2);
+	moreCalls.start();
+	QTest::qWait(200);
+	
+	timer.restart();
+	sharded.removeEndpoint(s_path);
+	QVERIFY(timer.elapsed() < 500);
+	QVERIFY(sharded.endpoints().isEmpty());
+	
+	QVERIFY(moreCalls.wait(10000));
+	QCOMPARE(moreCalls.failed(), 0);
+	
+	QVERIFY(!sharded.callWithKey(Variant(qint32(1)), "record", QList<Variant>()));
+	QCOMPARE(sharded.lastErrorMessage(), QString("No endpoint available"));
+}
+
+void TestMessageBusFeatures::stripeReassembly()
+{
+	TestMessageBusFeatures_PeerThread	peer(s_path, [](MessageBus * server, TestMessageBusFeatures_Receiver * receiver) {
+		MessageBusPool::acceptStripes(server, receiver);
+	});
+	QVERIFY(peer.waitForStarted());
+	
+	MessageBusPool	pool(0);
+	QVERIFY2(pool.connectToServer(s_path, 4), qPrintable(pool.lastErrorMessage()));
+	
+	// The last stripe is shorter
+	QByteArray	data(4 * MSGBUS_STRIPE_MIN_SIZE + 123, Qt::Uninitialized);
+	for(int i = 0; i < data.size(); i++)
+		data[i]	=	char(i * 7);
+	
+	QVERIFY2(pool.callStriped("record", data, QList<Variant>() << Variant(qint32(5))), qPrintable(pool.lastErrorMessage()));
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 1, 10000);
+	QCOMPARE(peer.receiver()->lastArgs().at(0).toByteArray(), data);
+	QCOMPARE(peer.receiver()->lastArgs().at(1).toInt32(), qint32(5));
+}
+
+
+// Sends a stripe as MessageBusPool::callStriped() does
+static bool sendStripe(MessageBus& bus, quint64 transferId, qint64 offset, qint64 size, qint32 stripes, const QByteArray& data)
+{
+	Variant	header(QList<Variant>() << Variant(transferId) << Variant(offset) << Variant(size) << Variant(stripes)
+													<< Variant(QString("record")) << Variant(QList<Variant>()));
+	
+	return bus.callObject(QString::fromLatin1(MSGBUS_STRIPE_PATH), "stripe", QList<Variant>() << header << Variant(data));
+}
+
+
+void TestMessageBusFeatures::stripeLyingPeer()
+{
+	TestMessageBusFeatures_PeerThread	peer(s_path, [](MessageBus * server, TestMessageBusFeatures_Receiver * receiver) {
+		MessageBusPool::acceptStripes(server, receiver);
+	});
+	QVERIFY(peer.waitForStarted());
+	
+	MessageBus	bus(0);
+	QVERIFY(bus.connectToServer(s_path));
+	
+	// Two stripes of 5 bytes
+	const QByteArray	data("0123456789");
+	
+	// More data than a transfer may have
+	QVERIFY(sendStripe(bus, 1, 0, Q_INT64_C(1) << 40, 2, data.left(5)));
+	// More stripes than bytes
+	QVERIFY(sendStripe(bus, 2, 0, 10, 11, data.left(1)));
+	// The same stripe twice: the transfer is dropped, the other stripe opens a new one
+	QVERIFY(sendStripe(bus, 3, 0, 10, 2, data.left(5)));
+	QVERIFY(sendStripe(bus, 3, 0, 10, 2, data.left(5)));
+	QVERIFY(sendStripe(bus, 3, 5, 10, 2, data.mid(5)));
+	// A short stripe
+	QVERIFY(sendStripe(bus, 4, 0, 10, 2, data.left(3)));
+	QVERIFY(sendStripe(bus, 4, 5, 10, 2, data.mid(5)));
+	// A stripe between the stripes of the layout
+	QVERIFY(sendStripe(bus, 5, 2, 10, 2, data.mid(2, 5)));
+	QVERIFY(sendStripe(bus, 5, 5, 10, 2, data.mid(5)));
+	
+	// A correct transfer is delivered, none of the ones above
+	QVERIFY(sendStripe(bus, 6, 5, 10, 2, data.mid(5)));
+	QVERIFY(sendStripe(bus, 6, 0, 10, 2, data.left(5)));
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 1, 5000);
+	QCOMPARE(peer.receiver()->lastArgs().first().toByteArray(), data);
+	
+	// Incomplete transfers are limited (3, 4 and 5 are incomplete)
+	for(int i = 3; i < MSGBUS_STRIPE_MAX_TRANSFERS; i++)
+		QVERIFY(sendStripe(bus, 100 + i, 0, 10, 2, data.left(5)));
+	
+	QVERIFY(sendStripe(bus, 200, 0, 10, 1, QByteArray("abcdefghij")));
+	
+	// Completing a transfer makes room again
+	QVERIFY(sendStripe(bus, 103, 5, 10, 2, data.mid(5)));
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 2, 5000);
+	QCOMPARE(peer.receiver()->lastArgs().first().toByteArray(), data);
+	
+	QVERIFY(sendStripe(bus, 200, 0, 10, 1, QByteArray("abcdefghij")));
+	QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 3, 5000);
+	QCOMPARE(peer.receiver()->lastArgs().first().toByteArray(), QByteArray("abcdefghij"));
+}
+
+
+QTEST_MAIN(TestMessageBusFeatures)
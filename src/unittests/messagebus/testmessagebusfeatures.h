@@ -0,0 +1,69 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2012  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TESTMESSAGEBUSFEATURES_H
+#define TESTMESSAGEBUSFEATURES_H
+
+#include <QtTest>
+
+#include "../../messagebus.h"
+
+
+class TestMessageBusFeatures : public QObject
+{
+	Q_OBJECT
+	
+	private slots:
+		void firstCallCredits();
+		
+		void channelFirstCallCredits();
+		
+		void oldPeerCalls();
+		
+		void channelsAndRootWindow();
+		
+		void shapedMaps();
+		
+		void objectIdCollisions();
+		
+		void objectIdZero();
+		
+		void structSlot();
+		
+		void unknownMethodId();
+		
+		void publishFanOut();
+		
+		void supervisorHandoff();
+		
+		void handOver();
+		
+		void handOverTcp();
+		
+		void shardedCallOutsideRingLock();
+		
+		void stripeReassembly();
+		
+		void stripeLyingPeer();
+		
+	public:
+		static QString	s_path;
+};
+
+#endif // TESTMESSAGEBUSFEATURES_H
@@ -0,0 +1,150 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2012  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "testmessagebusfeatures_peer.h"
+
+#include <QFile>
+
+
+TestMessageBusFeatures_Receiver::TestMessageBusFeatures_Receiver()
+	:	QObject(), m_calls(0), m_delay(0)
+{
+}
+
+
+int TestMessageBusFeatures_Receiver::calls() const
+{
+	QMutexLocker	locker(&m_lock);
+	return m_calls;
+}
+
+
+QList<Variant> TestMessageBusFeatures_Receiver::lastArgs() const
+{
+	QMutexLocker	locker(&m_lock);
+	return m_lastArgs;
+}
+
+
+void TestMessageBusFeatures_Receiver::setDelay(int msecs)
+{
+	QMutexLocker	locker(&m_lock);
+	m_delay	=	msecs;
+}
+
+
+void TestMessageBusFeatures_Receiver::record(MessageBus* src, const Variant& arg1, const Variant& arg2, const Variant& arg3)
+{
+	Q_UNUSED(src);
+	
+	int	delay;
+	{
+		QMutexLocker	locker(&m_lock);
+		delay	=	m_delay;
+	}
+	
+	if(delay > 0)
+		QThread::msleep(delay);
+	
+	QMutexLocker	locker(&m_lock);
+	m_lastArgs	=	QList<Variant>() << arg1 << arg2 << arg3;
+	m_calls++;
+}
+
+
+void TestMessageBusFeatures_Receiver::recordSample(MessageBus* src, const TestMessageBusFeatures_Sample& sample)
+{
+	Q_UNUSED(src);
+	
+	QMutexLocker	locker(&m_lock);
+	m_lastArgs	=	QList<Variant>() << Variant(sample.time) << Variant(sample.sensor);
+	m_calls++;
+}
+
+
+TestMessageBusFeatures_PeerThread::TestMessageBusFeatures_PeerThread(const QString& path, const Setup& setup, bool acceptHandover)
+	:	QThread(), m_path(path), m_setup(setup), m_acceptHandover(acceptHandover), m_started(false), m_receiver(0), m_server(0)
+{
+	start();
+}
+
+
+TestMessageBusFeatures_PeerThread::~TestMessageBusFeatures_PeerThread()
+{
+	quit();
+	wait();
+}
+
+
+bool TestMessageBusFeatures_PeerThread::waitForStarted(int timeout)
+{
+	QMutexLocker	locker(&m_lock);
+	
+	if(!m_started)
+		m_startedCondition.wait(&m_lock, timeout);
+	
+	return (m_receiver != 0);
+}
+
+
+TestMessageBusFeatures_Receiver * TestMessageBusFeatures_PeerThread::receiver() const
+{
+	QMutexLocker	locker(&m_lock);
+	return m_receiver;
+}
+
+
+MessageBus * TestMessageBusFeatures_PeerThread::server() const
+{
+	QMutexLocker	locker(&m_lock);
+	return m_server;
+}
+
+
+void TestMessageBusFeatures_PeerThread::run()
+{
+	// Deletes the listening bus and its clients
+	TestMessageBusFeatures_Receiver	*	receiver	=	new TestMessageBusFeatures_Receiver();
+	MessageBus											*	server		=	new MessageBus(receiver);
+	
+	if(m_setup)
+		m_setup(server, receiver);
+	
+	QFile::remove(m_path);
+	const bool	listening	=	(m_acceptHandover ? server->acceptHandover(m_path) : server->listen(m_path));
+	
+	{
+		QMutexLocker	locker(&m_lock);
+		m_started		=	true;
+		m_receiver	=	(listening ? receiver : 0);
+		m_server		=	(listening ? server : 0);
+		m_startedCondition.wakeAll();
+	}
+	
+	if(listening)
+		exec();
+	
+	{
+		QMutexLocker	locker(&m_lock);
+		m_receiver	=	0;
+		m_server		=	0;
+	}
+	
+	delete receiver;
+}
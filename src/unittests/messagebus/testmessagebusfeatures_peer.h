@@ -0,0 +1,107 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2012  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TESTMESSAGEBUSFEATURES_PEER_H
+#define TESTMESSAGEBUSFEATURES_PEER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <functional>
+
+#include "../../variant.h"
+#include "../../variantstruct.h"
+#include "../../messagebus.h"
+
+// Struct passed to slots (registered by the test)
+struct TestMessageBusFeatures_Sample
+{
+	qint64		time;
+	QString		sensor;
+	
+	MSGBUS_FIELDS(time, sensor)
+};
+
+
+// Records the calls of the tests in the thread of the peer
+class TestMessageBusFeatures_Receiver : public QObject
+{
+	Q_OBJECT
+	
+	public:
+		TestMessageBusFeatures_Receiver();
+		
+		int calls() const;
+		
+		QList<Variant> lastArgs() const;
+		
+		// Simulate a slow receiver
+		void setDelay(int msecs);
+		
+	public slots:
+		void record(MessageBus * src, const Variant& arg1 = Variant(), const Variant& arg2 = Variant(), const Variant& arg3 = Variant());
+		
+		// Records the fields of \a sample as arguments
+		void recordSample(MessageBus * src, const TestMessageBusFeatures_Sample& sample);
+		
+	private:
+		mutable QMutex				m_lock;
+		int										m_calls;
+		QList<Variant>				m_lastArgs;
+		int										m_delay;
+};
+
+
+// Serves a listening MessageBus in its own thread (calls block the caller until they are acknowledged)
+class TestMessageBusFeatures_PeerThread : public QThread
+{
+	public:
+		// Called in the thread of the peer before it starts listening
+		typedef std::function<void(MessageBus * server, TestMessageBusFeatures_Receiver * receiver)>	Setup;
+		
+		// With \a acceptHandover the bus waits on \a path for the handover of another bus instead of listening
+		TestMessageBusFeatures_PeerThread(const QString& path, const Setup& setup = Setup(), bool acceptHandover = false);
+		
+		virtual ~TestMessageBusFeatures_PeerThread();
+		
+		bool waitForStarted(int timeout = 10000);
+		
+		TestMessageBusFeatures_Receiver * receiver() const;
+		
+		// The listening bus (lives in the thread of the peer)
+		MessageBus * server() const;
+		
+	protected:
+		virtual void run();
+		
+	private:
+		QString														m_path;
+		Setup															m_setup;
+		bool															m_acceptHandover;
+		
+		mutable QMutex										m_lock;
+		QWaitCondition										m_startedCondition;
+		bool															m_started;
+		TestMessageBusFeatures_Receiver		*	m_receiver;
+		MessageBus												*	m_server;
+};
+
+#endif // TESTMESSAGEBUSFEATURES_PEER_H
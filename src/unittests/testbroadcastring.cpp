@@ -0,0 +1,63 @@
+#include "testbroadcastring.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../broadcastring.h"
+
+
+void TestBroadcastRing::testSealed()
+{
+  BroadcastRing   ring;
+  QVERIFY2(ring.create(8192), qPrintable(ring.lastErrorString()));
+  
+  const int fd    = ring.descriptor().toSocketDescriptor();
+  const int seals = fcntl(fd, F_GET_SEALS);
+  QVERIFY(seals >= 0);
+  QVERIFY(seals & F_SEAL_SHRINK);
+  QVERIFY(seals & F_SEAL_GROW);
+  QVERIFY(seals & F_SEAL_SEAL);
+  
+  // Nobody can take the memory away from the readers
+  QVERIFY(ftruncate(fd, 0) < 0);
+}
+
+
+void TestBroadcastRing::testUnsealedRefused()
+{
+  // Looks like a ring, but could be shrunk while it is mapped
+  int fd  = memfd_create("test-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  QVERIFY(fd >= 0);
+  QVERIFY(ftruncate(fd, 4096 + 8192) == 0);
+  
+  BroadcastRing   ring;
+  QVERIFY(!ring.attach(Variant::fromSocketDescriptor(fd)));
+  QVERIFY(!ring.isOpen());
+  QVERIFY(!ring.lastErrorString().isEmpty());
+}
+
+
+void TestBroadcastRing::testReadWrite()
+{
+  BroadcastRing   writer;
+  QVERIFY2(writer.create(8192), qPrintable(writer.lastErrorString()));
+  
+  // The reader takes ownership of its descriptor
+  BroadcastRing   reader;
+  QVERIFY2(reader.attach(Variant::fromSocketDescriptor(::dup(writer.descriptor().toSocketDescriptor()))), qPrintable(reader.lastErrorString()));
+  
+  QVERIFY(writer.write(Variant(QByteArray("first"))));
+  QVERIFY(writer.write(Variant(qint32(42))));
+  
+  bool  ok  = false;
+  QCOMPARE(reader.read(&ok).toByteArray(), QByteArray("first"));
+  QVERIFY(ok);
+  QCOMPARE(reader.read(&ok).toInt32(), qint32(42));
+  QVERIFY(ok);
+  reader.read(&ok);
+  QVERIFY(!ok);
+}
+
+
+QTEST_MAIN(TestBroadcastRing)
@@ -0,0 +1,19 @@
+#ifndef TESTBROADCASTRING_H
+#define TESTBROADCASTRING_H
+
+#include <QtCore>
+#include <QtTest>
+
+class TestBroadcastRing : public QObject
+{
+  Q_OBJECT
+  
+  private slots:
+    void testSealed();
+    
+    void testUnsealedRefused();
+    
+    void testReadWrite();
+};
+
+#endif // TESTBROADCASTRING_H
@@ -0,0 +1,194 @@
+#include "testbroker.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../broker/broker.h"
+#include "../brokerclient.h"
+#include "../brokerprotocol.h"
+
+#define BROKER_PATH   (QDir::tempPath() + "/test_broker.sock")
+
+
+// Package as written by LocalSocket
+static QByteArray rawPackage(const Variant& package)
+{
+  quint8    type  = quint8(package.type());
+  quint32   optId = package.optionalId();
+  quint32   size  = package.size();
+  
+  QByteArray  ret;
+  ret.append((const char*)&type, sizeof(type));
+  ret.append((const char*)&optId, sizeof(optId));
+  ret.append((const char*)&size, sizeof(size));
+  ret.append(package.constData(), size);
+  return ret;
+}
+
+
+TestBroker_Thread::TestBroker_Thread(const QString& path)
+: QThread(), m_path(path), m_listening(false)
+{
+  start();
+}
+
+
+TestBroker_Thread::~TestBroker_Thread()
+{
+  quit();
+  wait();
+}
+
+
+bool TestBroker_Thread::waitForStarted()
+{
+  m_started.acquire();
+  return m_listening;
+}
+
+
+void TestBroker_Thread::run()
+{
+  Broker  broker;
+  m_listening = broker.listen(m_path, 2);
+  m_started.release();
+  
+  if(m_listening)
+    exec();
+}
+
+
+QList<QPair<QString, Variant> > TestBroker_Receiver::calls() const
+{
+  QMutexLocker  locker(&m_lock);
+  return m_calls;
+}
+
+
+void TestBroker_Receiver::record(const QString& sender, const Variant& param)
+{
+  QMutexLocker  locker(&m_lock);
+  m_calls.append(qMakePair(sender, param));
+}
+
+
+void TestBroker::init()
+{
+  QFile::remove(BROKER_PATH);
+  
+  m_broker  = new TestBroker_Thread(BROKER_PATH);
+  QVERIFY(m_broker->waitForStarted());
+}
+
+
+void TestBroker::cleanup()
+{
+  delete m_broker;
+  m_broker  = 0;
+}
+
+
+void TestBroker::testCrossWorkerDelivery()
+{
+  // Clients are assigned round robin: both workers are involved
+  TestBroker_Receiver   receiverA;
+  TestBroker_Receiver   receiverB;
+  BrokerClient        * clientA = new BrokerClient(&receiverA);
+  BrokerClient        * clientB = new BrokerClient(&receiverB);
+  
+  QVERIFY2(clientA->connectToBroker(BROKER_PATH, "a"), qPrintable(clientA->lastErrorMessage()));
+  QVERIFY2(clientB->connectToBroker(BROKER_PATH, "b"), qPrintable(clientB->lastErrorMessage()));
+  
+  for(int i = 0; i < 100; i++)
+  {
+    QVERIFY(clientA->call("b", "record", QList<Variant>() << Variant(qint32(i))));
+    QVERIFY(clientB->call("a", "record", QList<Variant>() << Variant(qint32(-i))));
+  }
+  
+  QTRY_COMPARE(receiverB.calls().count(), 100);
+  QTRY_COMPARE(receiverA.calls().count(), 100);
+  
+  // In order, from the right sender
+  for(int i = 0; i < 100; i++)
+  {
+    QCOMPARE(receiverB.calls().at(i).first, QString("a"));
+    QCOMPARE(receiverB.calls().at(i).second.toInt32(), qint32(i));
+    QCOMPARE(receiverA.calls().at(i).first, QString("b"));
+    QCOMPARE(receiverA.calls().at(i).second.toInt32(), qint32(-i));
+  }
+}
+
+
+void TestBroker::testUndeliverable()
+{
+  TestBroker_Receiver   receiverA;
+  TestBroker_Receiver   receiverB;
+  BrokerClient        * clientA = new BrokerClient(&receiverA);
+  BrokerClient        * clientB = new BrokerClient(&receiverB);
+  
+  QVERIFY2(clientA->connectToBroker(BROKER_PATH, "a"), qPrintable(clientA->lastErrorMessage()));
+  QVERIFY2(clientB->connectToBroker(BROKER_PATH, "b"), qPrintable(clientB->lastErrorMessage()));
+  
+  QSignalSpy  spy(clientA, SIGNAL(undeliverable(QString)));
+  
+  QVERIFY(clientA->call("nobody", "record", QList<Variant>() << Variant(qint32(1))));
+  QTRY_COMPARE(spy.count(), 1);
+  QCOMPARE(spy.at(0).at(0).toString(), QString("nobody"));
+  
+  // A receiver of the other worker that has gone
+  clientB->disconnectFromBroker();
+  QTRY_VERIFY(!clientB->isOpen());
+  QTest::qWait(200);
+  
+  QVERIFY(clientA->call("b", "record", QList<Variant>() << Variant(qint32(2))));
+  QTRY_COMPARE(spy.count(), 2);
+  QCOMPARE(spy.at(1).at(0).toString(), QString("b"));
+  QVERIFY(receiverB.calls().isEmpty());
+}
+
+
+void TestBroker::testSlowReceiver()
+{
+  TestBroker_Receiver   receiverA;
+  BrokerClient        * clientA = new BrokerClient(&receiverA);
+  QVERIFY2(clientA->connectToBroker(BROKER_PATH, "a"), qPrintable(clientA->lastErrorMessage()));
+  
+  // Registers as "slow" but never reads the calls
+  int fd  = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  QVERIFY(fd >= 0);
+  
+  struct sockaddr_un  address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family  = AF_UNIX;
+  strncpy(address.sun_path, QFile::encodeName(BROKER_PATH).constData(), sizeof(address.sun_path) - 1);
+  QVERIFY(::connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0);
+  
+  Variant   registration(QString("slow"));
+  registration.setOptionalId(BROKER_OPTID(BROKER_REGISTER, 0));
+  const QByteArray  raw(rawPackage(registration));
+  QVERIFY(::write(fd, raw.constData(), raw.size()) == raw.size());
+  
+  // Header of the answer: type, optional id and size
+  char      answer[9];
+  QVERIFY(::read(fd, answer, sizeof(answer)) == sizeof(answer));
+  
+  QSignalSpy  spy(clientA, SIGNAL(undeliverable(QString)));
+  
+  // Much more than the broker queues for one client
+  const Variant   payload(QByteArray(1024 * 1024, 'x'));
+  for(int i = 0; i < 64; i++)
+    QVERIFY(clientA->call("slow", "record", QList<Variant>() << payload));
+  
+  QTRY_VERIFY_WITH_TIMEOUT(spy.count() > 0, 10000);
+  QCOMPARE(spy.at(0).at(0).toString(), QString("slow"));
+  
+  // The broker still serves everybody else
+  QVERIFY(clientA->call("a", "record", QList<Variant>() << Variant(qint32(7))));
+  QTRY_COMPARE(receiverA.calls().count(), 1);
+  
+  ::close(fd);
+}
+
+
+QTEST_MAIN(TestBroker)
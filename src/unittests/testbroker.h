@@ -0,0 +1,66 @@
+#ifndef TESTBROKER_H
+#define TESTBROKER_H
+
+#include <QtCore>
+#include <QtTest>
+
+#include "../variant.h"
+
+// Runs the broker with two workers in its own thread
+class TestBroker_Thread : public QThread
+{
+  Q_OBJECT
+  
+  public:
+    TestBroker_Thread(const QString& path);
+    
+    ~TestBroker_Thread();
+    
+    bool waitForStarted();
+    
+  protected:
+    virtual void run();
+    
+  private:
+    QString     m_path;
+    bool        m_listening;
+    QSemaphore  m_started;
+};
+
+
+class TestBroker_Receiver : public QObject
+{
+  Q_OBJECT
+  
+  public:
+    QList<QPair<QString, Variant> > calls() const;
+    
+  public slots:
+    void record(const QString& sender, const Variant& param);
+    
+  private:
+    mutable QMutex                    m_lock;
+    QList<QPair<QString, Variant> >   m_calls;
+};
+
+
+class TestBroker : public QObject
+{
+  Q_OBJECT
+  
+  private slots:
+    void init();
+    
+    void cleanup();
+    
+    void testCrossWorkerDelivery();
+    
+    void testUndeliverable();
+    
+    void testSlowReceiver();
+    
+  private:
+    TestBroker_Thread   * m_broker;
+};
+
+#endif // TESTBROKER_H
@@ -0,0 +1,418 @@
+#include "testlocalsocketflow.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "../localsocket.h"
+#include "../variant.h"
+
+// Wire format of LocalSocketPrivate
+#define FRAGMENT_TYPE   0x7F
+#define PRIORITY_FLAG   0x80
+
+
+static QByteArray header(quint8 type, quint32 optId, quint32 size)
+{
+  QByteArray  ret;
+  ret.append((const char*)&type, sizeof(type));
+  ret.append((const char*)&optId, sizeof(optId));
+  ret.append((const char*)&size, sizeof(size));
+  return ret;
+}
+
+
+static QByteArray fragment(quint32 id, const QByteArray& data, bool highPriority = false)
+{
+  return header(FRAGMENT_TYPE | (highPriority ? PRIORITY_FLAG : 0), id, data.size()) + data;
+}
+
+
+static QByteArray firstFragment(quint32 id, quint64 packageSize, const QByteArray& data, bool highPriority = false)
+{
+  quint8    type  = Variant::ByteArray;
+  quint32   optId = 0;
+  QByteArray  packageHeader;
+  packageHeader.append((const char*)&type, sizeof(type));
+  packageHeader.append((const char*)&optId, sizeof(optId));
+  packageHeader.append((const char*)&packageSize, sizeof(packageSize));
+  
+  return fragment(id, packageHeader + data, highPriority);
+}
+
+
+static bool writeRaw(int fd, const QByteArray& data)
+{
+  return (::write(fd, data.constData(), data.size()) == data.size());
+}
+
+
+// Listening TCP socket on 127.0.0.1, the port is chosen by the kernel
+static int listenTcp(quint16 * port)
+{
+  struct sockaddr_in  address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family      = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port        = 0;
+  
+  int fd  = ::socket(AF_INET, SOCK_STREAM, 0);
+  socklen_t length  = sizeof(address);
+  
+  if(fd < 0 || ::bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || ::listen(fd, 1) != 0 ||
+     ::getsockname(fd, (struct sockaddr*)&address, &length) != 0)
+  {
+    if(fd >= 0)
+      ::close(fd);
+    return -1;
+  }
+  
+  *port = ntohs(address.sin_port);
+  return fd;
+}
+
+
+int TestLocalSocketFlow::connectRaw(LocalSocket* socket)
+{
+  int fds[2];
+  if(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    return -1;
+  
+  if(!socket->setSocketDescriptor(quintptr(fds[0])))
+  {
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return -1;
+  }
+  
+  return fds[1];
+}
+
+
+void TestLocalSocketFlow::init()
+{
+  int fds[2];
+  QVERIFY(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  
+  m_writer  = new LocalSocket();
+  m_reader  = new LocalSocket();
+  QVERIFY(m_writer->setSocketDescriptor(quintptr(fds[0])));
+  QVERIFY(m_reader->setSocketDescriptor(quintptr(fds[1])));
+}
+
+
+void TestLocalSocketFlow::cleanup()
+{
+  delete m_writer;
+  delete m_reader;
+  m_writer  = 0;
+  m_reader  = 0;
+}
+
+
+void TestLocalSocketFlow::testCorkThreshold()
+{
+  m_writer->setCorkThreshold(4096);
+  m_writer->setCorkDeadline(60 * 1000 * 1000);
+  m_writer->setCorked(true);
+  
+  // Held back below the threshold
+  QVERIFY(m_writer->write(Variant(QByteArray(1024, 'a'))));
+  QVERIFY(m_writer->dataToWrite() > 0);
+  QVERIFY(!m_reader->waitForReadyRead(100));
+  
+  // Reaching the threshold writes everything without waiting for the deadline
+  QVERIFY(m_writer->write(Variant(QByteArray(4096, 'b'))));
+  QVERIFY(m_writer->waitForDataWritten(5000));
+  QCOMPARE(m_writer->dataToWrite(), qint64(0));
+  
+  while(m_reader->availableData() < 2)
+    QVERIFY(m_reader->waitForReadyRead(5000));
+  QCOMPARE(m_reader->read().toByteArray(), QByteArray(1024, 'a'));
+  QCOMPARE(m_reader->read().toByteArray(), QByteArray(4096, 'b'));
+}
+
+
+void TestLocalSocketFlow::testCorkDeadline()
+{
+  m_writer->setCorkThreshold(1024 * 1024);
+  m_writer->setCorkDeadline(50 * 1000);
+  m_writer->setCorked(true);
+  
+  QElapsedTimer timer;
+  timer.start();
+  QVERIFY(m_writer->write(Variant(QByteArray("corked"))));
+  QVERIFY(m_writer->dataToWrite() > 0);
+  
+  // Flushed by the scheduler once the deadline has passed (needs the event loop)
+  QTRY_COMPARE_WITH_TIMEOUT(m_writer->dataToWrite(), qint64(0), 5000);
+  QVERIFY(timer.elapsed() >= 40);
+  
+  QVERIFY(m_reader->waitForReadyRead(5000));
+  QCOMPARE(m_reader->read().toByteArray(), QByteArray("corked"));
+}
+
+
+void TestLocalSocketFlow::testWaterMarks()
+{
+  const QByteArray  chunk(64 * 1024, 'w');
+  
+  m_writer->setHighWaterMark(256 * 1024);
+  m_writer->setLowWaterMark(64 * 1024);
+  QSignalSpy  writableSpy(m_writer, SIGNAL(writable()));
+  
+  // Nobody reads: fill the kernel buffers until the write buffer reaches the high water mark
+  bool  wouldBlock  = false;
+  int   written     = 0;
+  while(written < 4096 && m_writer->tryWrite(Variant(chunk), &wouldBlock))
+    written++;
+  
+  QVERIFY(wouldBlock);
+  QVERIFY(!m_writer->isWritable());
+  QVERIFY(m_writer->dataToWrite() >= 256 * 1024);
+  QVERIFY(m_writer->isOpen());
+  
+  // write() keeps queueing, high priority packages pass tryWrite()
+  QVERIFY(m_writer->write(Variant(chunk)));
+  QVERIFY(m_writer->tryWrite(Variant(chunk), &wouldBlock, LocalSocket::HighPriority));
+  QVERIFY(!wouldBlock);
+  written += 2;
+  
+  // Reading drains the write buffer below the low water mark
+  int   received  = 0;
+  QElapsedTimer timer;
+  timer.start();
+  while(received < written && timer.elapsed() < 30000)
+  {
+    QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    
+    while(m_reader->availableData() > 0)
+    {
+      QCOMPARE(m_reader->read().toByteArray(), chunk);
+      received++;
+    }
+  }
+  
+  QCOMPARE(received, written);
+  QVERIFY(writableSpy.count() >= 1);
+  QVERIFY(m_writer->isWritable());
+  QVERIFY(m_writer->tryWrite(Variant(chunk), &wouldBlock));
+}
+
+
+void TestLocalSocketFlow::testFragmentsNegotiated()
+{
+  LocalSocket   socket;
+  const int     fd  = connectRaw(&socket);
+  QVERIFY(fd >= 0);
+  
+  const QByteArray  large(64 * 1024, 'f');
+  quint8            type  = 0;
+  
+  // Peers of older versions cannot read fragments: not written unless enabled
+  QVERIFY(socket.write(Variant(large)));
+  QVERIFY(socket.waitForDataWritten(5000));
+  QByteArray  received(9 + large.size(), 0);
+  QCOMPARE(int(::recv(fd, received.data(), received.size(), MSG_WAITALL)), received.size());
+  memcpy(&type, received.constData(), sizeof(type));
+  QCOMPARE(int(type), int(Variant::ByteArray));
+  
+  socket.setFragmentsEnabled(true);
+  QVERIFY(socket.write(Variant(large)));
+  QVERIFY(socket.waitForDataWritten(5000));
+  QCOMPARE(int(::recv(fd, received.data(), 9, MSG_WAITALL)), 9);
+  memcpy(&type, received.constData(), sizeof(type));
+  QCOMPARE(int(type), FRAGMENT_TYPE);
+  
+  ::close(fd);
+}
+
+
+void TestLocalSocketFlow::testFragmentSizeLimit()
+{
+  LocalSocket   socket;
+  const int     fd  = connectRaw(&socket);
+  QVERIFY(fd >= 0);
+  
+  // Just above the largest package a peer accepts in fragments (256M)
+  const int   size  = 256 * 1024 * 1024 + 1;
+  socket.setFragmentsEnabled(true);
+  QVERIFY(socket.write(Variant(QByteArray(size, 'l'))));
+  
+  // Written in one piece, as peers read it
+  QByteArray  head;
+  QByteArray  buffer(1024 * 1024, Qt::Uninitialized);
+  qint64      received  = 0;
+  QElapsedTimer timer;
+  timer.start();
+  
+  while(received < 9 + qint64(size) && timer.elapsed() < 30000)
+  {
+    QCoreApplication::processEvents();
+    
+    const ssize_t count = ::recv(fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+    if(count > 0)
+    {
+      if(head.size() < 9)
+        head.append(buffer.constData(), qMin(int(count), 9 - head.size()));
+      received  += count;
+    }
+  }
+  
+  QCOMPARE(received, 9 + qint64(size));
+  quint8    type;
+  quint32   dataSize;
+  memcpy(&type, head.constData(), sizeof(type));
+  memcpy(&dataSize, head.constData() + 5, sizeof(dataSize));
+  QCOMPARE(int(type), int(Variant::ByteArray));
+  QCOMPARE(dataSize, quint32(size));
+  QVERIFY(socket.isOpen());
+  
+  ::close(fd);
+}
+
+
+void TestLocalSocketFlow::testFragmentInterleaving()
+{
+  LocalSocket   socket;
+  const int     fd  = connectRaw(&socket);
+  QVERIFY(fd >= 0);
+  
+  const QByteArray  normal(40000, 'n');
+  const QByteArray  high(20000, 'h');
+  
+  // One large package per lane, fragments and a small package interleaved
+  QByteArray  wire;
+  wire.append(firstFragment(7, normal.size(), normal.left(16000)));
+  wire.append(firstFragment(8, high.size(), high.left(10000), true));
+  wire.append(fragment(7, normal.mid(16000, 16000)));
+  wire.append(header(Variant::ByteArray | PRIORITY_FLAG, 0, 5) + QByteArray("small"));
+  wire.append(fragment(8, high.mid(10000), true));
+  wire.append(fragment(7, normal.mid(32000)));
+  QVERIFY(writeRaw(fd, wire));
+  
+  QTRY_COMPARE_WITH_TIMEOUT(socket.availableData(), 3, 5000);
+  QVERIFY(socket.isOpen());
+  
+  LocalSocket::Priority   priority;
+  QCOMPARE(socket.read(0, &priority).toByteArray(), QByteArray("small"));
+  QCOMPARE(priority, LocalSocket::HighPriority);
+  QCOMPARE(socket.read(0, &priority).toByteArray(), high);
+  QCOMPARE(priority, LocalSocket::HighPriority);
+  QCOMPARE(socket.read(0, &priority).toByteArray(), normal);
+  QCOMPARE(priority, LocalSocket::NormalPriority);
+  
+  ::close(fd);
+}
+
+
+void TestLocalSocketFlow::testFragmentOversized()
+{
+  LocalSocket   socket;
+  const int     fd  = connectRaw(&socket);
+  QVERIFY(fd >= 0);
+  
+  // Announces 4G but only sends a few bytes: must be refused, not allocated
+  QVERIFY(writeRaw(fd, firstFragment(1, Q_UINT64_C(0xFFFFFFFF), QByteArray(16, 'x'))));
+  
+  QTRY_VERIFY_WITH_TIMEOUT(!socket.isOpen(), 5000);
+  QVERIFY(!socket.lastErrorString().isEmpty());
+  
+  ::close(fd);
+}
+
+
+void TestLocalSocketFlow::testFragmentTooMany()
+{
+  LocalSocket   socket;
+  const int     fd  = connectRaw(&socket);
+  QVERIFY(fd >= 0);
+  
+  // A peer only writes one package per lane in fragments at a time
+  QByteArray  wire;
+  for(quint32 id = 1; id <= 16; id++)
+    wire.append(firstFragment(id, 1024 * 1024, QByteArray(16, 'x')));
+  QVERIFY(writeRaw(fd, wire));
+  
+  QTRY_VERIFY_WITH_TIMEOUT(!socket.isOpen(), 5000);
+  
+  ::close(fd);
+}
+
+
+void TestLocalSocketFlow::testFragmentOverflow()
+{
+  LocalSocket   socket;
+  const int     fd  = connectRaw(&socket);
+  QVERIFY(fd >= 0);
+  
+  // More data than announced
+  QVERIFY(writeRaw(fd, firstFragment(1, 100, QByteArray(64, 'x')) + fragment(1, QByteArray(64, 'y'))));
+  
+  QTRY_VERIFY_WITH_TIMEOUT(!socket.isOpen(), 5000);
+  QCOMPARE(socket.availableData(), 0);
+  
+  ::close(fd);
+}
+
+
+
+void TestLocalSocketFlow::testTcpLoopback()
+{
+  quint16   port    = 0;
+  const int server  = listenTcp(&port);
+  QVERIFY(server >= 0);
+  
+  LocalSocket   client;
+  QVERIFY2(client.connectToServer(QString("tcp://127.0.0.1:%1").arg(port)), qPrintable(client.lastErrorString()));
+  QVERIFY(!client.canPassFileDescriptors());
+  
+  const int accepted  = ::accept(server, 0, 0);
+  ::close(server);
+  QVERIFY(accepted >= 0);
+  
+  // Accepted descriptors are detected as TCP
+  LocalSocket   peer;
+  QVERIFY(peer.setSocketDescriptor(quintptr(accepted)));
+  QVERIFY(!peer.canPassFileDescriptors());
+  
+  QVERIFY(client.write(Variant(QByteArray("ping"))));
+  QVERIFY(client.write(Variant(QByteArray(256 * 1024, 'x'))));
+  while(peer.availableData() < 2)
+    QVERIFY(peer.waitForReadyRead(5000));
+  QCOMPARE(peer.read().toByteArray(), QByteArray("ping"));
+  QCOMPARE(peer.read().toByteArray(), QByteArray(256 * 1024, 'x'));
+  
+  QVERIFY(peer.write(Variant(qint32(42))));
+  while(client.availableData() < 1)
+    QVERIFY(client.waitForReadyRead(5000));
+  QCOMPARE(client.read().toInt32(), qint32(42));
+  
+  // Refused before anything is written
+  QVERIFY(!client.write(Variant::fromSocketDescriptor(0)));
+  QVERIFY(client.isOpen());
+}
+
+
+void TestLocalSocketFlow::testTcpConnectRefused()
+{
+  // Nobody listens on the port anymore
+  quint16   port    = 0;
+  const int server  = listenTcp(&port);
+  QVERIFY(server >= 0);
+  ::close(server);
+  
+  LocalSocket   client;
+  QElapsedTimer timer;
+  timer.start();
+  QVERIFY(!client.connectToServer(QString("tcp://127.0.0.1:%1").arg(port)));
+  QVERIFY(timer.elapsed() < 5000);
+  
+  // The error of connect(), not of the cleanup after it
+  QVERIFY2(client.lastErrorString().contains(QString::fromLocal8Bit(strerror(ECONNREFUSED))), qPrintable(client.lastErrorString()));
+}
+
+QTEST_MAIN(TestLocalSocketFlow)
@@ -0,0 +1,49 @@
+#ifndef TESTLOCALSOCKETFLOW_H
+#define TESTLOCALSOCKETFLOW_H
+
+#include <QtCore>
+#include <QtTest>
+
+class LocalSocket;
+
+class TestLocalSocketFlow : public QObject
+{
+  Q_OBJECT
+  
+  private slots:
+    void init();
+    
+    void cleanup();
+    
+    void testCorkThreshold();
+    
+    void testCorkDeadline();
+    
+    void testWaterMarks();
+    
+    void testFragmentsNegotiated();
+    
+    void testFragmentSizeLimit();
+    
+    void testFragmentInterleaving();
+    
+    void testFragmentOversized();
+    
+    void testFragmentTooMany();
+    
+    void testFragmentOverflow();
+    
+    void testTcpLoopback();
+    
+    void testTcpConnectRefused();
+    
+  private:
+    // Connects \a socket to a raw socket descriptor (returned) to inspect or forge the wire format
+    static int connectRaw(LocalSocket * socket);
+    
+  private:
+    LocalSocket   * m_writer;
+    LocalSocket   * m_reader;
+};
+
+#endif // TESTLOCALSOCKETFLOW_H
@@ -1,8 +1,80 @@
 #include "testvariant.h"
 
 #include <QVariantMap>
+#include <QDir>
+
+#include <utility>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "../variant.h"
+#include "../variantview.h"
+#include "../variantstruct.h"
+#include "../localsocket.h"
+#include "../messagebus.h"
+#include "messagebus/testmessagebusfeatures_peer.h"
+
+struct TestVariant_Point
+{
+  qint32    x;
+  qint32    y;
+  
+  MSGBUS_FIELDS(x, y)
+};
+
+struct TestVariant_Sample
+{
+  qint64            time;
+  QString           sensor;
+  TestVariant_Point point;
+  QVector<double>   values;
+  
+  MSGBUS_FIELDS(time, sensor, point, values)
+};
+
+// Open descriptors of the process: every copy of an auto closing SocketDescriptor Variant dup()s one
+static int openDescriptors()
+{
+  return QDir("/proc/self/fd").entryList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot).count();
+}
+
+template<typename T>
+struct TestVariant_Value
+{
+  T   value;
+  
+  MSGBUS_FIELDS(value)
+};
+
+// Converts a String shared with other threads
+class TestVariant_StringReader : public QThread
+{
+  public:
+    TestVariant_StringReader(const Variant& string, const QString& expected)
+      : QThread(), m_string(string), m_expected(expected), m_matches(0)
+    {
+    }
+    
+    int matches() const
+    {
+      return m_matches;
+    }
+    
+  protected:
+    virtual void run()
+    {
+      for(int i = 0; i < 1000; i++)
+      {
+        if(m_string.toString() == m_expected)
+          m_matches++;
+      }
+    }
+    
+  private:
+    const Variant & m_string;
+    QString         m_expected;
+    int             m_matches;
+};
 
 void TestVariant::testQMap()
 {
@@ -32,4 +104,359 @@ void TestVariant::testQList()
 }
 
 
+void TestVariant::testArrays()
+{
+  const QVector<qint32>   ints({1, -2, 0x01020304});
+  const QVector<double>   doubles({0.5, -1.25});
+  
+  Variant intArray(ints);
+  Variant doubleArray(doubles);
+  QCOMPARE(intArray.type(), Variant::Int32Array);
+  QCOMPARE(intArray.arraySize(), 3);
+  QCOMPARE(intArray.toInt32Array(), ints);
+  QCOMPARE(doubleArray.toDoubleArray(), doubles);
+  
+  // Little endian on every host
+  QCOMPARE(QByteArray(intArray.constData() + 8, 4), QByteArray("\x04\x03\x02\x01", 4));
+  QCOMPARE(Variant(QVector<qint64>({1})).toByteArray(), QByteArray("\x01\0\0\0\0\0\0\0", 8));
+  
+  // A list of numbers is encoded as array, also when nested
+  QVariantList  list({1, 2, 3});
+  QCOMPARE(Variant(list).type(), Variant::Int32Array);
+  QCOMPARE(Variant(list).toQList(), list);
+  
+  QVariantMap   map;
+  map.insert("values", list);
+  Variant mapVariant(map);
+  QCOMPARE(mapVariant.mapView().typeOf("values"), Variant::Int32Array);
+  QCOMPARE(mapVariant.toQMap(), map);
+}
+
+
+void TestVariant::testArrayListView()
+{
+  // Arrays are no Lists: their views are invalid instead of reading the numbers as items
+  Variant intArray(QVector<qint32>({1, 2, 3}));
+  QVERIFY(!intArray.listView().isValid());
+  QCOMPARE(intArray.listView().size(), 0);
+  QVERIFY(!intArray.mapView().isValid());
+  
+  QVariantList  nested;
+  nested.append(QVariantList({1, 2}));
+  nested.append(QVariantList({1.5, 2.5}));
+  nested.append(QVariantList({"a", 3}));
+  
+  Variant list(nested);
+  VariantListView view(list.listView());
+  QVERIFY(view.isValid());
+  QCOMPARE(view.size(), 3);
+  QCOMPARE(view.typeAt(0), Variant::Int32Array);
+  QCOMPARE(view.typeAt(1), Variant::DoubleArray);
+  QVERIFY(!view.listAt(0).isValid());
+  QVERIFY(!view.listAt(1).isValid());
+  QVERIFY(view.listAt(2).isValid());
+  QCOMPARE(view.at(0).toInt32Array(), QVector<qint32>({1, 2}));
+  QCOMPARE(view.at(1).toDoubleArray(), QVector<double>({1.5, 2.5}));
+}
+
+
+void TestVariant::testArrayLegacyEncoding()
+{
+  // Integer arrays are sent to peers of older versions as Lists
+  const QVector<qint32>   ints({7, -8});
+  Variant legacyInts(Variant(ints).toLegacyEncoding());
+  QCOMPARE(legacyInts.type(), Variant::List);
+  
+  bool  ok  = false;
+  Variant decoded(Variant::fromLegacyEncoding(legacyInts, &ok));
+  QVERIFY(ok);
+  QCOMPARE(decoded.toInt32Array(), ints);
+  
+  // Float and Double arrays are sent unchanged: such a peer receives an unknown type with the raw data
+  const QVector<float>    floats({1.5f});
+  const QVector<double>   doubles({2.5});
+  Variant floatArray(floats);
+  Variant doubleArray(doubles);
+  
+  Variant legacyFloats(floatArray.toLegacyEncoding());
+  Variant legacyDoubles(doubleArray.toLegacyEncoding());
+  QCOMPARE(legacyFloats.type(), Variant::FloatArray);
+  QCOMPARE(legacyDoubles.type(), Variant::DoubleArray);
+  QCOMPARE(legacyFloats.toByteArray(), floatArray.toByteArray());
+  QCOMPARE(legacyDoubles.toByteArray(), doubleArray.toByteArray());
+  QCOMPARE(legacyDoubles.toDoubleArray(), doubles);
+  
+  // Nested in a List the same applies to the items
+  QVariantList  nested;
+  nested.append(QVariantList({1, 2}));
+  nested.append(QVariantList({0.5}));
+  
+  Variant legacyList(Variant(nested).toLegacyEncoding());
+  decoded = Variant::fromLegacyEncoding(legacyList, &ok);
+  QVERIFY(ok);
+  QList<Variant>  items(decoded.toList());
+  QCOMPARE(items.count(), 2);
+  QCOMPARE(items.at(0).type(), Variant::List);
+  QCOMPARE(items.at(0).toInt32Array(), QVector<qint32>({1, 2}));
+  QCOMPARE(items.at(1).type(), Variant::DoubleArray);
+  QCOMPARE(items.at(1).toDoubleArray(), QVector<double>({0.5}));
+}
+
+
+void TestVariant::testStruct()
+{
+  TestVariant_Sample  sample;
+  sample.time     = 1234567890123LL;
+  sample.sensor   = "temperature";
+  sample.point.x  = -3;
+  sample.point.y  = 4;
+  sample.values   = QVector<double>({0.5, 1.5});
+  
+  // Positional List, nested structs as Lists too
+  Variant encoded(VariantStruct::encode(sample));
+  QCOMPARE(encoded.type(), Variant::List);
+  QCOMPARE(encoded.toList().count(), 4);
+  QCOMPARE(encoded.toList().at(2).type(), Variant::List);
+  
+  TestVariant_Sample  decoded;
+  QVERIFY(VariantStruct::decode(encoded, decoded));
+  QCOMPARE(decoded.time, sample.time);
+  QCOMPARE(decoded.sensor, sample.sensor);
+  QCOMPARE(decoded.point.x, -3);
+  QCOMPARE(decoded.point.y, 4);
+  QCOMPARE(decoded.values, sample.values);
+  
+  // Other field counts or types are no sample
+  TestVariant_Point   point;
+  QVERIFY(!VariantStruct::decode(encoded, point));
+  QVERIFY(!VariantStruct::decode(VariantStruct::encode(sample.point), decoded));
+  QVERIFY(!VariantStruct::decode(Variant(qint32(1)), point));
+}
+
+
+void TestVariant::testStructIntegers()
+{
+  TestVariant_Value<qint64>   wide;
+  TestVariant_Value<qint32>   narrow;
+  TestVariant_Value<quint8>   byte;
+  
+  // Numbers fitting into the field are converted
+  wide.value  = -5;
+  QVERIFY(VariantStruct::decode(VariantStruct::encode(wide), narrow));
+  QCOMPARE(narrow.value, -5);
+  
+  wide.value  = 200;
+  QVERIFY(VariantStruct::decode(VariantStruct::encode(wide), byte));
+  QCOMPARE(byte.value, quint8(200));
+  
+  // Others are rejected instead of being truncated
+  wide.value  = qint64(1) << 40;
+  QVERIFY(!VariantStruct::decode(VariantStruct::encode(wide), narrow));
+  
+  wide.value  = -1;
+  QVERIFY(!VariantStruct::decode(VariantStruct::encode(wide), byte));
+  
+  TestVariant_Value<quint64>  unsignedWide;
+  unsignedWide.value  = quint64(1) << 63;
+  QVERIFY(!VariantStruct::decode(VariantStruct::encode(unsignedWide), wide));
+  
+  unsignedWide.value  = 300;
+  QVERIFY(!VariantStruct::decode(VariantStruct::encode(unsignedWide), byte));
+}
+
+
+void TestVariant::testStrings()
+{
+  const QString   text(QString::fromUtf8("temp\xc3\xa9rature"));
+  Variant         ascii(QString("status"));
+  Variant         utf8(text);
+  
+  QCOMPARE(ascii.toString(), QString("status"));
+  QCOMPARE(utf8.toString(), text);
+  
+  // The stored bytes, shared instead of copied
+  QCOMPARE(utf8.toUtf8(), text.toUtf8());
+  QVERIFY(utf8.toUtf8().constData() == utf8.constData());
+  
+  bool  ok  = false;
+  QCOMPARE(ascii.toLatin1String(&ok), QLatin1String("status"));
+  QVERIFY(ok);
+  utf8.toLatin1String(&ok);
+  QVERIFY(!ok);
+  
+  QVERIFY(ascii.equals(QLatin1String("status")));
+  QVERIFY(!ascii.equals(QLatin1String("statu")));
+  QVERIFY(ascii.equals(QByteArray("status")));
+  QVERIFY(utf8.equals(text));
+  QVERIFY(!utf8.equals(QString("temperature")));
+  QVERIFY(!Variant(QByteArray("status")).equals(QLatin1String("status")));
+  
+  QCOMPARE(utf8.stringHash(7), qHash(text.toUtf8(), 7));
+  
+  // Converted once, copies share the result until their value changes
+  const Variant   copy(utf8);
+  QVERIFY(copy.toString().constData() == utf8.toString().constData());
+  utf8.setValue(QString("other"));
+  QCOMPARE(copy.toString(), text);
+  QCOMPARE(utf8.toString(), QString("other"));
+  
+  utf8.setValue(QByteArray("raw"));
+  QCOMPARE(utf8.toString(), QString("raw"));
+  utf8  = qint32(5);
+  utf8  = QString("again");
+  QCOMPARE(utf8.toString(), QString("again"));
+}
+
+
+void TestVariant::testStringConcurrent()
+{
+  const QString   text(QString::fromUtf8("temp\xc3\xa9rature"));
+  const Variant   string(text);
+  
+  // All threads convert the same Variant for the first time at once
+  QList<TestVariant_StringReader*>  readers;
+  for(int i = 0; i < 8; i++)
+    readers.append(new TestVariant_StringReader(string, text));
+  
+  foreach(TestVariant_StringReader * reader, readers)
+    reader->start();
+  
+  foreach(TestVariant_StringReader * reader, readers)
+  {
+    QVERIFY(reader->wait(10000));
+    QCOMPARE(reader->matches(), 1000);
+  }
+  
+  qDeleteAll(readers);
+  
+  // One conversion was kept
+  QVERIFY(string.toString().constData() == string.toString().constData());
+}
+
+
+void TestVariant::testLayout()
+{
+  // Data, inline number (or cache of the data), optional id, type and flags
+  QVERIFY(sizeof(Variant) <= 24);
+}
+
+
+void TestVariant::testMove()
+{
+  QByteArray    payload(4 * 1024 * 1024, 'x');
+  const char  * data  = payload.constData();
+  
+  // Taken over without copying
+  Variant var(std::move(payload));
+  QVERIFY(payload.isEmpty());
+  QVERIFY(var.constData() == data);
+  
+  // Passed through a queue like the buffers of LocalSocket
+  QList<Variant>  queue;
+  queue.append(Variant());
+  queue.last()  = std::move(var);
+  QVERIFY(var.type() == Variant::None);
+  
+  Variant taken(std::move(queue.first()));
+  queue.removeFirst();
+  QVERIFY(taken.constData() == data);
+  
+  // Copies share the data
+  Variant copy(taken);
+  QVERIFY(copy.constData() == data);
+  copy  = Variant();
+  
+  Variant target(Variant::ByteArray);
+  target.setValue(taken.toByteArray());
+  QVERIFY(target.constData() == data);
+  
+  // Once the Variants are gone the data has a single owner: it was never duplicated
+  QByteArray  result(target.toByteArray());
+  taken   = Variant();
+  target  = Variant();
+  QVERIFY(result.isDetached());
+  QVERIFY(result.constData() == data);
+  
+  // Copies of an auto closing descriptor dup() it, moves hand it over
+  int   fds[2];
+  QVERIFY(::pipe(fds) == 0);
+  ::close(fds[1]);
+  const int   descriptors = openDescriptors();
+  
+  Variant   descriptor(Variant::fromSocketDescriptor(fds[0], true));
+  Variant   moved(std::move(descriptor));
+  QCOMPARE(openDescriptors(), descriptors);
+  QCOMPARE(moved.toInt64(), qint64(fds[0]));
+  
+  Variant   duplicate(moved);
+  QCOMPARE(openDescriptors(), descriptors + 1);
+  
+  // The descriptor replaced by a move is closed, the moved one kept
+  duplicate = std::move(moved);
+  QCOMPARE(openDescriptors(), descriptors);
+  QCOMPARE(duplicate.toInt64(), qint64(fds[0]));
+  
+  duplicate = Variant();
+  QCOMPARE(openDescriptors(), descriptors - 1);
+  
+  // LocalSocket: moved into the write buffer and out of the read buffer
+  QVERIFY(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  LocalSocket   writer;
+  LocalSocket   reader;
+  QVERIFY(writer.setSocketDescriptor(quintptr(fds[0])));
+  QVERIFY(reader.setSocketDescriptor(quintptr(fds[1])));
+  
+  QByteArray  packet(1024 * 1024, 'y');
+  Variant     package(packet);
+  
+  // Held back by cork mode: the write buffer shares the data instead of copying it
+  writer.setCorkThreshold(64 * 1024 * 1024);
+  writer.setCorkDeadline(60 * 1000 * 1000);
+  writer.setCorked(true);
+  QVERIFY(writer.write(std::move(package)));
+  QVERIFY(package.type() == Variant::None);
+  QVERIFY(!packet.isDetached());
+  
+  // Once written nothing refers to it anymore
+  QVERIFY(writer.flush());
+  QVERIFY(writer.waitForDataWritten(5000));
+  QTRY_VERIFY_WITH_TIMEOUT(packet.isDetached(), 5000);
+  
+  while(reader.availableData() < 1)
+    QVERIFY(reader.waitForReadyRead(5000));
+  
+  Variant   received(reader.read());
+  QCOMPARE(received.size(), packet.size());
+  QCOMPARE(reader.availableData(), 0);
+  
+  // The read buffer kept no reference
+  QByteArray  receivedData(received.toByteArray());
+  received  = Variant();
+  QVERIFY(receivedData.isDetached());
+  QVERIFY(receivedData == packet);
+  
+  // MessageBus: a shared list is not detached, a moved list leaves no reference behind
+  const QString   path(QDir::tempPath() + "/test_variant.sock");
+  TestMessageBusFeatures_PeerThread   peer(path);
+  QVERIFY(peer.waitForStarted());
+  
+  MessageBus  bus(0);
+  QVERIFY(bus.connectToServer(path));
+  
+  QList<Variant>  params;
+  params.append(Variant(packet));
+  QList<Variant>  shared(params);
+  
+  QVERIFY2(bus.call("record", shared), qPrintable(bus.lastErrorMessage()));
+  QVERIFY(params.isSharedWith(shared));
+  QVERIFY(params.first().constData() == packet.constData());
+  shared.clear();
+  
+  QVERIFY2(bus.call("record", std::move(params)), qPrintable(bus.lastErrorMessage()));
+  QTRY_COMPARE_WITH_TIMEOUT(peer.receiver()->calls(), 2, 5000);
+  QCOMPARE(peer.receiver()->lastArgs().first().size(), packet.size());
+  QTRY_VERIFY_WITH_TIMEOUT(packet.isDetached(), 5000);
+}
+
+
 QTEST_MAIN(TestVariant)
@@ -30,6 +30,24 @@ class TestVariant : public QObject
     void testQMap();
     
     void testQList();
+    
+    void testArrays();
+    
+    void testArrayListView();
+    
+    void testArrayLegacyEncoding();
+    
+    void testStruct();
+    
+    void testStructIntegers();
+    
+    void testStrings();
+    
+    void testStringConcurrent();
+    
+    void testLayout();
+    
+    void testMove();
 };
 
 #endif // TESTVARIANT_H
@@ -17,135 +17,360 @@
  */
 
 #include "variant.h"
+#include "variantview.h"
+#include "variantwriter.h"
 
 #include <QVariant>
 #include <QString>
+#include <QHash>
 #include <unistd.h>
+#include <string.h>
+#include <utility>
+#include <algorithm>
+
+// Marks items of the compact Map/List format stored as [size][raw data] instead of a number
+#define COMPACT_RAW_DATA	0x80
+
+// Not changed once published: a thread might still read it through another copy of the Variant
+struct Variant::Cache
+{
+	Cache(const QString& string)
+		:	ref(1), string(string)
+	{
+	}
+	
+	Cache(const QSharedPointer<const MapKeys>& keys)
+		:	ref(1), keys(keys)
+	{
+	}
+	
+	~Cache()
+	{
+		delete encoded.loadAcquire();
+	}
+	
+	QAtomicInt											ref;
+	// toString() of a String
+	QString													string;
+	// Map made by fromShape(): m_data holds the values only
+	QSharedPointer<const MapKeys>		keys;
+	// The Map including its keys, built on first use
+	QAtomicPointer<QByteArray>			encoded;
+};
+
+// Size of the inline value of scalar types, 0 for types stored as QByteArray
+static int inlineSize(quint8 type)
+{
+	switch(type)
+	{
+		case Variant::UInt8:
+		case Variant::Int8:
+		case Variant::Bool:
+			return sizeof(quint8);
+			
+		case Variant::UInt16:
+		case Variant::Int16:
+			return sizeof(quint16);
+			
+		case Variant::UInt32:
+		case Variant::Int32:
+			return sizeof(quint32);
+			
+		case Variant::UInt64:
+		case Variant::Int64:
+		case Variant::SocketDescriptor:
+			return sizeof(quint64);
+			
+		default:
+			return 0;
+	}
+}
+
+// Size of the elements of the array types, 0 for other types
+static int elementSize(quint8 type)
+{
+	switch(type)
+	{
+		case Variant::Int32Array:
+			return sizeof(qint32);
+			
+		case Variant::Int64Array:
+			return sizeof(qint64);
+			
+		case Variant::FloatArray:
+			return sizeof(float);
+			
+		case Variant::DoubleArray:
+			return sizeof(double);
+			
+		default:
+			return 0;
+	}
+}
+
+// Array elements are stored little endian, big endian hosts swap them (in both directions)
+static inline void swapElements(char * data, int count, int size)
+{
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+	for(int i = 0; i < count; i++)
+		std::reverse(data + i * size, data + (i + 1) * size);
+#else
+	Q_UNUSED(data);
+	Q_UNUSED(count);
+	Q_UNUSED(size);
+#endif
+}
+
+template<typename T>
+static QByteArray fromVector(const QVector<T>& array)
+{
+	QByteArray	ret(reinterpret_cast<const char*>(array.constData()), array.size() * int(sizeof(T)));
+	swapElements(ret.data(), array.size(), sizeof(T));
+	
+	return ret;
+}
+
+template<typename T>
+static QVector<T> toVector(const QByteArray& data)
+{
+	QVector<T>	ret(data.size() / int(sizeof(T)));
+	memcpy(ret.data(), data.constData(), ret.size() * sizeof(T));
+	swapElements(reinterpret_cast<char*>(ret.data()), ret.size(), sizeof(T));
+	
+	return ret;
+}
+
+// Lists (e.g. of peers of older versions) are converted item by item
+template<typename T>
+static QVector<T> listToVector(const QVariantList& list, bool * ok)
+{
+	QVector<T>	ret(list.count());
+	
+	for(int i = 0; i < list.count(); i++)
+	{
+		if(!list.at(i).canConvert<T>())
+		{
+			if(ok)
+				(*ok)	=	false;
+			
+			return QVector<T>();
+		}
+		
+		ret[i]	=	list.at(i).value<T>();
+	}
+	
+	return ret;
+}
+
+// Element \a index of an array as QVariant (the data might not be aligned)
+static QVariant arrayElement(quint8 type, const char * data, int index)
+{
+	switch(type)
+	{
+		case Variant::Int32Array:
+		{
+			qint32	value;
+			memcpy(&value, data + index * sizeof(value), sizeof(value));
+			swapElements(reinterpret_cast<char*>(&value), 1, sizeof(value));
+			return QVariant(int(value));
+		}
+		
+		case Variant::Int64Array:
+		{
+			qint64	value;
+			memcpy(&value, data + index * sizeof(value), sizeof(value));
+			swapElements(reinterpret_cast<char*>(&value), 1, sizeof(value));
+			return QVariant(qlonglong(value));
+		}
+		
+		case Variant::FloatArray:
+		{
+			float		value;
+			memcpy(&value, data + index * sizeof(value), sizeof(value));
+			swapElements(reinterpret_cast<char*>(&value), 1, sizeof(value));
+			return QVariant(value);
+		}
+		
+		case Variant::DoubleArray:
+		{
+			double	value;
+			memcpy(&value, data + index * sizeof(value), sizeof(value));
+			swapElements(reinterpret_cast<char*>(&value), 1, sizeof(value));
+			return QVariant(value);
+		}
+		
+		default:
+			return QVariant();
+	}
+}
 
 Variant::Variant()
-: m_type(None), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(None), m_inline(false), m_autoCloseAndDup(false)
 {
 }
 
 
 Variant::Variant(Variant::Type type)
-: m_type(type), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(type), m_inline(false), m_autoCloseAndDup(false)
 {
 
 }
 
 
 Variant::Variant(qint8 num)
-: m_type(Int8), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(Int8), m_inline(false), m_autoCloseAndDup(false)
 {
 	setValue(num);
 }
 
 
 Variant::Variant(quint8 num)
-: m_type(UInt8), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(UInt8), m_inline(false), m_autoCloseAndDup(false)
 {
 	setValue(num);
 }
 
 
 Variant::Variant(qint16 num)
-: m_type(Int16), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(Int16), m_inline(false), m_autoCloseAndDup(false)
 {
 	setValue(num);
 }
 
 
 Variant::Variant(quint16 num)
-: m_type(UInt16), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(UInt16), m_inline(false), m_autoCloseAndDup(false)
 {
 	setValue(num);
 }
 
 
 Variant::Variant(qint32 num)
-: m_type(Int32), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(Int32), m_inline(false), m_autoCloseAndDup(false)
 {
 	setValue(num);
 }
 
 
 Variant::Variant(quint32 num)
-: m_type(UInt32), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(UInt32), m_inline(false), m_autoCloseAndDup(false)
 {
 	setValue(num);
 }
 
 
 Variant::Variant(qint64 num)
-: m_type(Int64), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(Int64), m_inline(false), m_autoCloseAndDup(false)
 {
 	setValue(num);
 }
 
 
 Variant::Variant(quint64 num)
-: m_type(UInt64), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(UInt64), m_inline(false), m_autoCloseAndDup(false)
 {
 	setValue(num);
 }
 
 
 Variant::Variant(const QString& string)
-: m_type(String), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(String), m_inline(false), m_autoCloseAndDup(false)
 {
 	setValue(string);
 }
 
 
 Variant::Variant(const QVariantMap& map)
-: m_type(Map), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(Map), m_inline(false), m_autoCloseAndDup(false)
 {
   setValue(map);
 }
 
 
 Variant::Variant(const QVariantList& list)
-: m_type(List), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(List), m_inline(false), m_autoCloseAndDup(false)
 {
-  setValue(list);
+  setList(list);
 }
 
 
 Variant::Variant(const QList< Variant >& list)
-: m_type(List), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(List), m_inline(false), m_autoCloseAndDup(false)
 {
   setValue(list);
 }
 
 
+Variant::Variant(const QVector< qint32 >& array)
+: m_data(fromVector(array)), m_number(0), m_optId(0), m_type(Int32Array), m_inline(false), m_autoCloseAndDup(false)
+{
+}
+
+
+Variant::Variant(const QVector< qint64 >& array)
+: m_data(fromVector(array)), m_number(0), m_optId(0), m_type(Int64Array), m_inline(false), m_autoCloseAndDup(false)
+{
+}
+
+
+Variant::Variant(const QVector< float >& array)
+: m_data(fromVector(array)), m_number(0), m_optId(0), m_type(FloatArray), m_inline(false), m_autoCloseAndDup(false)
+{
+}
+
+
+Variant::Variant(const QVector< double >& array)
+: m_data(fromVector(array)), m_number(0), m_optId(0), m_type(DoubleArray), m_inline(false), m_autoCloseAndDup(false)
+{
+}
+
+
 Variant::Variant(bool boolean)
-: m_type(Bool), m_optId(0), m_autoCloseAndDup(false)
+: m_number(0), m_optId(0), m_type(Bool), m_inline(false), m_autoCloseAndDup(false)
 {
 	setValue(boolean);
 }
 
 
 Variant::Variant(const QByteArray& data)
-: m_type(ByteArray), m_data(data), m_optId(0), m_autoCloseAndDup(false)
+: m_data(data), m_number(0), m_optId(0), m_type(ByteArray), m_inline(false), m_autoCloseAndDup(false)
+{
+}
+
+
+Variant::Variant(QByteArray&& data)
+: m_data(std::move(data)), m_number(0), m_optId(0), m_type(ByteArray), m_inline(false), m_autoCloseAndDup(false)
 {
 }
 
 
 Variant::Variant(const QByteArray &data, Variant::Type type, quint32 optId)
-: m_type(type), m_data(data), m_optId(optId), m_autoCloseAndDup(false)
+: m_number(0), m_optId(optId), m_type(type), m_inline(false), m_autoCloseAndDup(false)
 {
+	setValue(data);
 }
 
 
 Variant::Variant(const Variant& other)
+: m_number(0), m_optId(0), m_type(None), m_inline(false), m_autoCloseAndDup(false)
 {
   (*this) = other;
 }
 
 
+Variant::Variant(Variant&& other) noexcept
+: m_data(std::move(other.m_data)), m_number(other.m_number), m_optId(other.m_optId),
+	m_type(other.m_type), m_inline(other.m_inline), m_autoCloseAndDup(other.m_autoCloseAndDup)
+{
+	other.m_number					=	0;
+	other.m_type						=	None;
+	other.m_inline					=	false;
+	other.m_autoCloseAndDup	=	false;
+}
+
+
 Variant::Variant(const QVariant& other)
-: m_type(None), m_optId(0)
+: m_number(0), m_optId(0), m_type(None), m_inline(false)
 {
 	(*this)	=	other;
 }
@@ -156,14 +381,31 @@ Variant::~Variant()
   if(m_type == SocketDescriptor && m_autoCloseAndDup) {
     ::close(int(toInt64()));
   }
+  
+  clearValue();
 }
 
 
 Variant& Variant::operator = (const Variant& other)
 {
-	m_data	=	other.m_data;
-	m_type	=	other.m_type;
-	m_optId	=	other.m_optId;
+	if(this == &other)
+		return *this;
+	
+	// Loaded once: another thread might publish a cache for other meanwhile
+	Cache	*	cache	=	(other.m_inline ? 0 : other.m_cache.loadAcquire());
+	if(cache)
+		cache->ref.ref();
+	
+	clearValue();
+	
+	m_data		=	other.m_data;
+	if(other.m_inline)
+		m_number	=	other.m_number;
+	else
+		m_cache.storeRelease(cache);
+	m_type		=	other.m_type;
+	m_optId		=	other.m_optId;
+	m_inline	=	other.m_inline;
   m_autoCloseAndDup = other.m_autoCloseAndDup;
   
   if(m_type == SocketDescriptor && m_autoCloseAndDup) {
@@ -176,6 +418,36 @@ Variant& Variant::operator = (const Variant& other)
 }
 
 
+Variant& Variant::operator = (Variant&& other) noexcept
+{
+	if(this == &other)
+		return *this;
+	
+	// Our own descriptor is released like in the destructor
+	if(m_type == SocketDescriptor && m_autoCloseAndDup)
+		::close(int(toInt64()));
+	
+	clearValue();
+	
+	// The descriptor of \a other is taken over (no dup() needed)
+	m_data		=	std::move(other.m_data);
+	m_number	=	other.m_number;
+	m_type		=	other.m_type;
+	m_optId		=	other.m_optId;
+	m_inline	=	other.m_inline;
+	m_autoCloseAndDup	=	other.m_autoCloseAndDup;
+	
+	// Moving QByteArray swaps, release our old data right away
+	other.m_data.clear();
+	other.m_number					=	0;
+	other.m_type						=	None;
+	other.m_inline					=	false;
+	other.m_autoCloseAndDup	=	false;
+	
+	return *this;
+}
+
+
 Variant& Variant::operator = (const QVariant& other)
 {
   m_autoCloseAndDup = false;
@@ -322,8 +594,7 @@ Variant& Variant::operator = (const QVariant& other)
     
     case QVariant::List:
     {
-      m_type  = List;
-      setValue(other.toList());
+      setList(other.toList());
     }break;
 		
 		case QVariant::Bool:
@@ -372,8 +643,7 @@ Variant& Variant::operator = (const QVariantMap& other)
 Variant& Variant::operator = (const QVariantList& other)
 {
   m_autoCloseAndDup = false;
-  m_type  = List;
-  setValue(other);
+  setList(other);
   return *this;
 }
 
@@ -482,184 +752,132 @@ quint32 Variant::optionalId() const
 
 void Variant::setValue(qint8 num)
 {
-	m_data	=	QByteArray((char*)&num, sizeof(qint8));
+	setNumber(quint64(qint64(num)), &num, sizeof(qint8));
 }
 
 
 void Variant::setValue(quint8 num)
 {
-	m_data	=	QByteArray((char*)&num, sizeof(quint8));
+	setNumber(quint64(num), &num, sizeof(quint8));
 }
 
 
 void Variant::setValue(qint16 num)
 {
-	m_data	=	QByteArray((char*)&num, sizeof(qint16));
+	setNumber(quint64(qint64(num)), &num, sizeof(qint16));
 }
 
 
 void Variant::setValue(quint16 num)
 {
-	m_data	=	QByteArray((char*)&num, sizeof(quint16));
+	setNumber(quint64(num), &num, sizeof(quint16));
 }
 
 
 void Variant::setValue(qint32 num)
 {
-	m_data	=	QByteArray((char*)&num, sizeof(qint32));
+	setNumber(quint64(qint64(num)), &num, sizeof(qint32));
 }
 
 
 void Variant::setValue(quint32 num)
 {
-	m_data	=	QByteArray((char*)&num, sizeof(quint32));
+	setNumber(quint64(num), &num, sizeof(quint32));
 }
 
 
 void Variant::setValue(qint64 num)
 {
-	m_data	=	QByteArray((char*)&num, sizeof(qint64));
+	setNumber(quint64(num), &num, sizeof(qint64));
 }
 
 
 void Variant::setValue(quint64 num)
 {
-	m_data	=	QByteArray((char*)&num, sizeof(quint64));
+	setNumber(num, &num, sizeof(quint64));
 }
 
 
 void Variant::setValue(const QByteArray& data)
 {
-	m_data	=	data;
+	// Raw data of a scalar (e.g. read from a socket)
+	if(inlineSize(m_type) && data.size() == inlineSize(m_type))
+	{
+		setRawData(data.constData(), data.size());
+		return;
+	}
+	
+	clearValue();
+	m_data		=	data;
+	m_inline	=	false;
+}
+
+
+void Variant::setValue(QByteArray&& data)
+{
+	if(inlineSize(m_type) && data.size() == inlineSize(m_type))
+	{
+		setRawData(data.constData(), data.size());
+		return;
+	}
+	
+	clearValue();
+	m_data		=	std::move(data);
+	m_inline	=	false;
+}
+
+
+void Variant::setRawData(const char* data, int size)
+{
+	if(inlineSize(m_type) && size == inlineSize(m_type))
+	{
+		clearValue();
+		m_data.clear();
+		memcpy(&m_number, data, size);
+		m_inline	=	true;
+		return;
+	}
+	
+	clearValue();
+	m_data		=	QByteArray(data, size);
+	m_inline	=	false;
 }
 
 
 void Variant::setValue(const QString& value)
 {
+  clearValue();
   m_data  = value.toUtf8();
+  m_inline = false;
 }
 
 
 void Variant::setValue(const QVariantMap& value)
 {
-  QByteArray  data;
-  QByteArray  key;
-  data.reserve(sizeof(quint64) + value.count() * (sizeof(quint32) * 2 + 32));
-  
   // Format:
-  // [item count][key size][UTF8 key][value size][value]...
-  
-  // item count
-  quint64 itemCount = value.count();
-  data.resize(data.size() + sizeof(itemCount));
-  *((quint64*)(&(data.data()[data.size() - sizeof(itemCount)]))) = itemCount;
-  
-  QMapIterator<QString, QVariant>   it(value);
-  while(it.hasNext()) {
-    it.next();
-    
-    key = it.key().toUtf8();
-    
-    // key size
-    quint32 size = key.size();
-    data.resize(data.size() + sizeof(size));
-    *((quint32*)(&(data.data()[data.size() - sizeof(size)]))) = size;
-    
-    // key
-    data.append(key);
-    
-    Variant     val(Variant(it.value()));
-    QByteArray  value(val.toByteArray());
-    
-    // value type
-    quint16 type = quint16(val.type());
-    data.resize(data.size() + sizeof(type));
-    *((quint16*)(&(data.data()[data.size() - sizeof(type)]))) = type;
-    
-    // value size
-    size = value.size();
-    data.resize(data.size() + sizeof(size));
-    *((quint32*)(&(data.data()[data.size() - sizeof(size)]))) = size;
-    
-    // value
-    data.append(value);
-  }
-  
-  m_data  = data;
+  // [item count][key size][UTF8 key][value type][value]...
+  // (counts, sizes and integers are written by writeIntelligentNumber())
+  clearValue();
+  m_data  = VariantWriter(value).toByteArray();
+  m_inline = false;
 }
 
 
 void Variant::setValue(const QVariantList& value)
 {
-  QByteArray  data;
-  QByteArray  key;
-  data.reserve(sizeof(quint64) + value.count() * (sizeof(quint32) * 2 + 32));
-  
   // Format:
-  // [item count][value size][value]...
-  
-  // item count
-  quint64 itemCount = value.count();
-  data.resize(data.size() + sizeof(itemCount));
-  *((quint64*)(&(data.data()[data.size() - sizeof(itemCount)]))) = itemCount;
-  
-  QListIterator<QVariant>   it(value);
-  while(it.hasNext()) {
-    Variant     val(Variant(it.next()));
-    QByteArray  value(val.toByteArray());
-    
-    // value type
-    quint16 type = quint16(val.type());
-    data.resize(data.size() + sizeof(type));
-    *((quint16*)(&(data.data()[data.size() - sizeof(type)]))) = type;
-    
-    // value size
-    quint32 size = value.size();
-    data.resize(data.size() + sizeof(size));
-    *((quint32*)(&(data.data()[data.size() - sizeof(size)]))) = size;    
-    
-    // value
-    data.append(value);
-  }
-  
-  m_data  = data;
+  // [item count][value type][value]...
+  clearValue();
+  m_data  = VariantWriter(value).toByteArray();
+  m_inline = false;
 }
 
 
 void Variant::setValue(const QList< Variant >& value)
 {
-  QByteArray  data;
-  QByteArray  key;
-  data.reserve(sizeof(quint64) + value.count() * (sizeof(quint32) * 2 + 32));
-  
-  // Format:
-  // [item count][value size][value]...
-  
-  // item count
-  quint64 itemCount = value.count();
-  data.resize(data.size() + sizeof(itemCount));
-  *((quint64*)(&(data.data()[data.size() - sizeof(itemCount)]))) = itemCount;
-  
-  QListIterator<Variant>   it(value);
-  while(it.hasNext()) {
-    Variant     val(it.next());
-    QByteArray  value(val.toByteArray());
-    
-    // value type
-    quint16 type = quint16(val.type());
-    data.resize(data.size() + sizeof(type));
-    *((quint16*)(&(data.data()[data.size() - sizeof(type)]))) = type;
-    
-    // value size
-    quint32 size = value.size();
-    data.resize(data.size() + sizeof(size));
-    *((quint32*)(&(data.data()[data.size() - sizeof(size)]))) = size;
-    
-    // value
-    data.append(value);
-  }
-  
-  m_data  = data;
+  clearValue();
+  m_data  = VariantWriter(value).toByteArray();
+  m_inline = false;
 }
 
 
@@ -857,7 +1075,10 @@ QByteArray Variant::toByteArray(bool * ok) const
 	if(ok)
 		(*ok)	=	true;
 	
-	return m_data;
+	if(m_inline)
+		return QByteArray(constData(), size());
+	
+	return compactData();
 }
 
 
@@ -876,7 +1097,12 @@ QString Variant::toString(bool * ok) const
 		
 		case String:
 		{
-			return QString::fromUtf8(m_data);
+			// Threads converting at the same time keep the result published first
+			Cache	*	cache	=	m_cache.loadAcquire();
+			if(!cache)
+				cache	=	setCache(new Cache(QString::fromUtf8(m_data)));
+			
+			return cache->string;
 		}break;
     
     case Map: {
@@ -981,6 +1207,68 @@ QString Variant::toString(bool * ok) const
 }
 
 
+QByteArray Variant::toUtf8(bool* ok) const
+{
+	if(m_type != String)
+		return toString(ok).toUtf8();
+	
+	if(ok)
+		(*ok)	=	true;
+	
+	return m_data;
+}
+
+
+QLatin1String Variant::toLatin1String(bool* ok) const
+{
+	bool	ascii	=	(m_type == String);
+	
+	for(int i = 0; ascii && i < m_data.size(); i++)
+		ascii	=	(quint8(m_data.at(i)) < 0x80);
+	
+	if(ok)
+		(*ok)	=	ascii;
+	
+	return (ascii ? QLatin1String(m_data.constData(), m_data.size()) : QLatin1String());
+}
+
+
+bool Variant::equals(QLatin1String string) const
+{
+	if(m_type != String)
+		return false;
+	
+	const char	*	latin1	=	string.data();
+	
+	for(int i = 0; i < string.size(); i++)
+	{
+		// UTF-8 and Latin-1 only share the ASCII characters
+		if(quint8(latin1[i]) >= 0x80)
+			return (toString() == string);
+	}
+	
+	return (m_data.size() == string.size() && memcmp(m_data.constData(), latin1, string.size()) == 0);
+}
+
+
+bool Variant::equals(const QByteArray& utf8) const
+{
+	return (m_type == String && m_data == utf8);
+}
+
+
+bool Variant::equals(const QString& string) const
+{
+	return (m_type == String && toString() == string);
+}
+
+
+uint Variant::stringHash(uint seed) const
+{
+	return qHash(toUtf8(), seed);
+}
+
+
 QVariantMap Variant::toQMap(bool* ok) const
 {
   if(ok)
@@ -989,45 +1277,26 @@ QVariantMap Variant::toQMap(bool* ok) const
   ///@todo Complete switch
   switch(m_type) {
     case Map: {
-      QVariantMap ret;
-      int         idx = 0;
-      
-      // Read map
-      
-      // Format:
-      // [item count][key size][UTF8 key][value size][value]...
-      
-      // item count
-      quint64 itemCount = *((quint64*)&(m_data.data()[idx]));
-      idx += sizeof(itemCount);
+      QList< QPair<QString, Variant> >  items;
+      QVariantMap                       ret;
       
-      for(quint64 i = 0; i < itemCount; i++) {
-        // Key size
-        quint32 size = *((quint32*)&(m_data.data()[idx]));
-        idx += sizeof(size);
-        
-        // Key
-        QString key(QString::fromUtf8(m_data.mid(idx, size)));
-        idx += size;
-        
-        // Value type
-        quint16 type = *((quint16*)&(m_data.data()[idx]));
-        idx += sizeof(type);
+      if(!readCompactMap(items)) {
+        if(ok)
+          (*ok) = false;
         
-        // Value size
-        size = *((quint32*)&(m_data.data()[idx]));
-        idx += sizeof(size);
-        
-        // Value
-        Variant value(m_data.mid(idx, size), (Variant::Type)type);
-        idx += size;
-        
-        ret.insert(key, value.toQVariant());
+        return ret;
       }
       
+      for(int i = 0; i < items.count(); i++)
+        ret.insert(items.at(i).first, items.at(i).second.toQVariant());
+      
       return ret;
     }break;
     
+    case Int32Array:
+    case Int64Array:
+    case FloatArray:
+    case DoubleArray:
     case List: {
       QVariantList  list(toQList(ok));
       QVariantMap   ret;
@@ -1070,33 +1339,25 @@ QVariantList Variant::toQList(bool* ok) const
     }break;
     
     case List: {
-      QVariantList  ret;
-      int           idx = 0;
-      
-      // Read list
+      QList<Variant>  items(toList(ok));
+      QVariantList    ret;
       
-      // Format:
-      // [item count][value size][value]...
+      for(int i = 0; i < items.count(); i++)
+        ret.append(items.at(i).toQVariant());
       
-      // item count
-      quint64 itemCount = *((quint64*)&(m_data.data()[idx]));
-      idx += sizeof(itemCount);
+      return ret;
+    }break;
+    
+    case Int32Array:
+    case Int64Array:
+    case FloatArray:
+    case DoubleArray: {
+      QVariantList  ret;
+      const int     count = arraySize();
       
-      for(int i = 0; i < itemCount; i++) {
-        // Value type
-        quint16 type = *((quint16*)&(m_data.data()[idx]));
-        idx += sizeof(type);
-        
-        // Value size
-        quint32 size = *((quint32*)&(m_data.data()[idx]));
-        idx += sizeof(size);
-        
-        // Value
-        Variant value(m_data.mid(idx, size), (Variant::Type)type);
-        idx += size;
-        
-        ret.append(value.toQVariant());
-      }
+      ret.reserve(count);
+      for(int i = 0; i < count; i++)
+        ret.append(arrayElement(m_type, m_data.constData(), i));
       
       return ret;
     }break;
@@ -1122,36 +1383,57 @@ QList<Variant> Variant::toList(bool* ok) const
   switch(m_type) {
     case List: {
       QList<Variant>  ret;
-      int           idx = 0;
+      const char    * data  = m_data.constData();
+      const int       size  = m_data.size();
+      int             idx   = 0;
+      bool            valid = true;
       
       // Read list
       
       // Format:
-      // [item count][value size][value]...
+      // [item count][value type][value]...
       
-      // item count
-      quint64 itemCount = *((quint64*)&(m_data.data()[idx]));
-      idx += sizeof(itemCount);
+      const quint64 itemCount = readIntelligentNumber(data, size, idx, &valid);
       
-      for(int i = 0; i < itemCount; i++) {
-        // Value type
-        quint16 type = *((quint16*)&(m_data.data()[idx]));
-        idx += sizeof(type);
+      for(quint64 i = 0; valid && i < itemCount; i++) {
+        Variant value(readCompactItem(data, size, idx, &valid));
         
-        // Value size
-        quint32 size = *((quint32*)&(m_data.data()[idx]));
-        idx += sizeof(size);
-        
-        // Value
-        Variant value(m_data.mid(idx, size), (Variant::Type)type);
-        idx += size;
+        if(valid)
+          ret.append(value);
+      }
+      
+      if(!valid) {
+        if(ok)
+          (*ok) = false;
         
-        ret.append(value);
+        return QList<Variant>();
       }
       
       return ret;
     }break;
     
+    case Int32Array: {
+      QVector<qint32>   array(toInt32Array());
+      QList<Variant>    ret;
+      
+      ret.reserve(array.count());
+      for(int i = 0; i < array.count(); i++)
+        ret.append(Variant(array.at(i)));
+      
+      return ret;
+    }break;
+    
+    case Int64Array: {
+      QVector<qint64>   array(toInt64Array());
+      QList<Variant>    ret;
+      
+      ret.reserve(array.count());
+      for(int i = 0; i < array.count(); i++)
+        ret.append(Variant(array.at(i)));
+      
+      return ret;
+    }break;
+    
     default:
     {
       // Return list with first value being variant value
@@ -1164,30 +1446,118 @@ QList<Variant> Variant::toList(bool* ok) const
 }
 
 
-QVariant Variant::toQVariant(bool* ok) const
+QVector< qint32 > Variant::toInt32Array(bool* ok) const
 {
-  switch(m_type) {
-    case Variant::Bool:
-      return QVariant(toBool(ok));break;
-      
-    case Variant::Int8:
-      return QVariant(toInt8(ok));break;
-      
-    case Variant::Int16:
-      return QVariant(toInt16(ok));break;
-      
-    case Variant::Int32:
-      return QVariant(toInt32(ok));break;
-      
-    case Variant::Int64:
-      return QVariant(toInt64(ok));break;
-      
-    case Variant::UInt8:
-      return QVariant(toUInt8(ok));break;
-      
-    case Variant::UInt16:
-      return QVariant(toUInt16(ok));break;
-      
+	if(ok)
+		(*ok)	=	true;
+	
+	if(m_type == Int32Array)
+		return toVector<qint32>(m_data);
+	else if(m_type == List)
+		return listToVector<qint32>(toQList(ok), ok);
+	
+	if(ok)
+		(*ok)	=	false;
+	
+	return QVector<qint32>();
+}
+
+
+QVector< qint64 > Variant::toInt64Array(bool* ok) const
+{
+	if(ok)
+		(*ok)	=	true;
+	
+	if(m_type == Int64Array)
+		return toVector<qint64>(m_data);
+	else if(m_type == Int32Array || m_type == List)
+		return listToVector<qint64>(toQList(ok), ok);
+	
+	if(ok)
+		(*ok)	=	false;
+	
+	return QVector<qint64>();
+}
+
+
+QVector< float > Variant::toFloatArray(bool* ok) const
+{
+	if(ok)
+		(*ok)	=	true;
+	
+	if(m_type == FloatArray)
+		return toVector<float>(m_data);
+	else if(m_type == List)
+		return listToVector<float>(toQList(ok), ok);
+	
+	if(ok)
+		(*ok)	=	false;
+	
+	return QVector<float>();
+}
+
+
+QVector< double > Variant::toDoubleArray(bool* ok) const
+{
+	if(ok)
+		(*ok)	=	true;
+	
+	if(m_type == DoubleArray)
+		return toVector<double>(m_data);
+	else if(m_type == FloatArray || m_type == Int32Array || m_type == List)
+		return listToVector<double>(toQList(ok), ok);
+	
+	if(ok)
+		(*ok)	=	false;
+	
+	return QVector<double>();
+}
+
+
+int Variant::arraySize() const
+{
+	const int	size	=	elementSize(m_type);
+	
+	return (size ? m_data.size() / size : 0);
+}
+
+
+VariantMapView Variant::mapView() const
+{
+  return VariantMapView(*this);
+}
+
+
+VariantListView Variant::listView() const
+{
+  return VariantListView(*this);
+}
+
+
+QVariant Variant::toQVariant(bool* ok) const
+{
+  switch(m_type) {
+    case Variant::Bool:
+      return QVariant(toBool(ok));break;
+      
+    case Variant::Int8:
+      return QVariant(toInt8(ok));break;
+      
+    case Variant::Int16:
+      return QVariant(toInt16(ok));break;
+      
+    case Variant::Int32:
+      return QVariant(toInt32(ok));break;
+      
+    case Variant::Int64:
+      return QVariant(toInt64(ok));break;
+      
+    case Variant::UInt8:
+      return QVariant(toUInt8(ok));break;
+      
+    case Variant::UInt16:
+      return QVariant(toUInt16(ok));break;
+      
     case Variant::UInt32:
       return QVariant(toUInt32(ok));break;
       
@@ -1204,6 +1574,10 @@ QVariant Variant::toQVariant(bool* ok) const
       return QVariant(toQMap(ok));break;
       
     case Variant::List:
+    case Variant::Int32Array:
+    case Variant::Int64Array:
+    case Variant::FloatArray:
+    case Variant::DoubleArray:
       return QVariant(toQList(ok));break;
       
     
@@ -1251,7 +1625,7 @@ bool Variant::toBool(bool* ok) const
 
 Variant::Type Variant::type() const
 {
-  return m_type;
+  return Type(m_type);
 }
 
 
@@ -1359,7 +1733,7 @@ Variant Variant::fromList(const QList< Variant >& list)
 
 bool Variant::operator == (const Variant& other) const
 {
-  return (m_type == other.m_type && m_data == other.m_data && m_optId == other.m_optId);
+  return (m_type == other.m_type && m_optId == other.m_optId && size() == other.size() && memcmp(constData(), other.constData(), size()) == 0);
 }
 
 
@@ -1377,7 +1751,152 @@ bool Variant::isValid() const
 
 int Variant::size() const
 {
-	return m_data.size();
+	if(m_inline)
+		return inlineSize(m_type);
+	
+	// Same size as the Map the peer encoded
+	const QSharedPointer<const MapKeys>&	keys	=	shapeKeys();
+	
+	return (keys ? keys->encoded.size() + m_data.size() : m_data.size());
+}
+
+
+const char * Variant::constData() const
+{
+	return (m_inline ? reinterpret_cast<const char*>(&m_number) : compactData().constData());
+}
+
+
+void Variant::setNumber(quint64 num, const void* raw, int size)
+{
+	const int	width	=	inlineSize(m_type);
+	
+	// setValue() doesn't change the type: Other types keep the bytes of the number
+	if(!width)
+	{
+		clearValue();
+		m_data		=	QByteArray(reinterpret_cast<const char*>(raw), size);
+		m_inline	=	false;
+		return;
+	}
+	
+	clearValue();
+	m_data.clear();
+	m_inline	=	true;
+	
+	// Stored with the size of the type, like on the wire
+	switch(width)
+	{
+		case sizeof(quint8):
+		{
+			quint8	value	=	quint8(num);
+			memcpy(&m_number, &value, sizeof(value));
+		}break;
+		
+		case sizeof(quint16):
+		{
+			quint16	value	=	quint16(num);
+			memcpy(&m_number, &value, sizeof(value));
+		}break;
+		
+		case sizeof(quint32):
+		{
+			quint32	value	=	quint32(num);
+			memcpy(&m_number, &value, sizeof(value));
+		}break;
+		
+		default:
+			m_number	=	num;
+			break;
+	}
+}
+
+
+Variant::Cache * Variant::setCache(Cache* cache) const
+{
+	if(m_cache.testAndSetOrdered(0, cache))
+		return cache;
+	
+	delete cache;
+	return m_cache.loadAcquire();
+}
+
+
+Variant Variant::fromShape(const QSharedPointer<const MapKeys>& keys, const QByteArray& values)
+{
+	Variant	ret(values, Map);
+	ret.m_cache.storeRelease(new Cache(keys));
+	
+	return ret;
+}
+
+
+const QSharedPointer<const Variant::MapKeys>& Variant::shapeKeys() const
+{
+	static const QSharedPointer<const MapKeys>	none;
+	
+	Cache	*	cache	=	((m_type == Map && !m_inline) ? m_cache.loadAcquire() : 0);
+	
+	return (cache ? cache->keys : none);
+}
+
+
+const QByteArray& Variant::compactData() const
+{
+	const QSharedPointer<const MapKeys>&	keys	=	shapeKeys();
+	
+	if(!keys)
+		return m_data;
+	
+	Cache				*	cache		=	m_cache.loadAcquire();
+	QByteArray	*	encoded	=	cache->encoded.loadAcquire();
+	
+	if(encoded)
+		return *encoded;
+	
+	// Same bytes as the Map the peer encoded (the values were checked by MapShapes)
+	const char	*	source	=	m_data.constData();
+	const int			size		=	m_data.size();
+	int						idx			=	0;
+	
+	encoded	=	new QByteArray();
+	encoded->reserve(keys->encoded.size() + size);
+	encoded->append(keys->encoded.constData(), keys->ends.first());
+	
+	for(int i = 1; i < keys->ends.count(); i++)
+	{
+		encoded->append(keys->encoded.constData() + keys->ends.at(i - 1), keys->ends.at(i) - keys->ends.at(i - 1));
+		
+		const int		itemBegin	=	idx;
+		quint8			type;
+		int					begin, end;
+		
+		if(!locateCompactItem(source, size, idx, type, begin, end))
+			break;
+		
+		encoded->append(source + itemBegin, idx - itemBegin);
+	}
+	
+	// Threads encoding at the same time keep the result published first
+	if(cache->encoded.testAndSetOrdered(0, encoded))
+		return *encoded;
+	
+	delete encoded;
+	return *cache->encoded.loadAcquire();
+}
+
+
+void Variant::clearValue()
+{
+	// m_number is the cache pointer of values stored in m_data
+	if(!m_inline)
+	{
+		Cache	*	cache	=	m_cache.loadAcquire();
+		if(cache && !cache->ref.deref())
+			delete cache;
+	}
+	
+	m_number	=	0;
 }
 
 
@@ -1386,7 +1905,7 @@ quint64 Variant::getUIntNumber(quint8 size, bool * ok) const
 	if(ok)
 		(*ok)	=	true;
 	
-	if(size > m_data.size())
+	if(size > this->size())
 	{
 		if(ok)
 			(*ok)	=	false;
@@ -1397,16 +1916,16 @@ quint64 Variant::getUIntNumber(quint8 size, bool * ok) const
 	switch(size)
 	{
 		case sizeof(quint8):
-			return (quint64)*((quint8*)m_data.data());break;
+			return (quint64)*((const quint8*)constData());break;
 			
 		case sizeof(quint16):
-			return (quint64)*((quint16*)m_data.data());break;
+			return (quint64)*((const quint16*)constData());break;
 			
 		case sizeof(quint32):
-			return (quint64)*((quint32*)m_data.data());break;
+			return (quint64)*((const quint32*)constData());break;
 			
 		case sizeof(quint64):
-			return (quint64)*((quint64*)m_data.data());break;
+			return (quint64)*((const quint64*)constData());break;
 	}
 	
 	if(ok)
@@ -1421,7 +1940,7 @@ qint64 Variant::getIntNumber(quint8 size, bool * ok) const
 	if(ok)
 		(*ok)	=	true;
 	
-	if(size > m_data.size())
+	if(size > this->size())
 	{
 		if(ok)
 			(*ok)	=	false;
@@ -1432,16 +1951,16 @@ qint64 Variant::getIntNumber(quint8 size, bool * ok) const
 	switch(size)
 	{
 		case sizeof(qint8):
-			return (qint64)*((qint8*)m_data.data());break;
+			return (qint64)*((const qint8*)constData());break;
 			
 		case sizeof(qint16):
-			return (qint64)*((qint16*)m_data.data());break;
+			return (qint64)*((const qint16*)constData());break;
 			
 		case sizeof(qint32):
-			return (qint64)*((qint32*)m_data.data());break;
+			return (qint64)*((const qint32*)constData());break;
 			
 		case sizeof(qint64):
-			return (qint64)*((qint64*)m_data.data());break;
+			return (qint64)*((const qint64*)constData());break;
 	}
 	
 	if(ok)
@@ -1451,15 +1970,505 @@ qint64 Variant::getIntNumber(quint8 size, bool * ok) const
 }
 
 
-void Variant::writeIntelligentNumber(QByteArray& target, quint64 num, quint8 shift)
+void Variant::writeIntelligentNumber(QByteArray& target, quint64 num)
 {
-  ///@todo Use 2 bits (right shifted by \a shift) to mark size of following integer (8/16/32/64)
+	char	buffer[9];
+	target.append(buffer, int(writeIntelligentNumber(buffer, num) - buffer));
+}
+
+
+int Variant::intelligentNumberSize(quint64 num)
+{
+	if(num < (Q_UINT64_C(1) << 6))
+		return 1;
+	else if(num < (Q_UINT64_C(1) << 14))
+		return 2;
+	else if(num < (Q_UINT64_C(1) << 30))
+		return 4;
+	
+	return 9;
+}
+
+
+char * Variant::writeIntelligentNumber(char* target, quint64 num)
+{
+	// Big endian, so the size bits are in the first byte:
+	// 00: 6 bit, 01: 14 bit, 10: 30 bit, 11: 64 bit in the following 8 bytes
+	switch(intelligentNumberSize(num))
+	{
+		case 1:
+			target[0]	=	char(num);
+			return target + 1;
+			
+		case 2:
+			target[0]	=	char(0x40 | (num >> 8));
+			target[1]	=	char(num);
+			return target + 2;
+			
+		case 4:
+			target[0]	=	char(0x80 | (num >> 24));
+			target[1]	=	char(num >> 16);
+			target[2]	=	char(num >> 8);
+			target[3]	=	char(num);
+			return target + 4;
+	}
+	
+	target[0]	=	char(0xC0);
+	for(int i = 0; i < 8; i++)
+		target[1 + i]	=	char(num >> (56 - i * 8));
+	
+	return target + 9;
 }
 
 
-quint64 Variant::readIntelligentNumber(const QByteArray& source, int idx, int& readBytes)
+quint64 Variant::readIntelligentNumber(const char* source, int size, int& idx, bool* ok)
 {
+	static const int	lengths[4]	=	{1, 2, 4, 9};
+	
+	if(idx >= size || size - idx < lengths[quint8(source[idx]) >> 6])
+	{
+		if(ok)
+			(*ok)	=	false;
+		
+		return 0;
+	}
+	
+	const quint8	first		=	quint8(source[idx]);
+	const int			length	=	lengths[first >> 6];
+	quint64				num			=	(length == 9 ? 0 : (first & 0x3F));
+	
+	for(int i = 1; i < length; i++)
+		num	=	(num << 8) | quint8(source[idx + i]);
+	
+	idx	+=	length;
+	
+	if(ok)
+		(*ok)	=	true;
+	
+	return num;
+}
 
+
+bool Variant::compactNumber(const Variant& value, quint64& num)
+{
+	// Integers are written by writeIntelligentNumber(), signed ones zigzag encoded so small
+	// negative numbers stay small
+	if(!value.m_inline)
+		return false;
+	
+	switch(value.m_type)
+	{
+		case Int8:
+		case Int16:
+		case Int32:
+		case Int64:
+		{
+			const qint64	signedNum	=	value.toInt64();
+			num	=	(quint64(signedNum) << 1) ^ quint64(signedNum >> 63);
+		}return true;
+		
+		case UInt8:
+		case UInt16:
+		case UInt32:
+		case UInt64:
+		case Bool:
+			num	=	value.toUInt64();
+			return true;
+			
+		default:
+			return false;
+	}
+}
+
+
+int Variant::compactItemSize(const Variant& value)
+{
+	quint64	num	=	0;
+	
+	if(compactNumber(value, num))
+		return 1 + intelligentNumberSize(num);
+	
+	return 1 + intelligentNumberSize(value.size()) + value.size();
+}
+
+
+char * Variant::writeCompactItem(char* target, const Variant& value)
+{
+	quint64	num	=	0;
+	
+	if(compactNumber(value, num))
+	{
+		*target++	=	char(value.m_type);
+		return writeIntelligentNumber(target, num);
+	}
+	
+	// Everything else as [size][raw data], marked if the type would be read as number
+	*target++	=	char(value.m_type | (inlineSize(value.m_type) ? COMPACT_RAW_DATA : 0));
+	target		=	writeIntelligentNumber(target, value.size());
+	memcpy(target, value.constData(), value.size());
+	
+	return target + value.size();
+}
+
+
+void Variant::appendCompactItem(QByteArray& target, const Variant& value)
+{
+	const int	pos	=	target.size();
+	
+	target.resize(pos + compactItemSize(value));
+	writeCompactItem(target.data() + pos, value);
+}
+
+
+Variant Variant::readCompactItem(const char* source, int size, int& idx, bool* ok)
+{
+	if(idx >= size)
+	{
+		if(ok)
+			(*ok)	=	false;
+		
+		return Variant();
+	}
+	
+	const quint8	tag		=	quint8(source[idx++]);
+	Variant				value(Type(tag & ~COMPACT_RAW_DATA));
+	bool					valid	=	true;
+	
+	if(!(tag & COMPACT_RAW_DATA) && inlineSize(tag))
+	{
+		const quint64	num	=	readIntelligentNumber(source, size, idx, &valid);
+		
+		switch(tag)
+		{
+			case Int8:
+			case Int16:
+			case Int32:
+			case Int64:
+				value.setValue(qint64(num >> 1) ^ -qint64(num & 1));
+				break;
+				
+			default:
+				value.setValue(num);
+				break;
+		}
+	}
+	else
+	{
+		const quint64	length	=	readIntelligentNumber(source, size, idx, &valid);
+		
+		if(valid && length <= quint64(size - idx))
+		{
+			value.setRawData(source + idx, int(length));
+			idx	+=	int(length);
+		}
+		else
+			valid	=	false;
+	}
+	
+	if(ok)
+		(*ok)	=	valid;
+	
+	return (valid ? value : Variant());
+}
+
+
+bool Variant::locateCompactItem(const char* source, int size, int& idx, quint8& type, int& begin, int& end)
+{
+	if(idx >= size)
+		return false;
+	
+	const quint8	tag		=	quint8(source[idx++]);
+	bool					valid	=	true;
+	
+	type	=	(tag & ~COMPACT_RAW_DATA);
+	
+	// Numbers: the encoded number
+	if(!(tag & COMPACT_RAW_DATA) && inlineSize(tag))
+	{
+		begin	=	idx;
+		readIntelligentNumber(source, size, idx, &valid);
+		end		=	idx;
+		
+		return valid;
+	}
+	
+	const quint64	length	=	readIntelligentNumber(source, size, idx, &valid);
+	if(!valid || length > quint64(size - idx))
+		return false;
+	
+	begin	=	idx;
+	idx		+=	int(length);
+	end		=	idx;
+	
+	return true;
+}
+
+
+Variant::Type Variant::arrayType(const QVariantList& list)
+{
+	if(list.isEmpty())
+		return None;
+	
+	const int		type	=	list.first().userType();
+	
+	for(int i = 1; i < list.count(); i++)
+	{
+		if(list.at(i).userType() != type)
+			return None;
+	}
+	
+	switch(type)
+	{
+		case QMetaType::Int:
+			return Int32Array;
+			
+		case QMetaType::LongLong:
+			return Int64Array;
+			
+		case QMetaType::Float:
+			return FloatArray;
+			
+		case QMetaType::Double:
+			return DoubleArray;
+			
+		default:
+			return None;
+	}
+}
+
+
+void Variant::setList(const QVariantList& list)
+{
+	m_type	=	arrayType(list);
+	
+	if(m_type == None)
+	{
+		m_type	=	List;
+		setValue(list);
+		return;
+	}
+	
+	// The numbers are converted straight into the contiguous data
+	clearValue();
+	m_data.resize(list.count() * elementSize(m_type));
+	m_inline	=	false;
+	
+	switch(m_type)
+	{
+		case Int32Array:
+		{
+			qint32	*	data	=	reinterpret_cast<qint32*>(m_data.data());
+			for(int i = 0; i < list.count(); i++)
+				data[i]	=	list.at(i).toInt();
+		}break;
+		
+		case Int64Array:
+		{
+			qint64	*	data	=	reinterpret_cast<qint64*>(m_data.data());
+			for(int i = 0; i < list.count(); i++)
+				data[i]	=	list.at(i).toLongLong();
+		}break;
+		
+		case FloatArray:
+		{
+			float		*	data	=	reinterpret_cast<float*>(m_data.data());
+			for(int i = 0; i < list.count(); i++)
+				data[i]	=	list.at(i).value<float>();
+		}break;
+		
+		default:
+		{
+			double	*	data	=	reinterpret_cast<double*>(m_data.data());
+			for(int i = 0; i < list.count(); i++)
+				data[i]	=	list.at(i).toDouble();
+		}break;
+	}
+	
+	swapElements(m_data.data(), list.count(), elementSize(m_type));
+}
+
+
+bool Variant::readCompactMap(QList< QPair<QString, Variant> >& items) const
+{
+	const char	*	data	=	m_data.constData();
+	const int			size	=	m_data.size();
+	int						idx		=	0;
+	bool					valid	=	true;
+	
+	// Values of a shape: its keys are shared instead of converted
+	const QSharedPointer<const MapKeys>&	keys	=	shapeKeys();
+	
+	if(keys)
+	{
+		for(int i = 0; valid && i < keys->strings.count(); i++)
+		{
+			Variant	value(readCompactItem(data, size, idx, &valid));
+			if(valid)
+				items.append(qMakePair(keys->strings.at(i), value));
+		}
+		
+		return valid;
+	}
+	
+	// Format:
+	// [item count][key size][UTF8 key][value type][value]...
+	
+	const quint64	itemCount	=	readIntelligentNumber(data, size, idx, &valid);
+	
+	for(quint64 i = 0; valid && i < itemCount; i++)
+	{
+		const quint64	keySize	=	readIntelligentNumber(data, size, idx, &valid);
+		if(!valid || keySize > quint64(size - idx))
+			return false;
+		
+		QString	key(QString::fromUtf8(data + idx, int(keySize)));
+		idx	+=	int(keySize);
+		
+		Variant	value(readCompactItem(data, size, idx, &valid));
+		if(valid)
+			items.append(qMakePair(key, value));
+	}
+	
+	return valid;
+}
+
+
+Variant Variant::toLegacyEncoding() const
+{
+	// Arrays of integers as List, older versions don't know floating point numbers at all
+	if(m_type == Int32Array || m_type == Int64Array)
+	{
+		Variant	list(toList());
+		list.m_optId	=	m_optId;
+		
+		return list.toLegacyEncoding();
+	}
+	
+	if(m_type != Map && m_type != List)
+		return *this;
+	
+	// Format:
+	// [quint64 item count]([quint32 key size][UTF8 key])[quint16 value type][quint32 value size][value]...
+	QList< QPair<QString, Variant> >	items;
+	
+	if(m_type == Map)
+		readCompactMap(items);
+	else
+	{
+		QList<Variant>	list(toList());
+		for(int i = 0; i < list.count(); i++)
+			items.append(qMakePair(QString(), list.at(i)));
+	}
+	
+	QByteArray	data;
+	quint64			itemCount	=	items.count();
+	data.append(reinterpret_cast<const char*>(&itemCount), sizeof(itemCount));
+	
+	for(int i = 0; i < items.count(); i++)
+	{
+		if(m_type == Map)
+		{
+			QByteArray	key(items.at(i).first.toUtf8());
+			quint32			keySize	=	key.size();
+			data.append(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+			data.append(key);
+		}
+		
+		const Variant	value(items.at(i).second.toLegacyEncoding());
+		quint16				type	=	quint16(value.m_type);
+		quint32				size	=	value.size();
+		data.append(reinterpret_cast<const char*>(&type), sizeof(type));
+		data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+		data.append(value.constData(), size);
+	}
+	
+	return Variant(data, Type(m_type), m_optId);
+}
+
+
+Variant Variant::fromLegacyEncoding(const Variant& legacy, bool* ok)
+{
+	if(ok)
+		(*ok)	=	true;
+	
+	if(legacy.m_type != Map && legacy.m_type != List)
+		return legacy;
+	
+	const char	*	source	=	legacy.m_data.constData();
+	const int			size		=	legacy.m_data.size();
+	int						idx			=	0;
+	bool					valid		=	(size >= int(sizeof(quint64)));
+	QByteArray		data;
+	quint64				itemCount	=	0;
+	
+	if(valid)
+	{
+		memcpy(&itemCount, source, sizeof(itemCount));
+		idx	+=	sizeof(itemCount);
+		writeIntelligentNumber(data, itemCount);
+	}
+	
+	for(quint64 i = 0; valid && i < itemCount; i++)
+	{
+		if(legacy.m_type == Map)
+		{
+			quint32	keySize	=	0;
+			if(size - idx < int(sizeof(keySize)))
+			{
+				valid	=	false;
+				break;
+			}
+			
+			memcpy(&keySize, source + idx, sizeof(keySize));
+			idx	+=	sizeof(keySize);
+			
+			if(keySize > quint32(size - idx))
+			{
+				valid	=	false;
+				break;
+			}
+			
+			writeIntelligentNumber(data, keySize);
+			data.append(source + idx, keySize);
+			idx	+=	keySize;
+		}
+		
+		quint16	type			=	0;
+		quint32	valueSize	=	0;
+		if(size - idx < int(sizeof(type) + sizeof(valueSize)))
+		{
+			valid	=	false;
+			break;
+		}
+		
+		memcpy(&type, source + idx, sizeof(type));
+		idx	+=	sizeof(type);
+		memcpy(&valueSize, source + idx, sizeof(valueSize));
+		idx	+=	sizeof(valueSize);
+		
+		if(valueSize > quint32(size - idx))
+		{
+			valid	=	false;
+			break;
+		}
+		
+		Variant	value(Type(quint8(type)));
+		value.setRawData(source + idx, valueSize);
+		idx	+=	valueSize;
+		
+		// Nested Maps and Lists are legacy encoded as well
+		appendCompactItem(data, fromLegacyEncoding(value, &valid));
+	}
+	
+	if(!valid)
+	{
+		if(ok)
+			(*ok)	=	false;
+		
+		return Variant();
+	}
+	
+	return Variant(data, Type(legacy.m_type), legacy.m_optId);
 }
 
 
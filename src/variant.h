@@ -24,6 +24,13 @@
 #include <QVariantList>
 #include <QByteArray>
 #include <QMetaType>
+#include <QPair>
+#include <QVector>
+#include <QAtomicPointer>
+#include <QSharedPointer>
+
+class VariantMapView;
+class VariantListView;
 
 /**
 
@@ -75,7 +82,12 @@ class Variant
 			Bool								=	0x11,
 			SocketDescriptor		=	0x12,
 			Map                 = 0x13,
-      List                = 0x14
+      List                = 0x14,
+      // Contiguous numbers in little endian byte order
+      Int32Array          = 0x15,
+      Int64Array          = 0x16,
+      FloatArray          = 0x17,
+      DoubleArray         = 0x18
 		};
 		
 	public:
@@ -101,6 +113,9 @@ class Variant
 		
 		Variant(const QByteArray& data);
 		
+		// Takes over \a data without touching its reference count
+		Variant(QByteArray&& data);
+		
 		/**
 			@brief Constructs an Variant with the specified data and type.
 			
@@ -114,18 +129,37 @@ class Variant
     
     Variant(const QVariantMap& map);
     
+    /**
+      @brief Constructs a List.
+      
+      Lists of only int, qlonglong, float or double values become an Int32Array, Int64Array,
+      FloatArray or DoubleArray.
+    */
     Variant(const QVariantList& list);
     
     Variant(const QList<Variant>& list);
+    
+    Variant(const QVector<qint32>& array);
+    
+    Variant(const QVector<qint64>& array);
+    
+    Variant(const QVector<float>& array);
+    
+    Variant(const QVector<double>& array);
 		
 		Variant(const Variant& other);
 		
+		// \a other is left invalid (and no longer owns its file descriptor)
+		Variant(Variant&& other) noexcept;
+		
 		Variant(const QVariant& other);
 		
 		~Variant();
 		
 		Variant& operator = (const Variant& other);
 		
+		Variant& operator = (Variant&& other) noexcept;
+		
 		Variant& operator = (const QVariant& other);
 		
 		Variant& operator = (const QByteArray& other);
@@ -162,8 +196,12 @@ class Variant
 		
 		bool isValid() const;
 		
+		// Size of the raw data (as written to a socket)
 		int size() const;
 		
+		// Raw data of size() bytes, valid as long as the Variant is not modified
+		const char * constData() const;
+		
 		void setOptionalId(quint32 optId);
 		
 		quint32 optionalId() const;
@@ -186,6 +224,8 @@ class Variant
 		
 		void setValue(const QByteArray& value);
 		
+		void setValue(QByteArray&& value);
+		
 		void setValue(const QString& value);
     
     void setValue(const QVariantMap& value);
@@ -196,6 +236,9 @@ class Variant
 		
 		void setValue(bool boolean);
 		
+		// Like setValue(const QByteArray&) without creating a QByteArray for scalar types
+		void setRawData(const char * data, int size);
+		
 		qint8 toInt8(bool * ok = 0) const;
 		
 		quint8 toUInt8(bool * ok = 0) const;
@@ -216,7 +259,25 @@ class Variant
 		
 		QByteArray toByteArray(bool * ok = 0) const;
 		
+		// A String is converted from UTF-8 once, the copies of the Variant share the result
 		QString toString(bool * ok = 0) const;
+		
+		// UTF-8 data of a String without conversion (e.g. as key of a QHash or for forwarding)
+		QByteArray toUtf8(bool * ok = 0) const;
+		
+		// String referring to the data of the Variant, \a ok is false if it is not ASCII only
+		QLatin1String toLatin1String(bool * ok = 0) const;
+		
+		// Compares a String without converting it to UTF-16
+		bool equals(QLatin1String string) const;
+		
+		// \a utf8 is compared byte by byte
+		bool equals(const QByteArray& utf8) const;
+		
+		bool equals(const QString& string) const;
+		
+		// Hash of the UTF-8 data of a String (qHash(toUtf8(), seed))
+		uint stringHash(uint seed = 0) const;
     
     QVariantMap toQMap(bool * ok = 0) const;
     
@@ -224,7 +285,36 @@ class Variant
     
     QList<Variant> toList(bool * ok = 0) const;
     
+    QVector<qint32> toInt32Array(bool * ok = 0) const;
+    
+    QVector<qint64> toInt64Array(bool * ok = 0) const;
+    
+    QVector<float> toFloatArray(bool * ok = 0) const;
+    
+    QVector<double> toDoubleArray(bool * ok = 0) const;
+    
+    /**
+      @brief Number of elements of an array type.
+      
+      The elements are stored little endian, on little endian hosts they can be read in place with
+      constData() (e.g. as const qint32 * for an Int32Array).
+    */
+    int arraySize() const;
+    
     QVariant toQVariant(bool * ok = 0) const;
+    
+    // Read single items of a Map or List without decoding all of them (see VariantMapView)
+    VariantMapView mapView() const;
+    
+    VariantListView listView() const;
+    
+    /**
+      @brief Map or List in the fixed size encoding of older versions.
+      
+      Peers not announcing the compact encoding get Maps and Lists in this format (see MessageBus),
+      Int32Array and Int64Array are converted to Lists. Other types are returned unchanged.
+    */
+    Variant toLegacyEncoding() const;
 		
 		bool toBool(bool * ok = 0) const;
 
@@ -260,23 +350,104 @@ class Variant
     static Variant fromList(const QVariantList& list);
     
     static Variant fromList(const QList<Variant>& list);
+    
+    // Map or List received from a peer using the fixed size encoding of older versions
+    static Variant fromLegacyEncoding(const Variant& legacy, bool * ok = 0);
 		
 	private:
+		// Store \a num inline for scalar types, otherwise the \a size bytes at \a raw
+		void setNumber(quint64 num, const void * raw, int size);
+		
 		quint64 getUIntNumber(quint8 size, bool * ok) const;
 		
 		qint64 getIntNumber(quint8 size, bool * ok) const;
+		
+		// Conversions of m_data kept by the Variant (see toString())
+		struct Cache;
+		
+		// Publish \a cache unless another thread was faster, returns the published cache
+		Cache * setCache(Cache * cache) const;
+		
+		// Release the cache (or the inline number) before the value changes
+		void clearValue();
+		
+		// Keys of the Maps of one shape (see MapShapes), shared by the Maps received with it
+		struct MapKeys
+		{
+			// Encoded item count followed by the encoded keys
+			QByteArray					encoded;
+			// End of the encoded count and of each key in encoded
+			QVector<int>				ends;
+			// Converted once for all Maps of the shape
+			QVector<QString>		strings;
+		};
+		
+		// Map holding only the compact \a values of \a keys, the keys are not copied into it
+		static Variant fromShape(const QSharedPointer<const MapKeys>& keys, const QByteArray& values);
+		
+		// Keys of a Map made by fromShape(), null for other Variants
+		const QSharedPointer<const MapKeys>& shapeKeys() const;
+		
+		// Data in the compact format (a Map made by fromShape() is encoded with its keys once)
+		const QByteArray& compactData() const;
+    
+    // The upper 2 bits of the first byte mark the size of the number (1, 2, 4 or 9 bytes)
+    static void writeIntelligentNumber(QByteArray& target, quint64 num);
+    
+    static char * writeIntelligentNumber(char * target, quint64 num);
+    
+    static int intelligentNumberSize(quint64 num);
     
-    void writeIntelligentNumber(QByteArray& target, quint64 num, quint8 shift = 0);
+    static quint64 readIntelligentNumber(const char * source, int size, int& idx, bool * ok);
     
-    quint64 readIntelligentNumber(const QByteArray& source, int idx, int& readBytes);
+    // The number written for integers of the compact format, false for other items
+    static bool compactNumber(const Variant& value, quint64& num);
+    
+    static int compactItemSize(const Variant& value);
+    
+    static char * writeCompactItem(char * target, const Variant& value);
+    
+    static void appendCompactItem(QByteArray& target, const Variant& value);
+    
+    static Variant readCompactItem(const char * source, int size, int& idx, bool * ok);
+    
+    bool readCompactMap(QList< QPair<QString, Variant> >& items) const;
+    
+    // Array type for a list of only one type of numbers, None otherwise
+    static Type arrayType(const QVariantList& list);
+    
+    // Set a List or the array picked by arrayType()
+    void setList(const QVariantList& list);
+    
+    // Type and [begin, end) of the value of the item at \a idx, \a idx is moved to the next item
+    static bool locateCompactItem(const char * source, int size, int& idx, quint8& type, int& begin, int& end);
+    
+    friend class VariantMapView;
+    friend class VariantListView;
+    friend class VariantWriter;
+    friend class MapShapes;
 		
 	private:
-		Type							m_type;
+		// Data of ByteArray, String, Map and List (and of scalars not matching their type's size)
 		QByteArray				m_data;
+		union
+		{
+			// Scalars (integers, bool, socket descriptors) are stored here without allocation
+			quint64												m_number;
+			// Values in m_data: their Cache (shared by the copies, null until first used)
+			mutable QBasicAtomicPointer<Cache>	m_cache;
+		};
 		quint32						m_optId;
+		// Type
+		quint8						m_type;
+		// The value is stored in m_number
+		bool							m_inline;
     bool              m_autoCloseAndDup;
 };
 
+// Relocated by memmove in Qt containers
+Q_DECLARE_TYPEINFO(Variant, Q_MOVABLE_TYPE);
+
 Q_DECLARE_METATYPE(Variant)
 Q_DECLARE_METATYPE(QList<Variant>)
 
@@ -0,0 +1,92 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "variantstruct.h"
+
+#include <QHash>
+#include <QPair>
+#include <QMetaMethod>
+#include <QReadWriteLock>
+
+typedef QPair<const QMetaObject*, QByteArray>		StructSlotKey;
+
+static QReadWriteLock										s_decodersLock;
+static QHash<int, VariantStruct::Decoder>		s_decoders;
+// Result of structSlots(), the lookup walks all methods of the meta object
+static QHash<StructSlotKey, QVector<int> >	s_structSlots;
+
+VariantStruct::Decoder VariantStruct::decoder(int type)
+{
+	QReadLocker		locker(&s_decodersLock);
+	
+	return s_decoders.value(type, 0);
+}
+
+
+void VariantStruct::registerDecoder(int type, Decoder decoder)
+{
+	QWriteLocker	locker(&s_decodersLock);
+	
+	s_decoders.insert(type, decoder);
+	s_structSlots.clear();
+}
+
+
+QVector<int> VariantStruct::structSlots(const QMetaObject* meta, const QByteArray& name)
+{
+	const StructSlotKey		key(meta, name);
+	
+	{
+		QReadLocker		locker(&s_decodersLock);
+		
+		QHash<StructSlotKey, QVector<int> >::const_iterator	it	=	s_structSlots.constFind(key);
+		if(it != s_structSlots.constEnd())
+			return it.value();
+	}
+	
+	QWriteLocker		locker(&s_decodersLock);
+	const int				variantId	=	qMetaTypeId<Variant>();
+	QVector<int>		ret;
+	
+	for(int i = 0; i < meta->methodCount(); i++)
+	{
+		const QMetaMethod		method(meta->method(i));
+		
+		if(method.parameterCount() < 2 || method.name() != name)
+			continue;
+		
+		bool	structs	=	false;
+		bool	matches	=	true;
+		for(int p = 1; p < method.parameterCount() && matches; p++)
+		{
+			const int		type	=	method.parameterType(p);
+			
+			if(type == variantId)
+				continue;
+			
+			structs	=	true;
+			matches	=	s_decoders.contains(type);
+		}
+		
+		if(structs && matches)
+			ret.append(i);
+	}
+	
+	s_structSlots.insert(key, ret);
+	return ret;
+}
@@ -0,0 +1,281 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VARIANTSTRUCT_H
+#define VARIANTSTRUCT_H
+
+#include <QMetaType>
+#include <QMetaObject>
+#include <QList>
+#include <QVector>
+
+#include <tuple>
+#include <utility>
+#include <limits>
+#include <type_traits>
+
+#include "variant.h"
+
+/**
+	@brief Declares the fields of a struct for VariantStruct.
+	
+	Place it after the fields inside the struct. The fields are encoded in this order.
+	
+@code
+struct Sample
+{
+	qint64		time;
+	qint32		value;
+	QString		sensor;
+	
+	MSGBUS_FIELDS(time, value, sensor)
+};
+@endcode
+*/
+#define MSGBUS_FIELDS(...) \
+	auto msgbusFields() -> decltype(std::tie(__VA_ARGS__)) { return std::tie(__VA_ARGS__); } \
+	auto msgbusFields() const -> decltype(std::tie(__VA_ARGS__)) { return std::tie(__VA_ARGS__); }
+
+/**
+	@brief Encodes structs declaring their fields with MSGBUS_FIELDS.
+	
+	A struct is sent as List of its fields, without names, so the encoder and decoder are
+	generated at compile time and no map is built. Nested structs, all types Variant can be
+	constructed from and QVector arrays can be used as fields. Other field types (e.g. long,
+	char or enums) don't compile instead of being converted implicitly. Integers are only
+	decoded if they fit into the field.
+	
+	Slots can take a registered struct as parameter, MessageBus decodes it before the slot
+	is called:
+	
+@code
+// Once in both processes
+VariantStruct::registerType<Sample>("Sample");
+
+// Sender
+bus->call("onSample", VariantStruct::encode(sample));
+
+// Receiver
+void Receiver::onSample(MessageBus * bus, const Sample& sample);
+@endcode
+*/
+class VariantStruct
+{
+	public:
+		typedef bool (*Decoder)(const Variant& value, void * target);
+		
+		template<typename T>
+		static Variant encode(const T& value)
+		{
+			typedef decltype(value.msgbusFields())		Tuple;
+			
+			QList<Variant>	fields;
+			fields.reserve(std::tuple_size<Tuple>::value);
+			
+			Fields<0, std::tuple_size<Tuple>::value>::encode(value.msgbusFields(), fields);
+			
+			return Variant(fields);
+		}
+		
+		// False if \a value doesn't hold the fields of \a T
+		template<typename T>
+		static bool decode(const Variant& value, T& target)
+		{
+			typedef decltype(target.msgbusFields())		Tuple;
+			
+			bool						ok		=	false;
+			QList<Variant>	fields(value.toList(&ok));
+			
+			if(!ok || value.type() != Variant::List || fields.count() != int(std::tuple_size<Tuple>::value))
+				return false;
+			
+			Tuple		tuple(target.msgbusFields());
+			return Fields<0, std::tuple_size<Tuple>::value>::decode(fields, tuple);
+		}
+		
+		// Register \a T as meta type, so it can be used as slot parameter
+		template<typename T>
+		static int registerType(const char * typeName)
+		{
+			const int		type	=	qRegisterMetaType<T>(typeName);
+			registerDecoder(type, &decodeTo<T>);
+			
+			return type;
+		}
+		
+		// Decoder of the registered meta type \a type, 0 for other types
+		static Decoder decoder(int type);
+		
+		/**
+			@brief Indexes of the methods of \a meta named \a name taking registered structs.
+			
+			The parameters after the first (the MessageBus) have to be Variants or registered structs,
+			at least one of them a struct. The result is cached, registering a type clears the cache.
+		*/
+		static QVector<int> structSlots(const QMetaObject * meta, const QByteArray& name);
+		
+		// A single field (nested structs are encoded with encode())
+		template<typename F>
+		static Variant toVariant(const F& field)
+		{
+			return toVariant(field, 0);
+		}
+		
+		template<typename F>
+		static bool fromVariant(const Variant& value, F& field)
+		{
+			return fromVariant(value, field, 0);
+		}
+		
+	private:
+		static void registerDecoder(int type, Decoder decoder);
+		
+		template<typename T>
+		static bool decodeTo(const Variant& value, void * target)
+		{
+			return decode(value, *static_cast<T*>(target));
+		}
+		
+		// Nested structs
+		template<typename F>
+		static auto toVariant(const F& field, int) -> decltype(field.msgbusFields(), Variant())
+		{
+			return encode(field);
+		}
+		
+		template<typename F>
+		static Variant toVariant(const F& field, long)
+		{
+			static_assert(IsField<F>::value, "VariantStruct: unsupported field type, use a fixed size integer, bool, QString, QByteArray, QVector array or nested struct");
+			return Variant(field);
+		}
+		
+		template<typename F>
+		static auto fromVariant(const Variant& value, F& field, int) -> decltype(field.msgbusFields(), bool())
+		{
+			return decode(value, field);
+		}
+		
+		template<typename F>
+		static bool fromVariant(const Variant& value, F& field, long)
+		{
+			return read(value, field);
+		}
+		
+		// Integers only if the number fits into \a field, they are never truncated
+		template<typename I>
+		static bool readInteger(const Variant& value, I& field)
+		{
+			bool	ok	=	false;
+			
+			switch(value.type())
+			{
+				case Variant::Int8:
+				case Variant::Int16:
+				case Variant::Int32:
+				case Variant::Int64:
+				{
+					const qint64	num	=	value.toInt64(&ok);
+					
+					if(!ok || (num < 0 ? (!std::numeric_limits<I>::is_signed || num < qint64(std::numeric_limits<I>::min())) : quint64(num) > quint64(std::numeric_limits<I>::max())))
+						return false;
+					
+					field	=	I(num);
+				}return true;
+				
+				default:
+				{
+					const quint64	num	=	value.toUInt64(&ok);
+					
+					if(!ok || num > quint64(std::numeric_limits<I>::max()))
+						return false;
+					
+					field	=	I(num);
+				}return true;
+			}
+		}
+		
+		static bool read(const Variant& value, qint8& field)				{ return readInteger(value, field); }
+		static bool read(const Variant& value, quint8& field)				{ return readInteger(value, field); }
+		static bool read(const Variant& value, qint16& field)				{ return readInteger(value, field); }
+		static bool read(const Variant& value, quint16& field)			{ return readInteger(value, field); }
+		static bool read(const Variant& value, qint32& field)				{ return readInteger(value, field); }
+		static bool read(const Variant& value, quint32& field)			{ return readInteger(value, field); }
+		static bool read(const Variant& value, qint64& field)				{ return readInteger(value, field); }
+		static bool read(const Variant& value, quint64& field)			{ return readInteger(value, field); }
+		static bool read(const Variant& value, bool& field)					{ bool ok; field = value.toBool(&ok); return ok; }
+		static bool read(const Variant& value, QString& field)			{ bool ok; field = value.toString(&ok); return ok; }
+		static bool read(const Variant& value, QByteArray& field)		{ bool ok; field = value.toByteArray(&ok); return ok; }
+		static bool read(const Variant& value, QVariantMap& field)	{ bool ok; field = value.toQMap(&ok); return ok; }
+		static bool read(const Variant& value, QVariantList& field)	{ bool ok; field = value.toQList(&ok); return ok; }
+		static bool read(const Variant& value, QList<Variant>& field)	{ bool ok; field = value.toList(&ok); return ok; }
+		static bool read(const Variant& value, QVector<qint32>& field)	{ bool ok; field = value.toInt32Array(&ok); return ok; }
+		static bool read(const Variant& value, QVector<qint64>& field)	{ bool ok; field = value.toInt64Array(&ok); return ok; }
+		static bool read(const Variant& value, QVector<float>& field)		{ bool ok; field = value.toFloatArray(&ok); return ok; }
+		static bool read(const Variant& value, QVector<double>& field)	{ bool ok; field = value.toDoubleArray(&ok); return ok; }
+		static bool read(const Variant& value, Variant& field)			{ field = value; return true; }
+		
+		// Field types with a read() overload: the same types are accepted by the encoder, so no
+		// field is converted implicitly (e.g. a long to qint32)
+		template<typename F>
+		struct IsField
+		{
+			template<typename U>
+			static auto test(int) -> decltype(read(std::declval<const Variant&>(), std::declval<U&>()), std::true_type());
+			
+			template<typename U>
+			static std::false_type test(long);
+			
+			static const bool value = decltype(test<F>(0))::value;
+		};
+		
+		// Field I to N - 1 of the tuple returned by msgbusFields()
+		template<int I, int N>
+		struct Fields
+		{
+			template<typename Tuple>
+			static void encode(const Tuple& tuple, QList<Variant>& fields)
+			{
+				fields.append(toVariant(std::get<I>(tuple), 0));
+				Fields<I + 1, N>::encode(tuple, fields);
+			}
+			
+			template<typename Tuple>
+			static bool decode(const QList<Variant>& fields, Tuple& tuple)
+			{
+				return fromVariant(fields.at(I), std::get<I>(tuple), 0) && Fields<I + 1, N>::decode(fields, tuple);
+			}
+		};
+		
+		template<int N>
+		struct Fields<N, N>
+		{
+			template<typename Tuple>
+			static void encode(const Tuple&, QList<Variant>&)
+			{
+			}
+			
+			template<typename Tuple>
+			static bool decode(const QList<Variant>&, Tuple&)
+			{
+				return true;
+			}
+		};
+};
+
+#endif // VARIANTSTRUCT_H
@@ -0,0 +1,444 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "variantview.h"
+
+#include <string.h>
+
+VariantListView::VariantListView()
+	:	m_end(0), m_count(-1), m_firstItem(0)
+{
+}
+
+
+VariantListView::VariantListView(const Variant& list)
+	:	m_end(0), m_count(-1), m_firstItem(0)
+{
+	if(list.type() != Variant::List)
+		return;
+	
+	// Shared, not copied
+	m_data	=	list.m_data;
+	init(0, m_data.size());
+}
+
+
+VariantListView::VariantListView(const QByteArray& data, int begin, int end)
+	:	m_data(data), m_end(0), m_count(-1), m_firstItem(0)
+{
+	init(begin, end);
+}
+
+
+void VariantListView::init(int begin, int end)
+{
+	int			idx		=	begin;
+	bool		valid	=	true;
+	
+	// Format:
+	// [item count][value type][value]...
+	const quint64	count	=	Variant::readIntelligentNumber(m_data.constData(), end, idx, &valid);
+	
+	// Each item takes at least one byte
+	if(!valid || count > quint64(end - idx))
+		return;
+	
+	m_end				=	end;
+	m_count			=	int(count);
+	m_firstItem	=	idx;
+}
+
+
+bool VariantListView::isValid() const
+{
+	return (m_count >= 0);
+}
+
+
+int VariantListView::size() const
+{
+	return qMax(m_count, 0);
+}
+
+
+Variant::Type VariantListView::typeAt(int index) const
+{
+	int			idx		=	offset(index);
+	quint8	type	=	Variant::None;
+	int			begin, end;
+	
+	if(idx < 0 || !Variant::locateCompactItem(m_data.constData(), m_end, idx, type, begin, end))
+		return Variant::None;
+	
+	return Variant::Type(type);
+}
+
+
+Variant VariantListView::at(int index) const
+{
+	int		idx		=	offset(index);
+	
+	if(idx < 0)
+		return Variant();
+	
+	return Variant::readCompactItem(m_data.constData(), m_end, idx, 0);
+}
+
+
+VariantMapView VariantListView::mapAt(int index) const
+{
+	int			idx		=	offset(index);
+	quint8	type	=	Variant::None;
+	int			begin, end;
+	
+	if(idx < 0 || !Variant::locateCompactItem(m_data.constData(), m_end, idx, type, begin, end) || type != Variant::Map)
+		return VariantMapView();
+	
+	return VariantMapView(m_data, begin, end);
+}
+
+
+VariantListView VariantListView::listAt(int index) const
+{
+	int			idx		=	offset(index);
+	quint8	type	=	Variant::None;
+	int			begin, end;
+	
+	if(idx < 0 || !Variant::locateCompactItem(m_data.constData(), m_end, idx, type, begin, end) || type != Variant::List)
+		return VariantListView();
+	
+	return VariantListView(m_data, begin, end);
+}
+
+
+bool VariantListView::buildIndex() const
+{
+	if(m_count < 0)
+		return false;
+	
+	if(m_offsets.count() == m_count)
+		return true;
+	
+	const char	*	data	=	m_data.constData();
+	int						idx		=	m_firstItem;
+	quint8				type;
+	int						begin, end;
+	
+	m_offsets.reserve(m_count);
+	
+	for(int i = 0; i < m_count; i++)
+	{
+		m_offsets.append(idx);
+		
+		if(!Variant::locateCompactItem(data, m_end, idx, type, begin, end))
+		{
+			m_offsets.clear();
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+
+int VariantListView::offset(int index) const
+{
+	if(index < 0 || index >= m_count || !buildIndex())
+		return -1;
+	
+	return m_offsets.at(index);
+}
+
+
+VariantMapView::VariantMapView()
+	:	m_end(0), m_count(-1), m_firstItem(0)
+{
+}
+
+
+VariantMapView::VariantMapView(const Variant& map)
+	:	m_end(0), m_count(-1), m_firstItem(0)
+{
+	if(map.type() != Variant::Map)
+		return;
+	
+	// Shared, not copied
+	m_data	=	map.m_data;
+	m_shape	=	map.shapeKeys();
+	
+	// Values only (checked when the Map was received)
+	if(m_shape)
+	{
+		m_end		=	m_data.size();
+		m_count	=	m_shape->strings.count();
+		return;
+	}
+	
+	init(0, m_data.size());
+}
+
+
+VariantMapView::VariantMapView(const QByteArray& data, int begin, int end)
+	:	m_data(data), m_end(0), m_count(-1), m_firstItem(0)
+{
+	init(begin, end);
+}
+
+
+void VariantMapView::init(int begin, int end)
+{
+	int			idx		=	begin;
+	bool		valid	=	true;
+	
+	// Format:
+	// [item count][key size][UTF8 key][value type][value]...
+	const quint64	count	=	Variant::readIntelligentNumber(m_data.constData(), end, idx, &valid);
+	
+	// Each entry takes at least two bytes
+	if(!valid || count > quint64(end - idx) / 2)
+		return;
+	
+	m_end				=	end;
+	m_count			=	int(count);
+	m_firstItem	=	idx;
+}
+
+
+bool VariantMapView::isValid() const
+{
+	return (m_count >= 0);
+}
+
+
+int VariantMapView::size() const
+{
+	return qMax(m_count, 0);
+}
+
+
+QString VariantMapView::keyAt(int index) const
+{
+	if(index < 0 || index >= m_count || !buildOffsets())
+		return QString();
+	
+	if(m_shape)
+		return m_shape->strings.at(index);
+	
+	int		keyBegin, keySize;
+	if(skipKey(m_offsets.at(index), &keyBegin, &keySize) < 0)
+		return QString();
+	
+	return QString::fromUtf8(m_data.constData() + keyBegin, keySize);
+}
+
+
+Variant VariantMapView::valueAt(int index) const
+{
+	if(index < 0 || index >= m_count || !buildOffsets())
+		return Variant();
+	
+	int		idx		=	(m_shape ? m_offsets.at(index) : skipKey(m_offsets.at(index)));
+	if(idx < 0)
+		return Variant();
+	
+	return Variant::readCompactItem(m_data.constData(), m_end, idx, 0);
+}
+
+
+bool VariantMapView::contains(const QString& key) const
+{
+	return (find(key) >= 0);
+}
+
+
+Variant::Type VariantMapView::typeOf(const QString& key) const
+{
+	int			idx		=	find(key);
+	quint8	type	=	Variant::None;
+	int			begin, end;
+	
+	if(idx < 0 || !Variant::locateCompactItem(m_data.constData(), m_end, idx, type, begin, end))
+		return Variant::None;
+	
+	return Variant::Type(type);
+}
+
+
+Variant VariantMapView::value(const QString& key, const Variant& defaultValue) const
+{
+	int		idx		=	find(key);
+	bool	ok		=	false;
+	
+	if(idx < 0)
+		return defaultValue;
+	
+	Variant	ret(Variant::readCompactItem(m_data.constData(), m_end, idx, &ok));
+	
+	return (ok ? ret : defaultValue);
+}
+
+
+VariantMapView VariantMapView::mapValue(const QString& key) const
+{
+	int			idx		=	find(key);
+	quint8	type	=	Variant::None;
+	int			begin, end;
+	
+	if(idx < 0 || !Variant::locateCompactItem(m_data.constData(), m_end, idx, type, begin, end) || type != Variant::Map)
+		return VariantMapView();
+	
+	return VariantMapView(m_data, begin, end);
+}
+
+
+VariantListView VariantMapView::listValue(const QString& key) const
+{
+	int			idx		=	find(key);
+	quint8	type	=	Variant::None;
+	int			begin, end;
+	
+	if(idx < 0 || !Variant::locateCompactItem(m_data.constData(), m_end, idx, type, begin, end) || type != Variant::List)
+		return VariantListView();
+	
+	return VariantListView(m_data, begin, end);
+}
+
+
+void VariantMapView::buildIndex() const
+{
+	if(!m_keys.isEmpty() || !buildOffsets())
+		return;
+	
+	m_keys.reserve(m_count);
+	
+	for(int i = 0; i < m_count; i++)
+	{
+		QByteArray	key;
+		int					idx;
+		
+		if(m_shape)
+		{
+			key	=	m_shape->strings.at(i).toUtf8();
+			idx	=	m_offsets.at(i);
+		}
+		else
+		{
+			int		keyBegin, keySize;
+			idx	=	skipKey(m_offsets.at(i), &keyBegin, &keySize);
+			key	=	QByteArray(m_data.constData() + keyBegin, keySize);
+		}
+		
+		// The first entry wins, like the linear search
+		if(!m_keys.contains(key))
+			m_keys.insert(key, idx);
+	}
+}
+
+
+bool VariantMapView::buildOffsets() const
+{
+	if(m_count < 0)
+		return false;
+	
+	if(m_offsets.count() == m_count)
+		return true;
+	
+	const char	*	data	=	m_data.constData();
+	int						idx		=	m_firstItem;
+	quint8				type;
+	int						begin, end;
+	
+	m_offsets.reserve(m_count);
+	
+	for(int i = 0; i < m_count; i++)
+	{
+		m_offsets.append(idx);
+		
+		if(!m_shape)
+			idx	=	skipKey(idx);
+		
+		if(idx < 0 || !Variant::locateCompactItem(data, m_end, idx, type, begin, end))
+		{
+			m_offsets.clear();
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+
+int VariantMapView::find(const QString& key) const
+{
+	if(m_count <= 0)
+		return -1;
+	
+	// The keys of a shape are compared without converting \a key
+	if(m_shape && m_keys.isEmpty())
+	{
+		const int	index	=	m_shape->strings.indexOf(key);
+		
+		return ((index >= 0 && buildOffsets()) ? m_offsets.at(index) : -1);
+	}
+	
+	const QByteArray	utf8(key.toUtf8());
+	
+	if(!m_keys.isEmpty())
+		return m_keys.value(utf8, -1);
+	
+	// Compare the encoded keys, values are skipped without decoding them
+	const char	*	data	=	m_data.constData();
+	int						idx		=	m_firstItem;
+	quint8				type;
+	int						begin, end;
+	
+	for(int i = 0; i < m_count; i++)
+	{
+		int		keyBegin, keySize;
+		
+		idx	=	skipKey(idx, &keyBegin, &keySize);
+		if(idx < 0)
+			return -1;
+		
+		if(keySize == utf8.size() && memcmp(data + keyBegin, utf8.constData(), keySize) == 0)
+			return idx;
+		
+		if(!Variant::locateCompactItem(data, m_end, idx, type, begin, end))
+			return -1;
+	}
+	
+	return -1;
+}
+
+
+int VariantMapView::skipKey(int idx, int* keyBegin, int* keySize) const
+{
+	bool						valid	=	true;
+	const quint64		size	=	Variant::readIntelligentNumber(m_data.constData(), m_end, idx, &valid);
+	
+	if(!valid || size > quint64(m_end - idx))
+		return -1;
+	
+	if(keyBegin)
+		(*keyBegin)	=	idx;
+	
+	if(keySize)
+		(*keySize)	=	int(size);
+	
+	return idx + int(size);
+}
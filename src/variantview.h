@@ -0,0 +1,161 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VARIANTVIEW_H
+#define VARIANTVIEW_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <QHash>
+
+#include "variant.h"
+
+class VariantMapView;
+
+/**
+	@brief Read-only access to the items of a Variant::List without decoding the whole list.
+	
+	The view shares the encoded data of the Variant, at() decodes only the requested item.
+	The offsets of the items are collected on the first indexed access.
+	
+@code
+VariantListView	list(package.listView());
+quint32	id	=	list.at(0).toUInt32();
+QString	name	=	list.mapAt(2).value("name").toString();
+@endcode
+*/
+class VariantListView
+{
+	public:
+		VariantListView();
+		
+		// Invalid if \a list is no Variant::List (e.g. an Int32Array, see Variant::toInt32Array()) or malformed
+		explicit VariantListView(const Variant& list);
+		
+		bool isValid() const;
+		
+		int size() const;
+		
+		Variant::Type typeAt(int index) const;
+		
+		Variant at(int index) const;
+		
+		// Nested Map or List at \a index (without copying its data), invalid for nested arrays
+		VariantMapView mapAt(int index) const;
+		
+		VariantListView listAt(int index) const;
+		
+	private:
+		friend class VariantMapView;
+		
+		VariantListView(const QByteArray& data, int begin, int end);
+		
+		void init(int begin, int end);
+		
+		bool buildIndex() const;
+		
+		// Start of the item at \a index, -1 if out of range
+		int offset(int index) const;
+		
+	private:
+		QByteArray							m_data;
+		int											m_end;
+		// Number of items (-1 if invalid)
+		int											m_count;
+		int											m_firstItem;
+		// Offset of each item, built on the first indexed access
+		mutable QVector<int>		m_offsets;
+};
+
+
+/**
+	@brief Read-only access to the items of a Variant::Map without decoding the whole map.
+	
+	Keys are looked up by comparing the encoded UTF-8 bytes, only the value of the matching
+	key is decoded. Handlers reading many keys of the same map should call buildIndex() first.
+	Maps received with a known shape (see MessageBus) hold only their values, the view uses
+	the keys of the shape then, converted once for all maps of that shape.
+	
+@code
+VariantMapView	status(package.mapView());
+QString	state		=	status.value("state").toString();
+qint64	uptime	=	status.mapValue("times").value("uptime").toInt64();
+@endcode
+*/
+class VariantMapView
+{
+	public:
+		VariantMapView();
+		
+		// Invalid if \a map is no Variant::Map or malformed
+		explicit VariantMapView(const Variant& map);
+		
+		bool isValid() const;
+		
+		int size() const;
+		
+		QString keyAt(int index) const;
+		
+		Variant valueAt(int index) const;
+		
+		bool contains(const QString& key) const;
+		
+		// Variant::None if \a key is not in the map
+		Variant::Type typeOf(const QString& key) const;
+		
+		Variant value(const QString& key, const Variant& defaultValue = Variant()) const;
+		
+		// Nested Map or List of \a key (without copying its data)
+		VariantMapView mapValue(const QString& key) const;
+		
+		VariantListView listValue(const QString& key) const;
+		
+		// Hash all keys, so every lookup takes constant time
+		void buildIndex() const;
+		
+	private:
+		friend class VariantListView;
+		
+		VariantMapView(const QByteArray& data, int begin, int end);
+		
+		void init(int begin, int end);
+		
+		bool buildOffsets() const;
+		
+		// Start of the value of \a key, -1 if not found
+		int find(const QString& key) const;
+		
+		// Start of the value of the entry at \a idx, -1 if malformed
+		int skipKey(int idx, int * keyBegin = 0, int * keySize = 0) const;
+		
+	private:
+		QByteArray													m_data;
+		int																	m_end;
+		// Number of entries (-1 if invalid)
+		int																	m_count;
+		int																	m_firstItem;
+		// Offset of each entry, built on the first indexed access
+		mutable QVector<int>								m_offsets;
+		// Offset of the value by UTF-8 key, built by buildIndex()
+		mutable QHash<QByteArray, int>			m_keys;
+		// Keys of a Map made of a shape, m_offsets point to the values then
+		QSharedPointer<const Variant::MapKeys>	m_shape;
+};
+
+#endif // VARIANTVIEW_H
@@ -0,0 +1,201 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "variantwriter.h"
+
+#include <string.h>
+
+VariantWriter::VariantWriter(const QVariantMap& map)
+	:	m_type(Variant::Map), m_map(map), m_size(0)
+{
+	m_size	=	measure(m_map);
+}
+
+
+VariantWriter::VariantWriter(const QVariantList& list)
+	:	m_type(Variant::List), m_list(list), m_size(0)
+{
+	m_size	=	measure(m_list);
+}
+
+
+VariantWriter::VariantWriter(const QList<Variant>& list)
+	:	m_type(Variant::List), m_variants(list), m_size(0)
+{
+	m_size	=	measure(m_variants);
+}
+
+
+Variant::Type VariantWriter::type() const
+{
+	return m_type;
+}
+
+
+int VariantWriter::size() const
+{
+	return m_size;
+}
+
+
+char * VariantWriter::write(char* target) const
+{
+	Cursor	cursor	=	{0, 0, 0};
+	
+	if(m_type == Variant::Map)
+		return write(target, m_map, cursor);
+	else if(!m_variants.isEmpty())
+		return write(target, m_variants);
+	
+	return write(target, m_list, cursor);
+}
+
+
+QByteArray VariantWriter::toByteArray() const
+{
+	QByteArray	ret(m_size, Qt::Uninitialized);
+	write(ret.data());
+	
+	return ret;
+}
+
+
+Variant VariantWriter::toVariant(quint32 optId) const
+{
+	return Variant(toByteArray(), m_type, optId);
+}
+
+
+int VariantWriter::measure(const QVariantMap& map)
+{
+	int		size	=	Variant::intelligentNumberSize(map.count());
+	
+	QMapIterator<QString, QVariant>		it(map);
+	while(it.hasNext())
+	{
+		it.next();
+		
+		m_keys.append(it.key().toUtf8());
+		size	+=	Variant::intelligentNumberSize(m_keys.last().size()) + m_keys.last().size();
+		size	+=	measureItem(it.value());
+	}
+	
+	return size;
+}
+
+
+int VariantWriter::measure(const QVariantList& list)
+{
+	int		size	=	Variant::intelligentNumberSize(list.count());
+	
+	for(int i = 0; i < list.count(); i++)
+		size	+=	measureItem(list.at(i));
+	
+	return size;
+}
+
+
+int VariantWriter::measure(const QList<Variant>& list)
+{
+	int		size	=	Variant::intelligentNumberSize(list.count());
+	
+	// Maps and Lists in the list are already encoded
+	for(int i = 0; i < list.count(); i++)
+		size	+=	Variant::compactItemSize(list.at(i));
+	
+	return size;
+}
+
+
+int VariantWriter::measureItem(const QVariant& value)
+{
+	// Lists of numbers are written as arrays
+	if(value.type() != QVariant::Map && (value.type() != QVariant::List || Variant::arrayType(value.toList()) != Variant::None))
+	{
+		m_leaves.append(Variant(value));
+		return Variant::compactItemSize(m_leaves.last());
+	}
+	
+	// The size is needed before the container itself is written
+	const int		slot	=	m_sizes.count();
+	m_sizes.append(0);
+	
+	const int		size	=	(value.type() == QVariant::Map ? measure(value.toMap()) : measure(value.toList()));
+	m_sizes[slot]	=	size;
+	
+	return 1 + Variant::intelligentNumberSize(size) + size;
+}
+
+
+char * VariantWriter::write(char* target, const QVariantMap& map, Cursor& cursor) const
+{
+	target	=	Variant::writeIntelligentNumber(target, map.count());
+	
+	QMapIterator<QString, QVariant>		it(map);
+	while(it.hasNext())
+	{
+		it.next();
+		
+		const QByteArray&		key	=	m_keys.at(cursor.key++);
+		target	=	Variant::writeIntelligentNumber(target, key.size());
+		memcpy(target, key.constData(), key.size());
+		target	+=	key.size();
+		
+		target	=	writeItem(target, it.value(), cursor);
+	}
+	
+	return target;
+}
+
+
+char * VariantWriter::write(char* target, const QVariantList& list, Cursor& cursor) const
+{
+	target	=	Variant::writeIntelligentNumber(target, list.count());
+	
+	for(int i = 0; i < list.count(); i++)
+		target	=	writeItem(target, list.at(i), cursor);
+	
+	return target;
+}
+
+
+char * VariantWriter::write(char* target, const QList<Variant>& list) const
+{
+	target	=	Variant::writeIntelligentNumber(target, list.count());
+	
+	for(int i = 0; i < list.count(); i++)
+		target	=	Variant::writeCompactItem(target, list.at(i));
+	
+	return target;
+}
+
+
+char * VariantWriter::writeItem(char* target, const QVariant& value, Cursor& cursor) const
+{
+	if(value.type() != QVariant::Map && (value.type() != QVariant::List || Variant::arrayType(value.toList()) != Variant::None))
+		return Variant::writeCompactItem(target, m_leaves.at(cursor.leaf++));
+	
+	// Same as Variant::writeCompactItem() with the data of the container written in place
+	*target++	=	char(value.type() == QVariant::Map ? Variant::Map : Variant::List);
+	target		=	Variant::writeIntelligentNumber(target, m_sizes.at(cursor.size++));
+	
+	if(value.type() == QVariant::Map)
+		return write(target, value.toMap(), cursor);
+	
+	return write(target, value.toList(), cursor);
+}
@@ -0,0 +1,108 @@
+/*
+ *  MessageBus - Inter process communication library
+ *  Copyright (C) 2013  Oliver Becker <der.ole.becker@gmail.com>
+ * 
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VARIANTWRITER_H
+#define VARIANTWRITER_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QVariantMap>
+#include <QVariantList>
+
+#include "variant.h"
+
+/**
+	@brief Encodes nested Maps and Lists into one buffer.
+	
+	The constructor measures the exact size of the encoded data, write() then encodes every
+	value straight into the target. Nested Maps and Lists are not encoded into Variants of
+	their own first, so each byte is written once no matter how deep it is nested.
+	
+	The target can be any buffer of size() bytes, e.g. behind a package header:
+	
+@code
+VariantWriter	writer(config);
+QByteArray		frame(HEADER_SIZE + writer.size(), Qt::Uninitialized);
+writer.write(frame.data() + HEADER_SIZE);
+@endcode
+*/
+class VariantWriter
+{
+	public:
+		explicit VariantWriter(const QVariantMap& map);
+		
+		explicit VariantWriter(const QVariantList& list);
+		
+		explicit VariantWriter(const QList<Variant>& list);
+		
+		// Variant::Map or Variant::List
+		Variant::Type type() const;
+		
+		// Exact size of the encoded data
+		int size() const;
+		
+		// Encode into \a target holding at least size() bytes, returns the end of the written data
+		char * write(char * target) const;
+		
+		QByteArray toByteArray() const;
+		
+		Variant toVariant(quint32 optId = 0) const;
+		
+	private:
+		// Position of the next size, leaf and key while writing
+		struct Cursor
+		{
+			int		size;
+			int		leaf;
+			int		key;
+		};
+		
+		// Size of the encoded container (without type and size)
+		int measure(const QVariantMap& map);
+		
+		int measure(const QVariantList& list);
+		
+		int measure(const QList<Variant>& list);
+		
+		// Size of the encoded item (with type and size)
+		int measureItem(const QVariant& value);
+		
+		char * write(char * target, const QVariantMap& map, Cursor& cursor) const;
+		
+		char * write(char * target, const QVariantList& list, Cursor& cursor) const;
+		
+		char * write(char * target, const QList<Variant>& list) const;
+		
+		char * writeItem(char * target, const QVariant& value, Cursor& cursor) const;
+		
+	private:
+		Variant::Type							m_type;
+		// The source (shared, not copied)
+		QVariantMap								m_map;
+		QVariantList							m_list;
+		QList<Variant>						m_variants;
+		int												m_size;
+		// Sizes of the nested Maps and Lists in the order they are written
+		QVector<int>							m_sizes;
+		// Values other than Maps and Lists, converted while measuring
+		QVector<Variant>					m_leaves;
+		// UTF8 keys of all Maps
+		QVector<QByteArray>				m_keys;
+};
+
+#endif // VARIANTWRITER_H